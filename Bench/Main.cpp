@@ -0,0 +1,316 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+// Benchmarks for the parts of Gemini that are about throughput.
+//
+// Usage: GeminiBench scheduler [MachineCount] [MaxWorkers]
+//        GeminiBench parser [SourceKB] [Rounds]
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../Gemini/AlgolyParser.h"
+#include "../Gemini/Common.h"
+#include "../Gemini/LispyParser.h"
+#include "../Gemini/OpCodes.h"
+#include "../Gemini/Scheduler.h"
+
+using namespace Gemini;
+
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+std::vector<U8> MakeCode( std::initializer_list<U8> insts )
+{
+    std::vector<U8> code( insts );
+
+    code.insert( code.end(), SENTINEL_SIZE, OP_SENTINEL );
+
+    while ( (code.size() % MODULE_CODE_ALIGNMENT) != 0 )
+        code.push_back( OP_SENTINEL );
+
+    return code;
+}
+
+struct BenchMachine
+{
+    CELL    Stack[64];
+    Machine Vm;
+};
+
+
+//----------------------------------------------------------------------------
+// Scheduler
+//----------------------------------------------------------------------------
+
+// Runs the same set of machines with 1, 2, 4 ... workers, and reports how
+// the throughput scales
+int BenchScheduler( int argc, char* argv[] )
+{
+    size_t   machineCount = (argc > 0) ? strtoul( argv[0], nullptr, 10 ) : 2000;
+    unsigned maxWorkers = (argc > 1) ? static_cast<unsigned>( strtoul( argv[1], nullptr, 10 ) ) : 0;
+
+    if ( maxWorkers == 0 )
+        maxWorkers = std::max( 1u, std::thread::hardware_concurrency() );
+
+    if ( machineCount == 0 )
+        return 2;
+
+    // Sums the numbers 1 to 20000, counting to 20000 with yields in between
+
+    auto code = MakeCode( {
+        OP_PUSH, 1,
+        OP_LDC_S, 0,
+        OP_INCLOC, 0, 1,
+        OP_PRIM, PRIM_ADD,
+        OP_LDLOC, 0,
+        OP_PRIMC_S, PRIM_MOD, 100,
+        OP_BTRUE, 1, 0,
+        OP_YIELD,
+        OP_LDLOC, 0,
+        OP_LDC, 0x20, 0x4E, 0, 0,
+        OP_BLT, 0xE8, 0xFF,
+        OP_RET
+        } );
+
+    Module mod = {};
+    VerifiedCode verified;
+
+    mod.CodeBase = code.data();
+    mod.CodeSize = static_cast<U32>( code.size() );
+
+    if ( VerifyModuleCode( &mod, &verified ) != ERR_NONE )
+    {
+        fprintf( stderr, "The benchmark's code doesn't verify\n" );
+        return 1;
+    }
+
+    mod.Verified = &verified;
+
+    printf( "%zu machines\n", machineCount );
+    printf( "%8s %12s %14s %8s %10s\n", "Workers", "Time (ms)", "Machines/s", "Speedup", "Steals" );
+
+    double baseTime = 0;
+
+    for ( unsigned workers = 1; ; workers = std::min( workers * 2, maxWorkers ) )
+    {
+        std::vector<std::unique_ptr<BenchMachine>> machines;
+        std::vector<Scheduler::TaskId> ids;
+
+        for ( size_t i = 0; i < machineCount; i++ )
+        {
+            auto bm = std::make_unique<BenchMachine>();
+
+            bm->Vm.Init( bm->Stack, static_cast<U16>( std::size( bm->Stack ) ), 0, &mod );
+
+            if ( bm->Vm.Start( 0, 0, 0 ) == nullptr )
+                return 1;
+
+            machines.push_back( std::move( bm ) );
+        }
+
+        Scheduler scheduler( workers );
+
+        auto startTime = Clock::now();
+
+        for ( auto& bm : machines )
+            ids.push_back( scheduler.Add( &bm->Vm ) );
+
+        scheduler.WaitAll();
+
+        double seconds = std::chrono::duration<double>( Clock::now() - startTime ).count();
+        U64 steals = 0;
+
+        for ( size_t i = 0; i < ids.size(); i++ )
+        {
+            auto stats = scheduler.GetStats( ids[i] );
+
+            if ( stats.Result != ERR_NONE
+                || machines[i]->Stack[std::size( machines[i]->Stack ) - 1] != 200010000 )
+            {
+                fprintf( stderr, "Machine %zu failed\n", i );
+                return 1;
+            }
+
+            steals += stats.Steals;
+        }
+
+        if ( workers == 1 )
+            baseTime = seconds;
+
+        printf( "%8u %12.1f %14.0f %7.2fx %10llu\n",
+            workers,
+            seconds * 1000,
+            machineCount / seconds,
+            baseTime / seconds,
+            static_cast<unsigned long long>( steals ) );
+
+        if ( workers == maxWorkers )
+            break;
+    }
+
+    return 0;
+}
+
+
+
+//----------------------------------------------------------------------------
+// Parser
+//----------------------------------------------------------------------------
+
+class PrintLog : public ICompilerLog
+{
+public:
+    virtual void Add( LogCategory category, const char* fileName, int line, int column, const char* message ) override
+    {
+        fprintf( stderr, "%s(%d,%d): %s\n", fileName, line, column, message );
+    }
+};
+
+// printf formats that take the number of the function
+
+const char gAlgolyFunc[] =
+    "def f%zu(x, y)\n"
+    "  var total := 0\n"
+    "  for i := 0 below x do\n"
+    "    # Sum some of the products\n"
+    "    if i %% 3 = 0 then\n"
+    "      total := total + i * y\n"
+    "    elsif i > 10 and y <> 0 then\n"
+    "      total := total - 1\n"
+    "    end\n"
+    "  end\n"
+    "  total\n"
+    "end\n\n";
+
+const char gLispyFunc[] =
+    "(defun f%zu (x y)\n"
+    "  (let ((total 0))\n"
+    "    ; Sum some of the products\n"
+    "    (loop for i from 0 below x do\n"
+    "      (if (= (%% i 3) 0)\n"
+    "        (set total (+ total (* i y)))\n"
+    "        (set total (- total 1))))\n"
+    "    total))\n\n";
+
+// Repeats a function with a different name each time, until the source is
+// at least the given size
+std::string MakeSource( const char* funcFormat, size_t size )
+{
+    std::string source;
+    char buffer[512];
+
+    for ( size_t i = 0; source.size() < size; i++ )
+    {
+        snprintf( buffer, sizeof buffer, funcFormat, i );
+        source.append( buffer );
+    }
+
+    return source;
+}
+
+template <typename TParser>
+bool TimeParse( const char* language, const std::string& source, int rounds )
+{
+    PrintLog log;
+    double bestSeconds = 0;
+
+    for ( int i = 0; i < rounds; i++ )
+    {
+        auto startTime = Clock::now();
+
+        try
+        {
+            TParser parser( source.data(), source.size(), "Bench", &log );
+            auto unit = parser.Parse();
+        }
+        catch ( CompilerException& )
+        {
+            return false;
+        }
+
+        double seconds = std::chrono::duration<double>( Clock::now() - startTime ).count();
+
+        if ( i == 0 || seconds < bestSeconds )
+            bestSeconds = seconds;
+    }
+
+    printf( "%8s %12zu %12.1f %10.1f\n",
+        language,
+        source.size() / 1024,
+        bestSeconds * 1000,
+        source.size() / bestSeconds / (1024 * 1024) );
+
+    return true;
+}
+
+// Parses generated source in each language, and reports the best of some
+// rounds in MB of source a second. It takes in the whole parse, including
+// making the syntax tree.
+int BenchParser( int argc, char* argv[] )
+{
+    size_t sourceKB = (argc > 0) ? strtoul( argv[0], nullptr, 10 ) : 4096;
+    int    rounds = (argc > 1) ? static_cast<int>( strtoul( argv[1], nullptr, 10 ) ) : 5;
+
+    if ( sourceKB == 0 || rounds <= 0 )
+        return 2;
+
+    printf( "%8s %12s %12s %10s\n", "Language", "Source (KB)", "Time (ms)", "MB/s" );
+
+    if ( !TimeParse<AlgolyParser>( "Algoly", MakeSource( gAlgolyFunc, sourceKB * 1024 ), rounds )
+        || !TimeParse<LispyParser>( "Lispy", MakeSource( gLispyFunc, sourceKB * 1024 ), rounds ) )
+    {
+        fprintf( stderr, "The benchmark's source doesn't parse\n" );
+        return 1;
+    }
+
+    return 0;
+}
+
+struct Benchmark
+{
+    const char* Name;
+    int (*Func)( int argc, char* argv[] );
+};
+
+const Benchmark gBenchmarks[] =
+{
+    { "scheduler",  BenchScheduler },
+    { "parser",     BenchParser },
+};
+
+}
+
+
+int main( int argc, char* argv[] )
+{
+    if ( argc >= 2 )
+    {
+        for ( const auto& benchmark : gBenchmarks )
+        {
+            if ( strcmp( argv[1], benchmark.Name ) == 0 )
+                return benchmark.Func( argc - 2, argv + 2 );
+        }
+    }
+
+    fprintf( stderr, "Usage: GeminiBench <benchmark> [args...]\n\nBenchmarks:\n" );
+
+    for ( const auto& benchmark : gBenchmarks )
+        fprintf( stderr, "  %s\n", benchmark.Name );
+
+    return 2;
+}
@@ -100,7 +100,8 @@ AlgolyParser::AlgolyParser( const char* codeText, size_t codeTextLen, const char
     mCurNumber( 0 ),
     mTokLine( 0 ),
     mTokCol( 0 ),
-    mRep( log )
+    mRep( log ),
+    mArena( std::make_shared<Arena>() )
 {
     if ( codeText == nullptr )
         throw std::invalid_argument( "codeText" );
@@ -159,7 +160,7 @@ void AlgolyParser::NextChar()
 
 void AlgolyParser::CollectChar()
 {
-    mCurString.append( 1, PeekChar() );
+    mCurString = std::string_view( mCurString.data(), mCurString.size() + 1 );
     NextChar();
 }
 
@@ -167,7 +168,7 @@ AlgolyParser::TokenCode AlgolyParser::ScanToken()
 {
     SkipWhitespace();
 
-    mCurString.clear();
+    mCurString = std::string_view( mCodeTextPtr, 0 );
     mCurNumber = 0;
     mTokLine = mLine;
     mTokCol = GetColumn();
@@ -447,21 +448,24 @@ bool AlgolyParser::IsIdentifierCoda( int c )
 
 void AlgolyParser::ReadNumber()
 {
+    // Leave INT32_MAX+1 in range for now, so it can be negated
+
+    const uint64_t MaxValue = (uint32_t) INT32_MAX + 1;
+    uint64_t value = 0;
+
     while ( isdigit( PeekChar() ) )
     {
-        mCurString.append( 1, PeekChar() );
-        NextChar();
+        // Stop adding digits once it's out of range, so it can't overflow
+        if ( value <= MaxValue )
+            value = value * 10 + (PeekChar() - '0');
+
+        CollectChar();
     }
 
     if ( IsIdentifierInitial( PeekChar() ) )
         ThrowSyntaxError( "syntax error : bad number" );
 
-    unsigned long value = strtoul( mCurString.c_str(), NULL, 10 );
-
-    // Leave INT32_MAX+1 in range for now, so it can be negated
-
-    if ( value == ULONG_MAX && errno == ERANGE
-        || value > (uint32_t) INT32_MAX + 1 )
+    if ( value > MaxValue )
         ThrowSyntaxError( "Number out of range" );
 
     mCurNumber = value;
@@ -471,7 +475,7 @@ void AlgolyParser::ReadNumber()
 
 void AlgolyParser::ReadSymbolOrKeyword()
 {
-    static std::map<std::string, TokenCode> sStrToKeyword
+    static constexpr KeywordEntry<TokenCode> sKeywordList[] =
     {
         { "above",  TokenCode::Above },
         { "and",    TokenCode::And },
@@ -511,16 +515,17 @@ void AlgolyParser::ReadSymbolOrKeyword()
         { "yield",  TokenCode::Yield },
     };
 
+    static constexpr auto sKeywords = MakeKeywordTable( sKeywordList );
+
     while ( IsIdentifierCoda( PeekChar() ) )
     {
-        mCurString.append( 1, PeekChar() );
-        NextChar();
+        CollectChar();
     }
 
-    if ( auto it = sStrToKeyword.find( mCurString );
-        it != sStrToKeyword.end() )
+    if ( auto keyword = sKeywords.Find( mCurString );
+        keyword != nullptr )
     {
-        mCurToken = it->second;
+        mCurToken = *keyword;
     }
     else
     {
@@ -548,7 +553,7 @@ bool AlgolyParser::IsStatementSeparator( TokenCode tokenCode )
 
 Unique<Unit> AlgolyParser::Parse()
 {
-    Unique<Unit> unit = Make<Unit>( mFileName );
+    Unique<Unit> unit( new Unit( mFileName, mArena ) );
 
     mUnitFileName = unit->GetUnitFileName();
 
@@ -1528,7 +1533,7 @@ Unique<TypeRef> AlgolyParser::ParsePtrFuncTypeRef()
         procTypeRef->ReturnTypeRef = ParseTypeRef();
     }
 
-    Unique<PointerTypeRef> pointerTypeRef( new PointerTypeRef() );
+    Unique<PointerTypeRef> pointerTypeRef = MakeInArena<PointerTypeRef>( *mArena );
 
     pointerTypeRef->Target = std::move( procTypeRef );
 
@@ -1914,12 +1919,12 @@ Unique<NumberExpr> AlgolyParser::ParseNumber()
     return elem;
 }
 
-std::string AlgolyParser::ParseRawSymbol()
+Symbol AlgolyParser::ParseRawSymbol()
 {
     if ( mCurToken != TokenCode::Symbol )
         ThrowSyntaxError( "Expected symbol" );
 
-    std::string symbol = std::move( mCurString );
+    Symbol symbol( mCurString );
     ScanToken();
     return symbol;
 }
@@ -1939,7 +1944,7 @@ std::string AlgolyParser::ParseAsRawSymbol()
     if ( mCurString.size() == 0 )
         THROW_INTERNAL_ERROR( "" );
 
-    std::string symbol = std::move( mCurString );
+    std::string symbol( mCurString );
     ScanToken();
     return symbol;
 }
@@ -1951,37 +1956,37 @@ Unique<NumberExpr> AlgolyParser::WrapNumber()
 
 Unique<NameExpr> AlgolyParser::WrapSymbol()
 {
-    return MakeSymbol( mCurString.c_str() );
+    return MakeSymbol( Symbol( mCurString ) );
 }
 
 Unique<NumberExpr> AlgolyParser::MakeNumber( int64_t value )
 {
-    NumberExpr* number = new NumberExpr();
+    Unique<NumberExpr> number = MakeInArena<NumberExpr>( *mArena );
     number->Value = value;
     number->Line = mTokLine;
     number->Column = mTokCol;
     number->FileName = mUnitFileName;
-    return Unique<NumberExpr>( number );
+    return number;
 }
 
-Unique<NameExpr> AlgolyParser::MakeSymbol( const char* string )
+Unique<NameExpr> AlgolyParser::MakeSymbol( Symbol string )
 {
-    NameExpr* symbol = new NameExpr();
+    Unique<NameExpr> symbol = MakeInArena<NameExpr>( *mArena );
     symbol->String = string;
     symbol->Line = mTokLine;
     symbol->Column = mTokCol;
     symbol->FileName = mUnitFileName;
-    return Unique<NameExpr>( symbol );
+    return symbol;
 }
 
 template <typename T, typename... Args>
 Unique<T> AlgolyParser::Make( Args&&... args )
 {
-    T* syntax = new T( std::forward<Args>( args )... );
+    Unique<T> syntax = MakeInArena<T>( *mArena, std::forward<Args>( args )... );
     syntax->Line = mTokLine;
     syntax->Column = mTokCol;
     syntax->FileName = mUnitFileName;
-    return Unique<T>( syntax );
+    return syntax;
 }
 
 void AlgolyParser::ThrowSyntaxError( const char* format, ... )
@@ -6,10 +6,12 @@
 
 #pragma once
 
+#include "KeywordTable.h"
 #include "LangCommon.h"
 #include "Syntax.h"
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 
@@ -104,7 +106,8 @@ class AlgolyParser
     char            mCurChar;
 
     TokenCode       mCurToken;
-    std::string     mCurString;
+    // Points into the code text
+    std::string_view mCurString;
     int64_t         mCurNumber;
 
     int             mTokLine;
@@ -112,6 +115,9 @@ class AlgolyParser
 
     Reporter        mRep;
 
+    // Holds the nodes, and goes along with the units
+    std::shared_ptr<Arena> mArena;
+
 public:
     AlgolyParser( const char* codeText, size_t codeTextLen, const char* fileName, ICompilerLog* log );
 
@@ -211,7 +217,7 @@ private:
     bool IsTokenAdditiveOp();
     bool IsTokenMultiplicativeOp();
 
-    std::string ParseRawSymbol();
+    Symbol ParseRawSymbol();
     std::string ParseAsRawSymbol();
 
     Unique<NumberExpr> ParseNumber();
@@ -221,7 +227,7 @@ private:
     Unique<NameExpr> WrapSymbol();
 
     Unique<NumberExpr> MakeNumber( int64_t value );
-    Unique<NameExpr> MakeSymbol( const char* string );
+    Unique<NameExpr> MakeSymbol( Symbol string );
 
     template <typename T, typename... Args>
     Unique<T> Make( Args&&... args );
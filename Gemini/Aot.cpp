@@ -0,0 +1,166 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+#include "pch.h"
+#include "Aot.h"
+#include <string.h>
+
+
+namespace Gemini
+{
+
+bool AotContext::Step( U32 address )
+{
+    Vm->mPC = address;
+    Vm->mSP = SP;
+    Vm->mBudget = Budget;
+
+    Status = Vm->Step();
+
+    SP          = Vm->mSP;
+    Budget      = Vm->mBudget;
+    FramePtr    = &Vm->mStack[Vm->mFramePtr];
+    ModIndex    = Vm->mModIndex;
+    PC          = Vm->mPC;
+
+    // If control left the module, then Machine::Run picks the engine again
+
+    if ( Status == ERR_SWITCH_ENGINE
+        && Vm->mMod == &Code->mMod
+        && Vm->HasVerifiedStackRoom() )
+    {
+        return true;
+    }
+
+    return false;
+}
+
+
+AotModule::AotModule(
+    const U8* code,
+    U32 codeSize,
+    CELL* data,
+    U16 dataSize,
+    CELL* consts,
+    U16 constSize,
+    U8 modIndex,
+    const AotExport* exports,
+    size_t exportCount,
+    AotProc proc )
+    :
+    mMod{},
+    mProc( proc ),
+    mIndex( modIndex ),
+    mExports( exports ),
+    mExportCount( exportCount )
+{
+    mMod.CodeBase   = code;
+    mMod.CodeSize   = codeSize;
+    mMod.DataBase   = data;
+    mMod.DataSize   = dataSize;
+    mMod.ConstBase  = consts;
+    mMod.ConstSize  = constSize;
+
+    mStatus = VerifyModuleCode( &mMod, &mVerified );
+
+    if ( mStatus == ERR_NONE )
+    {
+        mMod.Verified = &mVerified;
+        mMod.Aot = this;
+    }
+}
+
+int AotModule::GetStatus() const
+{
+    return mStatus;
+}
+
+U8 AotModule::GetIndex() const
+{
+    return mIndex;
+}
+
+const Module* AotModule::GetModule() const
+{
+    return mStatus == ERR_NONE ? &mMod : nullptr;
+}
+
+bool AotModule::FindExport( const char* name, U32* address ) const
+{
+    for ( size_t i = 0; i < mExportCount; i++ )
+    {
+        if ( strcmp( mExports[i].Name, name ) == 0 )
+        {
+            *address = mExports[i].Address;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int AotModule::Run( Machine* machine ) const
+{
+    if ( machine->mMod != &mMod || mMod.Verified == nullptr )
+        return ERR_BAD_MODULE;
+
+    if ( !machine->HasVerifiedStackRoom() )
+        return ERR_STACK_OVERFLOW;
+
+    AotContext context;
+
+    context.SP          = machine->mSP;
+    context.FramePtr    = &machine->mStack[machine->mFramePtr];
+    context.StackBase   = machine->mStack;
+    context.StackEnd    = &machine->mStack[machine->mStackSize];
+    context.PC          = machine->mPC;
+    context.Status      = ERR_NONE;
+    context.Budget      = machine->mBudget;
+    context.ModIndex    = machine->mModIndex;
+    context.Vm          = machine;
+    context.Code        = this;
+
+    int err = mProc( context );
+
+    machine->mSP = context.SP;
+    machine->mPC = context.PC;
+    machine->mBudget = context.Budget;
+
+    return err;
+}
+
+
+AotEnvironment::AotEnvironment( IEnvironment* next ) :
+    mNext( next )
+{
+}
+
+int AotEnvironment::AddModule( const AotModule& module )
+{
+    if ( module.GetModule() == nullptr )
+        return module.GetStatus();
+
+    if ( mModules[module.GetIndex()] != nullptr )
+        return ERR_BAD_STATE;
+
+    mModules[module.GetIndex()] = module.GetModule();
+    return ERR_NONE;
+}
+
+bool AotEnvironment::FindNativeCode( U32 id, NativeCode* nativeCode )
+{
+    return mNext != nullptr && mNext->FindNativeCode( id, nativeCode );
+}
+
+const Module* AotEnvironment::FindModule( U8 index )
+{
+    if ( mModules[index] != nullptr )
+        return mModules[index];
+
+    return mNext != nullptr ? mNext->FindModule( index ) : nullptr;
+}
+
+}
@@ -0,0 +1,110 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+#pragma once
+
+#include "Machine.h"
+#include "OpCodes.h"
+#include "VmCommon.h"
+#include <algorithm>
+
+
+namespace Gemini
+{
+
+// Support for modules translated ahead of time to C++ by TranslateModule.
+//
+// A translated unit defines a function that returns its AotModule. The module
+// holds the original bytecode and data, and Machine::Run executes the
+// translated code in place of the bytecode. Add it to an AotEnvironment, or
+// return its Module from another IEnvironment's FindModule.
+
+class AotModule;
+
+struct AotExport
+{
+    const char* Name;
+    U32         Address;
+};
+
+// The machine's state while translated code runs
+struct AotContext
+{
+    CELL*           SP;
+    CELL*           FramePtr;
+    CELL*           StackBase;
+    CELL*           StackEnd;
+    U32             PC;
+    int             Status;
+    U32             Budget;
+    U8              ModIndex;
+    Machine*        Vm;
+    const AotModule* Code;
+
+    // Runs the instruction at address with the interpreter. Returns true if
+    // it went on to somewhere else in the module, which is left in PC.
+    // Otherwise, Status has the result to return.
+    bool Step( U32 address );
+};
+
+using AotProc = int (*)( AotContext& context );
+
+class AotModule
+{
+    friend class Machine;
+    friend struct AotContext;
+
+    Module              mMod;
+    VerifiedCode        mVerified;
+    AotProc             mProc;
+    U8                  mIndex;
+    const AotExport*    mExports;
+    size_t              mExportCount;
+    int                 mStatus;
+
+public:
+    AotModule(
+        const U8* code,
+        U32 codeSize,
+        CELL* data,
+        U16 dataSize,
+        CELL* consts,
+        U16 constSize,
+        U8 modIndex,
+        const AotExport* exports,
+        size_t exportCount,
+        AotProc proc );
+
+    AotModule( const AotModule& ) = delete;
+    AotModule& operator=( const AotModule& ) = delete;
+
+    // Anything but ERR_NONE means that the bytecode didn't verify, and the
+    // module can't be run
+    int GetStatus() const;
+    U8 GetIndex() const;
+    const Module* GetModule() const;
+    bool FindExport( const char* name, U32* address ) const;
+
+private:
+    int Run( Machine* machine ) const;
+};
+
+// Finds translated modules by index, and everything else in another environment
+class AotEnvironment : public IEnvironment
+{
+    const Module*   mModules[256] = {};
+    IEnvironment*   mNext;
+
+public:
+    AotEnvironment( IEnvironment* next = nullptr );
+
+    int AddModule( const AotModule& module );
+
+    virtual bool FindNativeCode( U32 id, NativeCode* nativeCode ) override;
+    virtual const Module* FindModule( U8 index ) override;
+};
+
+}
@@ -0,0 +1,92 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+#include "pch.h"
+#include "Arena.h"
+#include <algorithm>
+#include <cstddef>
+
+
+namespace Gemini
+{
+
+// Keeps the memory after a block's header aligned for any type
+constexpr size_t BlockHeaderSize = alignof( std::max_align_t );
+
+static_assert( BlockHeaderSize >= sizeof( void* ) );
+
+
+Arena::Arena()
+{
+}
+
+Arena::~Arena()
+{
+    for ( Block* block = mBlocks; block != nullptr; )
+    {
+        Block* next = block->Next;
+
+        ::operator delete( block );
+        block = next;
+    }
+}
+
+size_t Arena::GetBlockBytes() const
+{
+    return mBlockBytes;
+}
+
+void* Arena::AllocateSlow( size_t size, size_t alignment )
+{
+    if ( size == 0 )
+        size = 1;
+
+    if ( size > SIZE_MAX - BlockHeaderSize - alignment )
+        throw std::bad_alloc();
+
+    // Something too big for a normal block gets its own. The current block
+    // is left alone, since it likely has room for the small things after it.
+
+    size_t needed = BlockHeaderSize + size + alignment;
+
+    if ( needed > mNextBlockSize )
+    {
+        Block* block = static_cast<Block*>( ::operator new( needed ) );
+
+        if ( mBlocks != nullptr )
+        {
+            block->Next = mBlocks->Next;
+            mBlocks->Next = block;
+        }
+        else
+        {
+            block->Next = nullptr;
+            mBlocks = block;
+        }
+
+        mBlockBytes += needed;
+
+        uintptr_t start = reinterpret_cast<uintptr_t>( block ) + BlockHeaderSize;
+        uintptr_t aligned = (start + alignment - 1) & ~static_cast<uintptr_t>( alignment - 1 );
+
+        return reinterpret_cast<void*>( aligned );
+    }
+
+    Block* block = static_cast<Block*>( ::operator new( mNextBlockSize ) );
+
+    block->Next = mBlocks;
+    mBlocks = block;
+    mBlockBytes += mNextBlockSize;
+
+    mCur = reinterpret_cast<char*>( block ) + BlockHeaderSize;
+    mEnd = reinterpret_cast<char*>( block ) + mNextBlockSize;
+
+    mNextBlockSize = std::min( mNextBlockSize * 2, MaxBlockSize );
+
+    return Allocate( size, alignment );
+}
+
+}
@@ -0,0 +1,122 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+#pragma once
+
+#include <memory>
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+
+
+namespace Gemini
+{
+
+// Hands out memory from large blocks, and frees all of it at once when it's
+// destroyed. Objects made in an arena still have to be destroyed, but freeing
+// each one is left to the arena.
+//
+// An arena isn't thread-safe. Only one thread at a time can allocate from it.
+
+class Arena
+{
+    struct Block
+    {
+        Block*  Next;
+    };
+
+    static constexpr size_t FirstBlockSize  = 4096;
+    static constexpr size_t MaxBlockSize    = 256 * 1024;
+
+    Block*  mBlocks = nullptr;
+    char*   mCur = nullptr;
+    char*   mEnd = nullptr;
+    size_t  mNextBlockSize = FirstBlockSize;
+    size_t  mBlockBytes = 0;
+
+public:
+    Arena();
+    ~Arena();
+
+    Arena( const Arena& ) = delete;
+    Arena& operator=( const Arena& ) = delete;
+
+    // The alignment has to be a power of 2
+    void* Allocate( size_t size, size_t alignment )
+    {
+        uintptr_t cur = reinterpret_cast<uintptr_t>( mCur );
+        uintptr_t aligned = (cur + alignment - 1) & ~static_cast<uintptr_t>( alignment - 1 );
+
+        if ( mCur != nullptr && size <= reinterpret_cast<uintptr_t>( mEnd ) - cur
+            && aligned - cur <= reinterpret_cast<uintptr_t>( mEnd ) - cur - size )
+        {
+            mCur = reinterpret_cast<char*>( aligned + size );
+            return reinterpret_cast<void*>( aligned );
+        }
+
+        return AllocateSlow( size, alignment );
+    }
+
+    // Size of all the blocks taken from the heap
+    size_t GetBlockBytes() const;
+
+private:
+    void* AllocateSlow( size_t size, size_t alignment );
+};
+
+
+// Lets std::allocate_shared make objects in an arena. Each object keeps the
+// arena alive, so that shared objects can outlive the one that made them.
+// Freeing an object is left to the arena.
+
+template <typename T>
+class ArenaAllocator
+{
+    template <typename U>
+    friend class ArenaAllocator;
+
+    std::shared_ptr<Arena>  mArena;
+
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator( std::shared_ptr<Arena> arena ) :
+        mArena( std::move( arena ) )
+    {
+    }
+
+    template <typename U>
+    ArenaAllocator( const ArenaAllocator<U>& other ) :
+        mArena( other.mArena )
+    {
+    }
+
+    T* allocate( size_t count )
+    {
+        if ( count > SIZE_MAX / sizeof( T ) )
+            throw std::bad_alloc();
+
+        return static_cast<T*>( mArena->Allocate( count * sizeof( T ), alignof( T ) ) );
+    }
+
+    void deallocate( T* p, size_t count )
+    {
+    }
+
+    template <typename U>
+    bool operator==( const ArenaAllocator<U>& other ) const
+    {
+        return mArena == other.mArena;
+    }
+
+    template <typename U>
+    bool operator!=( const ArenaAllocator<U>& other ) const
+    {
+        return mArena != other.mArena;
+    }
+};
+
+}
@@ -217,11 +217,24 @@ static bool IsLValue( const Syntax& node )
     return IsAssignableType( node.Type->GetKind() );
 }
 
+// Lets the code generator know which locals only change where they're
+// declared, like a for-loop index that the body doesn't touch
+static void MarkModified( Syntax& node )
+{
+    auto decl = node.GetDecl();
+
+    if ( node.Kind == SyntaxKind::Name
+        && decl != nullptr
+        && decl->Kind == DeclKind::Local )
+    {
+        ((LocalStorage*) decl)->IsModified = true;
+    }
+}
+
 template <typename T, typename... Args>
-std::shared_ptr<T> Make( Args&&... args )
+std::shared_ptr<T> BinderVisitor::Make( Args&&... args )
 {
-    T* type = new T( std::forward<Args>( args )... );
-    return std::shared_ptr<T>( type );
+    return std::allocate_shared<T>( ArenaAllocator<T>( mArena ), std::forward<Args>( args )... );
 }
 
 
@@ -231,6 +244,7 @@ BinderVisitor::BinderVisitor(
     SymTable& moduleTable,
     SymTable& publicTable,
     CompilerAttrs& globalAttrs,
+    std::shared_ptr<Arena> arena,
     ICompilerLog* log )
     :
     mGlobalTable( globalTable ),
@@ -238,7 +252,8 @@ BinderVisitor::BinderVisitor(
     mPublicTable( publicTable ),
     mRep( log ),
     mModIndex( modIndex ),
-    mGlobalAttrs( globalAttrs )
+    mGlobalAttrs( globalAttrs ),
+    mArena( std::move( arena ) )
 {
     mSymStack.push_back( &mGlobalTable );
 
@@ -359,6 +374,8 @@ void BinderVisitor::VisitAssignmentExpr( AssignmentExpr* assignment )
     if ( !IsLValue( *assignment->Left ) )
         mRep.ThrowSemanticsError( assignment->Left.get(), "Left side cannot be assigned" );
 
+    MarkModified( *assignment->Left );
+
     CheckType( assignment->Left->Type, assignment->Right->Type, assignment );
 
     assignment->Type = assignment->Left->Type;
@@ -516,23 +533,23 @@ void BinderVisitor::VisitCaseExpr( CaseExpr* caseExpr )
 
 void BinderVisitor::RewriteCaseWithComplexKey( CaseExpr* caseExpr )
 {
-    Unique<VarDecl> varDecl{ new VarDecl };
+    Unique<VarDecl> varDecl = MakeInArena<VarDecl>( *mArena );
     varDecl->Name = "$testKey";
     varDecl->Initializer = std::move( caseExpr->TestKey );
 
-    Unique<NameExpr> nameExpr{ new NameExpr( "$testKey" ) };
+    Unique<NameExpr> nameExpr = MakeInArena<NameExpr>( *mArena, "$testKey" );
 
     // Logically, we put the original case inside a new Let block.
     // But the original node is still owned up the tree.
     // So, make a copy of the case expression node.
 
-    Unique<CaseExpr> newCase{ new CaseExpr };
+    Unique<CaseExpr> newCase = MakeInArena<CaseExpr>( *mArena );
     newCase->Clauses.swap( caseExpr->Clauses );
     newCase->Fallback.swap( caseExpr->Fallback );
     newCase->TestKey = std::move( nameExpr );
     CopyBaseSyntax( *newCase, *caseExpr );
 
-    Unique<LetStatement> letStmt{ new LetStatement };
+    Unique<LetStatement> letStmt = MakeInArena<LetStatement>( *mArena );
     letStmt->Variables.push_back( std::move( varDecl ) );
     letStmt->Body.Statements.push_back( std::move( newCase ) );
 
@@ -907,12 +924,12 @@ void BinderVisitor::VisitLambdaExpr( LambdaExpr* lambdaExpr )
 
     // Replace the lambda expression with an equivalent address-of expression
 
-    Unique<NameExpr> nameExpr( new NameExpr() );
+    Unique<NameExpr> nameExpr = MakeInArena<NameExpr>( *mArena );
     nameExpr->String = name;
     nameExpr->Decl = func;
     nameExpr->Type = funcType;
 
-    Unique<AddrOfExpr> addrOf( new AddrOfExpr() );
+    Unique<AddrOfExpr> addrOf = MakeInArena<AddrOfExpr>( *mArena );
     addrOf->Inner = std::move( nameExpr );
     addrOf->Type = pointerType;
     CopyBaseSyntax( *addrOf, *lambdaExpr );
@@ -1059,12 +1076,12 @@ void BinderVisitor::CheckInitializer(
         auto& recordInit = (RecordInitializer&) *initializer;
         auto& recordType = (RecordType&) *type;
 
-        std::set<std::string> alreadyInit;
+        SymbolMap<bool> alreadyInit;
         SymTable notInit = recordType.GetFields();
 
         for ( auto& fieldInit : recordInit.Fields )
         {
-            if ( alreadyInit.find( fieldInit->Name ) != alreadyInit.end() )
+            if ( alreadyInit.count( fieldInit->Name ) != 0 )
                 mRep.ThrowSemanticsError( fieldInit.get(), "Field already initialized" );
 
             auto it = notInit.find( fieldInit->Name );
@@ -1078,7 +1095,7 @@ void BinderVisitor::CheckInitializer(
 
             fieldInit->Decl = fieldDecl;
 
-            alreadyInit.insert( fieldInit->Name );
+            alreadyInit.insert( { fieldInit->Name, true } );
             notInit.erase( it );
         }
 
@@ -1239,7 +1256,7 @@ void BinderVisitor::VisitNativeDecl( NativeDecl* nativeDecl )
         mPrevNativeId++;
     }
 
-    std::shared_ptr<NativeFunction> native( new NativeFunction() );
+    auto native = Make<NativeFunction>();
 
     native->Type = MakeFuncType( nativeDecl );
     native->Id = mPrevNativeId;
@@ -1552,7 +1569,7 @@ void BinderVisitor::VisitStatementList( StatementList* stmtList )
         if ( !IsStatementType( stmtList->Statements.back()->Type->GetKind() ) )
         {
             // REWRITING TREE:
-            Unique<NumberExpr> zero( new NumberExpr() );
+            Unique<NumberExpr> zero = MakeInArena<NumberExpr>( *mArena );
 
             zero->Accept( this );
 
@@ -1583,7 +1600,7 @@ void BinderVisitor::VisitUnaryExpr( UnaryExpr* unary )
 
         assert( value >= 0 && value <= (uint32_t) INT32_MAX + 1 );
 
-        Unique<NumberExpr> number( new NumberExpr( -value ) );
+        Unique<NumberExpr> number = MakeInArena<NumberExpr>( *mArena, -value );
 
         number->Type = mIntType;
 
@@ -1693,6 +1710,9 @@ void BinderVisitor::CheckArgument(
         mRep.ThrowSemanticsError( argNode, "Incompatible argument type" );
     }
 
+    if ( mode == ParamMode::RefInOut )
+        MarkModified( *argNode );
+
     // Let the code generator detect whether the expression has an address
 }
 
@@ -1816,7 +1836,7 @@ void BinderVisitor::CopyConstAggregateBlock( GlobalSize offset, int32_t* buffer,
 }
 
 
-std::shared_ptr<Declaration> BinderVisitor::FindSymbol( const std::string& symbol )
+std::shared_ptr<Declaration> BinderVisitor::FindSymbol( Symbol symbol )
 {
     for ( auto stackIt = mSymStack.rbegin(); stackIt != mSymStack.rend(); stackIt++ )
     {
@@ -1839,7 +1859,7 @@ std::shared_ptr<ParamStorage> BinderVisitor::AddParam( DeclSyntax* declNode, Par
     if ( paramSpec.Size > static_cast<size_t>(ParamSizeMax - mParamCount) )
         mRep.ThrowSemanticsError( declNode, "Param exceeds capacity" );
 
-    std::shared_ptr<ParamStorage> param( new ParamStorage() );
+    auto param = Make<ParamStorage>();
     param->Offset = mParamCount;
     param->Type = paramSpec.Type;
     param->Mode = paramSpec.Mode;
@@ -1864,7 +1884,7 @@ std::shared_ptr<LocalStorage> BinderVisitor::AddLocal( DeclSyntax* declNode, std
     if ( size > static_cast<size_t>( LocalSizeMax - mCurLocalCount ) )
         mRep.ThrowSemanticsError( declNode, "Local exceeds capacity" );
 
-    std::shared_ptr<LocalStorage> local( new LocalStorage() );
+    auto local = Make<LocalStorage>();
     local->Offset = static_cast<LocalSize>( mCurLocalCount + size - 1 );
     local->Type = type;
     mSymStack.back()->insert( SymTable::value_type( declNode->Name, local ) );
@@ -1885,7 +1905,7 @@ std::shared_ptr<GlobalStorage> BinderVisitor::AddGlobal( DeclSyntax* declNode, s
     if ( size > static_cast<size_t>( GlobalSizeMax - mGlobalSize ) )
         mRep.ThrowSemanticsError( declNode, "Global exceeds capacity" );
 
-    std::shared_ptr<GlobalStorage> global( new GlobalStorage() );
+    auto global = Make<GlobalStorage>();
     global->Offset = mGlobalSize;
     global->ModIndex = mModIndex;
     global->Type = type;
@@ -1919,7 +1939,7 @@ std::shared_ptr<Constant> BinderVisitor::AddConst( DeclSyntax* declNode, std::sh
             mRep.ThrowSemanticsError( declNode, "Const exceeds capacity" );
     }
 
-    std::shared_ptr<Constant> constant( new Constant() );
+    auto constant = Make<Constant>();
     constant->Type = type;
     constant->Value = value;
     constant->ModIndex = mModIndex;
@@ -1945,7 +1965,7 @@ std::shared_ptr<Function> BinderVisitor::AddFunc( DeclSyntax* declNode, bool isP
 {
     CheckDuplicateGlobalSymbol( declNode );
 
-    std::shared_ptr<Function> func( new Function() );
+    auto func = Make<Function>();
     func->Name = declNode->Name;
     func->Address = UndefinedAddr;
     func->ModIndex = mModIndex;
@@ -1961,7 +1981,7 @@ std::shared_ptr<TypeDeclaration> BinderVisitor::AddType( DeclSyntax* declNode, s
 {
     CheckDuplicateGlobalSymbol( declNode );
 
-    std::shared_ptr<TypeDeclaration> typeDecl( new TypeDeclaration() );
+    auto typeDecl = Make<TypeDeclaration>();
     typeDecl->Type = mTypeType;
     typeDecl->ReferentType = type;
     mGlobalTable.insert( SymTable::value_type( declNode->Name, typeDecl ) );
@@ -1992,11 +2012,11 @@ void BinderVisitor::CheckDuplicateSymbol( DeclSyntax* declNode, const SymTable&
 
 void BinderVisitor::MakeStdEnv()
 {
-    mErrorType.reset( new ErrorType() );
-    mTypeType.reset( new TypeType() );
-    mModuleType.reset( new ModuleType() );
-    mXferType.reset( new XferType() );
-    mIntType.reset( new IntType() );
+    mErrorType = Make<ErrorType>();
+    mTypeType = Make<TypeType>();
+    mModuleType = Make<ModuleType>();
+    mXferType = Make<XferType>();
+    mIntType = Make<IntType>();
 
     // Dummy syntax nodes to conform to the Add-declaration API's
 
@@ -2024,7 +2044,7 @@ void BinderVisitor::DeclareNode( DeclSyntax* node )
 {
     CheckDuplicateGlobalSymbol( node );
 
-    std::shared_ptr<UndefinedDeclaration> undef( new UndefinedDeclaration() );
+    auto undef = Make<UndefinedDeclaration>();
     undef->Node = node;
     undef->Type = mErrorType;
     mGlobalTable.insert( SymTable::value_type( node->Name, undef ) );
@@ -2042,7 +2062,7 @@ void BinderVisitor::PrepareToDefine( DeclSyntax* declNode )
     mGlobalTable.erase( declNode->Name );
 }
 
-std::shared_ptr<Declaration> BinderVisitor::DefineNode( const std::string& name, UndefinedDeclaration* decl )
+std::shared_ptr<Declaration> BinderVisitor::DefineNode( Symbol name, UndefinedDeclaration* decl )
 {
     // The first thing that the declaration nodes do is to erase the "undefined" declaration
     // to make room for the defined declaration. This also prevents getting stuck in loops.
@@ -53,6 +53,9 @@ class BinderVisitor final : public Visitor
     CompilerAttrs&                  mGlobalAttrs;
     std::shared_ptr<ModuleAttrs>    mModuleAttrs;
 
+    // Holds the declarations, types, and rewritten nodes made here
+    std::shared_ptr<Arena>          mArena;
+
 public:
     BinderVisitor(
         ModSize modIndex,
@@ -60,6 +63,7 @@ public:
         SymTable& moduleTable,
         SymTable& publicTable,
         CompilerAttrs& globalAttrs,
+        std::shared_ptr<Arena> arena,
         ICompilerLog* log );
 
     void Declare( Unit* unit );
@@ -163,7 +167,7 @@ private:
     void ForbidExternalGlobalInGlobalInit( Declaration& decl, Syntax* node );
 
     // Symbol table
-    std::shared_ptr<Declaration> FindSymbol( const std::string& symbol );
+    std::shared_ptr<Declaration> FindSymbol( Symbol symbol );
     std::shared_ptr<ParamStorage> AddParam( DeclSyntax* declNode, ParamSpec paramSpec );
     std::shared_ptr<LocalStorage> AddLocal( DeclSyntax* declNode, std::shared_ptr<Type> type, size_t size );
     std::shared_ptr<GlobalStorage> AddGlobal( DeclSyntax* declNode, std::shared_ptr<Type> type, size_t size );
@@ -182,8 +186,11 @@ private:
 
     void DeclareNode( DeclSyntax* node );
     void PrepareToDefine( DeclSyntax* declNode );
-    std::shared_ptr<Declaration> DefineNode( const std::string& name, UndefinedDeclaration* decl );
+    std::shared_ptr<Declaration> DefineNode( Symbol name, UndefinedDeclaration* decl );
     std::shared_ptr<FuncType> MakeFuncType( ProcDeclBase* procDecl );
+
+    template <typename T, typename... Args>
+    std::shared_ptr<T> Make( Args&&... args );
     std::shared_ptr<Type> VisitFuncReturnType( Unique<TypeRef>& typeRef );
 
     ParamSize GetParamSize( Type* type, ParamMode mode );
@@ -30,5 +30,7 @@ constexpr uint8_t       FRAME_WORDS = 2;
 constexpr uint32_t      MAX_MODULE_CODE_SIZE = (CodeSizeMax - MODULE_CODE_ALIGNMENT);
 constexpr uint16_t      MAX_MODULE_DATA_SIZE = GlobalSizeMax;
 constexpr uint8_t       MAX_NATIVE_NESTING = 32;
+constexpr uint16_t      NOT_RETURN_SITE = 0xFFFF;
+constexpr uint16_t      NOT_LIVE_INST = 0xFFFF;
 
 }
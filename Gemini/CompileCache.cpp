@@ -0,0 +1,1454 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+#include "pch.h"
+#include "CompileCache.h"
+#include "Disassembler.h"
+#include "OpCodes.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+
+// Serialized cache entry, little endian
+//
+//   U32    Magic
+//   U32    Version
+//   U64    Format
+//   U64    Key
+//   U32    Import name count, and the names
+//   U32    Import count, and for each one
+//            U8   Module index
+//            U64  Fingerprint
+//   Bytes  Code
+//   U32    Data count, and the I32 cells
+//   U32    Const count, and the I32 cells
+//   ...    Compiler stats
+//   U32    External count, and for each one: String name, U8 kind, I32 address
+//   U32    Global count, and for each one: String name, I32 offset
+//   U32    Log entry count, and for each one
+//            U8      Category
+//            U8      1 if there's a file name
+//            String  File name
+//            I32     Line
+//            I32     Column
+//            String  Message
+//   Bytes  Metadata
+//
+// Strings and byte arrays are a U32 size followed by the bytes.
+//
+// Serialized metadata
+//
+//   U32    Type count, and the U8 kind of each
+//   U32    Declaration count, and for each one
+//            U8   Kind
+//            I32  Value and Ref parent type, for enum members
+//   ...    Each type's contents
+//   ...    Each declaration's contents
+//   U32    Public symbol count, and for each one: String name, Ref declaration
+//   U32    Function count, and a Ref to each one, in address order
+//   String Module name
+//   I32    Module index
+//
+// A Ref is a U8 tag, followed by
+//   - nothing for null
+//   - U32 index of a type or declaration in this metadata
+//   - U8 module index and U32 index of a type or declaration in an imported
+//     module, in the order that MetadataWalker lists them
+
+namespace Gemini
+{
+
+constexpr uint32_t CACHE_MAGIC      = 0x434D4547;   // "GEMC"
+
+// Change this when the format, or the code generated, changes. Changes to
+// the instruction set are caught by GetCacheFormat
+constexpr uint32_t CACHE_VERSION    = 1;
+
+
+namespace
+{
+
+class ByteWriter
+{
+    std::vector<uint8_t>&   mBytes;
+
+public:
+    ByteWriter( std::vector<uint8_t>& bytes ) :
+        mBytes( bytes )
+    {
+    }
+
+    void WriteU8( uint8_t value )
+    {
+        mBytes.push_back( value );
+    }
+
+    void WriteU32( uint32_t value )
+    {
+        for ( int i = 0; i < 4; i++ )
+            mBytes.push_back( static_cast<uint8_t>( value >> (i * 8) ) );
+    }
+
+    void WriteU64( uint64_t value )
+    {
+        WriteU32( static_cast<uint32_t>( value ) );
+        WriteU32( static_cast<uint32_t>( value >> 32 ) );
+    }
+
+    void WriteI32( int32_t value )
+    {
+        WriteU32( static_cast<uint32_t>( value ) );
+    }
+
+    void WriteString( const std::string& str )
+    {
+        WriteU32( static_cast<uint32_t>( str.size() ) );
+        mBytes.insert( mBytes.end(), str.begin(), str.end() );
+    }
+
+    void WriteBytes( const std::vector<uint8_t>& bytes )
+    {
+        WriteU32( static_cast<uint32_t>( bytes.size() ) );
+        mBytes.insert( mBytes.end(), bytes.begin(), bytes.end() );
+    }
+
+    void WriteCells( const std::vector<int32_t>& cells )
+    {
+        WriteU32( static_cast<uint32_t>( cells.size() ) );
+
+        for ( int32_t cell : cells )
+            WriteI32( cell );
+    }
+};
+
+// Reading past the end gives zeros, and marks the reader failed
+class ByteReader
+{
+    const uint8_t*  mPtr;
+    const uint8_t*  mEnd;
+    bool            mFailed = false;
+
+public:
+    ByteReader( const uint8_t* bytes, size_t size ) :
+        mPtr( bytes ),
+        mEnd( bytes + size )
+    {
+    }
+
+    bool IsFailed() const
+    {
+        return mFailed;
+    }
+
+    bool IsAtEnd() const
+    {
+        return mPtr == mEnd;
+    }
+
+    void Fail()
+    {
+        mFailed = true;
+        mPtr = mEnd;
+    }
+
+    uint8_t ReadU8()
+    {
+        if ( mPtr == mEnd )
+        {
+            Fail();
+            return 0;
+        }
+
+        return *mPtr++;
+    }
+
+    uint32_t ReadU32()
+    {
+        uint32_t value = 0;
+
+        for ( int i = 0; i < 4; i++ )
+            value |= static_cast<uint32_t>( ReadU8() ) << (i * 8);
+
+        return value;
+    }
+
+    uint64_t ReadU64()
+    {
+        uint64_t low = ReadU32();
+        uint64_t high = ReadU32();
+
+        return low | (high << 32);
+    }
+
+    int32_t ReadI32()
+    {
+        return static_cast<int32_t>( ReadU32() );
+    }
+
+    // A count of items that take at least minItemSize bytes each. Fails if
+    // the rest of the bytes can't hold them.
+    uint32_t ReadCount( size_t minItemSize = 1 )
+    {
+        uint32_t count = ReadU32();
+
+        if ( count > static_cast<size_t>(mEnd - mPtr) / minItemSize )
+        {
+            Fail();
+            return 0;
+        }
+
+        return count;
+    }
+
+    std::string ReadString()
+    {
+        uint32_t size = ReadCount();
+        std::string str( reinterpret_cast<const char*>( mPtr ), size );
+
+        mPtr += size;
+        return str;
+    }
+
+    void ReadBytes( std::vector<uint8_t>& bytes )
+    {
+        uint32_t size = ReadCount();
+
+        bytes.assign( mPtr, mPtr + size );
+        mPtr += size;
+    }
+
+    void ReadCells( std::vector<int32_t>& cells )
+    {
+        uint32_t count = ReadCount( sizeof( int32_t ) );
+
+        cells.resize( count );
+
+        for ( auto& cell : cells )
+            cell = ReadI32();
+    }
+};
+
+
+void WriteCallStats( ByteWriter& writer, const CallStats& stats )
+{
+    writer.WriteU32( stats.MaxCallDepth );
+    writer.WriteU32( stats.MaxStackUsage );
+    writer.WriteU8( stats.Recurses );
+}
+
+void ReadCallStats( ByteReader& reader, CallStats& stats )
+{
+    stats.MaxCallDepth  = reader.ReadU32();
+    stats.MaxStackUsage = reader.ReadU32();
+    stats.Recurses      = reader.ReadU8() != 0;
+}
+
+
+//----------------------------------------------------------------------------
+//  Metadata
+//----------------------------------------------------------------------------
+
+enum class RefTag : uint8_t
+{
+    Null,
+    Local,
+    Import,
+};
+
+struct ImportRef
+{
+    ModSize     ModIndex;
+    uint32_t    Index;
+};
+
+using ImportTypeMap = std::map<const Type*, ImportRef>;
+using ImportDeclMap = std::map<const Declaration*, ImportRef>;
+
+// Lists the types and declarations reachable from a module's metadata, in an
+// order that only depends on what they hold. Objects in the import maps
+// aren't listed, nor what they reach.
+
+class MetadataWalker
+{
+    const ImportTypeMap*    mImportTypes;
+    const ImportDeclMap*    mImportDecls;
+
+public:
+    std::vector<std::shared_ptr<Type>>          Types;
+    std::vector<std::shared_ptr<Declaration>>   Decls;
+    std::map<const Type*, uint32_t>             TypeIds;
+    std::map<const Declaration*, uint32_t>      DeclIds;
+
+    MetadataWalker( const ImportTypeMap* importTypes = nullptr, const ImportDeclMap* importDecls = nullptr ) :
+        mImportTypes( importTypes ),
+        mImportDecls( importDecls )
+    {
+    }
+
+    void WalkModule( ModuleDeclaration& modDecl, const std::vector<std::shared_ptr<Function>>& funcs )
+    {
+        for ( auto& [name, decl] : modDecl.Table )
+            WalkDecl( decl );
+
+        for ( auto& func : funcs )
+            WalkDecl( func );
+    }
+
+    void WalkDecl( const std::shared_ptr<Declaration>& decl )
+    {
+        if ( !decl
+            || DeclIds.find( decl.get() ) != DeclIds.end()
+            || (mImportDecls != nullptr && mImportDecls->find( decl.get() ) != mImportDecls->end()) )
+            return;
+
+        DeclIds.insert( { decl.get(), static_cast<uint32_t>( Decls.size() ) } );
+        Decls.push_back( decl );
+
+        WalkType( decl->GetType() );
+
+        if ( decl->Kind == DeclKind::Const )
+        {
+            auto constant = (Constant*) decl.get();
+
+            if ( constant->Value.Is( ValueKind::Function ) )
+                WalkDecl( constant->Value.GetFunction() );
+        }
+        else if ( decl->Kind == DeclKind::Type )
+        {
+            WalkType( ((TypeDeclaration*) decl.get())->ReferentType );
+        }
+    }
+
+    void WalkType( const std::shared_ptr<Type>& type )
+    {
+        if ( !type
+            || TypeIds.find( type.get() ) != TypeIds.end()
+            || (mImportTypes != nullptr && mImportTypes->find( type.get() ) != mImportTypes->end()) )
+            return;
+
+        TypeIds.insert( { type.get(), static_cast<uint32_t>( Types.size() ) } );
+        Types.push_back( type );
+
+        switch ( type->GetKind() )
+        {
+        case TypeKind::Array:
+            WalkType( ((ArrayType*) type.get())->ElemType );
+            break;
+
+        case TypeKind::Func:
+            {
+                auto funcType = (FuncType*) type.get();
+
+                WalkType( funcType->ReturnType );
+
+                for ( auto& param : funcType->Params )
+                    WalkType( param.Type );
+            }
+            break;
+
+        case TypeKind::Pointer:
+            WalkType( ((PointerType*) type.get())->TargetType );
+            break;
+
+        case TypeKind::Record:
+            {
+                auto recordType = (RecordType*) type.get();
+
+                for ( auto& field : recordType->GetOrderedFields() )
+                    WalkDecl( field );
+
+                for ( auto& [name, field] : recordType->GetFields() )
+                    WalkDecl( field );
+            }
+            break;
+
+        case TypeKind::Enum:
+            for ( auto& [name, member] : ((EnumType*) type.get())->GetMembersByName() )
+                WalkDecl( member );
+            break;
+
+        default:
+            break;
+        }
+    }
+};
+
+struct ImportObjects
+{
+    ImportTypeMap   TypeRefs;
+    ImportDeclMap   DeclRefs;
+
+    // By module index, then by the order of the walk
+    std::map<ModSize, MetadataWalker>   Walkers;
+};
+
+void FindImportObjects( const CompilerAttrs& globalAttrs, const std::vector<ModuleDeclaration*>& imports, ImportObjects& objects )
+{
+    std::vector<ModuleDeclaration*> sortedImports( imports );
+
+    std::sort( sortedImports.begin(), sortedImports.end(),
+        []( ModuleDeclaration* a, ModuleDeclaration* b ) { return a->Index < b->Index; } );
+
+    for ( auto import : sortedImports )
+    {
+        ModSize modIndex = static_cast<ModSize>( import->Index );
+        MetadataWalker& walker = objects.Walkers[modIndex];
+
+        walker.WalkModule( *import, globalAttrs.GetModuleFunctions( modIndex ) );
+
+        // An object reached from more than one import belongs to the first
+
+        for ( uint32_t i = 0; i < walker.Types.size(); i++ )
+            objects.TypeRefs.insert( { walker.Types[i].get(), { modIndex, i } } );
+
+        for ( uint32_t i = 0; i < walker.Decls.size(); i++ )
+            objects.DeclRefs.insert( { walker.Decls[i].get(), { modIndex, i } } );
+    }
+}
+
+
+class MetadataWriter
+{
+    ByteWriter&             mWriter;
+    const ImportObjects&    mImports;
+    const MetadataWalker&   mLocals;
+    bool                    mFailed = false;
+
+public:
+    MetadataWriter( ByteWriter& writer, const ImportObjects& imports, const MetadataWalker& locals ) :
+        mWriter( writer ),
+        mImports( imports ),
+        mLocals( locals )
+    {
+    }
+
+    bool Write( ModuleDeclaration& modDecl, const std::vector<std::shared_ptr<Function>>& funcs )
+    {
+        mWriter.WriteU32( static_cast<uint32_t>( mLocals.Types.size() ) );
+
+        for ( auto& type : mLocals.Types )
+            mWriter.WriteU8( static_cast<uint8_t>( type->GetKind() ) );
+
+        mWriter.WriteU32( static_cast<uint32_t>( mLocals.Decls.size() ) );
+
+        for ( auto& decl : mLocals.Decls )
+        {
+            mWriter.WriteU8( static_cast<uint8_t>( decl->Kind ) );
+
+            if ( decl->Kind == DeclKind::Enum )
+            {
+                auto member = (EnumMember*) decl.get();
+
+                mWriter.WriteI32( member->Value );
+                WriteTypeRef( member->GetType().get() );
+            }
+        }
+
+        for ( auto& type : mLocals.Types )
+            WriteType( type.get() );
+
+        for ( auto& decl : mLocals.Decls )
+            WriteDecl( decl.get() );
+
+        mWriter.WriteU32( static_cast<uint32_t>( modDecl.Table.size() ) );
+
+        for ( auto& [name, decl] : modDecl.Table )
+        {
+            mWriter.WriteString( name );
+            WriteDeclRef( decl.get() );
+        }
+
+        mWriter.WriteU32( static_cast<uint32_t>( funcs.size() ) );
+
+        for ( auto& func : funcs )
+            WriteDeclRef( func.get() );
+
+        mWriter.WriteString( modDecl.Name );
+        mWriter.WriteI32( modDecl.Index );
+
+        return !mFailed;
+    }
+
+private:
+    template <typename T, typename TImportMap>
+    void WriteRef( const T* object, const std::map<const T*, uint32_t>& localIds, const TImportMap& importRefs )
+    {
+        if ( object == nullptr )
+        {
+            mWriter.WriteU8( static_cast<uint8_t>( RefTag::Null ) );
+        }
+        else if ( auto it = localIds.find( object ); it != localIds.end() )
+        {
+            mWriter.WriteU8( static_cast<uint8_t>( RefTag::Local ) );
+            mWriter.WriteU32( it->second );
+        }
+        else if ( auto importIt = importRefs.find( object ); importIt != importRefs.end() )
+        {
+            mWriter.WriteU8( static_cast<uint8_t>( RefTag::Import ) );
+            mWriter.WriteU8( importIt->second.ModIndex );
+            mWriter.WriteU32( importIt->second.Index );
+        }
+        else
+        {
+            mFailed = true;
+        }
+    }
+
+    void WriteTypeRef( const Type* type )
+    {
+        WriteRef( type, mLocals.TypeIds, mImports.TypeRefs );
+    }
+
+    void WriteDeclRef( const Declaration* decl )
+    {
+        WriteRef( decl, mLocals.DeclIds, mImports.DeclRefs );
+    }
+
+    void WriteType( Type* type )
+    {
+        switch ( type->GetKind() )
+        {
+        case TypeKind::Array:
+            {
+                auto arrayType = (ArrayType*) type;
+
+                mWriter.WriteU32( arrayType->Count );
+                WriteTypeRef( arrayType->ElemType.get() );
+            }
+            break;
+
+        case TypeKind::Func:
+            {
+                auto funcType = (FuncType*) type;
+
+                WriteTypeRef( funcType->ReturnType.get() );
+                mWriter.WriteU32( static_cast<uint32_t>( funcType->Params.size() ) );
+
+                for ( auto& param : funcType->Params )
+                {
+                    WriteTypeRef( param.Type.get() );
+                    mWriter.WriteU8( static_cast<uint8_t>( param.Mode ) );
+                    mWriter.WriteU32( param.Size );
+                }
+            }
+            break;
+
+        case TypeKind::Pointer:
+            WriteTypeRef( ((PointerType*) type)->TargetType.get() );
+            break;
+
+        case TypeKind::Record:
+            {
+                auto recordType = (RecordType*) type;
+
+                mWriter.WriteU32( static_cast<uint32_t>( recordType->GetOrderedFields().size() ) );
+
+                for ( auto& field : recordType->GetOrderedFields() )
+                    WriteDeclRef( field.get() );
+
+                mWriter.WriteU32( static_cast<uint32_t>( recordType->GetFields().size() ) );
+
+                for ( auto& [name, field] : recordType->GetFields() )
+                {
+                    mWriter.WriteString( name );
+                    WriteDeclRef( field.get() );
+                }
+            }
+            break;
+
+        case TypeKind::Enum:
+            {
+                auto& members = ((EnumType*) type)->GetMembersByName();
+
+                mWriter.WriteU32( static_cast<uint32_t>( members.size() ) );
+
+                for ( auto& [name, member] : members )
+                {
+                    mWriter.WriteString( name );
+                    WriteDeclRef( member.get() );
+                }
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    void WriteDecl( Declaration* decl )
+    {
+        mWriter.WriteU8( decl->IsReadOnly );
+
+        switch ( decl->Kind )
+        {
+        case DeclKind::Const:
+            {
+                auto constant = (Constant*) decl;
+
+                WriteTypeRef( constant->Type.get() );
+
+                if ( constant->Value.Is( ValueKind::Integer ) )
+                {
+                    mWriter.WriteU8( static_cast<uint8_t>( ValueKind::Integer ) );
+                    mWriter.WriteI32( constant->Value.GetInteger() );
+                }
+                else if ( constant->Value.Is( ValueKind::Function ) )
+                {
+                    mWriter.WriteU8( static_cast<uint8_t>( ValueKind::Function ) );
+                    WriteDeclRef( constant->Value.GetFunction().get() );
+                }
+                else
+                {
+                    auto& aggregate = constant->Value.GetAggregate();
+
+                    mWriter.WriteU8( static_cast<uint8_t>( ValueKind::Aggregate ) );
+
+                    if ( !aggregate.Module )
+                        mFailed = true;
+                    else
+                        mWriter.WriteU8( aggregate.Module->GetIndex() );
+
+                    mWriter.WriteU32( aggregate.Offset );
+                }
+
+                mWriter.WriteU32( constant->Offset );
+                mWriter.WriteU8( constant->ModIndex );
+                mWriter.WriteU8( constant->Serialized );
+            }
+            break;
+
+        case DeclKind::Global:
+            {
+                auto global = (GlobalStorage*) decl;
+
+                WriteTypeRef( global->Type.get() );
+                mWriter.WriteU32( global->Offset );
+                mWriter.WriteU8( global->ModIndex );
+            }
+            break;
+
+        case DeclKind::Field:
+            {
+                auto field = (FieldStorage*) decl;
+
+                WriteTypeRef( field->Type.get() );
+                mWriter.WriteU32( field->Offset );
+            }
+            break;
+
+        case DeclKind::Func:
+            {
+                auto func = (Function*) decl;
+
+                WriteTypeRef( func->Type.get() );
+                mWriter.WriteString( func->Name );
+                mWriter.WriteU32( func->Address );
+                mWriter.WriteU8( func->ModIndex );
+                mWriter.WriteU8( func->IsLambda );
+                mWriter.WriteU32( func->LocalCount );
+                mWriter.WriteU32( func->ParamCount );
+                mWriter.WriteU32( func->ExprDepth );
+                mWriter.WriteU32( func->CallDepth );
+                mWriter.WriteU32( func->IndividualStackUsage );
+                mWriter.WriteU32( func->TreeStackUsage );
+                mWriter.WriteU8( func->IsRecursive );
+                mWriter.WriteU8( func->IsDepthKnown );
+                mWriter.WriteU8( func->IsDepthPartial );
+                mWriter.WriteU8( func->CallsIndirectly );
+                mWriter.WriteU32( static_cast<uint32_t>( func->CalledFunctions.size() ) );
+
+                for ( auto& site : func->CalledFunctions )
+                {
+                    mWriter.WriteString( site.FunctionName );
+                    mWriter.WriteI32( site.ExprDepth );
+                    mWriter.WriteU8( site.ModIndex );
+                    mWriter.WriteU8( site.IsTail );
+                }
+            }
+            break;
+
+        case DeclKind::NativeFunc:
+            {
+                auto native = (NativeFunction*) decl;
+
+                WriteTypeRef( native->Type.get() );
+                mWriter.WriteI32( native->Id );
+            }
+            break;
+
+        case DeclKind::Type:
+            {
+                auto typeDecl = (TypeDeclaration*) decl;
+
+                WriteTypeRef( typeDecl->Type.get() );
+                WriteTypeRef( typeDecl->ReferentType.get() );
+            }
+            break;
+
+        case DeclKind::Enum:
+            break;
+
+        default:
+            mFailed = true;
+            break;
+        }
+    }
+};
+
+
+class MetadataReader
+{
+    ByteReader&             mReader;
+    CompilerAttrs&          mGlobalAttrs;
+    const ImportObjects&    mImports;
+
+    std::vector<std::shared_ptr<Type>>          mTypes;
+    std::vector<std::shared_ptr<Declaration>>   mDecls;
+
+public:
+    MetadataReader( ByteReader& reader, CompilerAttrs& globalAttrs, const ImportObjects& imports ) :
+        mReader( reader ),
+        mGlobalAttrs( globalAttrs ),
+        mImports( imports )
+    {
+    }
+
+    std::shared_ptr<ModuleDeclaration> Read( std::vector<std::shared_ptr<Function>>& funcs )
+    {
+        // Make all the objects first, because they can refer to each other
+
+        uint32_t typeCount = mReader.ReadCount();
+
+        for ( uint32_t i = 0; i < typeCount && !mReader.IsFailed(); i++ )
+            mTypes.push_back( MakeType( static_cast<TypeKind>( mReader.ReadU8() ) ) );
+
+        uint32_t declCount = mReader.ReadCount();
+
+        for ( uint32_t i = 0; i < declCount && !mReader.IsFailed(); i++ )
+            mDecls.push_back( MakeDecl( static_cast<DeclKind>( mReader.ReadU8() ) ) );
+
+        for ( uint32_t i = 0; i < mTypes.size() && !mReader.IsFailed(); i++ )
+            ReadType( mTypes[i].get() );
+
+        for ( uint32_t i = 0; i < mDecls.size() && !mReader.IsFailed(); i++ )
+            ReadDecl( mDecls[i].get() );
+
+        std::shared_ptr<ModuleDeclaration> modDecl( new ModuleDeclaration() );
+
+        modDecl->Type.reset( new ModuleType() );
+
+        uint32_t symbolCount = mReader.ReadCount();
+
+        for ( uint32_t i = 0; i < symbolCount && !mReader.IsFailed(); i++ )
+        {
+            std::string name = mReader.ReadString();
+            auto decl = ReadDeclRef();
+
+            if ( !decl )
+                mReader.Fail();
+            else
+                modDecl->Table.insert( { name, decl } );
+        }
+
+        uint32_t funcCount = mReader.ReadCount();
+
+        for ( uint32_t i = 0; i < funcCount && !mReader.IsFailed(); i++ )
+        {
+            auto decl = ReadDeclRef( DeclKind::Func );
+
+            if ( !decl )
+                mReader.Fail();
+            else
+                funcs.push_back( std::static_pointer_cast<Function>( decl ) );
+        }
+
+        modDecl->Name = mReader.ReadString();
+        modDecl->Index = mReader.ReadI32();
+
+        if ( mReader.IsFailed() || !mReader.IsAtEnd() )
+            return nullptr;
+
+        return modDecl;
+    }
+
+private:
+    std::shared_ptr<Type> MakeType( TypeKind kind )
+    {
+        switch ( kind )
+        {
+        case TypeKind::Error:   return std::make_shared<ErrorType>();
+        case TypeKind::Type:    return std::make_shared<TypeType>();
+        case TypeKind::Module:  return std::make_shared<ModuleType>();
+        case TypeKind::Xfer:    return std::make_shared<XferType>();
+        case TypeKind::Int:     return std::make_shared<IntType>();
+        case TypeKind::Array:   return std::make_shared<ArrayType>( 0, nullptr );
+        case TypeKind::Func:    return std::make_shared<FuncType>( nullptr );
+        case TypeKind::Pointer: return std::make_shared<PointerType>( nullptr );
+        case TypeKind::Record:  return std::make_shared<RecordType>();
+        case TypeKind::Enum:    return std::make_shared<EnumType>();
+        default:
+            mReader.Fail();
+            return nullptr;
+        }
+    }
+
+    std::shared_ptr<Declaration> MakeDecl( DeclKind kind )
+    {
+        switch ( kind )
+        {
+        case DeclKind::Const:       return std::make_shared<Constant>();
+        case DeclKind::Global:      return std::make_shared<GlobalStorage>();
+        case DeclKind::Field:       return std::make_shared<FieldStorage>();
+        case DeclKind::Func:        return std::make_shared<Function>();
+        case DeclKind::NativeFunc:  return std::make_shared<NativeFunction>();
+        case DeclKind::Type:        return std::make_shared<TypeDeclaration>();
+
+        case DeclKind::Enum:
+            {
+                // The parent type has to be made already
+
+                int32_t value = mReader.ReadI32();
+                auto parentType = ReadTypeRef( TypeKind::Enum );
+
+                if ( !parentType )
+                {
+                    mReader.Fail();
+                    return nullptr;
+                }
+
+                return std::make_shared<EnumMember>( value, std::static_pointer_cast<EnumType>( parentType ) );
+            }
+
+        default:
+            mReader.Fail();
+            return nullptr;
+        }
+    }
+
+    template <typename T>
+    std::shared_ptr<T> ReadRef(
+        const std::vector<std::shared_ptr<T>>& locals,
+        const std::vector<std::shared_ptr<T>> MetadataWalker::* importList )
+    {
+        switch ( static_cast<RefTag>( mReader.ReadU8() ) )
+        {
+        case RefTag::Null:
+            return nullptr;
+
+        case RefTag::Local:
+            {
+                uint32_t index = mReader.ReadU32();
+
+                if ( index < locals.size() )
+                    return locals[index];
+            }
+            break;
+
+        case RefTag::Import:
+            {
+                ModSize modIndex = mReader.ReadU8();
+                uint32_t index = mReader.ReadU32();
+
+                if ( auto it = mImports.Walkers.find( modIndex );
+                    it != mImports.Walkers.end() && index < (it->second.*importList).size() )
+                    return (it->second.*importList)[index];
+            }
+            break;
+        }
+
+        mReader.Fail();
+        return nullptr;
+    }
+
+    // A type that must be of the given kind, if it's not null
+    std::shared_ptr<Type> ReadTypeRef( std::optional<TypeKind> kind = std::nullopt )
+    {
+        auto type = ReadRef( mTypes, &MetadataWalker::Types );
+
+        if ( type && kind.has_value() && type->GetKind() != kind.value() )
+        {
+            mReader.Fail();
+            return nullptr;
+        }
+
+        return type;
+    }
+
+    std::shared_ptr<Declaration> ReadDeclRef( std::optional<DeclKind> kind = std::nullopt )
+    {
+        auto decl = ReadRef( mDecls, &MetadataWalker::Decls );
+
+        if ( decl && kind.has_value() && decl->Kind != kind.value() )
+        {
+            mReader.Fail();
+            return nullptr;
+        }
+
+        return decl;
+    }
+
+    void ReadType( Type* type )
+    {
+        switch ( type->GetKind() )
+        {
+        case TypeKind::Array:
+            {
+                auto arrayType = (ArrayType*) type;
+
+                arrayType->Count = static_cast<DataSize>( mReader.ReadU32() );
+                arrayType->ElemType = ReadTypeRef();
+            }
+            break;
+
+        case TypeKind::Func:
+            {
+                auto funcType = (FuncType*) type;
+
+                funcType->ReturnType = ReadTypeRef();
+
+                uint32_t paramCount = mReader.ReadCount();
+
+                for ( uint32_t i = 0; i < paramCount && !mReader.IsFailed(); i++ )
+                {
+                    ParamSpec param;
+
+                    param.Type = ReadTypeRef();
+                    param.Mode = static_cast<ParamMode>( mReader.ReadU8() );
+                    param.Size = static_cast<ParamSize>( mReader.ReadU32() );
+
+                    funcType->Params.push_back( param );
+                }
+            }
+            break;
+
+        case TypeKind::Pointer:
+            ((PointerType*) type)->TargetType = ReadTypeRef();
+            break;
+
+        case TypeKind::Record:
+            {
+                auto recordType = (RecordType*) type;
+
+                uint32_t orderedCount = mReader.ReadCount();
+
+                for ( uint32_t i = 0; i < orderedCount && !mReader.IsFailed(); i++ )
+                {
+                    auto field = ReadDeclRef( DeclKind::Field );
+
+                    if ( field )
+                        recordType->GetOrderedFields().push_back( std::static_pointer_cast<FieldStorage>( field ) );
+                }
+
+                uint32_t fieldCount = mReader.ReadCount();
+
+                for ( uint32_t i = 0; i < fieldCount && !mReader.IsFailed(); i++ )
+                {
+                    std::string name = mReader.ReadString();
+
+                    if ( auto field = ReadDeclRef( DeclKind::Field ) )
+                        recordType->GetFields().insert( { name, field } );
+                }
+            }
+            break;
+
+        case TypeKind::Enum:
+            {
+                auto& members = ((EnumType*) type)->GetMembersByName();
+
+                uint32_t memberCount = mReader.ReadCount();
+
+                for ( uint32_t i = 0; i < memberCount && !mReader.IsFailed(); i++ )
+                {
+                    std::string name = mReader.ReadString();
+
+                    if ( auto member = ReadDeclRef( DeclKind::Enum ) )
+                        members.insert( { name, member } );
+                }
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    void ReadDecl( Declaration* decl )
+    {
+        decl->IsReadOnly = mReader.ReadU8() != 0;
+
+        switch ( decl->Kind )
+        {
+        case DeclKind::Const:
+            {
+                auto constant = (Constant*) decl;
+
+                constant->Type = ReadTypeRef();
+
+                switch ( static_cast<ValueKind>( mReader.ReadU8() ) )
+                {
+                case ValueKind::Integer:
+                    constant->Value.SetInteger( mReader.ReadI32() );
+                    break;
+
+                case ValueKind::Function:
+                    constant->Value.SetFunction( std::static_pointer_cast<Function>( ReadDeclRef( DeclKind::Func ) ) );
+                    break;
+
+                case ValueKind::Aggregate:
+                    {
+                        ConstRef constRef;
+                        ModSize modIndex = mReader.ReadU8();
+
+                        constRef.Offset = static_cast<GlobalSize>( mReader.ReadU32() );
+
+                        if ( modIndex >= ModSizeMax )
+                            mReader.Fail();
+                        else
+                            constRef.Module = mGlobalAttrs.GetModule( modIndex );
+
+                        if ( !constRef.Module )
+                            mReader.Fail();
+
+                        constant->Value.SetAggregate( constRef );
+                    }
+                    break;
+
+                default:
+                    mReader.Fail();
+                    break;
+                }
+
+                constant->Offset = static_cast<GlobalSize>( mReader.ReadU32() );
+                constant->ModIndex = mReader.ReadU8();
+                constant->Serialized = mReader.ReadU8() != 0;
+            }
+            break;
+
+        case DeclKind::Global:
+            {
+                auto global = (GlobalStorage*) decl;
+
+                global->Type = ReadTypeRef();
+                global->Offset = static_cast<GlobalSize>( mReader.ReadU32() );
+                global->ModIndex = mReader.ReadU8();
+            }
+            break;
+
+        case DeclKind::Field:
+            {
+                auto field = (FieldStorage*) decl;
+
+                field->Type = ReadTypeRef();
+                field->Offset = static_cast<DataSize>( mReader.ReadU32() );
+            }
+            break;
+
+        case DeclKind::Func:
+            {
+                auto func = (Function*) decl;
+
+                func->Type = ReadTypeRef( TypeKind::Func );
+                func->Name = mReader.ReadString();
+                func->Address = mReader.ReadU32();
+                func->ModIndex = mReader.ReadU8();
+                func->IsLambda = mReader.ReadU8() != 0;
+                func->LocalCount = static_cast<LocalSize>( mReader.ReadU32() );
+                func->ParamCount = static_cast<ParamSize>( mReader.ReadU32() );
+                func->ExprDepth = static_cast<LocalSize>( mReader.ReadU32() );
+                func->CallDepth = mReader.ReadU32();
+                func->IndividualStackUsage = mReader.ReadU32();
+                func->TreeStackUsage = mReader.ReadU32();
+                func->IsRecursive = mReader.ReadU8() != 0;
+                func->IsDepthKnown = mReader.ReadU8() != 0;
+                func->IsDepthPartial = mReader.ReadU8() != 0;
+                func->CallsIndirectly = mReader.ReadU8() != 0;
+
+                uint32_t siteCount = mReader.ReadCount();
+
+                for ( uint32_t i = 0; i < siteCount && !mReader.IsFailed(); i++ )
+                {
+                    CallSite site;
+
+                    site.FunctionName = mReader.ReadString();
+                    site.ExprDepth = static_cast<int16_t>( mReader.ReadI32() );
+                    site.ModIndex = mReader.ReadU8();
+                    site.IsTail = mReader.ReadU8() != 0;
+
+                    func->CalledFunctions.push_back( site );
+                }
+            }
+            break;
+
+        case DeclKind::NativeFunc:
+            {
+                auto native = (NativeFunction*) decl;
+
+                native->Type = ReadTypeRef();
+                native->Id = mReader.ReadI32();
+            }
+            break;
+
+        case DeclKind::Type:
+            {
+                auto typeDecl = (TypeDeclaration*) decl;
+
+                typeDecl->Type = ReadTypeRef();
+                typeDecl->ReferentType = ReadTypeRef();
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+};
+
+}
+
+
+//----------------------------------------------------------------------------
+//  CompileCache
+//----------------------------------------------------------------------------
+
+CompileCache::CompileCache( const std::string& directory ) :
+    mDirectory( directory )
+{
+    std::error_code error;
+
+    std::filesystem::create_directories( std::filesystem::u8path( mDirectory ), error );
+}
+
+const std::string& CompileCache::GetDirectory() const
+{
+    return mDirectory;
+}
+
+bool CompileCache::Read( uint64_t key, CacheEntry& entry ) const
+{
+    std::ifstream file( std::filesystem::u8path( GetPath( key ) ), std::ios::binary );
+
+    if ( !file )
+        return false;
+
+    std::vector<uint8_t> bytes( (std::istreambuf_iterator<char>( file )), std::istreambuf_iterator<char>() );
+
+    if ( file.bad() )
+        return false;
+
+    return DeserializeCacheEntry( bytes.data(), bytes.size(), key, entry );
+}
+
+bool CompileCache::Write( uint64_t key, const CacheEntry& entry )
+{
+    std::vector<uint8_t> bytes;
+
+    SerializeCacheEntry( entry, key, bytes );
+
+    // Write somewhere else first, so that another build reading the entry
+    // never sees part of it
+
+    std::string path = GetPath( key );
+    std::ostringstream tempPath;
+
+    tempPath << path << '.'
+        << std::hash<std::thread::id>()( std::this_thread::get_id() ) << '.'
+        << std::chrono::steady_clock::now().time_since_epoch().count();
+
+    {
+        std::ofstream file( std::filesystem::u8path( tempPath.str() ), std::ios::binary );
+
+        file.write( reinterpret_cast<const char*>( bytes.data() ), bytes.size() );
+
+        if ( !file )
+            return false;
+    }
+
+    std::error_code error;
+
+    std::filesystem::rename( std::filesystem::u8path( tempPath.str() ), std::filesystem::u8path( path ), error );
+
+    if ( error )
+    {
+        std::filesystem::remove( std::filesystem::u8path( tempPath.str() ), error );
+        return false;
+    }
+
+    return true;
+}
+
+std::string CompileCache::GetPath( uint64_t key ) const
+{
+    char name[32];
+
+    snprintf( name, sizeof name, "%016llx.gemc", static_cast<unsigned long long>( key ) );
+
+    return (std::filesystem::u8path( mDirectory ) / name).u8string();
+}
+
+
+//----------------------------------------------------------------------------
+//  Serializing
+//----------------------------------------------------------------------------
+
+// FNV-1a
+uint64_t HashBytes( const void* bytes, size_t size, uint64_t hash )
+{
+    const uint8_t* p = static_cast<const uint8_t*>( bytes );
+
+    for ( size_t i = 0; i < size; i++ )
+    {
+        hash ^= p[i];
+        hash *= 0x100000001B3;
+    }
+
+    return hash;
+}
+
+uint64_t GetModuleFingerprint( const std::vector<uint8_t>& metadata, const std::vector<int32_t>& consts )
+{
+    std::vector<uint8_t> bytes;
+    ByteWriter writer( bytes );
+
+    writer.WriteBytes( metadata );
+    writer.WriteCells( consts );
+
+    return HashBytes( bytes.data(), bytes.size() );
+}
+
+uint64_t GetCacheFormat()
+{
+    static const uint64_t format = []
+    {
+        uint64_t hash = HashBytes( &CACHE_VERSION, sizeof CACHE_VERSION );
+
+        auto hashName = [&hash]( const char* name )
+        {
+            hash = HashBytes( name, strlen( name ) + 1, hash );
+        };
+
+        // Opcodes and primitives are numbered in the order they're named
+
+        for ( uint8_t op = 0; op < OP_MAXOPCODE; op++ )
+            hashName( Disassembler::GetOpName( op ) );
+
+        for ( uint8_t prim = 0; prim < PRIM_MAXPRIMITIVE; prim++ )
+            hashName( Disassembler::GetPrimitiveName( prim ) );
+
+        const uint8_t layout[] = { FRAME_WORDS, SENTINEL_SIZE, MODULE_CODE_ALIGNMENT };
+
+        return HashBytes( layout, sizeof layout, hash );
+    }();
+
+    return format;
+}
+
+void SerializeCacheEntry( const CacheEntry& entry, uint64_t key, std::vector<uint8_t>& bytes )
+{
+    ByteWriter writer( bytes );
+
+    writer.WriteU32( CACHE_MAGIC );
+    writer.WriteU32( CACHE_VERSION );
+    writer.WriteU64( GetCacheFormat() );
+    writer.WriteU64( key );
+
+    writer.WriteU32( static_cast<uint32_t>( entry.ImportNames.size() ) );
+
+    for ( const auto& name : entry.ImportNames )
+        writer.WriteString( name );
+
+    writer.WriteU32( static_cast<uint32_t>( entry.Imports.size() ) );
+
+    for ( const auto& import : entry.Imports )
+    {
+        writer.WriteU8( import.Index );
+        writer.WriteU64( import.Fingerprint );
+    }
+
+    writer.WriteBytes( entry.Code );
+    writer.WriteCells( entry.Data );
+    writer.WriteCells( entry.Const );
+
+    writer.WriteU32( entry.Stats.CodeBytesWritten );
+    writer.WriteU32( entry.Stats.PeepholeBytesSaved );
+    writer.WriteU32( entry.Stats.PeepholeInstsSaved );
+    writer.WriteU32( entry.Stats.LongBranches );
+    writer.WriteU32( entry.Stats.InlinedCalls );
+    writer.WriteI32( entry.Stats.InlineBytesAdded );
+    writer.WriteU32( entry.Stats.InlineLocalsAdded );
+    writer.WriteU8( entry.Stats.CallsIndirectly );
+    WriteCallStats( writer, entry.Stats.Lambda );
+    WriteCallStats( writer, entry.Stats.Static );
+
+    writer.WriteU32( static_cast<uint32_t>( entry.Externals.size() ) );
+
+    for ( const auto& external : entry.Externals )
+    {
+        writer.WriteString( external.Name );
+        writer.WriteU8( static_cast<uint8_t>( external.Kind ) );
+        writer.WriteI32( external.Address );
+    }
+
+    writer.WriteU32( static_cast<uint32_t>( entry.Globals.size() ) );
+
+    for ( const auto& global : entry.Globals )
+    {
+        writer.WriteString( global.Name );
+        writer.WriteI32( global.Offset );
+    }
+
+    writer.WriteU32( static_cast<uint32_t>( entry.LogEntries.size() ) );
+
+    for ( const auto& logEntry : entry.LogEntries )
+    {
+        writer.WriteU8( static_cast<uint8_t>( logEntry.Category ) );
+        writer.WriteU8( logEntry.HasFileName );
+        writer.WriteString( logEntry.FileName );
+        writer.WriteI32( logEntry.Line );
+        writer.WriteI32( logEntry.Column );
+        writer.WriteString( logEntry.Message );
+    }
+
+    writer.WriteBytes( entry.Metadata );
+}
+
+bool DeserializeCacheEntry( const uint8_t* bytes, size_t size, uint64_t key, CacheEntry& entry )
+{
+    ByteReader reader( bytes, size );
+
+    if ( reader.ReadU32() != CACHE_MAGIC
+        || reader.ReadU32() != CACHE_VERSION
+        || reader.ReadU64() != GetCacheFormat()
+        || reader.ReadU64() != key )
+        return false;
+
+    entry = CacheEntry();
+
+    uint32_t nameCount = reader.ReadCount();
+
+    for ( uint32_t i = 0; i < nameCount; i++ )
+        entry.ImportNames.push_back( reader.ReadString() );
+
+    uint32_t importCount = reader.ReadCount();
+
+    for ( uint32_t i = 0; i < importCount; i++ )
+    {
+        CacheEntry::Import import;
+
+        import.Index = reader.ReadU8();
+        import.Fingerprint = reader.ReadU64();
+
+        entry.Imports.push_back( import );
+    }
+
+    reader.ReadBytes( entry.Code );
+    reader.ReadCells( entry.Data );
+    reader.ReadCells( entry.Const );
+
+    entry.Stats.CodeBytesWritten    = reader.ReadU32();
+    entry.Stats.PeepholeBytesSaved  = reader.ReadU32();
+    entry.Stats.PeepholeInstsSaved  = reader.ReadU32();
+    entry.Stats.LongBranches        = reader.ReadU32();
+    entry.Stats.InlinedCalls        = reader.ReadU32();
+    entry.Stats.InlineBytesAdded    = reader.ReadI32();
+    entry.Stats.InlineLocalsAdded   = reader.ReadU32();
+    entry.Stats.CallsIndirectly     = reader.ReadU8() != 0;
+    ReadCallStats( reader, entry.Stats.Lambda );
+    ReadCallStats( reader, entry.Stats.Static );
+
+    uint32_t externalCount = reader.ReadCount();
+
+    for ( uint32_t i = 0; i < externalCount; i++ )
+    {
+        RecordedExternal external;
+
+        external.Name = reader.ReadString();
+        external.Kind = static_cast<ExternalKind>( reader.ReadU8() );
+        external.Address = reader.ReadI32();
+
+        entry.Externals.push_back( external );
+    }
+
+    uint32_t globalCount = reader.ReadCount();
+
+    for ( uint32_t i = 0; i < globalCount; i++ )
+    {
+        RecordedGlobal global;
+
+        global.Name = reader.ReadString();
+        global.Offset = reader.ReadI32();
+
+        entry.Globals.push_back( global );
+    }
+
+    uint32_t logCount = reader.ReadCount();
+
+    for ( uint32_t i = 0; i < logCount; i++ )
+    {
+        RecordedLogEntry logEntry;
+
+        logEntry.Category = static_cast<LogCategory>( reader.ReadU8() );
+        logEntry.HasFileName = reader.ReadU8() != 0;
+        logEntry.FileName = reader.ReadString();
+        logEntry.Line = reader.ReadI32();
+        logEntry.Column = reader.ReadI32();
+        logEntry.Message = reader.ReadString();
+
+        entry.LogEntries.push_back( logEntry );
+    }
+
+    reader.ReadBytes( entry.Metadata );
+
+    return !reader.IsFailed() && reader.IsAtEnd();
+}
+
+bool SerializeMetadata(
+    ModuleDeclaration& modDecl,
+    const CompilerAttrs& globalAttrs,
+    const std::vector<ModuleDeclaration*>& imports,
+    std::vector<uint8_t>& bytes )
+{
+    ImportObjects importObjects;
+
+    FindImportObjects( globalAttrs, imports, importObjects );
+
+    auto funcs = globalAttrs.GetModuleFunctions( static_cast<ModSize>( modDecl.Index ) );
+
+    MetadataWalker locals( &importObjects.TypeRefs, &importObjects.DeclRefs );
+
+    locals.WalkModule( modDecl, funcs );
+
+    ByteWriter writer( bytes );
+    MetadataWriter metadataWriter( writer, importObjects, locals );
+
+    return metadataWriter.Write( modDecl, funcs );
+}
+
+std::shared_ptr<ModuleDeclaration> DeserializeMetadata(
+    const std::vector<uint8_t>& bytes,
+    CompilerAttrs& globalAttrs,
+    const std::vector<ModuleDeclaration*>& imports,
+    std::vector<std::shared_ptr<Function>>& functions )
+{
+    ImportObjects importObjects;
+
+    FindImportObjects( globalAttrs, imports, importObjects );
+
+    ByteReader reader( bytes.data(), bytes.size() );
+    MetadataReader metadataReader( reader, globalAttrs, importObjects );
+
+    return metadataReader.Read( functions );
+}
+
+}
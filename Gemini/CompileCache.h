@@ -0,0 +1,128 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+#pragma once
+
+#include "Compiler.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+
+namespace Gemini
+{
+
+struct RecordedExternal
+{
+    std::string     Name;
+    ExternalKind    Kind;
+    int             Address;
+};
+
+
+struct RecordedGlobal
+{
+    std::string     Name;
+    int             Offset;
+};
+
+
+struct RecordedLogEntry
+{
+    LogCategory Category;
+    bool        HasFileName;
+    std::string FileName;
+    int         Line;
+    int         Column;
+    std::string Message;
+};
+
+
+// Everything that compiling a module produced, as saved in a CompileCache.
+//
+// The entry stays good as long as the modules that it imports have the same
+// fingerprints. A fingerprint covers a module's metadata and constant data,
+// which is all that the modules importing it see.
+
+struct CacheEntry
+{
+    struct Import
+    {
+        ModSize     Index;
+        uint64_t    Fingerprint;
+    };
+
+    std::vector<std::string>        ImportNames;
+
+    // Modules imported directly or through others, in index order
+    std::vector<Import>             Imports;
+
+    std::vector<uint8_t>            Code;
+    std::vector<int32_t>            Data;
+    std::vector<int32_t>            Const;
+    CompilerStats                   Stats;
+    std::vector<RecordedExternal>   Externals;
+    std::vector<RecordedGlobal>     Globals;
+    std::vector<RecordedLogEntry>   LogEntries;
+
+    // See SerializeMetadata
+    std::vector<uint8_t>            Metadata;
+};
+
+
+// Keeps compiled modules in files in a directory, named by their keys.
+// Writing replaces a file in one step, so a reader never sees part of one.
+
+class CompileCache
+{
+    std::string mDirectory;
+
+public:
+    // The directory is made if it doesn't exist
+    explicit CompileCache( const std::string& directory );
+
+    const std::string& GetDirectory() const;
+
+    bool Read( uint64_t key, CacheEntry& entry ) const;
+    bool Write( uint64_t key, const CacheEntry& entry );
+
+private:
+    std::string GetPath( uint64_t key ) const;
+};
+
+
+uint64_t HashBytes( const void* bytes, size_t size, uint64_t hash = 0xCBF29CE484222325 );
+
+uint64_t GetModuleFingerprint( const std::vector<uint8_t>& metadata, const std::vector<int32_t>& consts );
+
+// Identifies the entry format and the instruction set of the code in it.
+// Entries written by a build with another format are never read.
+uint64_t GetCacheFormat();
+
+void SerializeCacheEntry( const CacheEntry& entry, uint64_t key, std::vector<uint8_t>& bytes );
+bool DeserializeCacheEntry( const uint8_t* bytes, size_t size, uint64_t key, CacheEntry& entry );
+
+// Saves the public declarations of a compiled module, and all of its
+// functions. Types and functions that belong to the imported modules are
+// saved as references to them, so that they stay the same objects when the
+// metadata is loaded. Returns false if there's a declaration that can't be
+// saved.
+bool SerializeMetadata(
+    ModuleDeclaration& modDecl,
+    const CompilerAttrs& globalAttrs,
+    const std::vector<ModuleDeclaration*>& imports,
+    std::vector<uint8_t>& bytes );
+
+// The module's ModuleAttrs has to be added to globalAttrs first. The imports
+// have to be the same ones as when the metadata was saved. Returns null if
+// the metadata is bad.
+std::shared_ptr<ModuleDeclaration> DeserializeMetadata(
+    const std::vector<uint8_t>& bytes,
+    CompilerAttrs& globalAttrs,
+    const std::vector<ModuleDeclaration*>& imports,
+    std::vector<std::shared_ptr<Function>>& functions );
+
+}
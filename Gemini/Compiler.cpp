@@ -31,6 +31,46 @@ namespace Gemini
 #endif
 
 
+static bool IsComparison( uint8_t primitive )
+{
+    return primitive >= PRIM_EQ && primitive <= PRIM_GE;
+}
+
+static bool IsBranch( uint8_t op )
+{
+    return op == OP_B || op == OP_BFALSE || op == OP_BTRUE
+        || (op >= OP_BEQ && op <= OP_BGE);
+}
+
+// Case expressions with fewer constant keys than this compare them one by one
+constexpr size_t SwitchCountMin = 4;
+
+// A dense switch table is used if it has up to this many entries for each key
+constexpr int64_t SwitchDenseRatio = 3;
+
+// Procedures with more syntax nodes than this are always called
+constexpr int InlineNodeCountMax = 16;
+
+
+static OpCode GetCompareBranch( uint8_t primitive )
+{
+    static_assert( OP_BGE - OP_BEQ == PRIM_GE - PRIM_EQ, "Compare-branches must follow the order of comparisons" );
+
+    assert( IsComparison( primitive ) );
+
+    return static_cast<OpCode>(OP_BEQ + (primitive - PRIM_EQ));
+}
+
+static uint8_t GetUncheckedPrimitive( uint8_t primitive )
+{
+    static_assert( PRIM_MUL_U - PRIM_ADD_U == PRIM_MUL - PRIM_ADD, "Unchecked primitives must follow the order of arithmetic" );
+
+    assert( primitive >= PRIM_ADD && primitive <= PRIM_MUL );
+
+    return static_cast<uint8_t>(PRIM_ADD_U + (primitive - PRIM_ADD));
+}
+
+
 Compiler::Compiler( ICompilerEnv* env, ICompilerLog* log, CompilerAttrs& globalAttrs, ModSize modIndex ) :
     mEnv( env ),
     mRep( log ),
@@ -59,6 +99,9 @@ void Compiler::AddUnit( Unique<Unit>&& unit )
     if ( !unit )
         throw std::invalid_argument( "unit" );
 
+    if ( unit->GetArena() )
+        mUnitArenas.push_back( unit->GetArena() );
+
     mUnits.push_back( std::move( unit ) );
 }
 
@@ -78,6 +121,11 @@ void Compiler::AddModule( std::shared_ptr<ModuleDeclaration> moduleDecl )
         throw std::invalid_argument( "Module index already used" );
 }
 
+void Compiler::SetInlining( bool enable )
+{
+    mInlining = enable;
+}
+
 CompilerErr Compiler::Compile()
 {
     if ( mStatus != CompilerErr::NONE )
@@ -165,7 +213,7 @@ std::shared_ptr<ModuleDeclaration> Compiler::GetMetadata( const char* modName )
 
 void Compiler::BindAttributes()
 {
-    BinderVisitor binder( mModIndex, mGlobalTable, mModuleTable, mPublicTable, mGlobalAttrs, mRep.GetLog() );
+    BinderVisitor binder( mModIndex, mGlobalTable, mModuleTable, mPublicTable, mGlobalAttrs, mArena, mRep.GetLog() );
 
     for ( auto& unit : mUnits )
         binder.Declare( unit.get() );
@@ -192,12 +240,241 @@ void Compiler::FoldConstants()
 #endif
 }
 
+namespace
+{
+
+// Decides whether a procedure is small enough to generate in place of the
+// calls to it. Only leaves qualify, so they're never recursive. They can't
+// declare locals, and their parameters have to be scalars passed by value,
+// so that the caller can keep them in its own locals.
+
+class InlineChecker : public Visitor
+{
+    Syntax* mLastStatement = nullptr;
+    int     mNodeCount = 0;
+    bool    mIsInlinable = true;
+
+public:
+    bool Check( ProcDecl* procDecl )
+    {
+        auto func = (Function*) procDecl->Decl.get();
+        auto funcType = (FuncType*) func->GetType().get();
+
+        if ( func->IsLambda || !IsScalarType( funcType->ReturnType->GetKind() ) )
+            return false;
+
+        for ( auto& paramSpec : funcType->Params )
+        {
+            if ( paramSpec.Mode != ParamMode::Value
+                || paramSpec.Size != 1
+                || !IsScalarType( paramSpec.Type->GetKind() ) )
+                return false;
+        }
+
+        auto& statements = procDecl->Body.Statements;
+
+        if ( !statements.empty() )
+            mLastStatement = statements.back().get();
+
+        for ( auto& statement : statements )
+            Visit( statement.get() );
+
+        return mIsInlinable;
+    }
+
+    virtual void VisitAsExpr( AsExpr* asExpr ) override
+    {
+        mNodeCount++;
+        Visit( asExpr->Inner.get() );
+    }
+
+    virtual void VisitAssignmentExpr( AssignmentExpr* assignment ) override
+    {
+        mNodeCount++;
+        Visit( assignment->Left.get() );
+        Visit( assignment->Right.get() );
+    }
+
+    virtual void VisitBinaryExpr( BinaryExpr* binary ) override
+    {
+        mNodeCount++;
+        Visit( binary->Left.get() );
+        Visit( binary->Right.get() );
+    }
+
+    virtual void VisitCallOrSymbolExpr( CallOrSymbolExpr* callOrSymbol ) override
+    {
+        auto kind = callOrSymbol->Symbol->GetDecl()->Kind;
+
+        if ( kind != DeclKind::Func && kind != DeclKind::NativeFunc )
+        {
+            mNodeCount++;
+            Visit( callOrSymbol->Symbol.get() );
+        }
+    }
+
+    virtual void VisitCaseExpr( CaseExpr* caseExpr ) override
+    {
+        mNodeCount++;
+        Visit( caseExpr->TestKey.get() );
+
+        for ( auto& clause : caseExpr->Clauses )
+        {
+            for ( auto& key : clause->Keys )
+                Visit( key.get() );
+
+            Visit( &clause->Body );
+        }
+
+        if ( caseExpr->Fallback )
+            Visit( &caseExpr->Fallback->Body );
+    }
+
+    virtual void VisitCondExpr( CondExpr* condExpr ) override
+    {
+        mNodeCount++;
+
+        for ( auto& clause : condExpr->Clauses )
+        {
+            Visit( clause->Condition.get() );
+            Visit( &clause->Body );
+        }
+    }
+
+    virtual void VisitDotExpr( DotExpr* dotExpr ) override
+    {
+        if ( dotExpr->GetDecl()->Kind != DeclKind::Field )
+        {
+            mNodeCount++;
+        }
+        else if ( HasStaticBase( dotExpr ) )
+        {
+            mNodeCount++;
+            Visit( dotExpr->Head.get() );
+        }
+    }
+
+    virtual void VisitIndexExpr( IndexExpr* indexExpr ) override
+    {
+        if ( HasStaticBase( indexExpr ) )
+        {
+            mNodeCount++;
+            Visit( indexExpr->Head.get() );
+            Visit( indexExpr->Index.get() );
+        }
+    }
+
+    virtual void VisitNameExpr( NameExpr* nameExpr ) override
+    {
+        switch ( nameExpr->GetDecl()->Kind )
+        {
+        case DeclKind::Const:
+        case DeclKind::Enum:
+        case DeclKind::Global:
+        case DeclKind::Param:
+            mNodeCount++;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    virtual void VisitNumberExpr( NumberExpr* numberExpr ) override
+    {
+        mNodeCount++;
+    }
+
+    virtual void VisitReturnStatement( ReturnStatement* retStmt ) override
+    {
+        // Only the last statement can return, and it has to return a value
+
+        if ( retStmt == mLastStatement && retStmt->Inner )
+        {
+            mNodeCount++;
+            Visit( retStmt->Inner.get() );
+        }
+    }
+
+    virtual void VisitStatementList( StatementList* stmtList ) override
+    {
+        mNodeCount++;
+
+        for ( auto& statement : stmtList->Statements )
+            Visit( statement.get() );
+    }
+
+    virtual void VisitUnaryExpr( UnaryExpr* unary ) override
+    {
+        mNodeCount++;
+        Visit( unary->Inner.get() );
+    }
+
+private:
+    void Visit( Syntax* node )
+    {
+        int prevCount = mNodeCount;
+
+        if ( mIsInlinable )
+            node->Accept( this );
+
+        // Syntax that's not handled above doesn't count, and disqualifies
+        // the procedure
+
+        if ( mNodeCount == prevCount || mNodeCount > InlineNodeCountMax )
+            mIsInlinable = false;
+    }
+
+    // Only the addresses of global and constant aggregates are calculated
+    // the same way in any function
+    static bool HasStaticBase( Syntax* node )
+    {
+        while ( true )
+        {
+            if ( node->Kind == SyntaxKind::Index )
+                node = ((IndexExpr*) node)->Head.get();
+            else if ( node->Kind == SyntaxKind::DotExpr && node->GetDecl()->Kind == DeclKind::Field )
+                node = ((DotExpr*) node)->Head.get();
+            else
+                break;
+        }
+
+        auto decl = node->GetDecl();
+
+        return decl != nullptr
+            && (decl->Kind == DeclKind::Global || decl->Kind == DeclKind::Const);
+    }
+};
+
+}
+
 void Compiler::GenerateCode()
 {
+    FindInlineProcs();
+
     for ( auto& unit : mUnits )
         unit->Accept( this );
 }
 
+void Compiler::FindInlineProcs()
+{
+    mInlineProcs.clear();
+
+    if ( !mInlining )
+        return;
+
+    for ( auto& unit : mUnits )
+    {
+        for ( auto& procDecl : unit->FuncDeclarations )
+        {
+            InlineChecker checker;
+
+            if ( checker.Check( procDecl.get() ) )
+                mInlineProcs.insert( { (Function*) procDecl->Decl.get(), procDecl.get() } );
+        }
+    }
+}
+
 void Compiler::VisitUnit( Unit* unit )
 {
     for ( auto& varNode : unit->DataDeclarations )
@@ -231,8 +508,15 @@ void Compiler::Generate( Syntax* node, const GenConfig& config, GenStatus& statu
     {
         if ( config.trueChain != nullptr )
         {
-            OpCode opcode = (config.invert && status.kind != ExprKind::Comparison) ? OP_BFALSE : OP_BTRUE;
-            EmitBranch( opcode, config.trueChain );
+            if ( status.kind == ExprKind::Comparison && !status.discarded && EndsWithComparison() )
+            {
+                EmitCompareBranch( config.trueChain );
+            }
+            else
+            {
+                OpCode opcode = (config.invert && status.kind != ExprKind::Comparison) ? OP_BFALSE : OP_BTRUE;
+                EmitBranch( opcode, config.trueChain );
+            }
             DecreaseExprDepth();
 
             EmitBranch( OP_B, config.falseChain );
@@ -258,6 +542,7 @@ void Compiler::GenerateDiscard( Syntax* elem, const GenConfig& config )
 {
     GenConfig configDiscard = config.WithDiscard();
     GenStatus status = { ExprKind::Other };
+    LocalSize startDepth = mCurExprDepth;
 
     mGenStack.push_back( { configDiscard, status } );
 
@@ -275,7 +560,7 @@ void Compiler::GenerateDiscard( Syntax* elem, const GenConfig& config )
         DecreaseExprDepth();
     }
 
-    assert( mCurExprDepth == 0 );
+    assert( mCurExprDepth == startDepth );
 }
 
 void Compiler::VisitNumberExpr( NumberExpr* numberExpr )
@@ -374,7 +659,15 @@ void Compiler::EmitLoadScalar( Syntax* node, Declaration* decl, int32_t offset )
                 assert( offset >= 0 && offset < ParamSizeMax );
                 assert( offset < (ParamSizeMax - param->Offset) );
 
-                EmitU8( OP_LDARG, static_cast<uint8_t>(param->Offset + offset) );
+                if ( mInInlineCall )
+                {
+                    assert( offset == 0 );
+                    EmitU8( OP_LDLOC, static_cast<uint8_t>(mInlineParamBase + param->Offset) );
+                }
+                else
+                {
+                    EmitU8( OP_LDARG, static_cast<uint8_t>(param->Offset + offset) );
+                }
                 IncreaseExprDepth();
             }
             else if ( param->Mode == ParamMode::RefInOut
@@ -505,6 +798,18 @@ void Compiler::GenerateArithmetic( BinaryExpr* binary, const GenConfig& config,
     else
         THROW_INTERNAL_ERROR( "" );
 
+    // The machine doesn't have to saturate, if the result always fits
+
+    int64_t min;
+    int64_t max;
+
+    if ( primitive <= PRIM_MUL
+        && GetWideRange( binary, min, max )
+        && min >= INT32_MIN && max <= INT32_MAX )
+    {
+        primitive = GetUncheckedPrimitive( primitive );
+    }
+
     GenerateBinaryPrimitive( binary, primitive, config, status );
 }
 
@@ -532,9 +837,32 @@ void Compiler::VisitBinaryExpr( BinaryExpr* binary )
 
 void Compiler::GenerateReturn( ReturnStatement* retStmt, const GenConfig& config, GenStatus& status )
 {
+    GenStatus innerStatus = { ExprKind::Other };
+
+    if ( mInInlineCall )
+    {
+        // An inlined procedure can only return at its end, where the value
+        // of the call is left
+
+        mGenStack.push_back( { config, status } );
+
+        retStmt->Inner->Accept( this );
+
+        mGenStack.pop_back();
+        return;
+    }
+
     if ( retStmt->Inner != nullptr )
     {
-        Generate( retStmt->Inner.get() );
+        auto inner = retStmt->Inner.get();
+        GenConfig innerConfig = GenConfig::Statement();
+
+        // A call can return for this function, if it makes a tail call
+
+        if ( inner->Kind == SyntaxKind::Call || inner->Kind == SyntaxKind::CallOrSymbol )
+            innerConfig = innerConfig.WithTailCall();
+
+        Generate( inner, innerConfig, innerStatus );
     }
     else
     {
@@ -543,7 +871,8 @@ void Compiler::GenerateReturn( ReturnStatement* retStmt, const GenConfig& config
         IncreaseExprDepth();
     }
 
-    Emit( OP_RET );
+    if ( !innerStatus.tailRet )
+        Emit( OP_RET );
 
     if ( config.discard )
         DecreaseExprDepth();
@@ -651,6 +980,15 @@ void Compiler::GenerateCond( CondExpr* condExpr, const GenConfig& config, GenSta
 
             EmitBranch( OP_BTRUE, &leaveChain );
             DecreaseExprDepth();
+
+            // Drop the condition that was kept for the leave path, so that
+            // the stack is the same height wherever control gets to the end
+
+            if ( !config.discard )
+            {
+                Emit( OP_POP );
+                DecreaseExprDepth();
+            }
         }
         else
         {
@@ -775,7 +1113,15 @@ void Compiler::EmitStoreScalar( Syntax* node, Declaration* decl, int32_t offset
                 assert( offset >= 0 && offset < ParamSizeMax );
                 assert( offset < (ParamSizeMax - param->Offset) );
 
-                EmitU8( OP_STARG, static_cast<uint8_t>(param->Offset + offset) );
+                if ( mInInlineCall )
+                {
+                    assert( offset == 0 );
+                    EmitU8( OP_STLOC, static_cast<uint8_t>(mInlineParamBase + param->Offset) );
+                }
+                else
+                {
+                    EmitU8( OP_STARG, static_cast<uint8_t>(param->Offset + offset) );
+                }
             }
             else if ( param->Mode == ParamMode::RefInOut )
             {
@@ -975,11 +1321,15 @@ void Compiler::GenerateFuncall( CallExpr* call, const GenConfig& config, GenStat
     auto ptrType = (PointerType*) call->Head->Type.get();
     auto funcType = (FuncType*) ptrType->TargetType.get();
 
+    int32_t argsLoc = static_cast<int32_t>( mCodeBin.size() );
+
     ParamSize argCount = GenerateCallArgs( call->Arguments, funcType );
 
     Generate( call->Head.get() );
 
-    EmitU8( OP_CALLI, CallFlags::Build( argCount, config.discard ) );
+    bool isTailCall = IsTailCallAllowed( config, argsLoc );
+
+    EmitU8( isTailCall ? OP_TAILCALLI : OP_CALLI, CallFlags::Build( argCount, config.discard ) );
 
     DecreaseExprDepth();
 
@@ -988,6 +1338,9 @@ void Compiler::GenerateFuncall( CallExpr* call, const GenConfig& config, GenStat
     else
         IncreaseExprDepth();
 
+    if ( isTailCall )
+        status.tailRet = true;
+
     DecreaseExprDepth( argCount );
 
     if ( mInFunc )
@@ -1055,7 +1408,7 @@ void Compiler::EmitLocalAggregateCopyBlock( LocalSize offset, Type* localType, S
         auto dstArrayType = (ArrayType&) *localType;
 
         EmitLoadConstant( dstArrayType.Count );
-        EmitU8( OP_LDLOCA, offset );
+        EmitFrameAddress( OP_LDLOCA, offset );
         EmitU24( OP_COPYARRAY, dstArrayType.ElemType->GetSize() );
 
         IncreaseExprDepth();
@@ -1065,7 +1418,7 @@ void Compiler::EmitLocalAggregateCopyBlock( LocalSize offset, Type* localType, S
     {
         Generate( valueElem );
 
-        EmitU8( OP_LDLOCA, offset );
+        EmitFrameAddress( OP_LDLOCA, offset );
         EmitU24( OP_COPYBLOCK, valueElem->Type->GetSize() );
 
         IncreaseExprDepth();
@@ -1209,11 +1562,20 @@ void Compiler::GenerateCall( CallExpr* call, const GenConfig& config, GenStatus&
 
 void Compiler::GenerateCall( Declaration* decl, std::vector<Unique<Syntax>>& arguments, const GenConfig& config, GenStatus& status )
 {
+    if ( ProcDecl* procDecl = FindInlineProc( decl, config ) )
+    {
+        GenerateInlineCall( procDecl, arguments, config, status );
+        return;
+    }
+
     auto funcType = (FuncType*) decl->GetType().get();
 
+    int32_t argsLoc = static_cast<int32_t>( mCodeBin.size() );
+
     ParamSize argCount = GenerateCallArgs( arguments, funcType );
 
     uint8_t callFlags = CallFlags::Build( argCount, config.discard );
+    bool isTailCall = decl->Kind == DeclKind::Func && IsTailCallAllowed( config, argsLoc );
 
     if ( decl == nullptr )
     {
@@ -1225,7 +1587,7 @@ void Compiler::GenerateCall( Declaration* decl, std::vector<Unique<Syntax>>& arg
         Function* func = (Function*) decl;
 
         size_t curIndex = ReserveCode( 5 );
-        mCodeBin[curIndex+0] = OP_CALL;
+        mCodeBin[curIndex+0] = isTailCall ? OP_TAILCALL : OP_CALL;
         mCodeBin[curIndex+1] = callFlags;
 
         if ( func->Address == UndefinedAddr )
@@ -1238,7 +1600,7 @@ void Compiler::GenerateCall( Declaration* decl, std::vector<Unique<Syntax>>& arg
         DISASSEMBLE( &mCodeBin[curIndex], 5 );
 
         if ( mInFunc )
-            mCurFunc->CalledFunctions.push_back( { func->Name, mCurExprDepth, mModIndex } );
+            mCurFunc->CalledFunctions.push_back( { func->Name, mCurExprDepth, mModIndex, isTailCall } );
     }
     else
     {
@@ -1249,10 +1611,10 @@ void Compiler::GenerateCall( Declaration* decl, std::vector<Unique<Syntax>>& arg
         {
             auto func = (Function*) decl;
 
-            opCode = OP_CALLM;
+            opCode = isTailCall ? OP_TAILCALLM : OP_CALLM;
             id = CodeAddr::Build( func->Address, func->ModIndex );
 
-            mCurFunc->CalledFunctions.push_back( { func->Name, mCurExprDepth, func->ModIndex } );
+            mCurFunc->CalledFunctions.push_back( { func->Name, mCurExprDepth, func->ModIndex, isTailCall } );
         }
         else if ( decl->Kind == DeclKind::NativeFunc )
         {
@@ -1298,6 +1660,108 @@ void Compiler::GenerateCall( Declaration* decl, std::vector<Unique<Syntax>>& arg
     }
 
     DecreaseExprDepth( argCount );
+
+    if ( isTailCall )
+        status.tailRet = true;
+}
+
+ProcDecl* Compiler::FindInlineProc( Declaration* decl, const GenConfig& config )
+{
+    if ( !mInFunc
+        || mInInlineCall
+        || config.calcAddr
+        || decl == nullptr
+        || decl->Kind != DeclKind::Func )
+        return nullptr;
+
+    auto func = (Function*) decl;
+    auto it = mInlineProcs.find( func );
+
+    if ( it == mInlineProcs.end()
+        || func == mCurFunc
+        || func->ParamCount > LocalSizeMax - mInlineParamBase )
+        return nullptr;
+
+    return it->second;
+}
+
+// Generates the body of a small procedure in place of a call to it. The
+// arguments are moved to fresh locals of the caller, which stand for the
+// procedure's parameters while the body is generated.
+
+void Compiler::GenerateInlineCall( ProcDecl* procDecl, std::vector<Unique<Syntax>>& arguments, const GenConfig& config, GenStatus& status )
+{
+    // The size of the call instruction that's replaced
+    constexpr int32_t CallInstSize = 5;
+
+    auto func = (Function*) procDecl->Decl.get();
+    auto funcType = (FuncType*) func->GetType().get();
+
+    ParamSize argCount = GenerateCallArgs( arguments, funcType );
+
+    int32_t bodyLoc = static_cast<int32_t>(mCodeBin.size());
+
+    // The first argument is on top
+
+    for ( auto& paramDecl : procDecl->Params )
+    {
+        auto param = (ParamStorage*) paramDecl->GetDecl();
+
+        EmitU8( OP_STLOC, static_cast<uint8_t>(mInlineParamBase + param->Offset) );
+        DecreaseExprDepth();
+    }
+
+    LocalSize localCount = static_cast<LocalSize>(mInlineParamBase + argCount);
+
+    if ( localCount > mCurFunc->LocalCount )
+    {
+        mStats.InlineLocalsAdded += localCount - mCurFunc->LocalCount;
+        mCurFunc->LocalCount = localCount;
+    }
+
+    GenConfig bodyConfig = config;
+
+    bodyConfig.breakChain = nullptr;
+    bodyConfig.nextChain = nullptr;
+    bodyConfig.tailCall = false;
+
+    auto& statements = procDecl->Body.Statements;
+
+    mInInlineCall = true;
+
+    if ( statements.empty() )
+    {
+        GenerateNilIfNeeded( bodyConfig, status );
+    }
+    else
+    {
+        for ( size_t i = 0; i < statements.size() - 1; i++ )
+            GenerateDiscard( statements[i].get() );
+
+        // The last statement leaves the value of the call, like it does for
+        // the procedure. But the caller branches on it, if needed
+
+        mGenStack.push_back( { bodyConfig, status } );
+
+        statements.back()->Accept( this );
+
+        mGenStack.pop_back();
+    }
+
+    mInInlineCall = false;
+
+    mStats.InlinedCalls++;
+    mStats.InlineBytesAdded += static_cast<int32_t>(mCodeBin.size()) - bodyLoc - CallInstSize;
+}
+
+// A tail call replaces the current frame with the callee's. So, it's only
+// allowed if the arguments that start at argsLoc don't point into the frame.
+bool Compiler::IsTailCallAllowed( const GenConfig& config, int32_t argsLoc )
+{
+    return config.tailCall
+        && !config.discard
+        && mInFunc
+        && mLastFrameAddrLoc < argsLoc;
 }
 
 void Compiler::VisitCallExpr( CallExpr* call )
@@ -1363,20 +1827,41 @@ void Compiler::GenerateFor( ForStatement* forStmt, const GenConfig& config, GenS
 
     int32_t bodyLoc = static_cast<int32_t>( mCodeBin.size() );
 
+    // Indexing with the loop's index might not need bound checks in the body
+
+    auto indexRange = GetForIndexRange( forStmt );
+
+    if ( indexRange.has_value() )
+        mIndexRanges.push_back( { local, indexRange.value() } );
+
     // Body
     GenerateStatements( &forStmt->Body, config.WithLoop( &breakChain, &nextChain ), status );
 
+    if ( indexRange.has_value() )
+        mIndexRanges.pop_back();
+
     Patch( &nextChain );
 
+    std::optional<int32_t> optStep = step;
+
     if ( forStmt->Step != nullptr )
-        Generate( forStmt->Step.get() );
+        optStep = GetFinalOptionalSyntaxValue( forStmt->Step.get() );
+
+    if ( optStep.has_value() && optStep.value() >= INT8_MIN && optStep.value() <= INT8_MAX )
+    {
+        EmitU8U8( OP_INCLOC, local->Offset, static_cast<uint8_t>(optStep.value()) );
+        IncreaseExprDepth();
+    }
     else
-        EmitLoadConstant( step );
+    {
+        Generate( forStmt->Step.get() );
+
+        EmitU8( OP_LDLOC, local->Offset );
+        EmitU8( OP_PRIM, PRIM_ADD );
+        Emit( OP_DUP );
+        EmitU8( OP_STLOC, local->Offset );
+    }
 
-    EmitU8( OP_LDLOC, local->Offset );
-    EmitU8( OP_PRIM, PRIM_ADD );
-    Emit( OP_DUP );
-    EmitU8( OP_STLOC, local->Offset );
     IncreaseExprDepth();
     DecreaseExprDepth();
     IncreaseExprDepth();
@@ -1387,10 +1872,8 @@ void Compiler::GenerateFor( ForStatement* forStmt, const GenConfig& config, GenS
     // Ending expression
     Generate( forStmt->Last.get() );
 
-    EmitU8( OP_PRIM, primitive );
+    EmitBranch( GetCompareBranch( primitive ), &bodyChain );
     DecreaseExprDepth();
-
-    EmitBranch( OP_BTRUE, &bodyChain );
     DecreaseExprDepth();
 
     Patch( &bodyChain, bodyLoc );
@@ -1422,7 +1905,7 @@ void Compiler::GenerateSimpleLoop( LoopStatement* loopStmt, const GenConfig& con
     }
     else
     {
-        GenStatus exprStatus;
+        GenStatus exprStatus = { ExprKind::Other };
         PatchChain bodyChain;
 
         Patch( &nextChain );
@@ -1510,15 +1993,167 @@ void Compiler::VisitYieldStatement( YieldStatement* nextStmt )
     GenerateNilIfNeeded( Config(), Status() );
 }
 
+// If every key is a constant, and there are enough of them, then the test
+// key is evaluated once, and a switch table picks the clause. The table is
+// indexed directly if the keys are close together. Otherwise, the machine
+// searches it.
+
 void Compiler::GenerateCase( CaseExpr* caseExpr, const GenConfig& config, GenStatus& status )
 {
-    GenerateGeneralCase( caseExpr, config, status );
-}
+    std::vector<SwitchCase> cases;
 
-void Compiler::GenerateGeneralCase( CaseExpr* caseExpr, const GenConfig& config, GenStatus& status )
-{
-    PatchChain  exitChain;
-    LocalSize   exprDepth = mCurExprDepth;
+    for ( size_t i = 0; i < caseExpr->Clauses.size(); i++ )
+    {
+        for ( auto& key : caseExpr->Clauses[i]->Keys )
+        {
+            std::optional<int32_t> value = GetFinalOptionalSyntaxValue( key.get() );
+
+            if ( !value.has_value() )
+            {
+                GenerateGeneralCase( caseExpr, config, status );
+                return;
+            }
+
+            cases.push_back( { value.value(), i } );
+        }
+    }
+
+    // Like in the chain of comparisons, a repeated key goes to the first clause
+
+    std::stable_sort( cases.begin(), cases.end(),
+        []( const SwitchCase& a, const SwitchCase& b ) { return a.Key < b.Key; } );
+
+    cases.erase(
+        std::unique( cases.begin(), cases.end(),
+            []( const SwitchCase& a, const SwitchCase& b ) { return a.Key == b.Key; } ),
+        cases.end() );
+
+    if ( cases.size() < SwitchCountMin || cases.size() > SwitchInst::MaxCount )
+    {
+        GenerateGeneralCase( caseExpr, config, status );
+        return;
+    }
+
+    int64_t range = static_cast<int64_t>(cases.back().Key) - cases.front().Key + 1;
+    bool dense = range <= SwitchInst::MaxCount
+        && range <= static_cast<int64_t>(cases.size()) * SwitchDenseRatio;
+
+    GenerateSwitchCase( caseExpr, cases, dense, config, status );
+}
+
+void Compiler::GenerateSwitchCase(
+    CaseExpr* caseExpr,
+    const std::vector<SwitchCase>& cases,
+    bool dense,
+    const GenConfig& config,
+    GenStatus& status )
+{
+    PatchChain  exitChain;
+
+    Generate( caseExpr->TestKey.get() );
+
+    // The switch pops the key
+    DecreaseExprDepth();
+
+    LocalSize   exprDepth = mCurExprDepth;
+    int32_t     lowKey = cases.front().Key;
+    uint32_t    count;
+    size_t      size;
+
+    if ( dense )
+    {
+        count = static_cast<uint32_t>(cases.back().Key - static_cast<int64_t>(lowKey) + 1);
+        size = SwitchInst::HeaderSize + sizeof( SwitchInst::TKey ) + count * SwitchInst::DenseEntrySize;
+    }
+    else
+    {
+        count = static_cast<uint32_t>(cases.size());
+        size = SwitchInst::HeaderSize + count * SwitchInst::SparseEntrySize;
+    }
+
+    size_t switchLoc = ReserveCode( size );
+
+    mCodeBin[switchLoc] = OP_SWITCH;
+    mCodeBin[switchLoc + 1] = dense ? SwitchInst::Dense : SwitchInst::Sparse;
+    StoreU16( &mCodeBin[switchLoc + 2], count );
+
+    if ( dense )
+    {
+        StoreU32( &mCodeBin[switchLoc + SwitchInst::HeaderSize], lowKey );
+    }
+    else
+    {
+        for ( size_t i = 0; i < cases.size(); i++ )
+            StoreU32( &mCodeBin[switchLoc + SwitchInst::HeaderSize + i * SwitchInst::SparseEntrySize], cases[i].Key );
+    }
+
+    DISASSEMBLE( &mCodeBin[switchLoc], static_cast<int>(size) );
+
+    std::vector<int32_t> clauseLocs;
+
+    for ( auto& clause : caseExpr->Clauses )
+    {
+        // Restore the expression depth, so that it doesn't accumulate
+        mCurExprDepth = exprDepth;
+
+        clauseLocs.push_back( static_cast<int32_t>(mCodeBin.size()) );
+
+        GenerateImplicitProgn( &clause->Body, config, status );
+
+        EmitBranch( OP_B, &exitChain );
+    }
+
+    // Restore the expression depth, so that it doesn't accumulate
+    mCurExprDepth = exprDepth;
+
+    int32_t defaultLoc = static_cast<int32_t>(mCodeBin.size());
+
+    if ( caseExpr->Fallback != nullptr )
+    {
+        GenerateImplicitProgn( &caseExpr->Fallback->Body, config, status );
+    }
+    else
+    {
+        GenerateNilIfNeeded( config, status );
+    }
+
+    Patch( &exitChain );
+
+    // Now that the clauses are placed, fill in the table
+
+    int32_t switchEnd = static_cast<int32_t>(switchLoc + size);
+    const uint8_t* switchPtr = &mCodeBin[switchLoc];
+
+    auto storeOffset = [this, switchEnd]( const uint8_t* offsetPtr, int32_t target )
+    {
+        StoreBranchOffset( static_cast<int32_t>(offsetPtr - mCodeBin.data()), target - switchEnd );
+    };
+
+    storeOffset( SwitchInst::GetDefaultOffsetPtr( switchPtr ), defaultLoc );
+
+    if ( dense )
+    {
+        for ( uint32_t i = 0; i < count; i++ )
+            storeOffset( SwitchInst::GetOffsetPtr( switchPtr, i ), defaultLoc );
+
+        for ( const auto& switchCase : cases )
+        {
+            uint32_t index = static_cast<uint32_t>(switchCase.Key - static_cast<int64_t>(lowKey));
+
+            storeOffset( SwitchInst::GetOffsetPtr( switchPtr, index ), clauseLocs[switchCase.ClauseIndex] );
+        }
+    }
+    else
+    {
+        for ( uint32_t i = 0; i < count; i++ )
+            storeOffset( SwitchInst::GetOffsetPtr( switchPtr, i ), clauseLocs[cases[i].ClauseIndex] );
+    }
+}
+
+void Compiler::GenerateGeneralCase( CaseExpr* caseExpr, const GenConfig& config, GenStatus& status )
+{
+    PatchChain  exitChain;
+    LocalSize   exprDepth = mCurExprDepth;
 
     const GenConfig& statementConfig = config;
 
@@ -1539,17 +2174,16 @@ void Compiler::GenerateGeneralCase( CaseExpr* caseExpr, const GenConfig& config,
             Generate( caseExpr->TestKey.get() );
             Generate( key.get() );
 
-            EmitU8( OP_PRIM, PRIM_EQ );
             DecreaseExprDepth();
 
             if ( i == clause->Keys.size() )
             {
-                EmitBranch( OP_BFALSE, &falseChain );
+                EmitBranch( OP_BNE, &falseChain );
                 DecreaseExprDepth();
             }
             else
             {
-                EmitBranch( OP_BTRUE, &trueChain );
+                EmitBranch( OP_BEQ, &trueChain );
                 DecreaseExprDepth();
             }
         }
@@ -1580,7 +2214,20 @@ void Compiler::GenerateGeneralCase( CaseExpr* caseExpr, const GenConfig& config,
 
 void Compiler::VisitCaseExpr( CaseExpr* caseExpr )
 {
-    GenerateCase( caseExpr, Config(), Status() );
+    if ( Config().trueChain != nullptr )
+    {
+        // As a condition, make the value, and let Generate branch on it.
+        // The arms can't branch to the condition's chains themselves.
+
+        GenConfig valueConfig = GenConfig::Statement().WithLoop( Config().breakChain, Config().nextChain );
+
+        GenerateCase( caseExpr, valueConfig, Status() );
+        Status().kind = ExprKind::Other;
+    }
+    else
+    {
+        GenerateCase( caseExpr, Config(), Status() );
+    }
 }
 
 void Compiler::VisitUnaryExpr( UnaryExpr* unary )
@@ -1643,6 +2290,8 @@ void Compiler::GenerateComparison( BinaryExpr* binary, const GenConfig& config,
 
     GenerateBinaryPrimitive( binary, config.invert ? negativePrimitive : positivePrimitive, config, status );
     status.kind = ExprKind::Comparison;
+
+    mLastCompareLoc = static_cast<int32_t>(mCodeBin.size()) - 2;
 }
 
 void Compiler::GenerateAnd( BinaryExpr* binary, const GenConfig& config, GenStatus& status )
@@ -1738,11 +2387,43 @@ uint8_t Compiler::InvertJump( uint8_t opCode )
     {
     case OP_BTRUE:  return OP_BFALSE;
     case OP_BFALSE: return OP_BTRUE;
+    case OP_BEQ:    return OP_BNE;
+    case OP_BNE:    return OP_BEQ;
+    case OP_BLT:    return OP_BGE;
+    case OP_BLE:    return OP_BGT;
+    case OP_BGT:    return OP_BLE;
+    case OP_BGE:    return OP_BLT;
     default:
         THROW_INTERNAL_ERROR( "" );
     }
 }
 
+bool Compiler::EndsWithComparison() const
+{
+    // An expression that's only typed as a comparison, like a case whose
+    // arms are comparisons, ends with other code
+
+    return mLastCompareLoc >= 0
+        && static_cast<size_t>(mLastCompareLoc) == mCodeBin.size() - 2
+        && mCodeBin[mLastCompareLoc] == OP_PRIM
+        && IsComparison( mCodeBin[mLastCompareLoc + 1] );
+}
+
+void Compiler::EmitCompareBranch( PatchChain* chain )
+{
+    // Replace the comparison that was just emitted, and the branch on its
+    // result, with one instruction
+
+    assert( EndsWithComparison() );
+
+    uint8_t primitive = mCodeBin.back();
+
+    DeleteCode( 2 );
+    mLastCompareLoc = -1;
+
+    EmitBranch( GetCompareBranch( primitive ), chain );
+}
+
 void Compiler::PushPatch( PatchChain* chain )
 {
     PushPatch( chain, static_cast<int32_t>(mCodeBin.size()) );
@@ -1771,7 +2452,7 @@ void Compiler::PopPatch( PatchChain* chain )
     delete link;
 }
 
-void Compiler::PushFuncPatch( const std::string& name, CodeRef codeRef )
+void Compiler::PushFuncPatch( Symbol name, CodeRef codeRef )
 {
     auto patchIt = mFuncPatchMap.find( name );
     if ( patchIt == mFuncPatchMap.end() )
@@ -1838,17 +2519,44 @@ void Compiler::Patch( PatchChain* chain, int32_t targetIndex )
 
     for ( InstPatch* link = chain->First; link != nullptr; link = link->Next )
     {
-        ptrdiff_t diff = target - (link->Ref + BranchInst::Size);
-
-        if ( diff < BranchInst::OffsetMin || diff > BranchInst::OffsetMax )
-            mRep.ThrowSemanticsError( nullptr, "Branch target is too far." );
+        int32_t diff = target - (link->Ref + BranchInst::Size);
 
-        BranchInst::StoreOffset( &mCodeBin[link->Ref + 1], static_cast<BranchInst::TOffset>(diff) );
+        StoreBranchOffset( link->Ref + 1, diff );
     }
 
     chain->PatchedInstIndex = target;
 }
 
+// Stores an offset in a branch or switch entry. One too big for 16 bits is
+// kept aside until OptimizeProc lays out the function with long branches.
+
+void Compiler::StoreBranchOffset( int32_t offsetLoc, int32_t offset )
+{
+    if ( offset < BranchInst::OffsetMin || offset > BranchInst::OffsetMax )
+    {
+        mFarOffsets[offsetLoc] = offset;
+        offset = 0;
+    }
+    else
+    {
+        mFarOffsets.erase( offsetLoc );
+    }
+
+    BranchInst::StoreOffset( &mCodeBin[offsetLoc], static_cast<BranchInst::TOffset>(offset) );
+}
+
+int32_t Compiler::ReadBranchOffset( int32_t offsetLoc )
+{
+    auto it = mFarOffsets.find( offsetLoc );
+
+    if ( it != mFarOffsets.end() )
+        return it->second;
+
+    const uint8_t* offsetPtr = &mCodeBin[offsetLoc];
+
+    return BranchInst::ReadOffset( offsetPtr );
+}
+
 void Compiler::PatchCalls( FuncPatchChain* chain, uint32_t addr )
 {
     for ( FuncInstPatch* link = chain->First; link != nullptr; link = link->Next )
@@ -1898,9 +2606,34 @@ void Compiler::GenerateBinaryPrimitive( BinaryExpr* binary, uint8_t primitive, c
     else
     {
         Generate( binary->Left.get() );
-        Generate( binary->Right.get() );
 
-        EmitU8( OP_PRIM, primitive );
+        // A comparison that's branched on is fused with the branch instead
+
+        bool isBranch = config.trueChain != nullptr && IsComparison( primitive );
+        auto optRight = GetFinalOptionalSyntaxValue( binary->Right.get() );
+        Declaration* rightDecl = nullptr;
+
+        if ( binary->Right->Kind == SyntaxKind::Name )
+            rightDecl = binary->Right->GetDecl();
+
+        if ( !isBranch && optRight.has_value()
+            && optRight.value() >= INT8_MIN && optRight.value() <= INT8_MAX )
+        {
+            EmitU8U8( OP_PRIMC_S, primitive, static_cast<uint8_t>(optRight.value()) );
+            IncreaseExprDepth();
+        }
+        else if ( !isBranch && rightDecl != nullptr && rightDecl->Kind == DeclKind::Local
+            && IsScalarType( binary->Right->Type->GetKind() ) )
+        {
+            EmitU8U8( OP_PRIMLOC, primitive, ((LocalStorage*) rightDecl)->Offset );
+            IncreaseExprDepth();
+        }
+        else
+        {
+            Generate( binary->Right.get() );
+
+            EmitU8( OP_PRIM, primitive );
+        }
 
         DecreaseExprDepth();
     }
@@ -1933,7 +2666,7 @@ void Compiler::EmitLoadAddress( Syntax* node, Declaration* baseDecl, int32_t off
             assert( offset >= 0 && offset < LocalSizeMax );
             assert( offset <= ((LocalStorage*) baseDecl)->Offset );
 
-            EmitU8( OP_LDLOCA, static_cast<uint8_t>(((LocalStorage*) baseDecl)->Offset - offset) );
+            EmitFrameAddress( OP_LDLOCA, static_cast<uint8_t>(((LocalStorage*) baseDecl)->Offset - offset) );
             IncreaseExprDepth();
             break;
 
@@ -1959,7 +2692,7 @@ void Compiler::EmitLoadAddress( Syntax* node, Declaration* baseDecl, int32_t off
                     assert( offset >= 0 && offset < ParamSizeMax );
                     assert( offset < (ParamSizeMax - param->Offset) );
 
-                    EmitU8( OP_LDARGA, static_cast<uint8_t>(param->Offset + offset) );
+                    EmitFrameAddress( OP_LDARGA, static_cast<uint8_t>(param->Offset + offset) );
                     IncreaseExprDepth();
                 }
                 else if ( param->Mode == ParamMode::RefInOut
@@ -2095,7 +2828,20 @@ void Compiler::GenerateArefAddrBase( Syntax* fullExpr, Syntax* head, Syntax* ind
     {
         if ( fullExpr->Kind == SyntaxKind::Index )
         {
-            EmitOpenIndex( OP_INDEX, arrayType.ElemType->GetSize(), arrayType.Count );
+            auto indexRange = GetValueRange( index );
+
+            // An index that's known to be in bounds doesn't need checking
+
+            if ( indexRange.has_value()
+                && indexRange->Min >= 0
+                && static_cast<uint32_t>(indexRange->Max) < arrayType.Count )
+            {
+                EmitU24( OP_INDEX_U, arrayType.ElemType->GetSize() );
+            }
+            else
+            {
+                EmitOpenIndex( OP_INDEX, arrayType.ElemType->GetSize(), arrayType.Count );
+            }
         }
         else
         {
@@ -2404,6 +3150,7 @@ void Compiler::GenerateProc( ProcDecl* procDecl, Function* func )
 {
     mInFunc = true;
     mCurFunc = func;
+    mInlineParamBase = func->LocalCount;
 
     constexpr uint8_t PushInstSize = 2;
 
@@ -2463,12 +3210,513 @@ void Compiler::GenerateProc( ProcDecl* procDecl, Function* func )
         }
     }
 
+    OptimizeProc( bodyLoc );
+
     func->ExprDepth = mMaxExprDepth;
 
     mCurFunc = nullptr;
     mInFunc = false;
 }
 
+namespace
+{
+
+struct PeepholeInst
+{
+    int32_t     Loc;
+    int32_t     NewLoc;
+    int32_t     Target;     // Branch target, or a switch's default, if not negative
+    int32_t     Size;       // Size after optimizing; zero if deleted
+    int32_t     OrigSize;
+    bool        IsTarget;
+    bool        IsPatched;  // Holds an address in mLocalAddrRefs
+    bool        IsLong;     // Laid out with a long branch
+
+    std::vector<int32_t> SwitchTargets;
+    std::vector<int32_t> FarTargets;    // Switch targets reached through long branches after the table
+};
+
+}
+
+// Rewrites short sequences in a function that was just generated. The start
+// of the function doesn't move, so its address and the calls already patched
+// to it stay good. Branches are relative, and they're fixed up along with
+// the local address references. Branches that can't reach their targets
+// are made long here.
+
+void Compiler::OptimizeProc( int32_t bodyLoc )
+{
+    std::vector<PeepholeInst> insts;
+    int32_t bodyEnd = static_cast<int32_t>(mCodeBin.size());
+
+    Disassembler disassembler( &mCodeBin[bodyLoc], false );
+
+    for ( int32_t loc = bodyLoc; loc < bodyEnd; )
+    {
+        char text[256];
+
+        int32_t size = disassembler.Disassemble( text, sizeof text );
+        if ( size <= 0 || size > bodyEnd - loc )
+            THROW_INTERNAL_ERROR( "OptimizeProc: bad instruction" );
+
+        PeepholeInst inst = { loc, 0, -1, size, size };
+
+        if ( IsBranch( mCodeBin[loc] ) )
+        {
+            inst.Target = loc + BranchInst::Size + ReadBranchOffset( loc + 1 );
+        }
+        else if ( mCodeBin[loc] == OP_SWITCH )
+        {
+            const uint8_t* switchPtr = &mCodeBin[loc];
+
+            auto getTarget = [this, loc, size]( const uint8_t* offsetPtr )
+            {
+                return loc + size + ReadBranchOffset( static_cast<int32_t>(offsetPtr - mCodeBin.data()) );
+            };
+
+            inst.Target = getTarget( SwitchInst::GetDefaultOffsetPtr( switchPtr ) );
+
+            for ( uint32_t i = 0, count = SwitchInst::GetCount( switchPtr ); i < count; i++ )
+                inst.SwitchTargets.push_back( getTarget( SwitchInst::GetOffsetPtr( switchPtr, i ) ) );
+        }
+
+        insts.push_back( inst );
+        loc += size;
+    }
+
+    bool hasFarOffsets = !mFarOffsets.empty();
+
+    mFarOffsets.clear();
+
+    auto findInst = [&insts]( int32_t loc ) -> PeepholeInst*
+    {
+        auto it = std::upper_bound( insts.begin(), insts.end(), loc,
+            []( int32_t loc, const PeepholeInst& inst ) { return loc < inst.Loc; } );
+
+        return it == insts.begin() ? nullptr : &*(it - 1);
+    };
+
+    auto findInstAt = [&findInst]( int32_t loc ) -> PeepholeInst*
+    {
+        PeepholeInst* inst = findInst( loc );
+
+        return (inst != nullptr && inst->Loc == loc) ? inst : nullptr;
+    };
+
+    for ( const auto& ref : mLocalAddrRefs )
+    {
+        if ( ref.Kind != AddrRefKind::Inst )
+            THROW_INTERNAL_ERROR( "" );
+
+        if ( PeepholeInst* inst = findInst( *ref.InstIndexPtr ) )
+            inst->IsPatched = true;
+    }
+
+    auto markTargets = [&insts, &findInstAt]()
+    {
+        for ( auto& inst : insts )
+            inst.IsTarget = false;
+
+        for ( const auto& inst : insts )
+        {
+            if ( inst.Target < 0 )
+                continue;
+
+            if ( PeepholeInst* targetInst = findInstAt( inst.Target ) )
+                targetInst->IsTarget = true;
+
+            for ( int32_t target : inst.SwitchTargets )
+            {
+                if ( PeepholeInst* targetInst = findInstAt( target ) )
+                    targetInst->IsTarget = true;
+            }
+        }
+    };
+
+    auto inRange = []( const PeepholeInst& inst, int32_t target )
+    {
+        ptrdiff_t diff = target - (inst.Loc + inst.OrigSize);
+
+        return diff >= BranchInst::OffsetMin && diff <= BranchInst::OffsetMax;
+    };
+
+    markTargets();
+
+    // A conditional branch over an unconditional one becomes the inverted
+    // branch: BLT L1, B L2, L1: => BGE L2, L1:
+
+    for ( size_t i = 0; i + 2 < insts.size(); i++ )
+    {
+        uint8_t op = mCodeBin[insts[i].Loc];
+
+        if ( IsBranch( op ) && op != OP_B
+            && mCodeBin[insts[i + 1].Loc] == OP_B
+            && !insts[i + 1].IsTarget
+            && insts[i].Target == insts[i + 2].Loc
+            && inRange( insts[i], insts[i + 1].Target ) )
+        {
+            mCodeBin[insts[i].Loc] = InvertJump( op );
+            insts[i].Target = insts[i + 1].Target;
+            insts[i + 1].Target = -1;
+            insts[i + 1].Size = 0;
+            i++;
+        }
+    }
+
+    // Send branches that land on an unconditional branch straight to its
+    // target. An unconditional branch to a return becomes the return.
+
+    auto threadBranch = [&insts, &findInstAt, &inRange, this]( const PeepholeInst& inst, int32_t target )
+    {
+        for ( size_t hops = 0; hops < insts.size(); hops++ )
+        {
+            PeepholeInst* targetInst = findInstAt( target );
+
+            if ( targetInst == nullptr || targetInst == &inst
+                || targetInst->Target < 0 || mCodeBin[targetInst->Loc] != OP_B
+                || !inRange( inst, targetInst->Target ) )
+                break;
+
+            target = targetInst->Target;
+        }
+
+        return target;
+    };
+
+    for ( auto& inst : insts )
+    {
+        if ( inst.Target < 0 )
+            continue;
+
+        int32_t target = threadBranch( inst, inst.Target );
+
+        inst.Target = target;
+
+        for ( int32_t& switchTarget : inst.SwitchTargets )
+            switchTarget = threadBranch( inst, switchTarget );
+
+        if ( mCodeBin[inst.Loc] == OP_B && target < bodyEnd && mCodeBin[target] == OP_RET )
+        {
+            mCodeBin[inst.Loc] = OP_RET;
+            inst.Target = -1;
+            inst.Size = 1;
+        }
+    }
+
+    markTargets();
+
+    // Instructions after the first in a sequence must not be reached by a
+    // branch. If the first one is, then the branch goes to what's left.
+
+    auto isPlain = [&insts]( size_t i, bool first = false )
+    {
+        return i < insts.size()
+            && insts[i].Size == insts[i].OrigSize
+            && !insts[i].IsPatched
+            && (first || !insts[i].IsTarget);
+    };
+
+    auto opAt = [this, &insts]( size_t i )
+    {
+        return mCodeBin[insts[i].Loc];
+    };
+
+    auto operandAt = [this, &insts]( size_t i, size_t index = 0 )
+    {
+        return mCodeBin[insts[i].Loc + 1 + index];
+    };
+
+    auto isConstant = [this, &insts, &opAt]( size_t i, int32_t value )
+    {
+        const uint8_t* valuePtr = &mCodeBin[insts[i].Loc + 1];
+
+        if ( opAt( i ) == OP_LDC_S )
+            return static_cast<int8_t>(*valuePtr) == value;
+
+        if ( opAt( i ) == OP_LDC )
+            return ReadI32( valuePtr ) == value;
+
+        return false;
+    };
+
+    auto isIdentity = []( uint8_t primitive, int32_t value )
+    {
+        if ( value == 0 )
+            return primitive == PRIM_ADD || primitive == PRIM_SUB
+                || primitive == PRIM_ADD_U || primitive == PRIM_SUB_U;
+
+        return value == 1
+            && (primitive == PRIM_MUL || primitive == PRIM_DIV || primitive == PRIM_MUL_U);
+    };
+
+    for ( size_t i = 0; i < insts.size(); i++ )
+    {
+        if ( !isPlain( i, true ) )
+            continue;
+
+        uint8_t op = opAt( i );
+
+        if ( op == OP_DUP && isPlain( i + 1 ) && isPlain( i + 2 )
+            && (opAt( i + 1 ) == OP_STLOC || opAt( i + 1 ) == OP_STARG || opAt( i + 1 ) == OP_STMOD)
+            && opAt( i + 2 ) == OP_POP )
+        {
+            // DUP, STLOC n, POP => STLOC n
+
+            insts[i].Size = 0;
+            insts[i + 2].Size = 0;
+            i += 2;
+        }
+        else if ( isPlain( i + 1 ) && opAt( i + 1 ) == OP_PRIM
+            && ((isConstant( i, 0 ) && isIdentity( operandAt( i + 1 ), 0 ))
+                || (isConstant( i, 1 ) && isIdentity( operandAt( i + 1 ), 1 ))) )
+        {
+            // LDC 0, PRIM ADD => nothing. Same for SUB, and for MUL and DIV by 1
+
+            insts[i].Size = 0;
+            insts[i + 1].Size = 0;
+            i += 1;
+        }
+        else if ( op == OP_PRIMC_S
+            && isIdentity( operandAt( i ), static_cast<int8_t>(operandAt( i, 1 )) ) )
+        {
+            insts[i].Size = 0;
+        }
+        else if ( op == OP_PUSH && i == 0 && isPlain( i + 1 ) )
+        {
+            // PUSH n, LDC x, STLOC n-1 => PUSH n-1, LDC x
+            //
+            // The last local is on top of the stack. Loading its value takes
+            // its place, as long as the load doesn't read locals. A DUP can
+            // come before the store.
+
+            uint8_t count = operandAt( i );
+            uint8_t loadOp = opAt( i + 1 );
+            size_t  storeIndex = i + 2;
+
+            if ( isPlain( storeIndex ) && opAt( storeIndex ) == OP_DUP )
+                storeIndex++;
+
+            if ( (loadOp == OP_LDC || loadOp == OP_LDC_S || loadOp == OP_LDARG || loadOp == OP_LDMOD)
+                && isPlain( storeIndex )
+                && opAt( storeIndex ) == OP_STLOC && operandAt( storeIndex ) == count - 1 )
+            {
+                if ( count == 1 )
+                    insts[i].Size = 0;
+                else
+                    mCodeBin[insts[i].Loc + 1] = count - 1;
+
+                insts[storeIndex].Size = 0;
+                i = storeIndex;
+            }
+        }
+    }
+
+    // Lay out the instructions that are left
+
+    int32_t newLoc = bodyLoc;
+    uint32_t instsSaved = 0;
+
+    auto layOut = [&insts, &newLoc, bodyLoc]()
+    {
+        newLoc = bodyLoc;
+
+        for ( auto& inst : insts )
+        {
+            inst.NewLoc = newLoc;
+            newLoc += inst.Size;
+        }
+    };
+
+    auto mapLoc = [this, &findInstAt, &newLoc, bodyEnd]( int32_t loc )
+    {
+        if ( loc == bodyEnd )
+            return newLoc;
+
+        PeepholeInst* inst = findInstAt( loc );
+
+        if ( inst == nullptr )
+            THROW_INTERNAL_ERROR( "OptimizeProc: branch target" );
+
+        return inst->NewLoc;
+    };
+
+    auto isShort = []( int32_t diff )
+    {
+        return diff >= BranchInst::OffsetMin && diff <= BranchInst::OffsetMax;
+    };
+
+    for ( const auto& inst : insts )
+    {
+        if ( inst.Size == 0 )
+            instsSaved++;
+    }
+
+    layOut();
+
+    int32_t peepholeEnd = newLoc;
+    uint32_t longBranches = 0;
+
+    // Branches start out short. Making one long moves the code after it,
+    // which can put other targets out of reach. Sizes only grow, so this
+    // settles.
+
+    for ( bool grew = true; grew; )
+    {
+        grew = false;
+
+        for ( auto& inst : insts )
+        {
+            if ( inst.Size == 0 || inst.Target < 0 || inst.IsLong )
+                continue;
+
+            uint8_t op = mCodeBin[inst.Loc];
+
+            if ( op == OP_SWITCH )
+            {
+                int32_t tableEnd = inst.NewLoc + inst.OrigSize;
+
+                auto reach = [&]( int32_t target )
+                {
+                    if ( isShort( mapLoc( target ) - tableEnd )
+                        || std::find( inst.FarTargets.begin(), inst.FarTargets.end(), target ) != inst.FarTargets.end() )
+                        return;
+
+                    inst.FarTargets.push_back( target );
+                    inst.Size += LongBranchInst::Size;
+                    grew = true;
+                };
+
+                reach( inst.Target );
+
+                for ( int32_t target : inst.SwitchTargets )
+                    reach( target );
+
+                if ( !isShort( static_cast<int32_t>(inst.FarTargets.size()) * LongBranchInst::Size ) )
+                    mRep.ThrowSemanticsError( nullptr, "Branch target is too far." );
+            }
+            else if ( !isShort( mapLoc( inst.Target ) - (inst.NewLoc + BranchInst::Size) ) )
+            {
+                inst.IsLong = true;
+                inst.Size = (op == OP_B) ? LongBranchInst::Size : BranchInst::Size + LongBranchInst::Size;
+                grew = true;
+            }
+        }
+
+        if ( grew )
+            layOut();
+    }
+
+    for ( const auto& inst : insts )
+    {
+        if ( inst.IsLong )
+            longBranches++;
+
+        longBranches += static_cast<uint32_t>(inst.FarTargets.size());
+    }
+
+    if ( newLoc == bodyEnd && longBranches == 0 && !hasFarOffsets )
+        return;
+
+    if ( static_cast<size_t>(newLoc) > CodeSizeMax )
+        mRep.ThrowSemanticsError( NULL, "Generated code is too big. Max=%u", CodeSizeMax );
+
+    CodeVec newCode;
+
+    newCode.reserve( newLoc - bodyLoc );
+
+    for ( const auto& inst : insts )
+    {
+        if ( inst.Size == 0 )
+            continue;
+
+        uint8_t op = mCodeBin[inst.Loc];
+
+        if ( inst.IsLong )
+        {
+            // A conditional branch skips the long one, if it's not taken
+
+            uint8_t  longInst[BranchInst::Size + LongBranchInst::Size];
+            uint8_t* p = longInst;
+
+            if ( op != OP_B )
+            {
+                *p++ = InvertJump( op );
+                BranchInst::WriteOffset( p, LongBranchInst::Size );
+            }
+
+            *p++ = OP_B_L;
+            LongBranchInst::WriteOffset( p, mapLoc( inst.Target ) - (inst.NewLoc + inst.Size) );
+
+            newCode.insert( newCode.end(), longInst, p );
+            continue;
+        }
+
+        int32_t instSize = (op == OP_SWITCH) ? inst.OrigSize : inst.Size;
+
+        newCode.insert( newCode.end(), mCodeBin.begin() + inst.Loc, mCodeBin.begin() + inst.Loc + instSize );
+
+        if ( inst.Target < 0 )
+            continue;
+
+        auto getOffset = [&mapLoc, &inst, instSize]( int32_t target )
+        {
+            // Far switch targets go through the long branches after the table
+
+            auto it = std::find( inst.FarTargets.begin(), inst.FarTargets.end(), target );
+
+            if ( it != inst.FarTargets.end() )
+                return static_cast<BranchInst::TOffset>((it - inst.FarTargets.begin()) * LongBranchInst::Size);
+
+            int32_t diff = mapLoc( target ) - (inst.NewLoc + instSize);
+
+            assert( diff >= BranchInst::OffsetMin && diff <= BranchInst::OffsetMax );
+
+            return static_cast<BranchInst::TOffset>(diff);
+        };
+
+        uint8_t* instPtr = &newCode[inst.NewLoc - bodyLoc];
+
+        if ( *instPtr == OP_SWITCH )
+        {
+            SwitchInst::StoreDefaultOffset( instPtr, getOffset( inst.Target ) );
+
+            for ( size_t i = 0; i < inst.SwitchTargets.size(); i++ )
+                SwitchInst::StoreOffset( instPtr, static_cast<uint32_t>(i), getOffset( inst.SwitchTargets[i] ) );
+
+            for ( int32_t target : inst.FarTargets )
+            {
+                int32_t  stubLoc = bodyLoc + static_cast<int32_t>(newCode.size());
+                uint8_t  stub[LongBranchInst::Size];
+                uint8_t* p = stub;
+
+                *p++ = OP_B_L;
+                LongBranchInst::WriteOffset( p, mapLoc( target ) - (stubLoc + LongBranchInst::Size) );
+
+                newCode.insert( newCode.end(), stub, p );
+            }
+        }
+        else
+        {
+            BranchInst::StoreOffset( instPtr + 1, getOffset( inst.Target ) );
+        }
+    }
+
+    for ( const auto& ref : mLocalAddrRefs )
+    {
+        PeepholeInst* inst = findInst( *ref.InstIndexPtr );
+
+        if ( inst != nullptr )
+            *ref.InstIndexPtr += inst->NewLoc - inst->Loc;
+    }
+
+    mCodeBin.resize( bodyLoc );
+    mCodeBin.insert( mCodeBin.end(), newCode.begin(), newCode.end() );
+
+    mStats.PeepholeBytesSaved += static_cast<CodeSize>(bodyEnd - peepholeEnd);
+    mStats.PeepholeInstsSaved += instsSaved;
+    mStats.LongBranches += longBranches;
+}
+
 void Compiler::GenerateImplicitProgn( StatementList* stmtList, const GenConfig& config, GenStatus& status )
 {
     for ( int i = 0; i < (int) stmtList->Statements.size() - 1; i++ )
@@ -2592,6 +3840,183 @@ std::optional<int32_t> Compiler::GetFinalOptionalSyntaxValue( Syntax* node )
     return Gemini::GetFinalOptionalSyntaxValue( node );
 }
 
+// The values that a for-loop's index takes in the body, if the bounds and
+// step are constant, and the body doesn't modify the index. Arithmetic
+// saturates, so the index can't wrap around past the ending bound.
+
+std::optional<Compiler::ValueRange> Compiler::GetForIndexRange( ForStatement* forStmt )
+{
+    auto local = (LocalStorage*) forStmt->IndexDecl.get();
+
+    if ( local->IsModified )
+        return {};
+
+    bool up = forStmt->Comparison == ForComparison::Below
+        || forStmt->Comparison == ForComparison::To;
+
+    std::optional<int32_t> first = GetFinalOptionalSyntaxValue( forStmt->First.get() );
+    std::optional<int32_t> last = GetFinalOptionalSyntaxValue( forStmt->Last.get() );
+    std::optional<int32_t> step = up ? 1 : -1;
+
+    if ( forStmt->Step != nullptr )
+        step = GetFinalOptionalSyntaxValue( forStmt->Step.get() );
+
+    if ( !first.has_value() || !last.has_value() || !step.has_value() )
+        return {};
+
+    // A step the wrong way could take the index past the beginning bound
+
+    if ( (up && step.value() < 0) || (!up && step.value() > 0) )
+        return {};
+
+    int64_t min;
+    int64_t max;
+
+    switch ( forStmt->Comparison )
+    {
+    case ForComparison::Below:
+        min = first.value();
+        max = static_cast<int64_t>(last.value()) - 1;
+        break;
+
+    case ForComparison::To:
+        min = first.value();
+        max = last.value();
+        break;
+
+    case ForComparison::Downto:
+        min = last.value();
+        max = first.value();
+        break;
+
+    case ForComparison::Above:
+        min = static_cast<int64_t>(last.value()) + 1;
+        max = first.value();
+        break;
+
+    default:
+        return {};
+    }
+
+    // The body never runs, if there are no values
+
+    if ( min > max )
+        return {};
+
+    return ValueRange{ static_cast<int32_t>(min), static_cast<int32_t>(max) };
+}
+
+// The values that an integer expression can take, if they can be found from
+// constants, the indexes of enclosing for-loops, and remainders
+
+std::optional<Compiler::ValueRange> Compiler::GetValueRange( Syntax* node )
+{
+    std::optional<int32_t> value = GetFinalOptionalSyntaxValue( node );
+
+    if ( value.has_value() )
+        return ValueRange{ value.value(), value.value() };
+
+    if ( node->Kind == SyntaxKind::Name )
+    {
+        for ( const auto& indexRange : mIndexRanges )
+        {
+            if ( indexRange.Local == node->GetDecl() )
+                return indexRange.Range;
+        }
+    }
+    else if ( node->Kind == SyntaxKind::Binary )
+    {
+        int64_t min;
+        int64_t max;
+
+        // Saturating keeps the bounds in order, the same as in the machine
+
+        if ( GetWideRange( (BinaryExpr*) node, min, max ) )
+            return ValueRange{ Saturate( min ), Saturate( max ) };
+    }
+
+    return {};
+}
+
+// The exact values of an arithmetic expression, before they're saturated to
+// 32 bits. Division and modulo need a constant divisor. Modulo is bounded by
+// its divisor, even if nothing is known about its dividend.
+
+bool Compiler::GetWideRange( BinaryExpr* binary, int64_t& min, int64_t& max )
+{
+    auto& op = binary->Op;
+    auto right = GetValueRange( binary->Right.get() );
+
+    if ( !right.has_value() )
+        return false;
+
+    if ( op == "%" && right->Min == right->Max && right->Min != 0 )
+    {
+        int32_t divisor = right->Min;
+        auto left = GetValueRange( binary->Left.get() );
+
+        if ( left.has_value() && left->Min >= 0 && left->Max < divisor )
+        {
+            min = left->Min;
+            max = left->Max;
+        }
+        else
+        {
+            // The remainder takes the sign of the divisor
+
+            min = (divisor > 0) ? 0 : static_cast<int64_t>(divisor) + 1;
+            max = (divisor > 0) ? static_cast<int64_t>(divisor) - 1 : 0;
+        }
+
+        return true;
+    }
+
+    auto left = GetValueRange( binary->Left.get() );
+
+    if ( !left.has_value() )
+        return false;
+
+    if ( op == "+" )
+    {
+        min = static_cast<int64_t>(left->Min) + right->Min;
+        max = static_cast<int64_t>(left->Max) + right->Max;
+    }
+    else if ( op == "-" )
+    {
+        min = static_cast<int64_t>(left->Min) - right->Max;
+        max = static_cast<int64_t>(left->Max) - right->Min;
+    }
+    else if ( op == "*" )
+    {
+        int64_t products[] =
+        {
+            static_cast<int64_t>(left->Min) * right->Min,
+            static_cast<int64_t>(left->Min) * right->Max,
+            static_cast<int64_t>(left->Max) * right->Min,
+            static_cast<int64_t>(left->Max) * right->Max,
+        };
+
+        min = *std::min_element( std::begin( products ), std::end( products ) );
+        max = *std::max_element( std::begin( products ), std::end( products ) );
+    }
+    else if ( op == "/" && right->Min == right->Max && right->Min != 0 )
+    {
+        // Floored division keeps the order of the dividends, or reverses it
+
+        int32_t first = VmDiv( left->Min, right->Min );
+        int32_t last = VmDiv( left->Max, right->Min );
+
+        min = std::min( first, last );
+        max = std::max( first, last );
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
 void Compiler::IncreaseExprDepth( LocalSize amount )
 {
     if ( amount > (LocalSizeMax - mCurExprDepth) )
@@ -2678,7 +4103,7 @@ void Compiler::CalculateStackDepth()
     }
 }
 
-void Compiler::CalculateStackDepth( Function* func )
+void Compiler::CalculateStackDepth( Function* func, bool isTailCall )
 {
     if ( func->IsDepthKnown )
         return;
@@ -2690,8 +4115,11 @@ void Compiler::CalculateStackDepth( Function* func )
     }
 
     func->IsCalculating = true;
+    func->IsDepthPartial = false;
     func->IndividualStackUsage = FRAME_WORDS + func->LocalCount;
 
+    mDepthPath.push_back( { func, isTailCall } );
+
     uint32_t maxChildDepth = 0;
     uint32_t maxChildStackUsage = func->ExprDepth;
 
@@ -2723,11 +4151,23 @@ void Compiler::CalculateStackDepth( Function* func )
 
             auto childFunc = (Function*) it->second.get();
 
-            CalculateStackDepth( childFunc );
+            // Tail calls reuse the frame, so a cycle made only of them doesn't
+            // grow the stack
+
+            if ( site.IsTail && childFunc->IsCalculating && IsTailCycle( childFunc ) )
+                continue;
+
+            CalculateStackDepth( childFunc, site.IsTail );
 
             uint32_t childStackUsage = childFunc->TreeStackUsage + site.ExprDepth;
+            uint32_t childDepth = childFunc->CallDepth;
 
-            maxChildDepth = std::max( maxChildDepth, childFunc->CallDepth );
+            // The callee's frame takes the place of this one
+
+            if ( site.IsTail && childDepth > 0 )
+                childDepth--;
+
+            maxChildDepth = std::max( maxChildDepth, childDepth );
             maxChildStackUsage = std::max( maxChildStackUsage, childStackUsage );
 
             if ( childFunc->CallsIndirectly )
@@ -2741,12 +4181,38 @@ void Compiler::CalculateStackDepth( Function* func )
         }
     }
 
+    mDepthPath.pop_back();
+
+    // A function in a tail cycle didn't count the function that closes the
+    // cycle, because it wasn't known yet. So, figure it again when it's needed.
+
     func->IsCalculating = false;
-    func->IsDepthKnown = true;
+    func->IsDepthKnown = !func->IsDepthPartial;
     func->CallDepth = 1 + maxChildDepth;
     func->TreeStackUsage = func->IndividualStackUsage + maxChildStackUsage;
 }
 
+// The function is being calculated, and was called again through a tail call.
+// If every call since it was reached is also a tail call, then marks the
+// functions along the cycle as partly calculated, and returns true.
+bool Compiler::IsTailCycle( Function* func )
+{
+    auto it = mDepthPath.rbegin();
+
+    for ( ; it != mDepthPath.rend() && it->first != func; it++ )
+    {
+        if ( !it->second )
+            return false;
+    }
+
+    assert( it != mDepthPath.rend() );
+
+    for ( auto pathIt = mDepthPath.rbegin(); pathIt != it; pathIt++ )
+        pathIt->first->IsDepthPartial = true;
+
+    return true;
+}
+
 size_t Compiler::ReserveProgram( size_t size )
 {
     if ( size > (CodeSizeMax - mCodeBin.size()) )
@@ -2769,6 +4235,8 @@ void Compiler::DeleteCode( size_t size )
     assert( mCodeBin.size() >= size );
 
     mCodeBin.resize( mCodeBin.size() - size );
+
+    mFarOffsets.erase( mFarOffsets.lower_bound( static_cast<int32_t>(mCodeBin.size()) ), mFarOffsets.end() );
 }
 
 void Compiler::DeleteCode( size_t start, size_t size )
@@ -2776,6 +4244,20 @@ void Compiler::DeleteCode( size_t start, size_t size )
     assert( start < mCodeBin.size() && size <= (mCodeBin.size() - start) );
 
     mCodeBin.erase( mCodeBin.begin() + start, mCodeBin.begin() + start + size );
+
+    // Far offsets are relative, so only their locations move
+
+    std::map<int32_t, int32_t> farOffsets;
+
+    for ( const auto& [loc, offset] : mFarOffsets )
+    {
+        if ( loc < static_cast<int32_t>(start) )
+            farOffsets[loc] = offset;
+        else if ( loc >= static_cast<int32_t>(start + size) )
+            farOffsets[loc - static_cast<int32_t>(size)] = offset;
+    }
+
+    mFarOffsets.swap( farOffsets );
 }
 
 void Compiler::EmitBranch( OpCode opcode, PatchChain* chain )
@@ -2808,6 +4290,17 @@ void Compiler::EmitU8( OpCode opcode, uint8_t operand )
     DISASSEMBLE( &mCodeBin[curIndex], 2 );
 }
 
+void Compiler::EmitU8U8( OpCode opcode, uint8_t operand1, uint8_t operand2 )
+{
+    size_t curIndex = ReserveCode( 3 );
+
+    mCodeBin[curIndex] = opcode;
+    mCodeBin[curIndex + 1] = operand1;
+    mCodeBin[curIndex + 2] = operand2;
+
+    DISASSEMBLE( &mCodeBin[curIndex], 3 );
+}
+
 void Compiler::EmitU16( OpCode opcode, uint16_t operand )
 {
     size_t curIndex = ReserveCode( 3 );
@@ -2865,6 +4358,15 @@ void Compiler::EmitModAccess( OpCode opcode, uint8_t mod, uint16_t addr )
     DISASSEMBLE( &mCodeBin[curIndex], 4 );
 }
 
+// Emits LDLOCA or LDARGA, and remembers where, because a call that's passed
+// the address of something in the frame can't reuse the frame
+void Compiler::EmitFrameAddress( OpCode opcode, uint8_t offset )
+{
+    mLastFrameAddrLoc = static_cast<int32_t>( mCodeBin.size() );
+
+    EmitU8( opcode, offset );
+}
+
 
 //----------------------------------------------------------------------------
 //  Disassembly
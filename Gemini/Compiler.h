@@ -55,6 +55,12 @@ struct CallStats
 struct CompilerStats
 {
     CodeSize    CodeBytesWritten;
+    CodeSize    PeepholeBytesSaved;
+    uint32_t    PeepholeInstsSaved;
+    uint32_t    LongBranches;       // Branches and switch entries made long to reach far targets
+    uint32_t    InlinedCalls;
+    int32_t     InlineBytesAdded;   // Inlined code, less the calls that it replaced
+    uint32_t    InlineLocalsAdded;
     bool        CallsIndirectly;
     CallStats   Lambda;
     CallStats   Static;
@@ -129,7 +135,7 @@ public:
     using PatchChain = BasicPatchChain<int32_t>;
     using FuncPatchChain = BasicPatchChain<CodeRef>;
 
-    using FuncPatchMap = std::map<std::string, FuncPatchChain>;
+    using FuncPatchMap = SymbolMap<FuncPatchChain>;
 
 private:
     enum class AddrRefKind
@@ -189,6 +195,7 @@ private:
         bool calcAddr;
         PatchChain* breakChain;
         PatchChain* nextChain;
+        bool tailCall;
 
         static GenConfig Discard()
         {
@@ -240,6 +247,14 @@ private:
             config.discard = true;
             return config;
         }
+
+        // Only given to a call that's the value of a return
+        GenConfig WithTailCall() const
+        {
+            GenConfig config = *this;
+            config.tailCall = true;
+            return config;
+        }
     };
 
     typedef void (Compiler::*ConjClauseGenerator)( Syntax* elem, const GenConfig& config );
@@ -253,6 +268,7 @@ private:
     typedef std::vector<AddrRef> AddrRefVec;
     typedef std::vector<Unique<Unit>> UnitVec;
     typedef std::map<int32_t, std::shared_ptr<ModuleDeclaration>> ModIdMap;
+    typedef std::map<Function*, ProcDecl*> InlineProcMap;
 
     using CodeVec           = std::vector<uint8_t>;
     using GlobalVec         = std::vector<int32_t>;
@@ -271,6 +287,31 @@ private:
         bool            spilled;
     };
 
+    struct SwitchCase
+    {
+        int32_t         Key;
+        size_t          ClauseIndex;
+    };
+
+    // The values that an integer expression can take
+    struct ValueRange
+    {
+        int32_t         Min;
+        int32_t         Max;
+    };
+
+    // A for-loop index, and the values that it has in the loop's body
+    struct IndexRange
+    {
+        LocalStorage*   Local;
+        ValueRange      Range;
+    };
+
+    // The arenas of the units, and the one for what binding makes. They're
+    // declared first, so that the nodes in them are destroyed before them.
+    std::vector<std::shared_ptr<Arena>> mUnitArenas;
+    std::shared_ptr<Arena>              mArena = std::make_shared<Arena>();
+
     CodeVec         mCodeBin;
     GlobalVec       mGlobals;
     GlobalVec       mConsts;
@@ -283,6 +324,8 @@ private:
     FuncPatchMap    mFuncPatchMap;
     AddrRefVec      mLocalAddrRefs;
     MemTransferVec  mDeferredGlobals;
+    InlineProcMap   mInlineProcs;
+    bool            mInlining = true;
 
     GlobalDataGenerator mGlobalDataGenerator
     {
@@ -297,6 +340,27 @@ private:
     Function*       mCurFunc = nullptr;
     LocalSize       mCurExprDepth = 0;
     LocalSize       mMaxExprDepth = 0;
+    int32_t         mLastFrameAddrLoc = -1;
+
+    // Where the PRIM of the last comparison was emitted. A branch on the
+    // comparison can only be fused with it if the code still ends there.
+    int32_t         mLastCompareLoc = -1;
+
+    // Branch and switch offsets that don't fit in 16 bits, by the location
+    // of the offset. OptimizeProc lays these out with long branches.
+    std::map<int32_t, int32_t> mFarOffsets;
+
+    // Indexes of the for-loops being generated, whose bodies don't modify them
+    std::vector<IndexRange> mIndexRanges;
+
+    // While a call is generated in place, the callee's parameters are kept
+    // in the caller's locals, starting at mInlineParamBase
+    bool            mInInlineCall = false;
+    LocalSize       mInlineParamBase = 0;
+
+    // Functions whose stack depth is being calculated, and whether each one
+    // was reached by a tail call
+    std::vector<std::pair<Function*, bool>> mDepthPath;
 
     ICompilerEnv*   mEnv = nullptr;
     Reporter        mRep;
@@ -323,6 +387,11 @@ public:
 
     void AddUnit( Unique<Unit>&& unit );
     void AddModule( std::shared_ptr<ModuleDeclaration> moduleDecl );
+
+    // Small leaf procedures are generated in place of the calls to them,
+    // unless this is turned off before compiling
+    void SetInlining( bool enable );
+
     CompilerErr Compile();
 
     void GetStats( CompilerStats& stats );
@@ -338,6 +407,7 @@ private:
     void BindAttributes();
     void FoldConstants();
     void GenerateCode();
+    void FindInlineProcs();
 
     // Code generation
 
@@ -404,6 +474,9 @@ private:
     void GenerateCall( CallExpr* call, const GenConfig& config, GenStatus& status );
     void GenerateCall( Declaration* decl, std::vector<Unique<Syntax>>& arguments, const GenConfig& config, GenStatus& status );
     ParamSize GenerateCallArgs( std::vector<Unique<Syntax>>& arguments, FuncType* funcType );
+    ProcDecl* FindInlineProc( Declaration* decl, const GenConfig& config );
+    void GenerateInlineCall( ProcDecl* procDecl, std::vector<Unique<Syntax>>& arguments, const GenConfig& config, GenStatus& status );
+    bool IsTailCallAllowed( const GenConfig& config, int32_t argsLoc );
     void GenerateFor( ForStatement* forStmt, const GenConfig& config, GenStatus& status );
     void GenerateSimpleLoop( LoopStatement* loopStmt, const GenConfig& config, GenStatus& status );
     void GenerateDo( WhileStatement* whileStmt, const GenConfig& config, GenStatus& status );
@@ -411,11 +484,13 @@ private:
     void GenerateNext( NextStatement* nextStmt, const GenConfig& config, GenStatus& status );
     void GenerateCase( CaseExpr* caseExpr, const GenConfig& config, GenStatus& status );
     void GenerateGeneralCase( CaseExpr* caseExpr, const GenConfig& config, GenStatus& status );
+    void GenerateSwitchCase( CaseExpr* caseExpr, const std::vector<SwitchCase>& cases, bool dense, const GenConfig& config, GenStatus& status );
 
     void GenerateUnaryPrimitive( Syntax* elem, const GenConfig& config, GenStatus& status );
     void GenerateBinaryPrimitive( BinaryExpr* binary, uint8_t primitive, const GenConfig& config, GenStatus& status );
 
     void GenerateProc( ProcDecl* procDecl, Function* func );
+    void OptimizeProc( int32_t bodyLoc );
     void GenerateImplicitProgn( StatementList* stmtList, const GenConfig& config, GenStatus& status );
     void GenerateStatements( StatementList* list, const GenConfig& config, GenStatus& status );
     void GenerateNilIfNeeded( const GenConfig& config, GenStatus& status );
@@ -433,26 +508,34 @@ private:
     void ElideTrue( PatchChain* trueChain, PatchChain* falseChain );
     void ElideFalse( PatchChain* trueChain, PatchChain* falseChain );
     uint8_t InvertJump( uint8_t opCode );
+    bool EndsWithComparison() const;
+    void EmitCompareBranch( PatchChain* chain );
 
     // Backpatching
     void Patch( PatchChain* chain, int32_t targetIndex = -1 );
+    void StoreBranchOffset( int32_t offsetLoc, int32_t offset );
+    int32_t ReadBranchOffset( int32_t offsetLoc );
     template <typename TRef>
     void PushBasicPatch( BasicPatchChain<TRef>* chain, TRef patchLoc );
     void PushPatch( PatchChain* chain, int32_t patchLoc );
     void PushPatch( PatchChain* chain );
     void PopPatch( PatchChain* chain );
     void PatchCalls( FuncPatchChain* chain, uint32_t addr );
-    void PushFuncPatch( const std::string& name, CodeRef ref );
+    void PushFuncPatch( Symbol name, CodeRef ref );
     void CopyDeferredGlobals();
 
     int32_t GetSyntaxValue( Syntax* node, const char* message = nullptr );
     std::optional<int32_t> GetFinalOptionalSyntaxValue( Syntax* node );
+    std::optional<ValueRange> GetForIndexRange( ForStatement* forStmt );
+    std::optional<ValueRange> GetValueRange( Syntax* node );
+    bool GetWideRange( BinaryExpr* binary, int64_t& min, int64_t& max );
 
     // Stack usage
     void IncreaseExprDepth( LocalSize amount = 1 );
     void DecreaseExprDepth( LocalSize amount = 1 );
     void CalculateStackDepth();
-    void CalculateStackDepth( Function* func );
+    void CalculateStackDepth( Function* func, bool isTailCall = false );
+    bool IsTailCycle( Function* func );
 
     // Emitting instructions
     size_t ReserveProgram( size_t size );
@@ -462,11 +545,13 @@ private:
     void EmitBranch( OpCode opcode, PatchChain* chain );
     void Emit( OpCode opcode );
     void EmitU8( OpCode opcode, uint8_t operand );
+    void EmitU8U8( OpCode opcode, uint8_t operand1, uint8_t operand2 );
     void EmitU16( OpCode opcode, uint16_t operand );
     void EmitU24( OpCode opcode, uint32_t operand );
     void EmitU32( OpCode opcode, uint32_t operand );
     void EmitOpenIndex( OpCode opcode, uint32_t stride, uint32_t bound );
     void EmitModAccess( OpCode opcode, uint8_t mod, uint16_t addr );
+    void EmitFrameAddress( OpCode opcode, uint8_t offset );
 
 
     // Visitor
@@ -0,0 +1,81 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+#include "pch.h"
+#include "CowData.h"
+#include <algorithm>
+
+
+namespace Gemini
+{
+
+CowData::CowData( const CELL* image, U16 size ) :
+    mImage( image ),
+    mSize( size )
+{
+    assert( image != nullptr || size == 0 );
+}
+
+const CELL* CowData::GetImage() const
+{
+    return mImage;
+}
+
+U16 CowData::GetSize() const
+{
+    return mSize;
+}
+
+size_t CowData::GetCopiedPageCount() const
+{
+    return mCopies.size();
+}
+
+void CowData::Reset()
+{
+    mPages.clear();
+    mCopies.clear();
+}
+
+CELL* CowData::GetWritablePage( U32 page )
+{
+    if ( !mPages.empty() )
+    {
+        CELL* pagePtr = mPages[page];
+
+        if ( pagePtr != mImage + (page << PAGE_SHIFT) )
+            return pagePtr;
+    }
+
+    return CopyPage( page );
+}
+
+CELL* CowData::CopyPage( U32 page )
+{
+    if ( mPages.empty() )
+    {
+        U32 pageCount = (mSize + PAGE_MASK) >> PAGE_SHIFT;
+
+        mPages.resize( pageCount );
+
+        for ( U32 i = 0; i < pageCount; i++ )
+            mPages[i] = const_cast<CELL*>( mImage ) + (i << PAGE_SHIFT);
+    }
+
+    U32 start = page << PAGE_SHIFT;
+    U32 count = std::min<U32>( PAGE_SIZE, mSize - start );
+
+    auto copy = std::make_unique<CELL[]>( PAGE_SIZE );
+
+    std::copy_n( mImage + start, count, copy.get() );
+
+    mPages[page] = copy.get();
+    mCopies.push_back( std::move( copy ) );
+
+    return mPages[page];
+}
+
+}
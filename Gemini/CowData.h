@@ -0,0 +1,76 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+#pragma once
+
+#include "Machine.h"
+#include <memory>
+#include <vector>
+
+
+namespace Gemini
+{
+
+// A module's globals, read from an image shared by many machines, and
+// copied a page at a time the first time a page is written. Point Module::Cow
+// at one of these, and leave the module's DataBase and DataSize null and 0.
+//
+// Each machine's module has its own CowData. A CowData and its machine must
+// stay on one thread at a time, but the image can be read by any number of
+// them at once, and must not change while they use it.
+//
+// JIT and AOT code made for another module addresses that module's data
+// directly, so it must not be shared with a copy-on-write module.
+
+class CowData
+{
+public:
+    static constexpr U32 PAGE_SHIFT = 6;
+    static constexpr U32 PAGE_SIZE  = 1 << PAGE_SHIFT;
+    static constexpr U32 PAGE_MASK  = PAGE_SIZE - 1;
+
+private:
+    const CELL*         mImage;
+    U16                 mSize;
+    // Empty until the first write. Then each page points to the image or to
+    // a private copy.
+    std::vector<CELL*>  mPages;
+    std::vector<std::unique_ptr<CELL[]>> mCopies;
+
+public:
+    CowData( const CELL* image, U16 size );
+
+    CowData( const CowData& ) = delete;
+    CowData& operator=( const CowData& ) = delete;
+
+    const CELL* GetImage() const;
+    U16 GetSize() const;
+
+    // Number of pages copied so far
+    size_t GetCopiedPageCount() const;
+
+    // Drops the private pages, so that the data is the image's again
+    void Reset();
+
+    CELL Read( U32 addr ) const
+    {
+        if ( mPages.empty() )
+            return mImage[addr];
+
+        return mPages[addr >> PAGE_SHIFT][addr & PAGE_MASK];
+    }
+
+    void Write( U32 addr, CELL value )
+    {
+        GetWritablePage( addr >> PAGE_SHIFT )[addr & PAGE_MASK] = value;
+    }
+
+private:
+    CELL* GetWritablePage( U32 page );
+    CELL* CopyPage( U32 page );
+};
+
+}
@@ -10,6 +10,7 @@
 #include "VmCommon.h"
 #include <stdexcept>
 #include <stdio.h>
+#include <string.h>
 
 
 static const char* gOpCodes[] = 
@@ -50,6 +51,21 @@ static const char* gOpCodes[] =
     "RANGE",
     "OFFSET",
     "YIELD",
+    "INCLOC",
+    "PRIMLOC",
+    "PRIMC.S",
+    "BEQ",
+    "BNE",
+    "BLT",
+    "BLE",
+    "BGT",
+    "BGE",
+    "TAILCALL",
+    "TAILCALLI",
+    "TAILCALLM",
+    "SWITCH",
+    "INDEX.U",
+    "B.L",
 };
 
 static const char* gPrimitives[] = 
@@ -65,6 +81,9 @@ static const char* gPrimitives[] =
     "LE",
     "GT",
     "GE",
+    "ADD.U",
+    "SUB.U",
+    "MUL.U",
 };
 
 
@@ -168,6 +187,7 @@ int32_t Disassembler::Disassemble( char* disassembly, size_t capacity )
     case OP_COPYBLOCK:
     case OP_COPYARRAY:
     case OP_INDEXOPEN:
+    case OP_INDEX_U:
     case OP_RANGEOPEN:
     case OP_RANGEOPENCLOSED:
     case OP_OFFSET:
@@ -188,6 +208,7 @@ int32_t Disassembler::Disassemble( char* disassembly, size_t capacity )
         break;
 
     case OP_CALL:
+    case OP_TAILCALL:
         {
             uint8_t callFlags = *mCodePtr++;
             uint32_t funcAddr = ReadU24( mCodePtr );
@@ -199,6 +220,7 @@ int32_t Disassembler::Disassemble( char* disassembly, size_t capacity )
         break;
 
     case OP_CALLI:
+    case OP_TAILCALLI:
         {
             uint8_t callFlags = *mCodePtr++;
             charsWritten = snprintf( disassembly, (capacity - totalCharsWritten),
@@ -220,7 +242,45 @@ int32_t Disassembler::Disassemble( char* disassembly, size_t capacity )
         }
         break;
 
+    case OP_PRIMLOC:
+        {
+            int primitive = *(uint8_t*) mCodePtr++;
+            int index = *(uint8_t*) mCodePtr++;
+            if ( primitive >= PRIM_MAXPRIMITIVE )
+                return -1;
+            const char* primitiveName = gPrimitives[primitive];
+            charsWritten = snprintf( disassembly, (capacity - totalCharsWritten),
+                " %s %u",
+                primitiveName, index );
+        }
+        break;
+
+    case OP_PRIMC_S:
+        {
+            int primitive = *(uint8_t*) mCodePtr++;
+            int value = *(int8_t*) mCodePtr++;
+            if ( primitive >= PRIM_MAXPRIMITIVE )
+                return -1;
+            const char* primitiveName = gPrimitives[primitive];
+            char valueStr[ sizeof "-128" ] = "";
+            const char* Format = (mConstFormat == HexConst) ? "$%X" : "%d";
+            snprintf( valueStr, sizeof valueStr, Format, value );
+            charsWritten = snprintf( disassembly, (capacity - totalCharsWritten),
+                " %s %s",
+                primitiveName, valueStr );
+        }
+        break;
+
+    case OP_INCLOC:
+        {
+            int index = *(uint8_t*) mCodePtr++;
+            int step = *(int8_t*) mCodePtr++;
+            charsWritten = snprintf( disassembly, (capacity - totalCharsWritten), " %u, %d", index, step );
+        }
+        break;
+
     case OP_CALLM:
+    case OP_TAILCALLM:
         {
             uint8_t  callFlags = *mCodePtr++;
             uint8_t  iMod = ReadU8( mCodePtr );
@@ -258,6 +318,12 @@ int32_t Disassembler::Disassemble( char* disassembly, size_t capacity )
     case OP_B:
     case OP_BFALSE:
     case OP_BTRUE:
+    case OP_BEQ:
+    case OP_BNE:
+    case OP_BLT:
+    case OP_BLE:
+    case OP_BGT:
+    case OP_BGE:
         {
             int offset = BranchInst::ReadOffset( mCodePtr );
             int target = static_cast<int32_t>(mCodePtr - mCodeBin) + offset;
@@ -265,6 +331,14 @@ int32_t Disassembler::Disassemble( char* disassembly, size_t capacity )
         }
         break;
 
+    case OP_B_L:
+        {
+            uint32_t offset = LongBranchInst::ReadOffset( mCodePtr );
+            uint32_t target = static_cast<uint32_t>(mCodePtr - mCodeBin) + offset;
+            charsWritten = snprintf( disassembly, (capacity - totalCharsWritten), " $%06X", target );
+        }
+        break;
+
     case OP_INDEX:
     case OP_RANGE:
         {
@@ -274,6 +348,47 @@ int32_t Disassembler::Disassemble( char* disassembly, size_t capacity )
         }
         break;
 
+    case OP_SWITCH:
+        {
+            uint32_t size = SwitchInst::GetSize( origCodePtr );
+            if ( size == 0 )
+                return -1;
+
+            mCodePtr = origCodePtr + size;
+
+            bool dense = SwitchInst::GetFormat( origCodePtr ) == SwitchInst::Dense;
+            uint32_t count = SwitchInst::GetCount( origCodePtr );
+            int endAddr = static_cast<int32_t>(mCodePtr - mCodeBin);
+
+            charsWritten = snprintf( disassembly, (capacity - totalCharsWritten),
+                ".%c(%u) $%06X",
+                (dense ? 'D' : 'S'),
+                count, endAddr + SwitchInst::GetDefaultOffset( origCodePtr ) );
+
+            // Long tables are cut off where the text would run out of room
+
+            for ( uint32_t i = 0;
+                i < count && charsWritten >= 0 && static_cast<size_t>(totalCharsWritten + charsWritten) < capacity;
+                i++ )
+            {
+                char entry[ sizeof ", -2147483648: $000000" ];
+                size_t room = capacity - totalCharsWritten - charsWritten;
+
+                snprintf( entry, sizeof entry, ", %d: $%06X",
+                    SwitchInst::GetKey( origCodePtr, i ),
+                    endAddr + SwitchInst::GetOffset( origCodePtr, i ) );
+
+                if ( strlen( entry ) + sizeof ", ..." > room )
+                {
+                    charsWritten += snprintf( disassembly + charsWritten, room, ", ..." );
+                    break;
+                }
+
+                charsWritten += snprintf( disassembly + charsWritten, room, "%s", entry );
+            }
+        }
+        break;
+
     default:
         {
             charsWritten = snprintf( disassembly, (capacity - totalCharsWritten), " $%02X", op );
@@ -290,4 +405,22 @@ int32_t Disassembler::Disassemble( char* disassembly, size_t capacity )
     return static_cast<int32_t>(mCodePtr - origCodePtr);
 }
 
+const char* Disassembler::GetOpName( uint8_t op )
+{
+    if ( op < OP_MAXOPCODE )
+        return gOpCodes[op];
+    else if ( op == OP_SENTINEL )
+        return "SENTINEL";
+    else
+        return nullptr;
+}
+
+const char* Disassembler::GetPrimitiveName( uint8_t primitive )
+{
+    if ( primitive < PRIM_MAXPRIMITIVE )
+        return gPrimitives[primitive];
+    else
+        return nullptr;
+}
+
 }
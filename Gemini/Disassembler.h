@@ -29,6 +29,10 @@ public:
     Disassembler( const uint8_t* code, bool showInstAddr = true, ConstFormat constFormat = DecimalConst );
 
     int32_t Disassemble( char* disassembly, size_t capacity );
+
+    // Null for values that aren't opcodes or primitives
+    static const char* GetOpName( uint8_t op );
+    static const char* GetPrimitiveName( uint8_t primitive );
 };
 
 }
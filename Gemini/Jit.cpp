@@ -0,0 +1,1245 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+#include "pch.h"
+#include "Jit.h"
+#include "Common.h"
+#include "OpCodes.h"
+#include "VmCommon.h"
+#include <stddef.h>
+#include <string.h>
+
+#if defined( GEMINIVM_JIT ) && defined( __x86_64__ ) && defined( __linux__ )
+    #define GEMINIVM_JIT_X64    1
+    #include <sys/mman.h>
+#else
+    #define GEMINIVM_JIT_X64    0
+#endif
+
+
+// Native code layout
+//
+// A module's native code starts with an entry stub that saves the registers
+// it uses, and an exit stub that restores them. Then each instruction gets a
+// template, in the same order as the bytecode, so that falling through works
+// the same way. Branches within the module jump straight to their targets.
+// Backward ones first count down the budget in the context, like the
+// interpreter does.
+//
+// While native code runs, these registers hold the state of the machine:
+//
+//   rbx    Context
+//   r12    Stack pointer, one cell per stack slot as in the interpreter
+//   r13    Frame pointer, the address of the current frame
+//
+// Instructions without a template call JitCode::Step, which runs them with the
+// interpreter, and returns the native address to continue at. If it returns
+// null, then control left the module, or the instruction failed or yielded.
+
+
+namespace Gemini
+{
+
+struct JitCode::Context
+{
+    CELL*           SP;
+    CELL*           FramePtr;
+    CELL*           StackBase;
+    CELL*           StackEnd;
+    Machine*        Vm;
+    const JitCode*  Code;
+    U32             PC;
+    I32             Status;
+    U32             Budget;
+    U8              ModIndex;
+};
+
+constexpr U32 NO_NATIVE_CODE = UINT32_MAX;
+
+
+#if GEMINIVM_JIT_X64
+
+namespace
+{
+
+enum Reg
+{
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+enum Cond : U8
+{
+    CC_O    = 0x0,
+    CC_NO   = 0x1,
+    CC_B    = 0x2,
+    CC_AE   = 0x3,
+    CC_E    = 0x4,
+    CC_NE   = 0x5,
+    CC_BE   = 0x6,
+    CC_A    = 0x7,
+    CC_L    = 0xC,
+    CC_GE   = 0xD,
+    CC_LE   = 0xE,
+    CC_G    = 0xF,
+};
+
+// Opcodes of the "op r/m, reg" forms
+enum Alu : U8
+{
+    ALU_ADD     = 0x01,
+    ALU_SUB     = 0x29,
+    ALU_XOR     = 0x31,
+    ALU_CMP     = 0x39,
+    ALU_TEST    = 0x85,
+    ALU_MOV     = 0x89,
+};
+
+// Opcode extensions of the immediate and shift forms
+enum Ext : U8
+{
+    EXT_ADD     = 0,
+    EXT_OR      = 1,
+    EXT_SUB     = 5,
+    EXT_XOR     = 6,
+    EXT_CMP     = 7,
+    EXT_SHR     = 5,
+    EXT_SAR     = 7,
+};
+
+constexpr int REG_CTX   = RBX;
+constexpr int REG_SP    = R12;
+constexpr int REG_FP    = R13;
+
+
+class Assembler
+{
+    std::vector<U8> mBuf;
+
+public:
+    size_t GetSize() const
+    {
+        return mBuf.size();
+    }
+
+    const std::vector<U8>& GetBuffer() const
+    {
+        return mBuf;
+    }
+
+    void Byte( U8 b )
+    {
+        mBuf.push_back( b );
+    }
+
+    void Dword( U32 d )
+    {
+        for ( int i = 0; i < 4; i++ )
+            Byte( static_cast<U8>(d >> (i * 8)) );
+    }
+
+    void Qword( U64 q )
+    {
+        Dword( static_cast<U32>(q) );
+        Dword( static_cast<U32>(q >> 32) );
+    }
+
+    void Rex( bool wide, int reg, int rm )
+    {
+        U8 rex = 0x40;
+
+        if ( wide )
+            rex |= 8;
+        if ( reg & 8 )
+            rex |= 4;
+        if ( rm & 8 )
+            rex |= 1;
+
+        if ( rex != 0x40 )
+            Byte( rex );
+    }
+
+    void ModRmReg( int reg, int rm )
+    {
+        Byte( 0xC0 | ((reg & 7) << 3) | (rm & 7) );
+    }
+
+    void ModRmMem( int reg, int base, I32 disp )
+    {
+        U8 mod;
+
+        if ( disp == 0 && (base & 7) != RBP )
+            mod = 0;
+        else if ( disp >= INT8_MIN && disp <= INT8_MAX )
+            mod = 1;
+        else
+            mod = 2;
+
+        Byte( (mod << 6) | ((reg & 7) << 3) | (base & 7) );
+
+        // The base registers encoded like rsp need a SIB byte
+        if ( (base & 7) == RSP )
+            Byte( 0x24 );
+
+        if ( mod == 1 )
+            Byte( static_cast<U8>(disp) );
+        else if ( mod == 2 )
+            Dword( disp );
+    }
+
+    void OpReg( U8 op, bool wide, int reg, int rm )
+    {
+        Rex( wide, reg, rm );
+        Byte( op );
+        ModRmReg( reg, rm );
+    }
+
+    void OpMem( U8 op, bool wide, int reg, int base, I32 disp )
+    {
+        Rex( wide, reg, base );
+        Byte( op );
+        ModRmMem( reg, base, disp );
+    }
+
+    void Load32( int reg, int base, I32 disp )      { OpMem( 0x8B, false, reg, base, disp ); }
+    void Store32( int base, I32 disp, int reg )     { OpMem( 0x89, false, reg, base, disp ); }
+    void Load64( int reg, int base, I32 disp )      { OpMem( 0x8B, true, reg, base, disp ); }
+    void Store64( int base, I32 disp, int reg )     { OpMem( 0x89, true, reg, base, disp ); }
+    void Lea64( int reg, int base, I32 disp )       { OpMem( 0x8D, true, reg, base, disp ); }
+    void Cmp64Mem( int reg, int base, I32 disp )    { OpMem( 0x3B, true, reg, base, disp ); }
+    void Sub64Mem( int reg, int base, I32 disp )    { OpMem( 0x2B, true, reg, base, disp ); }
+
+    void Alu32( Alu op, int dst, int src )          { OpReg( op, false, src, dst ); }
+    void Alu64( Alu op, int dst, int src )          { OpReg( op, true, src, dst ); }
+
+    void StoreImm32( int base, I32 disp, U32 imm )
+    {
+        Rex( false, 0, base );
+        Byte( 0xC7 );
+        ModRmMem( 0, base, disp );
+        Dword( imm );
+    }
+
+    void DecMem32( int base, I32 disp )
+    {
+        Rex( false, 0, base );
+        Byte( 0xFF );
+        ModRmMem( 1, base, disp );
+    }
+
+    void CmpByteMemImm( int base, I32 disp, U8 imm )
+    {
+        Rex( false, 0, base );
+        Byte( 0x80 );
+        ModRmMem( EXT_CMP, base, disp );
+        Byte( imm );
+    }
+
+    void AluImm( Ext ext, bool wide, int reg, I32 imm )
+    {
+        Rex( wide, 0, reg );
+
+        if ( imm >= INT8_MIN && imm <= INT8_MAX )
+        {
+            Byte( 0x83 );
+            ModRmReg( ext, reg );
+            Byte( static_cast<U8>(imm) );
+        }
+        else
+        {
+            Byte( 0x81 );
+            ModRmReg( ext, reg );
+            Dword( imm );
+        }
+    }
+
+    void Shift( Ext ext, bool wide, int reg, U8 count )
+    {
+        Rex( wide, 0, reg );
+        Byte( 0xC1 );
+        ModRmReg( ext, reg );
+        Byte( count );
+    }
+
+    void MovImm32( int reg, U32 imm )
+    {
+        Rex( false, 0, reg );
+        Byte( 0xB8 + (reg & 7) );
+        Dword( imm );
+    }
+
+    void MovImm64( int reg, U64 imm )
+    {
+        Rex( true, 0, reg );
+        Byte( 0xB8 + (reg & 7) );
+        Qword( imm );
+    }
+
+    void Imul32( int dst, int src )
+    {
+        Rex( false, dst, src );
+        Byte( 0x0F );
+        Byte( 0xAF );
+        ModRmReg( dst, src );
+    }
+
+    void ImulImm64( int dst, int src, I32 imm )
+    {
+        OpReg( 0x69, true, dst, src );
+        Dword( imm );
+    }
+
+    // Only for the registers with byte forms that don't need a REX prefix
+    void SetccMovzx( Cond cc, int reg )
+    {
+        assert( reg < RSP );
+
+        Byte( 0x0F );
+        Byte( 0x90 | cc );
+        ModRmReg( 0, reg );
+        Byte( 0x0F );
+        Byte( 0xB6 );
+        ModRmReg( reg, reg );
+    }
+
+    void Push( int reg )
+    {
+        Rex( false, 0, reg );
+        Byte( 0x50 + (reg & 7) );
+    }
+
+    void Pop( int reg )
+    {
+        Rex( false, 0, reg );
+        Byte( 0x58 + (reg & 7) );
+    }
+
+    void CallReg( int reg )     { OpReg( 0xFF, false, 2, reg ); }
+    void JmpReg( int reg )      { OpReg( 0xFF, false, 4, reg ); }
+    void Ret()                  { Byte( 0xC3 ); }
+
+    void RepStosd()
+    {
+        Byte( 0xF3 );
+        Byte( 0xAB );
+    }
+
+    // The jumps return the end of the instruction, which their displacement is
+    // relative to, for patching later
+
+    size_t Jcc32( Cond cc )
+    {
+        Byte( 0x0F );
+        Byte( 0x80 | cc );
+        Dword( 0 );
+        return GetSize();
+    }
+
+    size_t Jmp32()
+    {
+        Byte( 0xE9 );
+        Dword( 0 );
+        return GetSize();
+    }
+
+    size_t Jcc8( Cond cc )
+    {
+        Byte( 0x70 | cc );
+        Byte( 0 );
+        return GetSize();
+    }
+
+    size_t Jmp8()
+    {
+        Byte( 0xEB );
+        Byte( 0 );
+        return GetSize();
+    }
+
+    void PatchRel32( size_t end, size_t target )
+    {
+        I32 rel = static_cast<I32>( static_cast<int64_t>(target) - static_cast<int64_t>(end) );
+
+        StoreU32( &mBuf[end - 4], rel );
+    }
+
+    void PatchRel8( size_t end, size_t target )
+    {
+        int64_t rel = static_cast<int64_t>(target) - static_cast<int64_t>(end);
+
+        assert( rel >= INT8_MIN && rel <= INT8_MAX );
+
+        mBuf[end - 1] = static_cast<U8>(rel);
+    }
+};
+
+
+CELL JitDiv( CELL a, CELL b )
+{
+    return VmDiv( a, b );
+}
+
+CELL JitMod( CELL a, CELL b )
+{
+    return VmMod( a, b );
+}
+
+Cond GetCompareCond( U8 func )
+{
+    switch ( func )
+    {
+    case PRIM_EQ:   return CC_E;
+    case PRIM_NE:   return CC_NE;
+    case PRIM_LT:   return CC_L;
+    case PRIM_LE:   return CC_LE;
+    case PRIM_GT:   return CC_G;
+    case PRIM_GE:   return CC_GE;
+    default:
+        assert( false );
+        return CC_E;
+    }
+}
+
+Cond GetBranchCond( U8 op )
+{
+    switch ( op )
+    {
+    case OP_BEQ:    return CC_E;
+    case OP_BNE:    return CC_NE;
+    case OP_BLT:    return CC_L;
+    case OP_BLE:    return CC_LE;
+    case OP_BGT:    return CC_G;
+    case OP_BGE:    return CC_GE;
+    default:
+        assert( false );
+        return CC_E;
+    }
+}
+
+}
+
+
+class JitCode::Generator
+{
+    struct Fixup
+    {
+        size_t  End;
+        U32     Target;
+    };
+
+    Assembler           mAsm;
+    const Module*       mMod;
+    std::vector<U32>&   mOffsets;
+    std::vector<Fixup>  mFixups;
+    size_t              mExit = 0;
+
+public:
+    Generator( const Module* mod, std::vector<U32>& offsets ) :
+        mMod( mod ),
+        mOffsets( offsets )
+    {
+    }
+
+    const std::vector<U8>& GetCode() const
+    {
+        return mAsm.GetBuffer();
+    }
+
+    int Generate()
+    {
+        U32 codeLimit = mMod->CodeSize - SENTINEL_SIZE;
+
+        mOffsets.assign( mMod->CodeSize, NO_NATIVE_CODE );
+
+        EmitEntryAndExit();
+
+        U32 addr = 0;
+
+        while ( addr < codeLimit && mMod->CodeBase[addr] != OP_SENTINEL )
+        {
+            mOffsets[addr] = static_cast<U32>( mAsm.GetSize() );
+
+            U32 size = EmitInst( addr );
+            if ( size == 0 || size > codeLimit - addr )
+                return ERR_BAD_MODULE;
+
+            addr += size;
+        }
+
+        // Verified code never gets here, but dead code might run into the sentinel
+
+        mOffsets[addr] = static_cast<U32>( mAsm.GetSize() );
+        EmitFail( ERR_BAD_OPCODE, addr );
+
+        for ( const auto& fixup : mFixups )
+        {
+            if ( fixup.Target >= addr || mOffsets[fixup.Target] == NO_NATIVE_CODE )
+                return ERR_BAD_MODULE;
+
+            mAsm.PatchRel32( fixup.End, mOffsets[fixup.Target] );
+        }
+
+        return ERR_NONE;
+    }
+
+private:
+    void EmitEntryAndExit()
+    {
+        // int Entry( Context* context, const void* target )
+
+        mAsm.Push( RBX );
+        mAsm.Push( R12 );
+        mAsm.Push( R13 );
+        mAsm.Alu64( ALU_MOV, REG_CTX, RDI );
+        LoadState();
+        mAsm.JmpReg( RSI );
+
+        mExit = mAsm.GetSize();
+
+        mAsm.Store64( REG_CTX, offsetof( Context, SP ), REG_SP );
+        mAsm.Load32( RAX, REG_CTX, offsetof( Context, Status ) );
+        mAsm.Pop( R13 );
+        mAsm.Pop( R12 );
+        mAsm.Pop( RBX );
+        mAsm.Ret();
+    }
+
+    void LoadState()
+    {
+        mAsm.Load64( REG_SP, REG_CTX, offsetof( Context, SP ) );
+        mAsm.Load64( REG_FP, REG_CTX, offsetof( Context, FramePtr ) );
+    }
+
+    void EmitJumpToExit()
+    {
+        size_t end = mAsm.Jmp32();
+        mAsm.PatchRel32( end, mExit );
+    }
+
+    void EmitFail( int err, U32 addr )
+    {
+        mAsm.StoreImm32( REG_CTX, offsetof( Context, PC ), addr );
+        mAsm.StoreImm32( REG_CTX, offsetof( Context, Status ), err );
+        EmitJumpToExit();
+    }
+
+    void EmitFailIf( Cond cc, int err, U32 addr )
+    {
+        size_t skip = mAsm.Jcc8( static_cast<Cond>(cc ^ 1) );
+        EmitFail( err, addr );
+        mAsm.PatchRel8( skip, mAsm.GetSize() );
+    }
+
+    void EmitBranch( Cond cc, U32 target )
+    {
+        size_t end = mAsm.Jcc32( cc );
+        mFixups.push_back( { end, target } );
+    }
+
+    void EmitJump( U32 target )
+    {
+        size_t end = mAsm.Jmp32();
+        mFixups.push_back( { end, target } );
+    }
+
+    // Backward branches charge the budget, and stop at their target if it ran out
+
+    void EmitChargedJump( U32 target )
+    {
+        mAsm.DecMem32( REG_CTX, offsetof( Context, Budget ) );
+        EmitBranch( CC_NE, target );
+        EmitFail( ERR_BUDGET_EXHAUSTED, target );
+    }
+
+    void EmitChargedBranch( Cond cc, U32 target )
+    {
+        size_t skip = mAsm.Jcc8( static_cast<Cond>(cc ^ 1) );
+        EmitChargedJump( target );
+        mAsm.PatchRel8( skip, mAsm.GetSize() );
+    }
+
+    void EmitStep( U32 addr )
+    {
+        mAsm.Store64( REG_CTX, offsetof( Context, SP ), REG_SP );
+        mAsm.Alu64( ALU_MOV, RDI, REG_CTX );
+        mAsm.MovImm32( RSI, addr );
+        mAsm.MovImm64( RAX, reinterpret_cast<uintptr_t>( &JitCode::Step ) );
+        mAsm.CallReg( RAX );
+        LoadState();
+        mAsm.Alu64( ALU_TEST, RAX, RAX );
+
+        size_t end = mAsm.Jcc32( CC_E );
+        mAsm.PatchRel32( end, mExit );
+
+        mAsm.JmpReg( RAX );
+    }
+
+    void EmitPush( int reg )
+    {
+        mAsm.AluImm( EXT_SUB, true, REG_SP, sizeof( CELL ) );
+        mAsm.Store32( REG_SP, 0, reg );
+    }
+
+    void EmitPop( int reg )
+    {
+        mAsm.Load32( reg, REG_SP, 0 );
+        mAsm.AluImm( EXT_ADD, true, REG_SP, sizeof( CELL ) );
+    }
+
+    static I32 GetLocalDisp( U8 index )
+    {
+        return -static_cast<I32>( (1 + index) * sizeof( CELL ) );
+    }
+
+    // Leaves the address of the argument in rax, and fails if it's past the stack
+    void EmitArgAddress( U8 index, U32 addr )
+    {
+        mAsm.Lea64( RAX, REG_FP, (FRAME_WORDS + index) * sizeof( CELL ) );
+        mAsm.Cmp64Mem( RAX, REG_CTX, offsetof( Context, StackEnd ) );
+        EmitFailIf( CC_AE, ERR_BAD_ADDRESS, addr );
+    }
+
+    // Leaves the stack address word of the cell in rax
+    void EmitStackAddrWord( int reg, I32 cellOffset )
+    {
+        mAsm.Alu64( ALU_MOV, RAX, reg );
+        mAsm.Sub64Mem( RAX, REG_CTX, offsetof( Context, StackBase ) );
+        mAsm.Shift( EXT_SHR, true, RAX, 2 );
+
+        if ( cellOffset != 0 )
+            mAsm.AluImm( EXT_ADD, false, RAX, cellOffset );
+
+        mAsm.AluImm( EXT_OR, false, RAX, static_cast<I32>( CodeAddr::Build( 0, MODINDEX_STACK ) ) );
+    }
+
+    // Turns a wrapped 32-bit sum or difference in eax into a saturated one
+    void EmitSaturate()
+    {
+        size_t skip = mAsm.Jcc8( CC_NO );
+        mAsm.Shift( EXT_SAR, false, RAX, 31 );
+        mAsm.AluImm( EXT_XOR, false, RAX, INT32_MIN );
+        mAsm.PatchRel8( skip, mAsm.GetSize() );
+    }
+
+    // Computes eax = eax <func> ecx
+    bool EmitPrimitive( U8 func, U32 addr )
+    {
+        switch ( func )
+        {
+        case PRIM_ADD:
+            mAsm.Alu32( ALU_ADD, RAX, RCX );
+            EmitSaturate();
+            break;
+
+        case PRIM_SUB:
+            mAsm.Alu32( ALU_SUB, RAX, RCX );
+            EmitSaturate();
+            break;
+
+        case PRIM_MUL:
+            {
+                // The sign of the product picks the limit if it overflows
+                mAsm.Alu32( ALU_MOV, RDX, RAX );
+                mAsm.Alu32( ALU_XOR, RDX, RCX );
+                mAsm.Imul32( RAX, RCX );
+
+                size_t skip = mAsm.Jcc8( CC_NO );
+                mAsm.Shift( EXT_SAR, false, RDX, 31 );
+                mAsm.AluImm( EXT_XOR, false, RDX, INT32_MAX );
+                mAsm.Alu32( ALU_MOV, RAX, RDX );
+                mAsm.PatchRel8( skip, mAsm.GetSize() );
+            }
+            break;
+
+        case PRIM_DIV:
+        case PRIM_MOD:
+            {
+                auto helper = (func == PRIM_DIV) ? &JitDiv : &JitMod;
+
+                mAsm.Alu32( ALU_TEST, RCX, RCX );
+                EmitFailIf( CC_E, ERR_DIVIDE, addr );
+                mAsm.Alu32( ALU_MOV, RDI, RAX );
+                mAsm.Alu32( ALU_MOV, RSI, RCX );
+                mAsm.MovImm64( RAX, reinterpret_cast<uintptr_t>( helper ) );
+                mAsm.CallReg( RAX );
+            }
+            break;
+
+        case PRIM_EQ:
+        case PRIM_NE:
+        case PRIM_LT:
+        case PRIM_LE:
+        case PRIM_GT:
+        case PRIM_GE:
+            mAsm.Alu32( ALU_CMP, RAX, RCX );
+            mAsm.SetccMovzx( GetCompareCond( func ), RAX );
+            break;
+
+        case PRIM_ADD_U:
+            mAsm.Alu32( ALU_ADD, RAX, RCX );
+            break;
+
+        case PRIM_SUB_U:
+            mAsm.Alu32( ALU_SUB, RAX, RCX );
+            break;
+
+        case PRIM_MUL_U:
+            mAsm.Imul32( RAX, RCX );
+            break;
+
+        default:
+            return false;
+        }
+
+        return true;
+    }
+
+    // Returns the size of the instruction, or 0 if it's bad
+    U32 EmitInst( U32 addr )
+    {
+        const U8* startPtr = mMod->CodeBase + addr;
+        const U8* codePtr = startPtr;
+        U8 op = *codePtr++;
+
+        switch ( op )
+        {
+        case OP_POP:
+            mAsm.AluImm( EXT_ADD, true, REG_SP, sizeof( CELL ) );
+            break;
+
+        case OP_DUP:
+            mAsm.Load32( RAX, REG_SP, 0 );
+            EmitPush( RAX );
+            break;
+
+        case OP_OVER:
+            mAsm.Load32( RAX, REG_SP, sizeof( CELL ) );
+            EmitPush( RAX );
+            break;
+
+        case OP_PUSH:
+            {
+                U8 count = ReadU8( codePtr );
+
+                if ( count > 0 )
+                {
+                    mAsm.AluImm( EXT_SUB, true, REG_SP, count * sizeof( CELL ) );
+                    mAsm.Alu64( ALU_MOV, RDI, REG_SP );
+                    mAsm.MovImm32( RCX, count );
+                    mAsm.Alu32( ALU_XOR, RAX, RAX );
+                    mAsm.RepStosd();
+                }
+            }
+            break;
+
+        case OP_NOT:
+            mAsm.Load32( RCX, REG_SP, 0 );
+            mAsm.Alu32( ALU_TEST, RCX, RCX );
+            mAsm.SetccMovzx( CC_E, RAX );
+            mAsm.Store32( REG_SP, 0, RAX );
+            break;
+
+        case OP_LDARGA:
+            {
+                U8 index = ReadU8( codePtr );
+
+                EmitArgAddress( index, addr );
+                EmitStackAddrWord( RAX, 0 );
+                EmitPush( RAX );
+            }
+            break;
+
+        case OP_LDARG:
+            {
+                U8 index = ReadU8( codePtr );
+
+                EmitArgAddress( index, addr );
+                mAsm.Load32( RAX, RAX, 0 );
+                EmitPush( RAX );
+            }
+            break;
+
+        case OP_STARG:
+            {
+                U8 index = ReadU8( codePtr );
+
+                EmitArgAddress( index, addr );
+                EmitPop( RCX );
+                mAsm.Store32( RAX, 0, RCX );
+            }
+            break;
+
+        case OP_LDLOCA:
+            {
+                U8 index = ReadU8( codePtr );
+
+                EmitStackAddrWord( REG_FP, -(1 + index) );
+                EmitPush( RAX );
+            }
+            break;
+
+        case OP_LDLOC:
+            {
+                U8 index = ReadU8( codePtr );
+
+                mAsm.Load32( RAX, REG_FP, GetLocalDisp( index ) );
+                EmitPush( RAX );
+            }
+            break;
+
+        case OP_STLOC:
+            {
+                U8 index = ReadU8( codePtr );
+
+                EmitPop( RAX );
+                mAsm.Store32( REG_FP, GetLocalDisp( index ), RAX );
+            }
+            break;
+
+        case OP_LDMOD:
+        case OP_STMOD:
+            {
+                U8  iMod = ReadU8( codePtr );
+                U16 dataAddr = ReadU16( codePtr );
+
+                // Only the module's own data has a known address. Everything
+                // else, including bad addresses, goes to the interpreter.
+
+                if ( dataAddr < mMod->DataSize && iMod < CONST_SECTION_MOD_INDEX_MASK )
+                {
+                    mAsm.CmpByteMemImm( REG_CTX, offsetof( Context, ModIndex ), iMod );
+
+                    size_t slowPath = mAsm.Jcc8( CC_NE );
+
+                    mAsm.MovImm64( RDX, reinterpret_cast<uintptr_t>( &mMod->DataBase[dataAddr] ) );
+
+                    if ( op == OP_LDMOD )
+                    {
+                        mAsm.Load32( RAX, RDX, 0 );
+                        EmitPush( RAX );
+                    }
+                    else
+                    {
+                        EmitPop( RAX );
+                        mAsm.Store32( RDX, 0, RAX );
+                    }
+
+                    size_t done = mAsm.Jmp8();
+
+                    mAsm.PatchRel8( slowPath, mAsm.GetSize() );
+                    EmitStep( addr );
+                    mAsm.PatchRel8( done, mAsm.GetSize() );
+                }
+                else
+                {
+                    EmitStep( addr );
+                }
+            }
+            break;
+
+        case OP_LDC:
+            {
+                CELL value = ReadI32( codePtr );
+
+                mAsm.AluImm( EXT_SUB, true, REG_SP, sizeof( CELL ) );
+                mAsm.StoreImm32( REG_SP, 0, value );
+            }
+            break;
+
+        case OP_LDC_S:
+            {
+                CELL value = ReadI8( codePtr );
+
+                mAsm.AluImm( EXT_SUB, true, REG_SP, sizeof( CELL ) );
+                mAsm.StoreImm32( REG_SP, 0, value );
+            }
+            break;
+
+        case OP_PRIM:
+            {
+                U8 func = ReadU8( codePtr );
+
+                mAsm.Load32( RAX, REG_SP, sizeof( CELL ) );
+                mAsm.Load32( RCX, REG_SP, 0 );
+
+                if ( !EmitPrimitive( func, addr ) )
+                    return 0;
+
+                mAsm.AluImm( EXT_ADD, true, REG_SP, sizeof( CELL ) );
+                mAsm.Store32( REG_SP, 0, RAX );
+            }
+            break;
+
+        case OP_PRIMLOC:
+            {
+                U8 func = ReadU8( codePtr );
+                U8 index = ReadU8( codePtr );
+
+                mAsm.Load32( RAX, REG_SP, 0 );
+                mAsm.Load32( RCX, REG_FP, GetLocalDisp( index ) );
+
+                if ( !EmitPrimitive( func, addr ) )
+                    return 0;
+
+                mAsm.Store32( REG_SP, 0, RAX );
+            }
+            break;
+
+        case OP_PRIMC_S:
+            {
+                U8   func = ReadU8( codePtr );
+                CELL value = ReadI8( codePtr );
+
+                mAsm.Load32( RAX, REG_SP, 0 );
+                mAsm.MovImm32( RCX, value );
+
+                if ( !EmitPrimitive( func, addr ) )
+                    return 0;
+
+                mAsm.Store32( REG_SP, 0, RAX );
+            }
+            break;
+
+        case OP_INCLOC:
+            {
+                U8   index = ReadU8( codePtr );
+                CELL step = ReadI8( codePtr );
+
+                mAsm.Load32( RAX, REG_FP, GetLocalDisp( index ) );
+                mAsm.AluImm( EXT_ADD, false, RAX, step );
+                EmitSaturate();
+                mAsm.Store32( REG_FP, GetLocalDisp( index ), RAX );
+                EmitPush( RAX );
+            }
+            break;
+
+        case OP_B:
+            {
+                BranchInst::TOffset offset = BranchInst::ReadOffset( codePtr );
+                I32 target = static_cast<I32>(codePtr - mMod->CodeBase) + offset;
+
+                if ( target < 0 )
+                    return 0;
+
+                if ( offset < 0 )
+                    EmitChargedJump( target );
+                else
+                    EmitJump( target );
+            }
+            break;
+
+        case OP_B_L:
+            {
+                LongBranchInst::TOffset offset = LongBranchInst::ReadOffset( codePtr );
+                int64_t target = static_cast<int64_t>(codePtr - mMod->CodeBase) + offset;
+
+                if ( target < 0 || target > INT32_MAX )
+                    return 0;
+
+                if ( offset < 0 )
+                    EmitChargedJump( static_cast<I32>(target) );
+                else
+                    EmitJump( static_cast<I32>(target) );
+            }
+            break;
+
+        case OP_BFALSE:
+        case OP_BTRUE:
+            {
+                BranchInst::TOffset offset = BranchInst::ReadOffset( codePtr );
+                I32 target = static_cast<I32>(codePtr - mMod->CodeBase) + offset;
+
+                if ( target < 0 )
+                    return 0;
+
+                Cond cc = (op == OP_BFALSE) ? CC_E : CC_NE;
+
+                EmitPop( RAX );
+                mAsm.Alu32( ALU_TEST, RAX, RAX );
+
+                if ( offset < 0 )
+                    EmitChargedBranch( cc, target );
+                else
+                    EmitBranch( cc, target );
+            }
+            break;
+
+        case OP_BEQ:
+        case OP_BNE:
+        case OP_BLT:
+        case OP_BLE:
+        case OP_BGT:
+        case OP_BGE:
+            {
+                BranchInst::TOffset offset = BranchInst::ReadOffset( codePtr );
+                I32 target = static_cast<I32>(codePtr - mMod->CodeBase) + offset;
+
+                if ( target < 0 )
+                    return 0;
+
+                mAsm.Load32( RAX, REG_SP, sizeof( CELL ) );
+                mAsm.Load32( RCX, REG_SP, 0 );
+                mAsm.AluImm( EXT_ADD, true, REG_SP, 2 * sizeof( CELL ) );
+                mAsm.Alu32( ALU_CMP, RAX, RCX );
+
+                if ( offset < 0 )
+                    EmitChargedBranch( GetBranchCond( op ), target );
+                else
+                    EmitBranch( GetBranchCond( op ), target );
+            }
+            break;
+
+        case OP_INDEX:
+            {
+                U32 stride = ReadU24( codePtr );
+                U32 bound  = ReadU24( codePtr );
+
+                // An unsigned compare also catches negative indexes
+
+                mAsm.Load32( RCX, REG_SP, 0 );
+                mAsm.AluImm( EXT_CMP, false, RCX, bound );
+                EmitFailIf( CC_AE, ERR_BOUND, addr );
+
+                mAsm.Load32( RAX, REG_SP, sizeof( CELL ) );
+                mAsm.ImulImm64( RCX, RCX, stride );
+                mAsm.Alu64( ALU_ADD, RCX, RAX );
+                mAsm.Alu32( ALU_MOV, RDX, RAX );
+                mAsm.AluImm( EXT_OR, false, RDX, CodeAddr::ToModuleMax( 0 ) );
+                mAsm.Alu64( ALU_CMP, RCX, RDX );
+                EmitFailIf( CC_A, ERR_BAD_ADDRESS, addr );
+
+                mAsm.AluImm( EXT_ADD, true, REG_SP, sizeof( CELL ) );
+                mAsm.Store32( REG_SP, 0, RCX );
+            }
+            break;
+
+        case OP_INDEX_U:
+            {
+                U32 stride = ReadU24( codePtr );
+
+                // Only the module's limit is checked. A negative index is
+                // zero-extended, which also takes it out of the module
+
+                mAsm.Load32( RAX, REG_SP, sizeof( CELL ) );
+                mAsm.Load32( RCX, REG_SP, 0 );
+                mAsm.ImulImm64( RCX, RCX, stride );
+                mAsm.Alu64( ALU_ADD, RCX, RAX );
+                mAsm.Alu32( ALU_MOV, RDX, RAX );
+                mAsm.AluImm( EXT_OR, false, RDX, CodeAddr::ToModuleMax( 0 ) );
+                mAsm.Alu64( ALU_CMP, RCX, RDX );
+                EmitFailIf( CC_A, ERR_BAD_ADDRESS, addr );
+
+                mAsm.AluImm( EXT_ADD, true, REG_SP, sizeof( CELL ) );
+                mAsm.Store32( REG_SP, 0, RCX );
+            }
+            break;
+
+        // These go to the interpreter
+
+        case OP_LOADI:
+        case OP_STOREI:
+        case OP_RET:
+        case OP_YIELD:
+            EmitStep( addr );
+            break;
+
+        case OP_CALLI:
+        case OP_TAILCALLI:
+            codePtr += 1;
+            EmitStep( addr );
+            break;
+
+        case OP_CALLNATIVE_S:
+            codePtr += 2;
+            EmitStep( addr );
+            break;
+
+        case OP_COPYBLOCK:
+        case OP_COPYARRAY:
+        case OP_INDEXOPEN:
+        case OP_RANGEOPEN:
+        case OP_RANGEOPENCLOSED:
+        case OP_OFFSET:
+            codePtr += 3;
+            EmitStep( addr );
+            break;
+
+        case OP_CALL:
+        case OP_TAILCALL:
+            codePtr += 4;
+            EmitStep( addr );
+            break;
+
+        case OP_CALLM:
+        case OP_TAILCALLM:
+        case OP_CALLNATIVE:
+            codePtr += 5;
+            EmitStep( addr );
+            break;
+
+        case OP_RANGE:
+            codePtr += 6;
+            EmitStep( addr );
+            break;
+
+        case OP_SWITCH:
+            codePtr = startPtr + SwitchInst::GetSize( startPtr );
+            EmitStep( addr );
+            break;
+
+        default:
+            return 0;
+        }
+
+        return static_cast<U32>(codePtr - startPtr);
+    }
+};
+
+#endif // GEMINIVM_JIT_X64
+
+
+JitCode::JitCode() :
+    mCode( nullptr ),
+    mCodeSize( 0 ),
+    mMod( nullptr )
+{
+}
+
+JitCode::~JitCode()
+{
+#if GEMINIVM_JIT_X64
+    if ( mCode != nullptr )
+        munmap( mCode, mCodeSize );
+#endif
+}
+
+bool JitCode::IsSupported()
+{
+    return GEMINIVM_JIT_X64;
+}
+
+int JitCode::Compile( const Module* mod )
+{
+#if GEMINIVM_JIT_X64
+    if ( mod == nullptr || mod->Verified == nullptr )
+        return ERR_BAD_ARG;
+
+    if ( mCode != nullptr )
+        return ERR_BAD_STATE;
+
+    int err = VerifyModule( mod );
+    if ( err != ERR_NONE )
+        return err;
+
+    std::vector<U32> offsets;
+    Generator generator( mod, offsets );
+
+    err = generator.Generate();
+    if ( err != ERR_NONE )
+        return err;
+
+    const auto& code = generator.GetCode();
+
+    void* mem = mmap( nullptr, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( mem == MAP_FAILED )
+        return ERR_BAD_STATE;
+
+    memcpy( mem, code.data(), code.size() );
+
+    if ( mprotect( mem, code.size(), PROT_READ | PROT_EXEC ) != 0 )
+    {
+        munmap( mem, code.size() );
+        return ERR_BAD_STATE;
+    }
+
+    mCode = static_cast<U8*>( mem );
+    mCodeSize = code.size();
+    mOffsets = std::move( offsets );
+    mMod = mod;
+
+    return ERR_NONE;
+#else
+    return ERR_BAD_STATE;
+#endif
+}
+
+int JitCode::Run( Machine* machine ) const
+{
+    if ( mCode == nullptr || machine->mMod != mMod || mMod->Verified == nullptr )
+        return ERR_BAD_MODULE;
+
+    if ( !machine->HasVerifiedStackRoom() )
+        return ERR_STACK_OVERFLOW;
+
+    const void* target = GetNativeAddress( machine->mPC );
+    if ( target == nullptr )
+        return ERR_BAD_ADDRESS;
+
+    Context context;
+
+    context.SP          = machine->mSP;
+    context.FramePtr    = &machine->mStack[machine->mFramePtr];
+    context.StackBase   = machine->mStack;
+    context.StackEnd    = &machine->mStack[machine->mStackSize];
+    context.Vm          = machine;
+    context.Code        = this;
+    context.PC          = machine->mPC;
+    context.Status      = ERR_NONE;
+    context.Budget      = machine->mBudget;
+    context.ModIndex    = machine->mModIndex;
+
+    auto entry = reinterpret_cast<Entry>( mCode );
+
+    int err = entry( &context, target );
+
+    machine->mSP = context.SP;
+    machine->mPC = context.PC;
+    machine->mBudget = context.Budget;
+
+    return err;
+}
+
+const void* JitCode::GetNativeAddress( U32 address ) const
+{
+    if ( address >= mOffsets.size() || mOffsets[address] == NO_NATIVE_CODE )
+        return nullptr;
+
+    return mCode + mOffsets[address];
+}
+
+const void* JitCode::Step( Context* context, U32 address )
+{
+    Machine* machine = context->Vm;
+
+    machine->mPC = address;
+    machine->mSP = context->SP;
+    machine->mBudget = context->Budget;
+
+    int err = machine->Step();
+
+    context->SP         = machine->mSP;
+    context->Budget     = machine->mBudget;
+    context->FramePtr   = &machine->mStack[machine->mFramePtr];
+    context->ModIndex   = machine->mModIndex;
+    context->PC         = machine->mPC;
+    context->Status     = err;
+
+    // Stay in native code if the instruction went on to somewhere in this
+    // module. Otherwise, Machine::Run picks the engine again, and reports
+    // anything wrong with the new address.
+
+    if ( err == ERR_SWITCH_ENGINE
+        && machine->mMod == context->Code->mMod
+        && machine->mMod->Jit == context->Code
+        && machine->HasVerifiedStackRoom() )
+    {
+        return context->Code->GetNativeAddress( machine->mPC );
+    }
+
+    return nullptr;
+}
+
+}
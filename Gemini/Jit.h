@@ -0,0 +1,60 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+#pragma once
+
+#include "Machine.h"
+
+
+namespace Gemini
+{
+
+// Translates the code of a verified module to x86-64 machine code, one
+// template for each instruction. Point Module::Jit at a compiled JitCode, and
+// Machine::Run executes it in place of the module's bytecode.
+//
+// Calls, returns, native calls, YIELD, and the rarer data instructions are
+// handed back to the interpreter one at a time, so errors are the same as the
+// unchecked engine's.
+//
+// The module's code, data base, and data size must not change after it's
+// compiled.
+
+class JitCode
+{
+    friend class Machine;
+
+    struct Context;
+    class Generator;
+
+    using Entry = int (*)( Context* context, const void* target );
+
+    U8*                 mCode;
+    size_t              mCodeSize;
+    std::vector<U32>    mOffsets;
+    const Module*       mMod;
+
+public:
+    JitCode();
+    ~JitCode();
+
+    JitCode( const JitCode& ) = delete;
+    JitCode& operator=( const JitCode& ) = delete;
+
+    static bool IsSupported();
+
+    // The module must have been verified with VerifyModuleCode, and its
+    // Verified field set. Returns ERR_BAD_STATE if the platform isn't supported.
+    int Compile( const Module* mod );
+
+private:
+    int Run( Machine* machine ) const;
+    const void* GetNativeAddress( U32 address ) const;
+
+    static const void* Step( Context* context, U32 address );
+};
+
+}
@@ -0,0 +1,121 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdexcept>
+#include <stdint.h>
+#include <string_view>
+
+
+namespace Gemini
+{
+
+template <typename T>
+struct KeywordEntry
+{
+    std::string_view    Name;
+    T                   Value = {};
+};
+
+
+// Maps a fixed set of words to values with a perfect hash that's found at
+// compile time. Each word gets a slot of its own, so looking up a word takes
+// one hash and at most one string compare.
+//
+// The hash only looks at the length and the first, middle and last chars of
+// a word. Words that agree on all of those can't go in the same table; the
+// search for a seed fails to compile if there are any.
+
+template <typename T, size_t N>
+class KeywordTable
+{
+    static constexpr size_t CalcSlotCount()
+    {
+        size_t count = 1;
+
+        while ( count < N * 4 )
+            count *= 2;
+
+        return count;
+    }
+
+    static constexpr size_t SlotCount = CalcSlotCount();
+    static constexpr uint32_t MaxSeed = 10000;
+
+    KeywordEntry<T> mSlots[SlotCount] = {};
+    uint32_t        mSeed = 0;
+
+public:
+    constexpr KeywordTable( const KeywordEntry<T> (&entries)[N] )
+    {
+        for ( uint32_t seed = 1; seed < MaxSeed; seed++ )
+        {
+            if ( TrySeed( seed, entries ) )
+            {
+                mSeed = seed;
+
+                for ( size_t i = 0; i < N; i++ )
+                    mSlots[GetSlot( seed, entries[i].Name )] = entries[i];
+
+                return;
+            }
+        }
+
+        throw std::logic_error( "No perfect hash for the keywords" );
+    }
+
+    // Returns nullptr if the word isn't in the table
+    constexpr const T* Find( std::string_view name ) const
+    {
+        if ( name.empty() )
+            return nullptr;
+
+        const KeywordEntry<T>& entry = mSlots[GetSlot( mSeed, name )];
+
+        return entry.Name == name ? &entry.Value : nullptr;
+    }
+
+private:
+    static constexpr size_t GetSlot( uint32_t seed, std::string_view name )
+    {
+        uint32_t hash = seed;
+
+        hash = (hash ^ static_cast<uint32_t>( name.size() )) * 0x01000193;
+        hash = (hash ^ static_cast<uint8_t>( name[0] )) * 0x01000193;
+        hash = (hash ^ static_cast<uint8_t>( name[name.size() / 2] )) * 0x01000193;
+        hash = (hash ^ static_cast<uint8_t>( name[name.size() - 1] )) * 0x01000193;
+        hash ^= hash >> 16;
+
+        return hash & (SlotCount - 1);
+    }
+
+    static constexpr bool TrySeed( uint32_t seed, const KeywordEntry<T> (&entries)[N] )
+    {
+        bool used[SlotCount] = {};
+
+        for ( size_t i = 0; i < N; i++ )
+        {
+            size_t slot = GetSlot( seed, entries[i].Name );
+
+            if ( used[slot] )
+                return false;
+
+            used[slot] = true;
+        }
+
+        return true;
+    }
+};
+
+template <typename T, size_t N>
+constexpr KeywordTable<T, N> MakeKeywordTable( const KeywordEntry<T> (&entries)[N] )
+{
+    return KeywordTable<T, N>( entries );
+}
+
+}
@@ -97,6 +97,8 @@ void Reporter::LogWarning( const char* fileName, int line, int col, const char*
 
 int32_t CompilerAttrs::AddFunctionByIndex( std::shared_ptr<Function> func )
 {
+    std::lock_guard<std::mutex> lock( mMutex );
+
     auto funcIt = mConstFuncIndexMap.find( func.get() );
     int32_t index;
 
@@ -117,6 +119,8 @@ int32_t CompilerAttrs::AddFunctionByIndex( std::shared_ptr<Function> func )
 
 void CompilerAttrs::AddFunctionByAddress( std::shared_ptr<Function> func )
 {
+    std::lock_guard<std::mutex> lock( mMutex );
+
     uint32_t address = CodeAddr::Build( func->Address, func->ModIndex );
 
     mAddressFuncMap.insert( AddressFuncMap::value_type( address, func ) );
@@ -124,14 +128,51 @@ void CompilerAttrs::AddFunctionByAddress( std::shared_ptr<Function> func )
 
 std::shared_ptr<Function> CompilerAttrs::GetFunction( int32_t id ) const
 {
+    std::lock_guard<std::mutex> lock( mMutex );
+
     if ( id < 0 )
         return mConstIndexFuncMap.find( id )->second;
     else
         return mAddressFuncMap.find( id )->second;
 }
 
+std::shared_ptr<Function> CompilerAttrs::FindFunctionContaining( uint32_t addrWord ) const
+{
+    std::lock_guard<std::mutex> lock( mMutex );
+
+    auto funcIt = mAddressFuncMap.upper_bound( addrWord );
+
+    if ( funcIt == mAddressFuncMap.begin() )
+        return nullptr;
+
+    --funcIt;
+
+    if ( CodeAddr::GetModule( funcIt->first ) != CodeAddr::GetModule( addrWord ) )
+        return nullptr;
+
+    return funcIt->second;
+}
+
+std::vector<std::shared_ptr<Function>> CompilerAttrs::GetModuleFunctions( ModSize modIndex ) const
+{
+    std::lock_guard<std::mutex> lock( mMutex );
+
+    std::vector<std::shared_ptr<Function>> funcs;
+    uint32_t moduleStart = CodeAddr::Build( 0, modIndex );
+
+    auto funcIt = mAddressFuncMap.lower_bound( moduleStart );
+    auto endIt = mAddressFuncMap.upper_bound( CodeAddr::ToModuleMax( moduleStart ) );
+
+    for ( ; funcIt != endIt; funcIt++ )
+        funcs.push_back( funcIt->second );
+
+    return funcs;
+}
+
 void CompilerAttrs::AddModule( std::shared_ptr<ModuleAttrs> module )
 {
+    std::lock_guard<std::mutex> lock( mMutex );
+
     assert( module->GetIndex() < ModSizeMax );
 
     if ( module->GetIndex() >= mModules.size() )
@@ -144,6 +185,8 @@ void CompilerAttrs::AddModule( std::shared_ptr<ModuleAttrs> module )
 
 std::shared_ptr<ModuleAttrs> CompilerAttrs::GetModule( int32_t index ) const
 {
+    std::lock_guard<std::mutex> lock( mMutex );
+
     return mModules[index];
 }
 
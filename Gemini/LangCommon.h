@@ -11,6 +11,7 @@
 #include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 
 
@@ -89,6 +90,9 @@ struct Function;
 class ModuleAttrs;
 
 
+// Shared by the compilers of the modules of a program. It's safe to use
+// from compilers running on different threads.
+
 class CompilerAttrs
 {
     using ConstFuncIndexMap = std::map<Function*, int32_t>;
@@ -96,6 +100,7 @@ class CompilerAttrs
     using AddressFuncMap    = std::map<uint32_t, std::shared_ptr<Function>>;
     using ModuleVec         = std::vector<std::shared_ptr<ModuleAttrs>>;
 
+    mutable std::mutex  mMutex;
     ConstFuncIndexMap   mConstFuncIndexMap;
     ConstIndexFuncMap   mConstIndexFuncMap;
     AddressFuncMap      mAddressFuncMap;
@@ -106,6 +111,13 @@ public:
     void AddFunctionByAddress( std::shared_ptr<Function> func );
     std::shared_ptr<Function> GetFunction( int32_t id ) const;
 
+    // The function whose code starts at or before the code address, in the
+    // same module. Null if there's none.
+    std::shared_ptr<Function> FindFunctionContaining( uint32_t addrWord ) const;
+
+    // The functions added by address for a module, in address order
+    std::vector<std::shared_ptr<Function>> GetModuleFunctions( ModSize modIndex ) const;
+
     void AddModule( std::shared_ptr<ModuleAttrs> module );
     std::shared_ptr<ModuleAttrs> GetModule( int32_t index ) const;
 };
@@ -50,7 +50,8 @@ LispyParser::LispyParser( const char* codeText, size_t codeTextLen, const char*
     mCurNumber( 0 ),
     mTokLine( 0 ),
     mTokCol( 0 ),
-    mRep( log )
+    mRep( log ),
+    mArena( std::make_shared<Arena>() )
 {
     if ( codeText == nullptr )
         throw std::invalid_argument( "codeText" );
@@ -65,43 +66,6 @@ LispyParser::LispyParser( const char* codeText, size_t codeTextLen, const char*
     {
         mCurChar = *mCodeTextPtr;
     }
-
-    mParserMap =
-    {
-        { "+", &LispyParser::ParseBinary },
-        { "*", &LispyParser::ParseBinary },
-        { "/", &LispyParser::ParseBinary },
-        { "%", &LispyParser::ParseBinary },
-        { "-", &LispyParser::ParseNegate },
-        { "=",  &LispyParser::ParseBinary},
-        { "<>", &LispyParser::ParseBinary },
-        { "<",  &LispyParser::ParseBinary },
-        { "<=", &LispyParser::ParseBinary },
-        { ">",  &LispyParser::ParseBinary },
-        { ">=", &LispyParser::ParseBinary },
-        { "and", &LispyParser::ParseBinary },
-        { "or",  &LispyParser::ParseBinary },
-        { "not", &LispyParser::ParseNot },
-        { "eval*", &LispyParser::ParseEvalStar },
-        { "lambda", &LispyParser::ParseLambda },
-        { "function", &LispyParser::ParseFunction },
-        { "funcall", &LispyParser::ParseFuncall },
-        { "return", &LispyParser::ParseReturn },
-        { "let", &LispyParser::ParseLet },
-        { "defvar", &LispyParser::ParseGlobalError },
-        { "aref", &LispyParser::ParseAref },
-        { "set", &LispyParser::ParseSet },
-        { "if", &LispyParser::ParseIf },
-        { "cond", &LispyParser::ParseCond },
-        { "loop", &LispyParser::ParseLoop },
-        { "do", &LispyParser::ParseDo },
-        { "break", &LispyParser::ParseBreak },
-        { "next", &LispyParser::ParseNext },
-        { "yield", &LispyParser::ParseYield },
-        { "case", &LispyParser::ParseCase },
-        { "progn", &LispyParser::ParseProgn },
-        { "defun", &LispyParser::ParseGlobalError },
-    };
 }
 
 int LispyParser::GetColumn()
@@ -148,7 +112,7 @@ LispyParser::TokenCode LispyParser::ScanToken()
 {
     SkipWhitespace();
 
-    mCurString.clear();
+    mCurString = std::string_view();
     mCurNumber = 0;
     mTokLine = mLine;
     mTokCol = GetColumn();
@@ -203,12 +167,12 @@ LispyParser::TokenCode LispyParser::ScanRParen()
     return ScanToken( TokenCode::RParen );
 }
 
-std::string LispyParser::ScanSymbol()
+Symbol LispyParser::ScanSymbol()
 {
     if ( mCurToken != TokenCode::Symbol )
         ThrowSyntaxError( "syntax error : expected symbol" );
 
-    std::string symbol = std::move( mCurString );
+    Symbol symbol( mCurString );
     ScanToken();
     return symbol;
 }
@@ -285,16 +249,19 @@ void LispyParser::ReadNumber()
         NextChar();
     }
 
+    // Unsigned, so that big numbers wrap instead of overflowing
+    unsigned int value = 0;
+
     while ( isdigit( PeekChar() ) )
     {
-        mCurString.append( 1, PeekChar() );
+        value = value * 10 + (PeekChar() - '0');
         NextChar();
     }
 
     if ( IsIdentifierInitial( PeekChar() ) )
         ThrowSyntaxError( "syntax error : bad number" );
 
-    mCurNumber = atoi( mCurString.c_str() );
+    mCurNumber = static_cast<int>( value );
     if ( negate )
         mCurNumber = -mCurNumber;
 
@@ -303,18 +270,21 @@ void LispyParser::ReadNumber()
 
 void LispyParser::ReadSymbol()
 {
+    const char* start = mCodeTextPtr;
+
     while ( IsIdentifierCoda( PeekChar() ) )
     {
-        mCurString.append( 1, PeekChar() );
         NextChar();
     }
 
+    mCurString = std::string_view( start, mCodeTextPtr - start );
+
     mCurToken = TokenCode::Symbol;
 }
 
 Unique<Unit> LispyParser::Parse()
 {
-    auto unit = Make<Unit>( mFileName );
+    Unique<Unit> unit( new Unit( mFileName, mArena ) );
 
     mUnitFileName = unit->GetUnitFileName();
 
@@ -343,7 +313,7 @@ Unique<Unit> LispyParser::Parse()
         }
         else
         {
-            ThrowSyntaxError( "'%s' is not valid at global scope", mCurString.c_str() );
+            ThrowSyntaxError( "'%.*s' is not valid at global scope", (int) mCurString.size(), mCurString.data() );
         }
     }
 
@@ -391,11 +361,50 @@ Unique<DataDecl> LispyParser::ParseParameter()
 
 Unique<Syntax> LispyParser::ParseGlobalError()
 {
-    ThrowSyntaxError( "'%s' is only allowed at global scope", mCurString.c_str() );
+    ThrowSyntaxError( "'%.*s' is only allowed at global scope", (int) mCurString.size(), mCurString.data() );
 }
 
 Unique<Syntax> LispyParser::ParseExpression( bool isInit )
 {
+    static constexpr KeywordEntry<ParseFunc> sSpecialFormList[] =
+    {
+        { "+", &LispyParser::ParseBinary },
+        { "*", &LispyParser::ParseBinary },
+        { "/", &LispyParser::ParseBinary },
+        { "%", &LispyParser::ParseBinary },
+        { "-", &LispyParser::ParseNegate },
+        { "=",  &LispyParser::ParseBinary},
+        { "<>", &LispyParser::ParseBinary },
+        { "<",  &LispyParser::ParseBinary },
+        { "<=", &LispyParser::ParseBinary },
+        { ">",  &LispyParser::ParseBinary },
+        { ">=", &LispyParser::ParseBinary },
+        { "and", &LispyParser::ParseBinary },
+        { "or",  &LispyParser::ParseBinary },
+        { "not", &LispyParser::ParseNot },
+        { "eval*", &LispyParser::ParseEvalStar },
+        { "lambda", &LispyParser::ParseLambda },
+        { "function", &LispyParser::ParseFunction },
+        { "funcall", &LispyParser::ParseFuncall },
+        { "return", &LispyParser::ParseReturn },
+        { "let", &LispyParser::ParseLet },
+        { "defvar", &LispyParser::ParseGlobalError },
+        { "aref", &LispyParser::ParseAref },
+        { "set", &LispyParser::ParseSet },
+        { "if", &LispyParser::ParseIf },
+        { "cond", &LispyParser::ParseCond },
+        { "loop", &LispyParser::ParseLoop },
+        { "do", &LispyParser::ParseDo },
+        { "break", &LispyParser::ParseBreak },
+        { "next", &LispyParser::ParseNext },
+        { "yield", &LispyParser::ParseYield },
+        { "case", &LispyParser::ParseCase },
+        { "progn", &LispyParser::ParseProgn },
+        { "defun", &LispyParser::ParseGlobalError },
+    };
+
+    static constexpr auto sSpecialForms = MakeKeywordTable( sSpecialFormList );
+
     if ( mCurToken == TokenCode::Number )
     {
         return ParseNumber();
@@ -415,10 +424,10 @@ Unique<Syntax> LispyParser::ParseExpression( bool isInit )
                 return ParseArrayInitializer();
         }
 
-        if ( auto it = mParserMap.find( mCurString );
-            it != mParserMap.end() )
+        if ( auto parseFunc = sSpecialForms.Find( mCurString );
+            parseFunc != nullptr )
         {
-            return (this->*it->second)();
+            return (this->*(*parseFunc))();
         }
         else
         {
@@ -438,7 +447,7 @@ Unique<NumberExpr> LispyParser::ParseNumber()
 
 Unique<NameExpr> LispyParser::ParseSymbol()
 {
-    auto node = Make<NameExpr>( std::move( mCurString ) );
+    auto node = Make<NameExpr>( Symbol( mCurString ) );
     ScanToken();
     return node;
 }
@@ -716,7 +725,7 @@ Unique<TypeRef> LispyParser::ParsePtrFuncTypeRef()
 
     ScanRParen();
 
-    Unique<PointerTypeRef> pointerTypeRef( new PointerTypeRef() );
+    Unique<PointerTypeRef> pointerTypeRef = MakeInArena<PointerTypeRef>( *mArena );
 
     pointerTypeRef->Target = std::move( procTypeRef );
 
@@ -1103,11 +1112,11 @@ void LispyParser::ParseImplicitProgn( StatementList& container )
 template <typename T, typename... Args>
 Unique<T> LispyParser::Make( Args&&... args )
 {
-    T* syntax = new T( std::forward<Args>( args )... );
+    Unique<T> syntax = MakeInArena<T>( *mArena, std::forward<Args>( args )... );
     syntax->Line = mTokLine;
     syntax->Column = mTokCol;
     syntax->FileName = mUnitFileName;
-    return Unique<T>( syntax );
+    return syntax;
 }
 
 void LispyParser::ThrowSyntaxError( const char* format, ... )
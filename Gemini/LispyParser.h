@@ -6,10 +6,11 @@
 
 #pragma once
 
+#include "KeywordTable.h"
 #include "LangCommon.h"
 #include "Syntax.h"
-#include <map>
 #include <string>
+#include <string_view>
 #include <vector>
 
 
@@ -29,7 +30,6 @@ class LispyParser
     };
 
     using ParseFunc = Unique<Syntax>( LispyParser::* )();
-    using ParserMap = std::map<std::string, ParseFunc>;
 
     std::string     mFileName;
     const char*     mUnitFileName;
@@ -41,13 +41,16 @@ class LispyParser
     char            mCurChar;
 
     TokenCode       mCurToken;
-    std::string     mCurString;
+    // Points into the code text
+    std::string_view mCurString;
     int             mCurNumber;
     int             mTokLine;
     int             mTokCol;
 
     Reporter        mRep;
-    ParserMap       mParserMap;
+
+    // Holds the nodes, and goes along with the units
+    std::shared_ptr<Arena> mArena;
 
 public:
     LispyParser( const char* codeText, size_t codeTextLen, const char* fileName, ICompilerLog* log );
@@ -66,7 +69,7 @@ private:
     TokenCode ScanToken( TokenCode code );
     TokenCode ScanLParen();
     TokenCode ScanRParen();
-    std::string ScanSymbol();
+    Symbol ScanSymbol();
     TokenCode ScanSymbol( const char* str );
     void AssertToken( TokenCode code );
     void ReadNumber();
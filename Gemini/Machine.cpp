@@ -6,9 +6,207 @@
 
 #include "pch.h"
 #include "Machine.h"
+#include "Aot.h"
+#include "CowData.h"
+#include "Jit.h"
 #include "OpCodes.h"
+#include "Sampler.h"
 #include "VmCommon.h"
 #include <algorithm>
+#include <iterator>
+
+
+// Instruction dispatch
+//
+// By default, Run dispatches through a portable switch statement. If
+// GEMINIVM_DIRECT_THREADED is defined and the compiler supports labels as
+// values, then each handler jumps straight to the next one through a table,
+// which gives every handler its own indirect branch to predict.
+//
+// In both cases, mPC is only written when control leaves Run or a handler needs it.
+//
+// Execute is instantiated twice. The checked engine guards every stack access
+// and branch. The unchecked engine runs modules that passed VerifyModuleCode,
+// so it only checks the stack room of each function as it's entered, and
+// whatever can't be known statically, like data addresses and return frames.
+//
+// Both engines charge Run's budget at backward branches and calls, which is
+// enough to stop any loop or recursion, and costs nothing in straight code.
+//
+// Step runs a single instruction of the unchecked engine. Native code from
+// JitCode and AotModule uses it for the instructions it doesn't translate itself.
+
+#if defined( GEMINIVM_DIRECT_THREADED ) && (defined( __GNUC__ ) || defined( __clang__ ))
+    #define GEMINIVM_COMPUTED_GOTO  1
+#else
+    #define GEMINIVM_COMPUTED_GOTO  0
+#endif
+
+// Profiling
+//
+// With GEMINIVM_PROFILE, every instruction fetched and every primitive
+// computed is counted. With timing on, the time from one fetch to the next is
+// charged to the instruction, and to its primitive if it has one. Each engine
+// run ends with VM_PROFILE_STOP, so that time outside the interpreter isn't
+// charged. Without GEMINIVM_PROFILE, the macros are empty.
+
+#ifdef GEMINIVM_PROFILE
+    #if (defined( _MSC_VER ) && (defined( _M_X64 ) || defined( _M_IX86 )))
+        #include <intrin.h>
+        #define VM_PROFILE_CLOCK()  __rdtsc()
+    #elif (defined( __GNUC__ ) || defined( __clang__ )) && (defined( __x86_64__ ) || defined( __i386__ ))
+        #include <x86intrin.h>
+        #define VM_PROFILE_CLOCK()  __rdtsc()
+    #else
+        #include <chrono>
+        #define VM_PROFILE_CLOCK() \
+            static_cast<U64>( std::chrono::duration_cast<std::chrono::nanoseconds>( \
+                std::chrono::steady_clock::now().time_since_epoch() ).count() )
+    #endif
+
+    #define VM_PROFILE_OP( op )     ProfileOp( op )
+    #define VM_PROFILE_PRIM( func ) ProfilePrim( func )
+    #define VM_PROFILE_STOP()       ProfileStop()
+#else
+    #define VM_PROFILE_OP( op )     ((void) 0)
+    #define VM_PROFILE_PRIM( func ) ((void) 0)
+    #define VM_PROFILE_STOP()       ((void) 0)
+#endif
+
+#define VM_FETCH() \
+    do { instPtr = codePtr; op = *codePtr++; VM_PROFILE_OP( op ); } while ( 0 )
+
+#define VM_FAIL( err ) \
+    do { mPC = static_cast<U32>( instPtr - mMod->CodeBase ); return (err); } while ( 0 )
+
+// Charges the budget for a backward branch or a call that went to codePtr.
+// If it ran out, then stop there, so Run can go on later. Otherwise, take a
+// sample if the sampler asked for one.
+#define VM_CHARGE() \
+    do \
+    { \
+        if ( --mBudget == 0 ) \
+        { \
+            mPC = static_cast<U32>( codePtr - mMod->CodeBase ); \
+            return ERR_BUDGET_EXHAUSTED; \
+        } \
+        \
+        VM_SAMPLE( codePtr ); \
+    } while ( 0 )
+
+#define VM_SAMPLE( codePtr ) \
+    do \
+    { \
+        if ( mSampleFlag->load( std::memory_order_relaxed ) ) \
+            TakeSample( codePtr ); \
+    } while ( 0 )
+
+#define VM_STEP_DONE() \
+    if ( Single ) { mPC = static_cast<U32>( codePtr - mMod->CodeBase ); return ERR_SWITCH_ENGINE; } else (void) 0
+
+#if GEMINIVM_COMPUTED_GOTO
+    // Labels as values are an extension. Pedantic warnings are only turned off
+    // where they're used: in the dispatch table and the jumps through it.
+    #define VM_EXTENSION_BEGIN  _Pragma( "GCC diagnostic push" ) _Pragma( "GCC diagnostic ignored \"-Wpedantic\"" )
+    #define VM_EXTENSION_END    _Pragma( "GCC diagnostic pop" )
+
+    #define VM_SWITCH( op )     VM_EXTENSION_BEGIN goto *sDispatchTable[op]; VM_EXTENSION_END
+    #define VM_CASE( op )       L_##op
+    #define VM_DEFAULT          L_DEFAULT
+    #define VM_NEXT()           do { VM_STEP_DONE(); VM_FETCH(); VM_EXTENSION_BEGIN goto *sDispatchTable[op]; VM_EXTENSION_END } while ( 0 )
+
+    #define VM_DEFAULT_X4       &&L_DEFAULT, &&L_DEFAULT, &&L_DEFAULT, &&L_DEFAULT
+    #define VM_DEFAULT_X16      VM_DEFAULT_X4, VM_DEFAULT_X4, VM_DEFAULT_X4, VM_DEFAULT_X4
+
+    // The opcodes with handlers, in dispatch table order. The table's labels
+    // and the list that's checked against the OpCode enum both come from here.
+    #define VM_DISPATCH_OPS( X ) \
+        X( OP_POP ) \
+        X( OP_DUP ) \
+        X( OP_OVER ) \
+        X( OP_PUSH ) \
+        X( OP_NOT ) \
+        X( OP_LDARGA ) \
+        X( OP_LDARG ) \
+        X( OP_STARG ) \
+        X( OP_LDLOCA ) \
+        X( OP_LDLOC ) \
+        X( OP_STLOC ) \
+        X( OP_LDMOD ) \
+        X( OP_STMOD ) \
+        X( OP_LDC ) \
+        X( OP_LDC_S ) \
+        X( OP_LOADI ) \
+        X( OP_STOREI ) \
+        X( OP_PRIM ) \
+        X( OP_B ) \
+        X( OP_BFALSE ) \
+        X( OP_BTRUE ) \
+        X( OP_RET ) \
+        X( OP_CALL ) \
+        X( OP_CALLI ) \
+        X( OP_CALLM ) \
+        X( OP_CALLNATIVE ) \
+        X( OP_CALLNATIVE_S ) \
+        X( OP_COPYBLOCK ) \
+        X( OP_COPYARRAY ) \
+        X( OP_INDEX ) \
+        X( OP_INDEXOPEN ) \
+        X( OP_RANGEOPEN ) \
+        X( OP_RANGEOPENCLOSED ) \
+        X( OP_RANGE ) \
+        X( OP_OFFSET ) \
+        X( OP_YIELD ) \
+        X( OP_INCLOC ) \
+        X( OP_PRIMLOC ) \
+        X( OP_PRIMC_S ) \
+        X( OP_BEQ ) \
+        X( OP_BNE ) \
+        X( OP_BLT ) \
+        X( OP_BLE ) \
+        X( OP_BGT ) \
+        X( OP_BGE ) \
+        X( OP_TAILCALL ) \
+        X( OP_TAILCALLI ) \
+        X( OP_TAILCALLM ) \
+        X( OP_SWITCH ) \
+        X( OP_INDEX_U ) \
+        X( OP_B_L )
+
+    #define VM_DISPATCH_LABEL( op )     &&L_##op,
+    #define VM_DISPATCH_OPCODE( op )    op,
+#else
+    #define VM_SWITCH( op )     switch ( op )
+    #define VM_CASE( op )       case op
+    #define VM_DEFAULT          default
+    #define VM_NEXT()           if ( true ) { VM_STEP_DONE(); continue; } else (void) 0
+#endif
+
+// Pops two cells, and branches if the first one pushed compares to the second one
+#define VM_COMPARE_BRANCH( cmp ) \
+    do \
+    { \
+        if ( Checked && WouldUnderflow( 2 ) ) \
+            VM_FAIL( ERR_STACK_UNDERFLOW ); \
+        \
+        BranchInst::TOffset offset = BranchInst::ReadOffset( codePtr ); \
+        I32 addr = static_cast<I32>(codePtr - mMod->CodeBase) + offset; \
+        \
+        if ( Checked && !IsCodeInBounds( addr ) ) \
+            VM_FAIL( ERR_BAD_ADDRESS ); \
+        \
+        CELL a = mSP[1]; \
+        CELL b = mSP[0]; \
+        mSP += 2; \
+        \
+        if ( a cmp b ) \
+        { \
+            codePtr = mMod->CodeBase + addr; \
+            \
+            if ( offset < 0 ) \
+                VM_CHARGE(); \
+        } \
+    } while ( 0 )
 
 
 /*
@@ -34,6 +232,14 @@ ret
 call <uint8> <uint24>
 calli <uint8>
 callm <uint8> <uint8> <uint24>
+tailcall <uint8> <uint24>
+tailcalli <uint8>
+tailcallm <uint8> <uint8> <uint24>
+
+incloc <uint8> <int8>
+primloc <uint8> <uint8>
+primc.s <uint8> <int8>
+beq, bne, blt, ble, bgt, bge <int16>
 */
 
 
@@ -42,6 +248,30 @@ namespace Gemini
 
 static_assert( FRAME_WORDS == (sizeof( StackFrame ) + sizeof( CELL ) - 1) / sizeof( CELL ) );
 
+// Machines without a sampler point here, so that checking for a sample
+// request is a single load
+static std::atomic<bool> sNoSampleFlag( false );
+
+#if GEMINIVM_COMPUTED_GOTO
+// Each handler must be at its opcode's index in the dispatch table, and the
+// table's padding must start right after the last one
+static constexpr OpCode sDispatchOrder[] = { VM_DISPATCH_OPS( VM_DISPATCH_OPCODE ) };
+
+static constexpr bool IsInOpCodeOrder( const OpCode* ops, size_t count )
+{
+    for ( size_t i = 0; i < count; i++ )
+    {
+        if ( ops[i] != i )
+            return false;
+    }
+
+    return true;
+}
+
+static_assert( std::size( sDispatchOrder ) == OP_MAXOPCODE, "Every opcode needs a handler in the dispatch table" );
+static_assert( IsInOpCodeOrder( sDispatchOrder, std::size( sDispatchOrder ) ), "Dispatch table handlers must be in OpCode order" );
+#endif
+
 
 Machine::Machine() :
     mSP( nullptr ),
@@ -56,9 +286,15 @@ Machine::Machine() :
     mNativeNestingLevel( 0 ),
     mModIndex(),
     mPC(),
+    mBudget(),
     mMod(),
-    mStackMod{}
+    mStackMod{},
+    mSampleFlag( &sNoSampleFlag ),
+    mSampler( nullptr )
 {
+#ifdef GEMINIVM_PROFILE
+    ResetProfile();
+#endif
 }
 
 void Machine::Init( CELL* stack, U16 stackSize, IEnvironment* environment, UserContext scriptCtx )
@@ -85,9 +321,29 @@ void Machine::Init( CELL* stack, U16 stackSize, UserContext scriptCtx )
     mStackMod.DataBase = stack;
     mStackMod.DataSize = stackSize;
 
+    mModTable.clear();
+
     Reset();
 }
 
+void Machine::PreloadModules()
+{
+    // Indexed by the module byte of an address word. A const section index
+    // maps to its module, and the stack index to the stack pseudo-module.
+
+    mModTable.assign( 256, nullptr );
+
+    for ( U8 i = 0; i < ModSizeMax; i++ )
+    {
+        const Module* mod = mEnv->FindModule( i );
+
+        mModTable[i] = mod;
+        mModTable[i | CONST_SECTION_MOD_INDEX_MASK] = mod;
+    }
+
+    mModTable[MODINDEX_STACK] = &mStackMod;
+}
+
 bool Machine::IsRunning() const
 {
     return mFramePtr < mStackSize;
@@ -120,6 +376,10 @@ CELL* Machine::Start( U8 modIndex, U32 address, U8 argCount )
         || address >= module->CodeSize - SENTINEL_SIZE )
         return nullptr;
 
+    if ( module->Verified != nullptr
+        && !std::binary_search( module->Verified->Entries.begin(), module->Verified->Entries.end(), address ) )
+        return nullptr;
+
     if ( WouldOverflow( argCount ) )
         return nullptr;
 
@@ -209,10 +469,28 @@ int Machine::CallNative( NativeFunc proc, U8 callFlags, UserContext context )
 }
 
 int Machine::Run()
+{
+    int err;
+
+    do
+    {
+        err = Run( UINT32_MAX );
+    }
+    while ( err == ERR_BUDGET_EXHAUSTED );
+
+    return err;
+}
+
+int Machine::Run( U32 instructionBudget )
 {
     if ( mFramePtr >= mStackSize )
         return ERR_NOT_RUNING;
 
+    if ( instructionBudget == 0 )
+        return ERR_BUDGET_EXHAUSTED;
+
+    mBudget = instructionBudget;
+
     if ( mNativeContinuation != nullptr )
     {
         NativeFunc continuation = mNativeContinuation;
@@ -231,224 +509,284 @@ int Machine::Run()
 
         if ( !IsCodeInBounds( mPC ) )
             return ERR_BAD_ADDRESS;
+
+        // The native frame might have been restored from a snapshot
+
+        if ( mMod->Verified != nullptr && !IsVerifiedResume() )
+            return ERR_BAD_ADDRESS;
     }
 
+    int err;
+
+    do
+    {
+        if ( mMod->Jit != nullptr )
+            err = mMod->Jit->Run( this );
+        else if ( mMod->Aot != nullptr )
+            err = mMod->Aot->Run( this );
+        else if ( mMod->Verified != nullptr )
+            err = Execute<false>();
+        else
+            err = Execute<true>();
+
+        VM_PROFILE_STOP();
+    }
+    while ( err == ERR_SWITCH_ENGINE );
+
+    return err;
+}
+
+int Machine::Step()
+{
+    int err = Execute<false, true>();
+
+    VM_PROFILE_STOP();
+
+    return err;
+}
+
+template <bool Checked, bool Single>
+int Machine::Execute()
+{
+    if ( !Checked && !HasVerifiedStackRoom() )
+        return ERR_STACK_OVERFLOW;
+
     const U8* codePtr = mMod->CodeBase + mPC;
 
-    while ( true )
+    const U8* instPtr;
+    U8 op;
+
+#if GEMINIVM_COMPUTED_GOTO
+    VM_EXTENSION_BEGIN
+
+    static const void* const sDispatchTable[] =
     {
-        mPC = static_cast<U32>( codePtr - mMod->CodeBase );
+        VM_DISPATCH_OPS( VM_DISPATCH_LABEL )
+
+        // Every other opcode, up to and including OP_SENTINEL, is invalid
+        VM_DEFAULT_X16, VM_DEFAULT_X16, VM_DEFAULT_X16, VM_DEFAULT_X16,
+        VM_DEFAULT_X16, VM_DEFAULT_X16, VM_DEFAULT_X16, VM_DEFAULT_X16,
+        VM_DEFAULT_X16, VM_DEFAULT_X16, VM_DEFAULT_X16, VM_DEFAULT_X16,
+        VM_DEFAULT_X4, VM_DEFAULT_X4, VM_DEFAULT_X4,
+        &&L_DEFAULT,
+    };
 
-        const U8 op = *codePtr;
-        codePtr++;
+    VM_EXTENSION_END
 
-        switch ( op )
+    static_assert( std::size( sDispatchTable ) == 256, "The dispatch table must cover every opcode" );
+#endif
+
+    while ( true )
+    {
+        VM_FETCH();
+
+        VM_SWITCH( op )
         {
-        case OP_POP:
+        VM_CASE( OP_POP ):
             {
-                if ( WouldUnderflow() )
-                    return ERR_STACK_UNDERFLOW;
+                if ( Checked && WouldUnderflow() )
+                    VM_FAIL( ERR_STACK_UNDERFLOW );
 
                 mSP++;
             }
-            break;
+            VM_NEXT();
 
-        case OP_DUP:
+        VM_CASE( OP_DUP ):
             {
-                if ( WouldOverflow() )
-                    return ERR_STACK_OVERFLOW;
+                if ( Checked && WouldOverflow() )
+                    VM_FAIL( ERR_STACK_OVERFLOW );
 
-                if ( WouldUnderflow() )
-                    return ERR_STACK_UNDERFLOW;
+                if ( Checked && WouldUnderflow() )
+                    VM_FAIL( ERR_STACK_UNDERFLOW );
 
                 DecrementSP( 1 );
                 *mSP = mSP[1];
             }
-            break;
+            VM_NEXT();
 
-        case OP_OVER:
+        VM_CASE( OP_OVER ):
             {
-                if ( WouldOverflow() )
-                    return ERR_STACK_OVERFLOW;
+                if ( Checked && WouldOverflow() )
+                    VM_FAIL( ERR_STACK_OVERFLOW );
 
-                if ( WouldUnderflow( 2 ) )
-                    return ERR_STACK_UNDERFLOW;
+                if ( Checked && WouldUnderflow( 2 ) )
+                    VM_FAIL( ERR_STACK_UNDERFLOW );
 
                 DecrementSP( 1 );
                 *mSP = mSP[2];
             }
-            break;
+            VM_NEXT();
 
-        case OP_PUSH:
+        VM_CASE( OP_PUSH ):
             {
                 U8 count = ReadU8( codePtr );
 
-                if ( WouldOverflow( count ) )
-                    return ERR_STACK_OVERFLOW;
+                if ( Checked && WouldOverflow( count ) )
+                    VM_FAIL( ERR_STACK_OVERFLOW );
 
                 DecrementSP( count );
 
                 std::fill( mSP, mSP + count, 0 );
             }
-            break;
+            VM_NEXT();
 
-        case OP_NOT:
+        VM_CASE( OP_NOT ):
             {
-                if ( WouldUnderflow() )
-                    return ERR_STACK_UNDERFLOW;
+                if ( Checked && WouldUnderflow() )
+                    VM_FAIL( ERR_STACK_UNDERFLOW );
 
                 mSP[0] = !mSP[0];
             }
-            break;
+            VM_NEXT();
 
-        case OP_LDARGA:
+        VM_CASE( OP_LDARGA ):
             {
                 int index = ReadU8( codePtr );
                 long offset = mFramePtr + FRAME_WORDS + index;
 
                 if ( offset >= mStackSize )
-                    return ERR_BAD_ADDRESS;
+                    VM_FAIL( ERR_BAD_ADDRESS );
 
-                if ( WouldOverflow() )
-                    return ERR_STACK_OVERFLOW;
+                if ( Checked && WouldOverflow() )
+                    VM_FAIL( ERR_STACK_OVERFLOW );
 
                 U32 addrWord = CodeAddr::Build( offset, MODINDEX_STACK );
                 Push( addrWord );
             }
-            break;
+            VM_NEXT();
 
-        case OP_LDARG:
+        VM_CASE( OP_LDARG ):
             {
                 int index = ReadU8( codePtr );
                 long offset = mFramePtr + FRAME_WORDS + index;
 
                 if ( offset >= mStackSize )
-                    return ERR_BAD_ADDRESS;
+                    VM_FAIL( ERR_BAD_ADDRESS );
 
-                if ( WouldOverflow() )
-                    return ERR_STACK_OVERFLOW;
+                if ( Checked && WouldOverflow() )
+                    VM_FAIL( ERR_STACK_OVERFLOW );
 
                 Push( mStack[offset] );
             }
-            break;
+            VM_NEXT();
 
-        case OP_STARG:
+        VM_CASE( OP_STARG ):
             {
                 int index = ReadU8( codePtr );
                 long offset = mFramePtr + FRAME_WORDS + index;
 
                 if ( offset >= mStackSize )
-                    return ERR_BAD_ADDRESS;
+                    VM_FAIL( ERR_BAD_ADDRESS );
 
-                if ( WouldUnderflow() )
-                    return ERR_STACK_UNDERFLOW;
+                if ( Checked && WouldUnderflow() )
+                    VM_FAIL( ERR_STACK_UNDERFLOW );
 
                 mStack[offset] = Pop();
             }
-            break;
+            VM_NEXT();
 
-        case OP_LDLOCA:
+        VM_CASE( OP_LDLOCA ):
             {
                 U8  index = ReadU8( codePtr );
                 I32 offset = mFramePtr - 1 - index;
 
-                if ( offset < 0 )
-                    return ERR_BAD_ADDRESS;
+                if ( Checked && offset < 0 )
+                    VM_FAIL( ERR_BAD_ADDRESS );
 
-                if ( WouldOverflow() )
-                    return ERR_STACK_OVERFLOW;
+                if ( Checked && WouldOverflow() )
+                    VM_FAIL( ERR_STACK_OVERFLOW );
 
                 U32 addrWord = CodeAddr::Build( offset, MODINDEX_STACK );
                 Push( addrWord );
             }
-            break;
+            VM_NEXT();
 
-        case OP_LDLOC:
+        VM_CASE( OP_LDLOC ):
             {
                 int index = ReadU8( codePtr );
                 long offset = mFramePtr - 1 - index;
 
-                if ( offset < 0 )
-                    return ERR_BAD_ADDRESS;
+                if ( Checked && offset < 0 )
+                    VM_FAIL( ERR_BAD_ADDRESS );
 
-                if ( WouldOverflow() )
-                    return ERR_STACK_OVERFLOW;
+                if ( Checked && WouldOverflow() )
+                    VM_FAIL( ERR_STACK_OVERFLOW );
 
                 Push( mStack[offset] );
             }
-            break;
+            VM_NEXT();
 
-        case OP_STLOC:
+        VM_CASE( OP_STLOC ):
             {
                 int index = ReadU8( codePtr );
                 long offset = mFramePtr - 1 - index;
 
-                if ( offset < 0 )
-                    return ERR_BAD_ADDRESS;
+                if ( Checked && offset < 0 )
+                    VM_FAIL( ERR_BAD_ADDRESS );
 
-                if ( WouldUnderflow() )
-                    return ERR_STACK_UNDERFLOW;
+                if ( Checked && WouldUnderflow() )
+                    VM_FAIL( ERR_STACK_UNDERFLOW );
 
                 mStack[offset] = Pop();
             }
-            break;
+            VM_NEXT();
 
-        case OP_LDMOD:
+        VM_CASE( OP_LDMOD ):
             {
                 U8  iMod = ReadU8( codePtr );
                 U16 addr = ReadU16( codePtr );
 
                 auto [err, mod] = GetReadableDataModule( iMod, addr );
                 if ( err != ERR_NONE )
-                    return err;
+                    VM_FAIL( err );
 
-                if ( WouldOverflow() )
-                    return ERR_STACK_OVERFLOW;
+                if ( Checked && WouldOverflow() )
+                    VM_FAIL( ERR_STACK_OVERFLOW );
 
-                Push( mod.Base[addr] );
+                Push( mod.Read( addr ) );
             }
-            break;
+            VM_NEXT();
 
-        case OP_STMOD:
+        VM_CASE( OP_STMOD ):
             {
                 U8  iMod = ReadU8( codePtr );
                 U16 addr = ReadU16( codePtr );
 
                 auto [err, mod] = GetWritableDataModule( iMod, addr );
                 if ( err != ERR_NONE )
-                    return err;
+                    VM_FAIL( err );
 
-                if ( WouldUnderflow() )
-                    return ERR_STACK_UNDERFLOW;
+                if ( Checked && WouldUnderflow() )
+                    VM_FAIL( ERR_STACK_UNDERFLOW );
 
-                mod.Base[addr] = Pop();
+                mod.Write( addr, Pop() );
             }
-            break;
+            VM_NEXT();
 
-        case OP_LDC:
+        VM_CASE( OP_LDC ):
             {
-                if ( WouldOverflow() )
-                    return ERR_STACK_OVERFLOW;
+                if ( Checked && WouldOverflow() )
+                    VM_FAIL( ERR_STACK_OVERFLOW );
 
                 CELL word = ReadI32( codePtr );
                 Push( word );
             }
-            break;
+            VM_NEXT();
 
-        case OP_LDC_S:
+        VM_CASE( OP_LDC_S ):
             {
-                if ( WouldOverflow() )
-                    return ERR_STACK_OVERFLOW;
+                if ( Checked && WouldOverflow() )
+                    VM_FAIL( ERR_STACK_OVERFLOW );
 
                 CELL word = ReadI8( codePtr );
                 Push( word );
             }
-            break;
+            VM_NEXT();
 
-        case OP_LOADI:
+        VM_CASE( OP_LOADI ):
             {
-                if ( WouldUnderflow() )
-                    return ERR_STACK_UNDERFLOW;
+                if ( Checked && WouldUnderflow() )
+                    VM_FAIL( ERR_STACK_UNDERFLOW );
 
                 U32 addrWord = Pop();
                 U8  iMod = CodeAddr::GetModule( addrWord );
@@ -456,16 +794,16 @@ int Machine::Run()
 
                 auto [err, mod] = GetReadableDataModule( iMod, addr );
                 if ( err != ERR_NONE )
-                    return err;
+                    VM_FAIL( err );
 
-                Push( mod.Base[addr] );
+                Push( mod.Read( addr ) );
             }
-            break;
+            VM_NEXT();
 
-        case OP_STOREI:
+        VM_CASE( OP_STOREI ):
             {
-                if ( WouldUnderflow( 2 ) )
-                    return ERR_STACK_UNDERFLOW;
+                if ( Checked && WouldUnderflow( 2 ) )
+                    VM_FAIL( ERR_STACK_UNDERFLOW );
 
                 U32 addrWord = Pop();
                 U32 value = Pop();
@@ -474,68 +812,101 @@ int Machine::Run()
 
                 auto [err, mod] = GetWritableDataModule( iMod, addr );
                 if ( err != ERR_NONE )
-                    return err;
+                    VM_FAIL( err );
 
-                mod.Base[addr] = value;
+                mod.Write( addr, value );
             }
-            break;
+            VM_NEXT();
 
-        case OP_PRIM:
+        VM_CASE( OP_PRIM ):
             {
                 U8 func = ReadU8( codePtr );
-                int err = CallPrimitive( func );
+
+                VM_PROFILE_PRIM( func );
+
+                int err = CallPrimitive<Checked>( func );
                 if ( err != ERR_NONE )
-                    return err;
+                    VM_FAIL( err );
             }
-            break;
+            VM_NEXT();
 
-        case OP_B:
+        VM_CASE( OP_B ):
             {
                 BranchInst::TOffset offset = BranchInst::ReadOffset( codePtr );
                 I32 addr = static_cast<I32>(codePtr - mMod->CodeBase) + offset;
 
-                if ( !IsCodeInBounds( addr ) )
-                    return ERR_BAD_ADDRESS;
+                if ( Checked && !IsCodeInBounds( addr ) )
+                    VM_FAIL( ERR_BAD_ADDRESS );
 
                 codePtr = mMod->CodeBase + addr;
+
+                if ( offset < 0 )
+                    VM_CHARGE();
             }
-            break;
+            VM_NEXT();
 
-        case OP_BFALSE:
+        VM_CASE( OP_B_L ):
             {
-                if ( WouldUnderflow() )
-                    return ERR_STACK_UNDERFLOW;
+                // A target before the start wraps to an address past the end
+
+                LongBranchInst::TOffset offset = LongBranchInst::ReadOffset( codePtr );
+                U32 addr = static_cast<U32>(codePtr - mMod->CodeBase) + static_cast<U32>(offset);
+
+                if ( Checked && !IsCodeInBounds( addr ) )
+                    VM_FAIL( ERR_BAD_ADDRESS );
+
+                codePtr = mMod->CodeBase + addr;
+
+                if ( offset < 0 )
+                    VM_CHARGE();
+            }
+            VM_NEXT();
+
+        VM_CASE( OP_BFALSE ):
+            {
+                if ( Checked && WouldUnderflow() )
+                    VM_FAIL( ERR_STACK_UNDERFLOW );
 
                 BranchInst::TOffset offset = BranchInst::ReadOffset( codePtr );
                 I32 addr = static_cast<I32>(codePtr - mMod->CodeBase) + offset;
 
-                if ( !IsCodeInBounds( addr ) )
-                    return ERR_BAD_ADDRESS;
+                if ( Checked && !IsCodeInBounds( addr ) )
+                    VM_FAIL( ERR_BAD_ADDRESS );
 
                 CELL condition = Pop();
                 if ( !condition )
+                {
                     codePtr = mMod->CodeBase + addr;
+
+                    if ( offset < 0 )
+                        VM_CHARGE();
+                }
             }
-            break;
+            VM_NEXT();
 
-        case OP_BTRUE:
+        VM_CASE( OP_BTRUE ):
             {
-                if ( WouldUnderflow() )
-                    return ERR_STACK_UNDERFLOW;
+                if ( Checked && WouldUnderflow() )
+                    VM_FAIL( ERR_STACK_UNDERFLOW );
 
                 BranchInst::TOffset offset = BranchInst::ReadOffset( codePtr );
                 I32 addr = static_cast<I32>(codePtr - mMod->CodeBase) + offset;
 
-                if ( !IsCodeInBounds( addr ) )
-                    return ERR_BAD_ADDRESS;
+                if ( Checked && !IsCodeInBounds( addr ) )
+                    VM_FAIL( ERR_BAD_ADDRESS );
 
                 CELL condition = Pop();
                 if ( condition )
+                {
                     codePtr = mMod->CodeBase + addr;
+
+                    if ( offset < 0 )
+                        VM_CHARGE();
+                }
             }
-            break;
+            VM_NEXT();
 
-        case OP_RET:
+        VM_CASE( OP_RET ):
             {
                 int err = PopFrame();
                 if ( err == ERR_SWITCH_TO_NATIVE )
@@ -547,35 +918,61 @@ int Machine::Run()
                 if ( !IsCodeInBounds( mPC ) )
                     return ERR_BAD_ADDRESS;
 
+                // Frames live in writable memory, so check where they lead
+
+                if ( mMod->Verified != nullptr && !IsVerifiedReturn() )
+                    return ERR_BAD_ADDRESS;
+
+                if ( HasNativeCode() || (mMod->Verified != nullptr) == Checked )
+                    return ERR_SWITCH_ENGINE;
+
                 codePtr = mMod->CodeBase + mPC;
             }
-            break;
+            VM_NEXT();
 
-        case OP_CALL:
+        VM_CASE( OP_CALL ):
+        VM_CASE( OP_TAILCALL ):
             {
                 U8 callFlags = ReadU8( codePtr );
                 U32 addr = ReadU24( codePtr );
 
-                if ( PushFrame( codePtr, callFlags ) == nullptr )
-                    return ERR_STACK_OVERFLOW;
+                if ( op == OP_CALL )
+                {
+                    if ( PushFrame<Checked>( codePtr, callFlags ) == nullptr )
+                        VM_FAIL( ERR_STACK_OVERFLOW );
+                }
+                else
+                {
+                    if ( ReplaceFrame( callFlags ) == nullptr )
+                        VM_FAIL( ERR_STACK_UNDERFLOW );
+                }
 
-                if ( !IsCodeInBounds( addr ) )
-                    return ERR_BAD_ADDRESS;
+                if ( Checked && !IsCodeInBounds( addr ) )
+                    VM_FAIL( ERR_BAD_ADDRESS );
+
+                if ( !Checked && !HasVerifiedStackRoom() )
+                {
+                    mPC = addr;
+                    return ERR_STACK_OVERFLOW;
+                }
 
                 codePtr = mMod->CodeBase + addr;
+                VM_CHARGE();
             }
-            break;
+            VM_NEXT();
 
-        case OP_CALLI:
-        case OP_CALLM:
+        VM_CASE( OP_CALLI ):
+        VM_CASE( OP_CALLM ):
+        VM_CASE( OP_TAILCALLI ):
+        VM_CASE( OP_TAILCALLM ):
             {
                 U8 callFlags = ReadU8( codePtr );
                 U32 addrWord;
 
-                if ( op == OP_CALLI )
+                if ( op == OP_CALLI || op == OP_TAILCALLI )
                 {
-                    if ( WouldUnderflow() )
-                        return ERR_STACK_UNDERFLOW;
+                    if ( Checked && WouldUnderflow() )
+                        VM_FAIL( ERR_STACK_UNDERFLOW );
 
                     addrWord = Pop();
                 }
@@ -584,25 +981,62 @@ int Machine::Run()
                     addrWord = ReadU32( codePtr );
                 }
 
-                if ( PushFrame( codePtr, callFlags ) == nullptr )
-                    return ERR_STACK_OVERFLOW;
+                if ( op == OP_CALLI || op == OP_CALLM )
+                {
+                    if ( PushFrame<Checked>( codePtr, callFlags ) == nullptr )
+                        VM_FAIL( ERR_STACK_OVERFLOW );
+                }
+                else
+                {
+                    if ( ReplaceFrame( callFlags ) == nullptr )
+                        VM_FAIL( ERR_STACK_UNDERFLOW );
+                }
 
                 U32 addr        = CodeAddr::GetAddress( addrWord );
                 U8  newModIndex = CodeAddr::GetModule( addrWord );
 
+                // The current module might have changed, so report the target
+
                 int err = SwitchModule( newModIndex );
                 if ( err != ERR_NONE )
+                {
+                    mPC = addr;
                     return err;
+                }
 
-                if ( !IsCodeInBounds( addr ) )
+                if ( !IsCodeInBounds( addr )
+                    || (mMod->Verified != nullptr && !IsVerifiedEntry( addr )) )
+                {
+                    mPC = addr;
                     return ERR_BAD_ADDRESS;
+                }
+
+                if ( --mBudget == 0 )
+                {
+                    mPC = addr;
+                    return ERR_BUDGET_EXHAUSTED;
+                }
+
+                VM_SAMPLE( mMod->CodeBase + addr );
+
+                if ( HasNativeCode() || (mMod->Verified != nullptr) == Checked )
+                {
+                    mPC = addr;
+                    return ERR_SWITCH_ENGINE;
+                }
+
+                if ( !Checked && !HasVerifiedStackRoom() )
+                {
+                    mPC = addr;
+                    return ERR_STACK_OVERFLOW;
+                }
 
                 codePtr = mMod->CodeBase + addr;
             }
-            break;
+            VM_NEXT();
 
-        case OP_CALLNATIVE:
-        case OP_CALLNATIVE_S:
+        VM_CASE( OP_CALLNATIVE ):
+        VM_CASE( OP_CALLNATIVE_S ):
             {
                 U8 callFlags = ReadU8( codePtr );
                 U32 id;
@@ -616,17 +1050,24 @@ int Machine::Run()
                     id = ReadU8( codePtr );
                 }
 
-                if ( PushFrame( codePtr, callFlags ) == nullptr )
-                    return ERR_STACK_OVERFLOW;
+                if ( PushFrame<Checked>( codePtr, callFlags ) == nullptr )
+                    VM_FAIL( ERR_STACK_OVERFLOW );
 
-                NativeCode nativeCode;
+                NativeFunc proc = GetBoundNative( instPtr );
 
-                if ( !mEnv->FindNativeCode( id, &nativeCode ) )
-                    return ERR_NATIVECODE_NOT_FOUND;
+                if ( proc == nullptr )
+                {
+                    NativeCode nativeCode;
+
+                    if ( !mEnv->FindNativeCode( id, &nativeCode ) )
+                        VM_FAIL( ERR_NATIVECODE_NOT_FOUND );
+
+                    proc = nativeCode.Proc;
+                }
 
-                int ret = CallNative( nativeCode.Proc, callFlags, 0 );
+                int ret = CallNative( proc, callFlags, 0 );
                 if ( ret != ERR_NONE )
-                    return ret;
+                    VM_FAIL( ret );
 
                 int err = PopFrame();
                 if ( err != ERR_NONE )
@@ -637,12 +1078,12 @@ int Machine::Run()
 
                 codePtr = mMod->CodeBase + mPC;
             }
-            break;
+            VM_NEXT();
 
-        case OP_COPYBLOCK:
+        VM_CASE( OP_COPYBLOCK ):
             {
-                if ( WouldUnderflow( 2 ) )
-                    return ERR_STACK_UNDERFLOW;
+                if ( Checked && WouldUnderflow( 2 ) )
+                    VM_FAIL( ERR_STACK_UNDERFLOW );
 
                 CELL source = mSP[1];
                 CELL dest   = mSP[0];
@@ -650,22 +1091,16 @@ int Machine::Run()
 
                 mSP += 2;
 
-                auto [err, pDst] = GetSizedWritableDataPtr( dest, size );
+                int err = CopyData( dest, source, size );
                 if ( err != ERR_NONE )
-                    return err;
-
-                auto [err1, pSrc] = GetSizedReadableDataPtr( source, size );
-                if ( err1 != ERR_NONE )
-                    return err1;
-
-                std::copy_n( pSrc, size, pDst );
+                    VM_FAIL( err );
             }
-            break;
+            VM_NEXT();
 
-        case OP_COPYARRAY:
+        VM_CASE( OP_COPYARRAY ):
             {
-                if ( WouldUnderflow( 4 ) )
-                    return ERR_STACK_UNDERFLOW;
+                if ( Checked && WouldUnderflow( 4 ) )
+                    VM_FAIL( ERR_STACK_UNDERFLOW );
 
                 CELL srcCount = mSP[3];
                 CELL srcAddr  = mSP[2];
@@ -676,31 +1111,25 @@ int Machine::Run()
                 mSP += 4;
 
                 if ( srcCount < 0 || dstCount < srcCount )
-                    return ERR_BOUND;
+                    VM_FAIL( ERR_BOUND );
 
                 U64 size64 = static_cast<U64>(srcCount) * elemSize;
 
                 if ( size64 > MAX_MODULE_DATA_SIZE )
-                    return ERR_BOUND;
+                    VM_FAIL( ERR_BOUND );
 
                 U32 size = static_cast<U32>(size64);
 
-                auto [err, pDst] = GetSizedWritableDataPtr( dstAddr, size );
+                int err = CopyData( dstAddr, srcAddr, size );
                 if ( err != ERR_NONE )
-                    return err;
-
-                auto [err1, pSrc] = GetSizedReadableDataPtr( srcAddr, size );
-                if ( err1 != ERR_NONE )
-                    return err1;
-
-                std::copy_n( pSrc, size, pDst );
+                    VM_FAIL( err );
             }
-            break;
+            VM_NEXT();
 
-        case OP_INDEX:
+        VM_CASE( OP_INDEX ):
             {
-                if ( WouldUnderflow( 2 ) )
-                    return ERR_STACK_UNDERFLOW;
+                if ( Checked && WouldUnderflow( 2 ) )
+                    VM_FAIL( ERR_STACK_UNDERFLOW );
 
                 U32  base   = mSP[1];
                 CELL index  = mSP[0];
@@ -708,22 +1137,45 @@ int Machine::Run()
                 U32  bound  = ReadU24( codePtr );
 
                 if ( index < 0 || static_cast<U32>(index) >= bound )
-                    return ERR_BOUND;
+                    VM_FAIL( ERR_BOUND );
 
                 auto newAddr = base + (static_cast<U64>(index) * stride);
 
                 if ( newAddr > CodeAddr::ToModuleMax( base ) )
-                    return ERR_BAD_ADDRESS;
+                    VM_FAIL( ERR_BAD_ADDRESS );
 
                 mSP[1] = static_cast<CELL>(newAddr);
                 mSP++;
             }
-            break;
+            VM_NEXT();
+
+        VM_CASE( OP_INDEX_U ):
+            {
+                if ( Checked && WouldUnderflow( 2 ) )
+                    VM_FAIL( ERR_STACK_UNDERFLOW );
+
+                U32  base   = mSP[1];
+                CELL index  = mSP[0];
+                U32  stride = ReadU24( codePtr );
+
+                // The compiler proved that the index is in bounds. But the
+                // element still has to be in the same module. A negative
+                // index is taken as unsigned, so that it leaves the module
+
+                auto newAddr = base + (static_cast<U64>(static_cast<U32>(index)) * stride);
 
-        case OP_INDEXOPEN:
+                if ( newAddr > CodeAddr::ToModuleMax( base ) )
+                    VM_FAIL( ERR_BAD_ADDRESS );
+
+                mSP[1] = static_cast<CELL>(newAddr);
+                mSP++;
+            }
+            VM_NEXT();
+
+        VM_CASE( OP_INDEXOPEN ):
             {
-                if ( WouldUnderflow( 3 ) )
-                    return ERR_STACK_UNDERFLOW;
+                if ( Checked && WouldUnderflow( 3 ) )
+                    VM_FAIL( ERR_STACK_UNDERFLOW );
 
                 CELL bound  = mSP[2];
                 U32  base   = mSP[1];
@@ -731,22 +1183,22 @@ int Machine::Run()
                 U32  stride = ReadU24( codePtr );
 
                 if ( index < 0 || index >= bound || bound < 0 )
-                    return ERR_BOUND;
+                    VM_FAIL( ERR_BOUND );
 
                 auto newAddr = base + (static_cast<U64>(index) * stride);
 
                 if ( newAddr > CodeAddr::ToModuleMax( base ) )
-                    return ERR_BAD_ADDRESS;
+                    VM_FAIL( ERR_BAD_ADDRESS );
 
                 mSP[2] = static_cast<CELL>(newAddr);
                 mSP += 2;
             }
-            break;
+            VM_NEXT();
 
-        case OP_RANGEOPEN:
+        VM_CASE( OP_RANGEOPEN ):
             {
-                if ( WouldUnderflow( 4 ) )
-                    return ERR_STACK_UNDERFLOW;
+                if ( Checked && WouldUnderflow( 4 ) )
+                    VM_FAIL( ERR_STACK_UNDERFLOW );
 
                 CELL bound  = mSP[3];
                 U32  base   = mSP[2];
@@ -759,23 +1211,23 @@ int Machine::Run()
 
                 if ( index < 0 || index >= bound || bound < 0
                     || end <= index || end > bound )
-                    return ERR_BOUND;
+                    VM_FAIL( ERR_BOUND );
 
                 auto newAddr = base + (static_cast<U64>(index) * stride);
 
                 if ( newAddr > CodeAddr::ToModuleMax( base ) )
-                    return ERR_BAD_ADDRESS;
+                    VM_FAIL( ERR_BAD_ADDRESS );
 
                 mSP[3] = end - index;
                 mSP[2] = static_cast<CELL>(newAddr);
                 mSP += 2;
             }
-            break;
+            VM_NEXT();
 
-        case OP_RANGEOPENCLOSED:
+        VM_CASE( OP_RANGEOPENCLOSED ):
             {
-                if ( WouldUnderflow( 4 ) )
-                    return ERR_STACK_UNDERFLOW;
+                if ( Checked && WouldUnderflow( 4 ) )
+                    VM_FAIL( ERR_STACK_UNDERFLOW );
 
                 CELL bound  = mSP[3];
                 U32  base   = mSP[2];
@@ -788,22 +1240,22 @@ int Machine::Run()
 
                 if ( index < 0 || index >= bound || bound < 0
                     || end <= index || end > bound )
-                    return ERR_BOUND;
+                    VM_FAIL( ERR_BOUND );
 
                 auto newAddr = base + (static_cast<U64>(index) * stride);
 
                 if ( newAddr > CodeAddr::ToModuleMax( base ) )
-                    return ERR_BAD_ADDRESS;
+                    VM_FAIL( ERR_BAD_ADDRESS );
 
                 mSP[3] = static_cast<CELL>(newAddr);
                 mSP += 3;
             }
-            break;
+            VM_NEXT();
 
-        case OP_RANGE:
+        VM_CASE( OP_RANGE ):
             {
-                if ( WouldUnderflow( 3 ) )
-                    return ERR_STACK_UNDERFLOW;
+                if ( Checked && WouldUnderflow( 3 ) )
+                    VM_FAIL( ERR_STACK_UNDERFLOW );
 
                 U32  base   = mSP[2];
                 CELL index  = mSP[1];
@@ -816,23 +1268,23 @@ int Machine::Run()
 
                 if ( index < 0 || static_cast<U32>(index) >= bound
                     || end <= index || static_cast<U32>(end) > bound )
-                    return ERR_BOUND;
+                    VM_FAIL( ERR_BOUND );
 
                 auto newAddr = base + (static_cast<U64>(index) * stride);
 
                 if ( newAddr > CodeAddr::ToModuleMax( base ) )
-                    return ERR_BAD_ADDRESS;
+                    VM_FAIL( ERR_BAD_ADDRESS );
 
                 mSP[2] = end - index;
                 mSP[1] = static_cast<CELL>(newAddr);
                 mSP++;
             }
-            break;
+            VM_NEXT();
 
-        case OP_OFFSET:
+        VM_CASE( OP_OFFSET ):
             {
-                if ( WouldUnderflow() )
-                    return ERR_STACK_UNDERFLOW;
+                if ( Checked && WouldUnderflow() )
+                    VM_FAIL( ERR_STACK_UNDERFLOW );
 
                 U32  base   = mSP[0];
                 U32  offset = ReadU24( codePtr );
@@ -840,25 +1292,134 @@ int Machine::Run()
                 auto newAddr = base + static_cast<U64>(offset);
 
                 if ( newAddr > CodeAddr::ToModuleMax( base ) )
-                    return ERR_BAD_ADDRESS;
+                    VM_FAIL( ERR_BAD_ADDRESS );
 
                 mSP[0] = static_cast<CELL>(newAddr);
             }
-            break;
+            VM_NEXT();
 
-        case OP_YIELD:
+        VM_CASE( OP_YIELD ):
             {
                 if ( mNativeNestingLevel > 0 )
-                    return ERR_BAD_STATE;
+                    VM_FAIL( ERR_BAD_STATE );
 
                 mPC = static_cast<U32>(codePtr - mMod->CodeBase);
 
                 return ERR_YIELDED;
             }
-            break;
+            VM_NEXT();
+
+        VM_CASE( OP_INCLOC ):
+            {
+                int  index = ReadU8( codePtr );
+                CELL step = ReadI8( codePtr );
+                long offset = mFramePtr - 1 - index;
+
+                if ( Checked && offset < 0 )
+                    VM_FAIL( ERR_BAD_ADDRESS );
+
+                if ( Checked && WouldOverflow() )
+                    VM_FAIL( ERR_STACK_OVERFLOW );
+
+                mStack[offset] = VmAdd( mStack[offset], step );
+                Push( mStack[offset] );
+            }
+            VM_NEXT();
+
+        VM_CASE( OP_PRIMLOC ):
+            {
+                U8   func = ReadU8( codePtr );
+                int  index = ReadU8( codePtr );
+                long offset = mFramePtr - 1 - index;
+
+                VM_PROFILE_PRIM( func );
+
+                if ( Checked && offset < 0 )
+                    VM_FAIL( ERR_BAD_ADDRESS );
+
+                if ( Checked && WouldUnderflow() )
+                    VM_FAIL( ERR_STACK_UNDERFLOW );
+
+                int err = ComputePrimitive( func, mSP[0], mStack[offset], mSP[0] );
+                if ( err != ERR_NONE )
+                    VM_FAIL( err );
+            }
+            VM_NEXT();
+
+        VM_CASE( OP_PRIMC_S ):
+            {
+                U8   func = ReadU8( codePtr );
+                CELL value = ReadI8( codePtr );
 
-        default:
-            return ERR_BAD_OPCODE;
+                VM_PROFILE_PRIM( func );
+
+                if ( Checked && WouldUnderflow() )
+                    VM_FAIL( ERR_STACK_UNDERFLOW );
+
+                int err = ComputePrimitive( func, mSP[0], value, mSP[0] );
+                if ( err != ERR_NONE )
+                    VM_FAIL( err );
+            }
+            VM_NEXT();
+
+        VM_CASE( OP_BEQ ):
+            VM_COMPARE_BRANCH( == );
+            VM_NEXT();
+
+        VM_CASE( OP_BNE ):
+            VM_COMPARE_BRANCH( != );
+            VM_NEXT();
+
+        VM_CASE( OP_BLT ):
+            VM_COMPARE_BRANCH( < );
+            VM_NEXT();
+
+        VM_CASE( OP_BLE ):
+            VM_COMPARE_BRANCH( <= );
+            VM_NEXT();
+
+        VM_CASE( OP_BGT ):
+            VM_COMPARE_BRANCH( > );
+            VM_NEXT();
+
+        VM_CASE( OP_BGE ):
+            VM_COMPARE_BRANCH( >= );
+            VM_NEXT();
+
+        VM_CASE( OP_SWITCH ):
+            {
+                if ( Checked && WouldUnderflow() )
+                    VM_FAIL( ERR_STACK_UNDERFLOW );
+
+                // Only the sentinels after the count are guaranteed, so
+                // check that the table is in the code before reading it
+
+                U32 size = SwitchInst::GetSize( instPtr );
+                U32 instAddr = static_cast<U32>(instPtr - mMod->CodeBase);
+
+                if ( Checked && size == 0 )
+                    VM_FAIL( ERR_BAD_OPCODE );
+
+                if ( Checked && size > mMod->CodeSize - instAddr )
+                    VM_FAIL( ERR_BAD_ADDRESS );
+
+                CELL key = mSP[0];
+                BranchInst::TOffset offset = SwitchInst::FindOffset( instPtr, key );
+                I32 addr = static_cast<I32>(instAddr + size) + offset;
+
+                if ( Checked && !IsCodeInBounds( addr ) )
+                    VM_FAIL( ERR_BAD_ADDRESS );
+
+                mSP++;
+                codePtr = mMod->CodeBase + addr;
+
+                if ( offset < 0 )
+                    VM_CHARGE();
+            }
+            VM_NEXT();
+
+        VM_DEFAULT:
+            VM_FAIL( ERR_BAD_OPCODE );
         }
     }
 Done:
@@ -866,12 +1427,13 @@ Done:
     return ERR_NONE;
 }
 
+template <bool Checked>
 StackFrame* Machine::PushFrame( const U8* curCodePtr, U8 callFlags )
 {
-    if ( WouldOverflow( FRAME_WORDS ) )
+    if ( Checked && WouldOverflow( FRAME_WORDS ) )
         return nullptr;
 
-    if ( WouldUnderflow( CallFlags::GetCount( callFlags ) ) )
+    if ( Checked && WouldUnderflow( CallFlags::GetCount( callFlags ) ) )
         return nullptr;
 
     DecrementSP( FRAME_WORDS );
@@ -888,6 +1450,43 @@ StackFrame* Machine::PushFrame( const U8* curCodePtr, U8 callFlags )
     return frame;
 }
 
+// Makes the frame for a tail call out of the current one. The new arguments
+// on top of the stack are moved to where the current frame's arguments end,
+// and the frame goes below them. The return address and auto-pop flag are
+// kept, so that the callee returns straight to the current frame's caller.
+// Frames live in writable memory, so the engines check this one the same way.
+StackFrame* Machine::ReplaceFrame( U8 callFlags )
+{
+    if ( (mFramePtr + FRAME_WORDS) > mStackSize )
+        return nullptr;
+
+    auto  curFrame = reinterpret_cast<StackFrame*>( &mStack[mFramePtr] );
+    U8    argCount = CallFlags::GetCount( callFlags );
+    U32   argsEnd = mFramePtr + FRAME_WORDS + CallFlags::GetCount( curFrame->CallFlags );
+
+    // The new arguments have to be below the current frame
+
+    if ( argCount > (&mStack[mFramePtr] - mSP) || argsEnd > mStackSize )
+        return nullptr;
+
+    StackFrame oldFrame = *curFrame;
+    U32 newFramePtr = argsEnd - argCount - FRAME_WORDS;
+
+    std::copy_backward( mSP, mSP + argCount, &mStack[argsEnd] );
+
+    mSP = &mStack[newFramePtr];
+
+    auto frame = reinterpret_cast<StackFrame*>( mSP );
+
+    frame->RetAddrWord = oldFrame.RetAddrWord;
+    frame->CallFlags = CallFlags::Build( argCount, CallFlags::GetAutoPop( oldFrame.CallFlags ) );
+    frame->FrameAddr = oldFrame.FrameAddr;
+
+    mFramePtr = static_cast<U16>( newFramePtr );
+
+    return frame;
+}
+
 int Machine::PopFrame()
 {
     int err = ERR_NONE;
@@ -943,6 +1542,11 @@ int Machine::PopCell( CELL& value )
     return ERR_NONE;
 }
 
+bool Machine::HasNativeContinuation() const
+{
+    return mNativeContinuation != nullptr;
+}
+
 int Machine::Yield( NativeFunc proc, UserContext context )
 {
     if ( proc == nullptr )
@@ -956,15 +1560,26 @@ int Machine::Yield( NativeFunc proc, UserContext context )
     return ERR_YIELDED;
 }
 
+template <bool Checked>
 int Machine::CallPrimitive( U8 func )
 {
-    if ( WouldUnderflow( 2 ) )
+    if ( Checked && WouldUnderflow( 2 ) )
         return ERR_STACK_UNDERFLOW;
 
     CELL result;
-    CELL a = mSP[1];
-    CELL b = mSP[0];
 
+    int err = ComputePrimitive( func, mSP[1], mSP[0], result );
+    if ( err != ERR_NONE )
+        return err;
+
+    mSP[1] = result;
+    mSP++;
+
+    return ERR_NONE;
+}
+
+int Machine::ComputePrimitive( U8 func, CELL a, CELL b, CELL& result )
+{
     switch ( func )
     {
     case PRIM_ADD:
@@ -1039,13 +1654,28 @@ int Machine::CallPrimitive( U8 func )
         }
         break;
 
+    case PRIM_ADD_U:
+        {
+            result = VmAddU( a, b );
+        }
+        break;
+
+    case PRIM_SUB_U:
+        {
+            result = VmSubU( a, b );
+        }
+        break;
+
+    case PRIM_MUL_U:
+        {
+            result = VmMulU( a, b );
+        }
+        break;
+
     default:
         return ERR_BAD_OPCODE;
     }
 
-    mSP[1] = result;
-    mSP++;
-
     return ERR_NONE;
 }
 
@@ -1113,62 +1743,247 @@ bool Machine::IsCodeInBounds( U32 address ) const
     return address < (mMod->CodeSize - SENTINEL_SIZE);
 }
 
-std::pair<int, const CELL*> Machine::GetSizedReadableDataPtr( CELL addrWord, CELL size, bool writable )
+bool Machine::IsVerifiedEntry( U32 address ) const
 {
-    U8  iMod = CodeAddr::GetModule( addrWord );
-    U32 offs = CodeAddr::GetAddress( addrWord );
+    const auto& entries = mMod->Verified->Entries;
 
-    auto [err, mod] = GetReadableDataModule( iMod, offs, writable );
-    if ( err != ERR_NONE )
-        return std::pair( err, nullptr );
+    return std::binary_search( entries.begin(), entries.end(), address );
+}
+
+bool Machine::IsVerifiedReturn() const
+{
+    I32 height = mFramePtr - static_cast<I32>( mSP - mStack );
+
+    return HasVerifiedStackRoom()
+        && mMod->Verified->ReturnHeights[mPC] == height;
+}
+
+bool Machine::IsVerifiedResume() const
+{
+    I32 height = mFramePtr - static_cast<I32>( mSP - mStack );
 
-    if ( size < 0 || size > (mod.Size - static_cast<U16>(offs)) )
-        return std::pair( ERR_BAD_ADDRESS, nullptr );
+    return mMod->Verified->Heights[mPC] == height;
+}
+
+bool Machine::HasVerifiedStackRoom() const
+{
+    return mFramePtr >= mMod->Verified->StackUsage;
+}
 
-    return std::pair( ERR_NONE, mod.Base + offs );
+bool Machine::HasNativeCode() const
+{
+    return mMod->Jit != nullptr || mMod->Aot != nullptr;
 }
 
-std::pair<int, CELL*> Machine::GetSizedWritableDataPtr( CELL addrWord, CELL size )
+// Null if the module isn't bound, or the checked engine went somewhere that
+// BindNatives didn't see as a call site
+inline NativeFunc Machine::GetBoundNative( const U8* instPtr ) const
 {
-    auto [err, ptr] = GetSizedReadableDataPtr( addrWord, size, true );
+    const NativeBinding* natives = mMod->Natives;
+
+    if ( natives == nullptr )
+        return nullptr;
+
+    size_t addr = static_cast<size_t>( instPtr - mMod->CodeBase );
+
+    if ( addr >= natives->CallSites.size() )
+        return nullptr;
+
+    U16 index = natives->CallSites[addr];
+
+    if ( index == NativeBinding::NOT_BOUND )
+        return nullptr;
+
+    return natives->Funcs[index];
+}
+
+size_t Machine::GetCallStack( U32* addrWords, size_t capacity ) const
+{
+    if ( addrWords == nullptr || capacity == 0 || !IsRunning() )
+        return 0;
+
+    size_t count = 0;
+    U32 framePtr = mFramePtr;
+
+    addrWords[count++] = CodeAddr::Build( mPC, mModIndex );
+
+    while ( count < capacity && (framePtr + FRAME_WORDS) <= mStackSize )
+    {
+        auto frame = reinterpret_cast<const StackFrame*>( &mStack[framePtr] );
+
+        if ( CodeAddr::GetModule( frame->RetAddrWord ) == MODINDEX_NATIVE )
+            break;
+
+        addrWords[count++] = frame->RetAddrWord;
+
+        // Frames are always further down the stack than the ones they return to
+
+        if ( frame->FrameAddr <= framePtr )
+            break;
+
+        framePtr = frame->FrameAddr;
+    }
+
+    return count;
+}
+
+void Machine::SetSampler( SamplingProfiler* sampler )
+{
+    mSampler = sampler;
+    mSampleFlag = (sampler != nullptr) ? &sampler->mSampleRequested : &sNoSampleFlag;
+}
+
+void Machine::TakeSample( const U8* codePtr )
+{
+    // Only one of the machines that share the sampler takes each sample
+
+    if ( !mSampleFlag->exchange( false ) )
+        return;
+
+    mPC = static_cast<U32>( codePtr - mMod->CodeBase );
+    mSampler->AddSample( *this );
+}
+
+#ifdef GEMINIVM_PROFILE
+
+inline void Machine::ProfileOp( U8 op )
+{
+    mProfile.Ops[op].Count++;
+
+    if ( mProfile.Timing )
+    {
+        U64 now = VM_PROFILE_CLOCK();
+
+        if ( mProfileOpEntry != nullptr )
+            mProfileOpEntry->Cycles += now - mProfileStart;
+
+        if ( mProfilePrimEntry != nullptr )
+            mProfilePrimEntry->Cycles += now - mProfileStart;
+
+        mProfileOpEntry = &mProfile.Ops[op];
+        mProfilePrimEntry = nullptr;
+        mProfileStart = now;
+    }
+}
+
+inline void Machine::ProfilePrim( U8 func )
+{
+    mProfile.Prims[func].Count++;
+
+    if ( mProfile.Timing )
+        mProfilePrimEntry = &mProfile.Prims[func];
+}
+
+inline void Machine::ProfileStop()
+{
+    if ( mProfileOpEntry != nullptr )
+    {
+        U64 elapsed = VM_PROFILE_CLOCK() - mProfileStart;
+
+        mProfileOpEntry->Cycles += elapsed;
+
+        if ( mProfilePrimEntry != nullptr )
+            mProfilePrimEntry->Cycles += elapsed;
+
+        mProfileOpEntry = nullptr;
+        mProfilePrimEntry = nullptr;
+    }
+}
+
+#endif
+
+int Machine::CopyData( CELL dstAddrWord, CELL srcAddrWord, CELL size )
+{
+    U32 dstOffs = CodeAddr::GetAddress( dstAddrWord );
+    U32 srcOffs = CodeAddr::GetAddress( srcAddrWord );
+
+    auto [err, dst] = GetWritableDataModule( CodeAddr::GetModule( dstAddrWord ), dstOffs );
     if ( err != ERR_NONE )
-        return std::pair( err, nullptr );
+        return err;
+
+    if ( size < 0 || size > (dst.Size - static_cast<U16>(dstOffs)) )
+        return ERR_BAD_ADDRESS;
+
+    auto [err1, src] = GetReadableDataModule( CodeAddr::GetModule( srcAddrWord ), srcOffs );
+    if ( err1 != ERR_NONE )
+        return err1;
+
+    if ( size > (src.Size - static_cast<U16>(srcOffs)) )
+        return ERR_BAD_ADDRESS;
+
+    if ( dst.Cow == nullptr && src.Cow == nullptr )
+    {
+        std::copy_n( src.Base + srcOffs, size, dst.Base + dstOffs );
+    }
+    else
+    {
+        // Copy-on-write pages aren't next to each other, so go a cell at a time
+
+        for ( CELL i = 0; i < size; i++ )
+            dst.Write( dstOffs + i, src.Read( srcOffs + i ) );
+    }
 
-    return std::pair( ERR_NONE, const_cast<CELL*>(ptr) );
+    return ERR_NONE;
+}
+
+inline CELL Machine::ReadableDataModule::Read( U32 addr ) const
+{
+    if ( Cow != nullptr )
+        return Cow->Read( addr );
+
+    return Base[addr];
+}
+
+inline void Machine::WritableDataModule::Write( U32 addr, CELL value ) const
+{
+    if ( Cow != nullptr )
+        Cow->Write( addr, value );
+    else
+        Base[addr] = value;
 }
 
 std::pair<int, Machine::ReadableDataModule> Machine::GetReadableDataModule( U8 index, U32 addr, bool writable )
 {
     const Module* mod;
 
-    if ( index == MODINDEX_STACK )
+    if ( !mModTable.empty() )
+    {
+        mod = mModTable[index];
+    }
+    else if ( index == MODINDEX_STACK )
     {
         mod = &mStackMod;
     }
     else
     {
         U8 baseIndex = index & ~CONST_SECTION_MOD_INDEX_MASK;
-        bool isConstSection = (baseIndex != index);
 
-        if ( baseIndex == mModIndex )
-        {
-            mod = mMod;
-        }
-        else
-        {
-            mod = GetModule( baseIndex );
-            if ( mod == nullptr )
-                return std::pair( ERR_BYTECODE_NOT_FOUND, ReadableDataModule() );
-        }
+        mod = (baseIndex == mModIndex) ? mMod : GetModule( baseIndex );
+    }
 
-        if ( isConstSection )
+    if ( mod == nullptr )
+        return std::pair( ERR_BYTECODE_NOT_FOUND, ReadableDataModule() );
+
+    if ( index != MODINDEX_STACK )
+    {
+        if ( (index & CONST_SECTION_MOD_INDEX_MASK) != 0 )
         {
             if ( writable || addr >= mod->ConstSize )
                 return std::pair( ERR_BAD_ADDRESS, ReadableDataModule() );
 
             assert( mod->ConstBase != nullptr );
 
-            return std::pair( ERR_NONE, ReadableDataModule{ mod->ConstBase, mod->ConstSize } );
+            return std::pair( ERR_NONE, ReadableDataModule{ mod->ConstBase, mod->ConstSize, nullptr } );
+        }
+
+        if ( mod->Cow != nullptr )
+        {
+            U16 cowSize = mod->Cow->GetSize();
+
+            if ( addr >= cowSize )
+                return std::pair( ERR_BAD_ADDRESS, ReadableDataModule() );
+
+            return std::pair( ERR_NONE, ReadableDataModule{ nullptr, cowSize, mod->Cow } );
         }
     }
 
@@ -1177,7 +1992,7 @@ std::pair<int, Machine::ReadableDataModule> Machine::GetReadableDataModule( U8 i
 
     assert( mod->DataBase != nullptr );
 
-    return std::pair( ERR_NONE, ReadableDataModule{ mod->DataBase, mod->DataSize } );
+    return std::pair( ERR_NONE, ReadableDataModule{ mod->DataBase, mod->DataSize, nullptr } );
 }
 
 std::pair<int, Machine::WritableDataModule> Machine::GetWritableDataModule( U8 index, U32 addr )
@@ -1186,12 +2001,15 @@ std::pair<int, Machine::WritableDataModule> Machine::GetWritableDataModule( U8 i
     if ( err != ERR_NONE )
         return std::pair( err, WritableDataModule() );
 
-    return std::pair( ERR_NONE, WritableDataModule{ const_cast<CELL*>(mod.Base), mod.Size } );
+    return std::pair( ERR_NONE, WritableDataModule{ const_cast<CELL*>(mod.Base), mod.Size, mod.Cow } );
 }
 
 const Module* Machine::GetModule( U8 index )
 {
-    return mEnv->FindModule( index );
+    if ( mModTable.empty() )
+        return mEnv->FindModule( index );
+
+    return (index < ModSizeMax) ? mModTable[index] : nullptr;
 }
 
 bool Machine::FindNativeCode( U32 id, NativeCode* nativeCode )
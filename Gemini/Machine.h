@@ -6,7 +6,10 @@
 
 #pragma once
 
+#include <atomic>
+#include <string>
 #include <utility>
+#include <vector>
 
 
 namespace Gemini
@@ -30,6 +33,7 @@ enum VmError
     ERR_DIVIDE,
     ERR_NATIVE_ERROR,
     ERR_BOUND,
+    ERR_BUDGET_EXHAUSTED,
 };
 
 
@@ -47,6 +51,23 @@ typedef uint32_t    UCELL;
 typedef uintptr_t   UserContext;
 
 
+// Produced by VerifyModuleCode. A module that points to one of these runs
+// without the per-instruction stack and branch checks.
+
+struct VerifiedCode
+{
+    std::vector<U32>    Entries;        // Sorted addresses where a call can start
+    std::vector<U16>    ReturnHeights;  // Stack height after each return site, by address
+    std::vector<U16>    Heights;        // Stack height at each live instruction, by address
+    U16                 StackUsage;     // Most cells any function uses below its frame
+};
+
+class JitCode;
+class AotModule;
+class CowData;
+class SamplingProfiler;
+struct NativeBinding;
+
 struct Module
 {
     const U8*       CodeBase;
@@ -55,6 +76,11 @@ struct Module
     U32             CodeSize;
     U16             DataSize;
     U16             ConstSize;
+    const VerifiedCode* Verified;
+    const JitCode*  Jit;            // Native code for a verified module, run in place of its bytecode
+    const AotModule* Aot;           // Translated code for a verified module, run in place of its bytecode
+    CowData*        Cow;            // Copy-on-write data, used in place of DataBase and DataSize
+    const NativeBinding* Natives;   // Native functions bound ahead of time, called without the environment
 };
 
 struct ByteCode
@@ -76,9 +102,57 @@ class IEnvironment
 {
 public:
     virtual bool FindNativeCode( U32 id, NativeCode* nativeCode ) = 0;
+
+    // A machine preloads its module table by calling this for every index
+    // below ModSizeMax, whether or not the code refers to it. Return nullptr
+    // for an index without a module.
     virtual const Module* FindModule( U8 index ) = 0;
 };
 
+// Made by BindNatives. The code of the module must not change after it's bound.
+
+struct NativeBinding
+{
+    static constexpr U16 NOT_BOUND = 0xFFFF;
+
+    std::vector<NativeFunc> Funcs;      // One for each native ID the module calls
+    std::vector<U32>        Ids;        // The ID of each function in Funcs
+    std::vector<U16>        CallSites;  // Index in Funcs of the native called at each address, by address
+};
+
+// The state of a machine, with only the live part of its stack: from the
+// stack pointer to the end. The modules' data isn't part of it.
+
+struct MachineSnapshot
+{
+    std::vector<CELL>   Stack;
+    U16                 StackSize;
+    U16                 FramePtr;
+    U32                 PC;
+    U8                  ModIndex;
+    NativeFunc          NativeContinuation;
+    UserContext         NativeContinuationContext;
+    U8                  NativeContinuationFlags;
+};
+
+// Kept by machines built with GEMINIVM_PROFILE. The counts are of the
+// instructions that the interpreter runs, including the ones that JIT and AOT
+// code hand to it. Cycles are only measured while timing is on. They come from
+// the time stamp counter on x86, and are nanoseconds elsewhere.
+
+struct MachineProfile
+{
+    struct Entry
+    {
+        U64     Count;
+        U64     Cycles;
+    };
+
+    Entry   Ops[256];       // By opcode
+    Entry   Prims[256];     // By PRIM_* function, for PRIM, PRIMLOC and PRIMC.S
+    bool    Timing;
+};
+
 struct StackFrame
 {
     U16             FrameAddr;
@@ -89,17 +163,27 @@ struct StackFrame
 
 class Machine : private IEnvironment
 {
+    friend class JitCode;
+    friend class AotModule;
+    friend struct AotContext;
+
 private:
     struct ReadableDataModule
     {
         const CELL* Base;
         U16         Size;
+        CowData*    Cow;
+
+        CELL Read( U32 addr ) const;
     };
 
     struct WritableDataModule
     {
         CELL*       Base;
         U16         Size;
+        CowData*    Cow;
+
+        void Write( U32 addr, CELL value ) const;
     };
 
 private:
@@ -116,8 +200,19 @@ private:
     U8              mNativeNestingLevel;
     U8              mModIndex;
     U32             mPC;
+    U32             mBudget;
     const Module*   mMod;
     Module          mStackMod;
+    std::vector<const Module*> mModTable;
+    std::atomic<bool>* mSampleFlag;
+    SamplingProfiler* mSampler;
+
+#ifdef GEMINIVM_PROFILE
+    MachineProfile  mProfile;
+    MachineProfile::Entry* mProfileOpEntry;
+    MachineProfile::Entry* mProfilePrimEntry;
+    U64             mProfileStart;
+#endif
 
 public:
     Machine();
@@ -125,6 +220,12 @@ public:
     void Init( CELL* stack, U16 stackSize, IEnvironment* environment, UserContext scriptCtx = 0 );
     void Init( CELL* stack, U16 stackSize, U8 modIndex, const Module* module, UserContext scriptCtx = 0 );
 
+    // Looks up all the environment's modules once, so that the machine doesn't
+    // have to ask the environment when code crosses modules. Call it after
+    // Init, when the environment has all of its modules. They must not change
+    // until the next Init.
+    void PreloadModules();
+
     bool IsRunning() const;
     UserContext GetScriptContext() const;
     U8 GetModIndex() const;
@@ -134,15 +235,63 @@ public:
     CELL* Start( CELL addrWord, U8 argCount );
     void Reset();
     int Run();
+
+    // Runs until the budget is used up, then returns ERR_BUDGET_EXHAUSTED. Like
+    // ERR_YIELDED, the machine can be run again from where it stopped. The
+    // budget is charged one for each backward branch taken and each call, so
+    // that every loop and recursion pays for itself.
+    int Run( U32 instructionBudget );
+
     int Yield( NativeFunc proc, UserContext context );
+
+    // True after a native function yielded with Yield. The next Run calls the
+    // continuation first.
+    bool HasNativeContinuation() const;
+
+    // Snapshots can be taken and restored whenever Run isn't executing.
+    // Stack addresses are indexes into the stack, so Restore and Fork need a
+    // stack the same size as the original's. The modules are looked up by
+    // index in the environment of the machine that takes the state.
+    int Snapshot( MachineSnapshot& snapshot ) const;
+    int Restore( const MachineSnapshot& snapshot );
+
+    // Copies this machine's state to another initialized machine, without
+    // going through a snapshot
+    int Fork( Machine& child ) const;
+
     int PushCell( CELL value );
     int PopCell( CELL& value );
 
+    // Fills addrWords with the code addresses of the script call stack,
+    // innermost first: the PC, then the return address of each frame. Stops at
+    // the frame that Start made, or when the buffer is full. Returns the count.
+    size_t GetCallStack( U32* addrWords, size_t capacity ) const;
+
+    // While a sampler is set, the machine checks for its sample requests at
+    // backward branches and calls. Pass null to stop.
+    void SetSampler( SamplingProfiler* sampler );
+
+    // Only a machine built with GEMINIVM_PROFILE keeps a profile. Otherwise,
+    // GetProfile returns null, and the others do nothing.
+    const MachineProfile* GetProfile() const;
+    void ResetProfile();
+    void SetProfileTiming( bool enable );
+
 private:
     void Init( CELL* stack, U16 stackSize, UserContext scriptCtx );
+
+    template <bool Checked, bool Single = false>
+    int Execute();
+    int Step();
+
+    template <bool Checked = true>
     StackFrame* PushFrame( const U8* curCodePtr, U8 argCount );
+    StackFrame* ReplaceFrame( U8 callFlags );
     int PopFrame();
+
+    template <bool Checked>
     int CallPrimitive( U8 func );
+    static int ComputePrimitive( U8 func, CELL a, CELL b, CELL& result );
     int CallNative( NativeFunc proc, U8 argCount, UserContext context );
 
     int SwitchModule( U8 newModIndex );
@@ -159,19 +308,66 @@ private:
 
     bool IsCodeInBounds( U32 address ) const;
 
+    bool IsVerifiedEntry( U32 address ) const;
+    bool IsVerifiedReturn() const;
+    bool IsVerifiedResume() const;
+    bool HasVerifiedStackRoom() const;
+    bool HasNativeCode() const;
+
+    NativeFunc GetBoundNative( const U8* instPtr ) const;
+
+    void TakeSample( const U8* codePtr );
+
+#ifdef GEMINIVM_PROFILE
+    void ProfileOp( U8 op );
+    void ProfilePrim( U8 func );
+    void ProfileStop();
+#endif
+
     std::pair<int, ReadableDataModule> GetReadableDataModule( U8 index, U32 addr, bool writable = false );
     std::pair<int, WritableDataModule> GetWritableDataModule( U8 index, U32 addr );
 
-    std::pair<int, const CELL*> GetSizedReadableDataPtr( CELL addrWord, CELL size, bool writable = false );
-    std::pair<int,       CELL*> GetSizedWritableDataPtr( CELL addrWord, CELL size );
+    int CopyData( CELL dstAddrWord, CELL srcAddrWord, CELL size );
 
     const Module* GetModule( U8 index );
 
+    int SetState(
+        const CELL* liveStack,
+        size_t liveCount,
+        U16 stackSize,
+        U16 framePtr,
+        U32 pc,
+        U8 modIndex,
+        NativeFunc continuation,
+        UserContext continuationContext,
+        U8 continuationFlags );
+
     virtual bool FindNativeCode( U32 id, NativeCode* nativeCode ) override;
     virtual const Module* FindModule( U8 index ) override;
 };
 
 
 int VerifyModule( const Module* mod );
+int VerifyModuleCode( const Module* mod, VerifiedCode* verifiedCode );
+
+// Looks up every native function that the module's code calls, so that the
+// machine doesn't have to ask the environment at each call. If any can't be
+// found, then returns ERR_NATIVECODE_NOT_FOUND, lists their IDs in
+// unresolvedIds, and leaves the binding as it was.
+int BindNatives(
+    const Module* mod,
+    IEnvironment* env,
+    NativeBinding* binding,
+    std::vector<U32>* unresolvedIds = nullptr );
+
+// Writes a snapshot to bytes that can be stored or sent to another process.
+// A pending native continuation is a pointer, so it can't be serialized, and
+// returns ERR_BAD_STATE.
+int SerializeSnapshot( const MachineSnapshot& snapshot, std::vector<U8>& bytes );
+int DeserializeSnapshot( const U8* bytes, size_t size, MachineSnapshot& snapshot );
+
+// Lists the opcodes and primitives that ran, most often first
+std::string FormatProfileText( const MachineProfile& profile );
+std::string FormatProfileJson( const MachineProfile& profile );
 
 }
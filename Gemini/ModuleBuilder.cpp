@@ -0,0 +1,613 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+#include "pch.h"
+#include "ModuleBuilder.h"
+#include "AlgolyParser.h"
+#include "CompileCache.h"
+#include "LispyParser.h"
+#include <algorithm>
+#include <atomic>
+#include <limits.h>
+#include <optional>
+#include <set>
+#include <thread>
+
+
+namespace Gemini
+{
+
+//----------------------------------------------------------------------------
+//  What a module adds to the environment and log, to pass on later
+//----------------------------------------------------------------------------
+
+class ModuleBuilder::ModuleEnv : public ICompilerEnv
+{
+public:
+    std::vector<RecordedExternal>   Externals;
+    std::vector<RecordedGlobal>     Globals;
+
+    virtual bool AddExternal( const std::string& name, ExternalKind kind, int address ) override
+    {
+        Externals.push_back( { name, kind, address } );
+        return true;
+    }
+
+    virtual bool FindExternal( const std::string& name, ExternalFunc* func ) override
+    {
+        return false;
+    }
+
+    virtual bool AddGlobal( const std::string& name, int offset ) override
+    {
+        Globals.push_back( { name, offset } );
+        return true;
+    }
+
+    virtual bool FindGlobal( const std::string& name, int& offset ) override
+    {
+        return false;
+    }
+};
+
+class ModuleBuilder::ModuleLog : public ICompilerLog
+{
+public:
+    // The file names point into the units, which are gone by the time that
+    // the entries are passed on. So, keep copies.
+    std::vector<RecordedLogEntry>   Entries;
+
+    virtual void Add( LogCategory category, const char* fileName, int line, int column, const char* message ) override
+    {
+        Entries.push_back( {
+            category,
+            fileName != nullptr,
+            fileName != nullptr ? fileName : "",
+            line,
+            column,
+            message } );
+    }
+};
+
+
+struct ModuleBuilder::ModuleState
+{
+    ModSize                     Index;
+    std::vector<SourceUnit>     Sources;
+    std::vector<Unique<Unit>>   Units;
+    std::vector<std::string>    ImportNames;
+
+    // Modules imported directly or through others
+    std::set<ModSize>           Imports;
+    unsigned                    Level = 0;
+
+    uint64_t                    SourceKey = 0;
+    std::unique_ptr<CacheEntry> Cached;
+
+    // Only set for modules whose metadata could be saved
+    std::optional<uint64_t>     Fingerprint;
+
+    std::unique_ptr<Compiler>   ModCompiler;
+    ModuleEnv                   Env;
+    ModuleLog                   Log;
+    std::exception_ptr          Exception;
+    BuiltModule                 Output = {};
+};
+
+
+namespace
+{
+
+// Collects the names of the modules imported by a unit
+class ImportCollector : public Visitor
+{
+    std::vector<std::string>&   mNames;
+
+public:
+    ImportCollector( std::vector<std::string>& names ) :
+        mNames( names )
+    {
+    }
+
+    virtual void VisitImportDecl( ImportDecl* importDecl ) override
+    {
+        mNames.push_back( importDecl->OriginalName );
+    }
+};
+
+// Calls the function with each index from 0 to count, on up to threadCount
+// threads including this one
+template <typename TFunc>
+void RunParallel( size_t count, unsigned threadCount, TFunc func )
+{
+    std::atomic<size_t> next{ 0 };
+
+    auto work = [&next, count, &func]()
+    {
+        for ( size_t i = next++; i < count; i = next++ )
+            func( i );
+    };
+
+    std::vector<std::thread> threads;
+    size_t extraCount = std::min<size_t>( threadCount, count );
+
+    for ( size_t i = 1; i < extraCount; i++ )
+        threads.emplace_back( work );
+
+    work();
+
+    for ( auto& thread : threads )
+        thread.join();
+}
+
+}
+
+
+//----------------------------------------------------------------------------
+//  ModuleBuilder
+//----------------------------------------------------------------------------
+
+ModuleBuilder::ModuleBuilder( ICompilerEnv* env, ICompilerLog* log, CompilerAttrs& globalAttrs, unsigned threadCount ) :
+    mEnv( env ),
+    mLog( log ),
+    mGlobalAttrs( globalAttrs ),
+    mThreadCount( threadCount )
+{
+    if ( env == nullptr )
+        throw std::invalid_argument( "env" );
+
+    if ( log == nullptr )
+        throw std::invalid_argument( "log" );
+
+    if ( mThreadCount == 0 )
+        mThreadCount = std::max( 1u, std::thread::hardware_concurrency() );
+}
+
+ModuleBuilder::~ModuleBuilder()
+{
+}
+
+ModSize ModuleBuilder::AddModule( const std::string& name, std::vector<SourceUnit> units )
+{
+    if ( mStatus != CompilerErr::NONE )
+        throw std::logic_error( "Modules can't be added after building" );
+
+    if ( mModules.size() >= ModSizeMax )
+        throw std::invalid_argument( "Too many modules" );
+
+    if ( name.empty() )
+        throw std::invalid_argument( "name" );
+
+    for ( const auto& unit : units )
+    {
+        if ( unit.Text.size() >= INT_MAX )
+            throw std::invalid_argument( "units" );
+    }
+
+    auto module = std::make_unique<ModuleState>();
+
+    module->Index = static_cast<ModSize>( mModules.size() );
+    module->Sources = std::move( units );
+    module->Output.Name = name;
+    module->Output.Error = CompilerErr::NONE;
+
+    mModules.push_back( std::move( module ) );
+
+    return mModules.back()->Index;
+}
+
+void ModuleBuilder::SetInlining( bool enable )
+{
+    mInlining = enable;
+}
+
+void ModuleBuilder::SetCache( CompileCache* cache )
+{
+    mCache = cache;
+}
+
+CompilerErr ModuleBuilder::Build()
+{
+    if ( mStatus != CompilerErr::NONE )
+        return mStatus;
+
+    RunParallel( mModules.size(), mThreadCount, [this]( size_t i )
+    {
+        ReadModule( *mModules[i] );
+    } );
+
+    // Find the imports, now that they're known. Imports of unknown modules
+    // are left for the binder to report.
+
+    unsigned levelCount = 0;
+    bool parsed = true;
+
+    for ( size_t i = 0; i < mModules.size(); i++ )
+    {
+        ModuleState& module = *mModules[i];
+
+        if ( module.Exception )
+            std::rethrow_exception( module.Exception );
+
+        if ( module.Output.Error != CompilerErr::NONE )
+            parsed = false;
+
+        for ( const auto& importName : module.ImportNames )
+        {
+            for ( size_t j = 0; j < i; j++ )
+            {
+                ModuleState& imported = *mModules[j];
+
+                if ( imported.Output.Name == importName )
+                {
+                    module.Imports.insert( static_cast<ModSize>( j ) );
+                    module.Imports.insert( imported.Imports.begin(), imported.Imports.end() );
+                    module.Level = std::max( module.Level, imported.Level + 1 );
+                    break;
+                }
+            }
+        }
+
+        levelCount = std::max( levelCount, module.Level + 1 );
+    }
+
+    for ( unsigned level = 0; parsed && level < levelCount; level++ )
+    {
+        std::vector<ModuleState*> levelModules;
+
+        for ( auto& module : mModules )
+        {
+            if ( module->Level == level )
+                levelModules.push_back( module.get() );
+        }
+
+        RunParallel( levelModules.size(), mThreadCount, [this, &levelModules]( size_t i )
+        {
+            CompileModule( *levelModules[i] );
+        } );
+
+        // Figuring stats updates the functions of imported modules. So, do it
+        // here, one module at a time.
+
+        bool failed = false;
+
+        for ( auto module : levelModules )
+        {
+            if ( module->Exception )
+                std::rethrow_exception( module->Exception );
+
+            FinishModule( *module );
+
+            if ( module->Output.Error != CompilerErr::OK )
+                failed = true;
+        }
+
+        if ( failed )
+            break;
+    }
+
+    mStatus = CompilerErr::OK;
+
+    for ( auto& module : mModules )
+    {
+        Flush( *module );
+
+        if ( mStatus == CompilerErr::OK
+            && module->Output.Error != CompilerErr::NONE
+            && module->Output.Error != CompilerErr::OK )
+        {
+            mStatus = module->Output.Error;
+        }
+    }
+
+    return mStatus;
+}
+
+size_t ModuleBuilder::GetModuleCount() const
+{
+    return mModules.size();
+}
+
+const BuiltModule& ModuleBuilder::GetModule( ModSize index ) const
+{
+    if ( index >= mModules.size() )
+        throw std::out_of_range( "index" );
+
+    return mModules[index]->Output;
+}
+
+uint64_t ModuleBuilder::GetSourceKey( const ModuleState& module ) const
+{
+    // Everything that the compiled module depends on, except for its imports
+
+#if defined( GEMINIVM_DISABLE_FOLDING_PASS )
+    const uint8_t folding = 0;
+#else
+    const uint8_t folding = 1;
+#endif
+
+    const uint8_t inlining = mInlining;
+    const uint64_t format = GetCacheFormat();
+    uint64_t hash = HashBytes( &format, sizeof format );
+
+    auto hashString = [&hash]( const std::string& str )
+    {
+        uint64_t size = str.size();
+
+        hash = HashBytes( &size, sizeof size, hash );
+        hash = HashBytes( str.data(), str.size(), hash );
+    };
+
+    hash = HashBytes( &folding, sizeof folding, hash );
+    hash = HashBytes( &inlining, sizeof inlining, hash );
+    hash = HashBytes( &module.Index, sizeof module.Index, hash );
+    hashString( module.Output.Name );
+
+    for ( const auto& source : module.Sources )
+    {
+        const uint8_t language = static_cast<uint8_t>( source.Language );
+
+        hash = HashBytes( &language, sizeof language, hash );
+        hashString( source.FileName );
+        hashString( source.Text );
+    }
+
+    return hash;
+}
+
+std::vector<ModuleDeclaration*> ModuleBuilder::GetImportDecls( const ModuleState& module ) const
+{
+    std::vector<ModuleDeclaration*> imports;
+
+    for ( ModSize imported : module.Imports )
+        imports.push_back( mModules[imported]->Output.Metadata.get() );
+
+    return imports;
+}
+
+void ModuleBuilder::ReadModule( ModuleState& module )
+{
+    if ( mCache != nullptr )
+    {
+        auto entry = std::make_unique<CacheEntry>();
+
+        module.SourceKey = GetSourceKey( module );
+
+        // The imports still have to be checked, once their fingerprints are known
+
+        if ( mCache->Read( module.SourceKey, *entry ) )
+        {
+            module.ImportNames = entry->ImportNames;
+            module.Cached = std::move( entry );
+            return;
+        }
+    }
+
+    ParseModule( module );
+}
+
+void ModuleBuilder::ParseModule( ModuleState& module )
+{
+    try
+    {
+        for ( const auto& source : module.Sources )
+        {
+            const char* text = source.Text.c_str();
+            int         textLen = static_cast<int>( source.Text.size() );
+
+            if ( source.Language == SourceLanguage::Algoly )
+            {
+                AlgolyParser parser( text, textLen, source.FileName.c_str(), &module.Log );
+                module.Units.push_back( parser.Parse() );
+            }
+            else
+            {
+                LispyParser parser( text, textLen, source.FileName.c_str(), &module.Log );
+                module.Units.push_back( parser.Parse() );
+            }
+        }
+
+        ImportCollector collector( module.ImportNames );
+
+        for ( auto& unit : module.Units )
+        {
+            for ( auto& decl : unit->DataDeclarations )
+                decl->Accept( &collector );
+        }
+    }
+    catch ( CompilerException& ex )
+    {
+        module.Output.Error = ex.GetError();
+    }
+    catch ( ... )
+    {
+        module.Exception = std::current_exception();
+    }
+}
+
+void ModuleBuilder::CompileModule( ModuleState& module )
+{
+    if ( module.Cached )
+    {
+        if ( CanLoadModule( module ) && LoadModule( module ) )
+            return;
+
+        // The sources were the same as in the entry, so they parse the same
+
+        module.Cached.reset();
+        module.ImportNames.clear();
+
+        ParseModule( module );
+
+        if ( module.Exception || module.Output.Error != CompilerErr::NONE )
+            return;
+    }
+
+    try
+    {
+        module.ModCompiler.reset( new Compiler( &module.Env, &module.Log, mGlobalAttrs, module.Index ) );
+
+        Compiler& compiler = *module.ModCompiler;
+
+        compiler.SetInlining( mInlining );
+
+        for ( auto& unit : module.Units )
+            compiler.AddUnit( std::move( unit ) );
+
+        for ( ModSize imported : module.Imports )
+            compiler.AddModule( mModules[imported]->Output.Metadata );
+
+        module.Output.Error = compiler.Compile();
+    }
+    catch ( ... )
+    {
+        module.Exception = std::current_exception();
+    }
+}
+
+bool ModuleBuilder::CanLoadModule( const ModuleState& module ) const
+{
+    const auto& cachedImports = module.Cached->Imports;
+
+    if ( cachedImports.size() != module.Imports.size() )
+        return false;
+
+    auto cachedIt = cachedImports.begin();
+
+    for ( ModSize imported : module.Imports )
+    {
+        const auto& fingerprint = mModules[imported]->Fingerprint;
+
+        if ( cachedIt->Index != imported
+            || !fingerprint.has_value()
+            || cachedIt->Fingerprint != fingerprint.value() )
+            return false;
+
+        ++cachedIt;
+    }
+
+    return true;
+}
+
+bool ModuleBuilder::LoadModule( ModuleState& module )
+{
+    const CacheEntry& entry = *module.Cached;
+    auto modAttrs = std::make_shared<ModuleAttrs>( module.Index, mGlobalAttrs );
+
+    modAttrs->GetConsts() = entry.Const;
+    mGlobalAttrs.AddModule( modAttrs );
+
+    std::vector<std::shared_ptr<Function>> funcs;
+    auto modDecl = DeserializeMetadata( entry.Metadata, mGlobalAttrs, GetImportDecls( module ), funcs );
+
+    if ( !modDecl || modDecl->Index != module.Index || modDecl->Name != module.Output.Name )
+        return false;
+
+    for ( auto& func : funcs )
+        mGlobalAttrs.AddFunctionByAddress( func );
+
+    BuiltModule& output = module.Output;
+
+    output.Error = CompilerErr::OK;
+    output.Code = entry.Code;
+    output.Data = entry.Data;
+    output.Const = entry.Const;
+    output.Metadata = modDecl;
+    output.Stats = entry.Stats;
+    output.FromCache = true;
+
+    module.Env.Externals = entry.Externals;
+    module.Env.Globals = entry.Globals;
+    module.Log.Entries = entry.LogEntries;
+    module.Fingerprint = GetModuleFingerprint( entry.Metadata, entry.Const );
+
+    return true;
+}
+
+void ModuleBuilder::FinishModule( ModuleState& module )
+{
+    BuiltModule& output = module.Output;
+
+    if ( output.FromCache || !module.ModCompiler )
+        return;
+
+    Compiler& compiler = *module.ModCompiler;
+
+    if ( output.Error == CompilerErr::OK )
+    {
+        compiler.GetStats( output.Stats );
+
+        output.Code.assign( compiler.GetCode(), compiler.GetCode() + compiler.GetCodeSize() );
+        output.Data.assign( compiler.GetData(), compiler.GetData() + compiler.GetDataSize() );
+        output.Const.assign( compiler.GetConst(), compiler.GetConst() + compiler.GetConstSize() );
+        output.Metadata = compiler.GetMetadata( output.Name.c_str() );
+
+        if ( mCache != nullptr )
+            StoreModule( module );
+    }
+
+    module.ModCompiler.reset();
+}
+
+void ModuleBuilder::StoreModule( ModuleState& module )
+{
+    BuiltModule& output = module.Output;
+    CacheEntry entry;
+
+    if ( !SerializeMetadata( *output.Metadata, mGlobalAttrs, GetImportDecls( module ), entry.Metadata ) )
+        return;
+
+    module.Fingerprint = GetModuleFingerprint( entry.Metadata, output.Const );
+
+    // Modules that import one that can't be saved can't be saved either
+
+    for ( ModSize imported : module.Imports )
+    {
+        const auto& fingerprint = mModules[imported]->Fingerprint;
+
+        if ( !fingerprint.has_value() )
+            return;
+
+        entry.Imports.push_back( { imported, fingerprint.value() } );
+    }
+
+    entry.ImportNames = module.ImportNames;
+    entry.Code = output.Code;
+    entry.Data = output.Data;
+    entry.Const = output.Const;
+    entry.Stats = output.Stats;
+    entry.Externals = module.Env.Externals;
+    entry.Globals = module.Env.Globals;
+    entry.LogEntries = module.Log.Entries;
+
+    // A cache that can't be written only costs time in the next build
+    mCache->Write( module.SourceKey, entry );
+}
+
+void ModuleBuilder::Flush( ModuleState& module )
+{
+    for ( const auto& entry : module.Log.Entries )
+    {
+        mLog->Add(
+            entry.Category,
+            entry.HasFileName ? entry.FileName.c_str() : nullptr,
+            entry.Line,
+            entry.Column,
+            entry.Message.c_str() );
+    }
+
+    for ( const auto& external : module.Env.Externals )
+        mEnv->AddExternal( external.Name, external.Kind, external.Address );
+
+    for ( const auto& global : module.Env.Globals )
+        mEnv->AddGlobal( global.Name, global.Offset );
+
+    module.Log.Entries.clear();
+    module.Env.Externals.clear();
+    module.Env.Globals.clear();
+}
+
+}
@@ -0,0 +1,127 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+#pragma once
+
+#include "Compiler.h"
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+namespace Gemini
+{
+
+enum class SourceLanguage
+{
+    Algoly,
+    Lispy,
+};
+
+
+struct SourceUnit
+{
+    std::string     FileName;
+    std::string     Text;
+    SourceLanguage  Language;
+};
+
+
+struct BuiltModule
+{
+    std::string                         Name;
+    CompilerErr                         Error;
+    std::vector<uint8_t>                Code;
+    std::vector<int32_t>                Data;
+    std::vector<int32_t>                Const;
+    std::shared_ptr<ModuleDeclaration>  Metadata;
+    CompilerStats                       Stats;
+
+    // Loaded from the cache instead of compiled
+    bool                                FromCache = false;
+};
+
+
+// Compiles the modules of a program on a pool of threads.
+//
+// Modules are added in the order that they'd be compiled one at a time, and
+// their indexes follow that order, starting at 0. A module can only import
+// the ones added before it.
+//
+// All the units are parsed at the same time. Then the modules are compiled by
+// level of the import graph: first the ones that import nothing, then the
+// ones that only import those, and so on. The modules of a level are bound,
+// folded and generated at the same time. The build stops after a level where
+// a module failed.
+//
+// The environment and log are only called from the thread that calls Build.
+// What each module adds to them is kept, and passed on in module order at the
+// end, so that they see the same calls as when compiling on one thread.
+//
+// With a cache, a module whose sources and imports are the same as in an
+// earlier build is loaded instead of parsed and compiled. Modules that are
+// compiled are stored in the cache.
+
+class CompileCache;
+
+class ModuleBuilder
+{
+    class ModuleEnv;
+    class ModuleLog;
+    struct ModuleState;
+
+    using ModuleStateVec = std::vector<std::unique_ptr<ModuleState>>;
+
+    ICompilerEnv*   mEnv;
+    ICompilerLog*   mLog;
+    CompilerAttrs&  mGlobalAttrs;
+    unsigned        mThreadCount;
+    bool            mInlining = true;
+    CompileCache*   mCache = nullptr;
+    CompilerErr     mStatus = CompilerErr::NONE;
+    ModuleStateVec  mModules;
+
+public:
+    // A thread count of 0 uses one for each hardware thread
+    ModuleBuilder( ICompilerEnv* env, ICompilerLog* log, CompilerAttrs& globalAttrs, unsigned threadCount = 0 );
+    ~ModuleBuilder();
+
+    ModuleBuilder( const ModuleBuilder& ) = delete;
+    ModuleBuilder& operator=( const ModuleBuilder& ) = delete;
+
+    ModSize AddModule( const std::string& name, std::vector<SourceUnit> units );
+
+    // See Compiler::SetInlining
+    void SetInlining( bool enable );
+
+    // The cache has to last until Build returns. Null turns off caching.
+    void SetCache( CompileCache* cache );
+
+    // Returns the error of the first module that failed, by index
+    CompilerErr Build();
+
+    size_t GetModuleCount() const;
+
+    // Modules that weren't compiled, because the build stopped before their
+    // level, have the error NONE
+    const BuiltModule& GetModule( ModSize index ) const;
+
+private:
+    uint64_t GetSourceKey( const ModuleState& module ) const;
+    std::vector<ModuleDeclaration*> GetImportDecls( const ModuleState& module ) const;
+
+    void ReadModule( ModuleState& module );
+    void ParseModule( ModuleState& module );
+    void CompileModule( ModuleState& module );
+    bool CanLoadModule( const ModuleState& module ) const;
+    bool LoadModule( ModuleState& module );
+    void FinishModule( ModuleState& module );
+    void StoreModule( ModuleState& module );
+    void Flush( ModuleState& module );
+};
+
+}
@@ -45,6 +45,21 @@ enum OpCode : uint8_t
     OP_RANGE,
     OP_OFFSET,
     OP_YIELD,
+    OP_INCLOC,
+    OP_PRIMLOC,
+    OP_PRIMC_S,
+    OP_BEQ,
+    OP_BNE,
+    OP_BLT,
+    OP_BLE,
+    OP_BGT,
+    OP_BGE,
+    OP_TAILCALL,
+    OP_TAILCALLI,
+    OP_TAILCALLM,
+    OP_SWITCH,
+    OP_INDEX_U,
+    OP_B_L,
     OP_MAXOPCODE,
 
     // Having each module end with this unsupported opcode ensures that:
@@ -72,6 +87,9 @@ enum : uint8_t
     PRIM_LE,
     PRIM_GT,
     PRIM_GE,
+    PRIM_ADD_U,
+    PRIM_SUB_U,
+    PRIM_MUL_U,
     PRIM_MAXPRIMITIVE,
 };
 
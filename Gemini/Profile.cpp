@@ -0,0 +1,172 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+#include "pch.h"
+#include "Common.h"
+#include "Machine.h"
+#include "Disassembler.h"
+#include <algorithm>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+
+namespace Gemini
+{
+
+const MachineProfile* Machine::GetProfile() const
+{
+#ifdef GEMINIVM_PROFILE
+    return &mProfile;
+#else
+    return nullptr;
+#endif
+}
+
+void Machine::ResetProfile()
+{
+#ifdef GEMINIVM_PROFILE
+    bool timing = mProfile.Timing;
+
+    mProfile = {};
+    mProfile.Timing = timing;
+    mProfileOpEntry = nullptr;
+    mProfilePrimEntry = nullptr;
+    mProfileStart = 0;
+#endif
+}
+
+void Machine::SetProfileTiming( bool enable )
+{
+#ifdef GEMINIVM_PROFILE
+    mProfile.Timing = enable;
+    mProfileOpEntry = nullptr;
+    mProfilePrimEntry = nullptr;
+#endif
+}
+
+
+struct ProfileRow
+{
+    const char* Name;
+    char        NameBuf[8];
+    const MachineProfile::Entry* Entry;
+};
+
+using NameFunc = const char* (*)( uint8_t value );
+
+static std::vector<ProfileRow> GetProfileRows( const MachineProfile::Entry* entries, NameFunc getName )
+{
+    std::vector<ProfileRow> rows;
+
+    for ( int i = 0; i < 256; i++ )
+    {
+        if ( entries[i].Count == 0 )
+            continue;
+
+        ProfileRow row = {};
+
+        row.Name = getName( static_cast<uint8_t>( i ) );
+        row.Entry = &entries[i];
+
+        if ( row.Name == nullptr )
+            snprintf( row.NameBuf, sizeof row.NameBuf, "$%02X", i );
+
+        rows.push_back( row );
+    }
+
+    std::stable_sort( rows.begin(), rows.end(), []( const ProfileRow& a, const ProfileRow& b )
+    {
+        return a.Entry->Count > b.Entry->Count;
+    } );
+
+    return rows;
+}
+
+static const char* GetRowName( const ProfileRow& row )
+{
+    return row.Name != nullptr ? row.Name : row.NameBuf;
+}
+
+static void Append( std::string& str, const char* format, ... )
+{
+    char buf[128];
+    va_list args;
+
+    va_start( args, format );
+    int len = vsnprintf( buf, sizeof buf, format, args );
+    va_end( args );
+
+    if ( len > 0 )
+        str.append( buf, std::min( static_cast<size_t>( len ), sizeof buf - 1 ) );
+}
+
+static void AppendTextRows( std::string& str, const char* title, const MachineProfile& profile, const MachineProfile::Entry* entries, NameFunc getName )
+{
+    auto rows = GetProfileRows( entries, getName );
+
+    if ( profile.Timing )
+        Append( str, "%-16s %20s %20s\n", title, "Count", "Cycles" );
+    else
+        Append( str, "%-16s %20s\n", title, "Count" );
+
+    for ( const auto& row : rows )
+    {
+        if ( profile.Timing )
+            Append( str, "%-16s %20" PRIu64 " %20" PRIu64 "\n", GetRowName( row ), row.Entry->Count, row.Entry->Cycles );
+        else
+            Append( str, "%-16s %20" PRIu64 "\n", GetRowName( row ), row.Entry->Count );
+    }
+}
+
+static void AppendJsonRows( std::string& str, const char* key, const MachineProfile& profile, const MachineProfile::Entry* entries, NameFunc getName )
+{
+    auto rows = GetProfileRows( entries, getName );
+
+    Append( str, "  \"%s\": [", key );
+
+    for ( size_t i = 0; i < rows.size(); i++ )
+    {
+        Append( str, "%s\n    { \"name\": \"%s\", \"count\": %" PRIu64,
+            (i > 0 ? "," : ""),
+            GetRowName( rows[i] ),
+            rows[i].Entry->Count );
+
+        if ( profile.Timing )
+            Append( str, ", \"cycles\": %" PRIu64, rows[i].Entry->Cycles );
+
+        str.append( " }" );
+    }
+
+    str.append( rows.empty() ? "]" : "\n  ]" );
+}
+
+std::string FormatProfileText( const MachineProfile& profile )
+{
+    std::string text;
+
+    AppendTextRows( text, "Opcode", profile, profile.Ops, Disassembler::GetOpName );
+    text.append( "\n" );
+    AppendTextRows( text, "Primitive", profile, profile.Prims, Disassembler::GetPrimitiveName );
+
+    return text;
+}
+
+std::string FormatProfileJson( const MachineProfile& profile )
+{
+    std::string json;
+
+    json.append( "{\n" );
+    Append( json, "  \"timing\": %s,\n", profile.Timing ? "true" : "false" );
+    AppendJsonRows( json, "ops", profile, profile.Ops, Disassembler::GetOpName );
+    json.append( ",\n" );
+    AppendJsonRows( json, "prims", profile, profile.Prims, Disassembler::GetPrimitiveName );
+    json.append( "\n}\n" );
+
+    return json;
+}
+
+}
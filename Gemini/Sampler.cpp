@@ -0,0 +1,210 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+#include "pch.h"
+#include "Sampler.h"
+#include "LangCommon.h"
+#include "Syntax.h"
+#include "VmCommon.h"
+#include <chrono>
+#include <inttypes.h>
+#include <stdio.h>
+
+
+namespace Gemini
+{
+
+SamplingProfiler::SamplingProfiler() :
+    mSampleRequested( false ),
+    mTimerStopping( false ),
+    mRoot{}
+{
+}
+
+SamplingProfiler::~SamplingProfiler()
+{
+    Stop();
+}
+
+int SamplingProfiler::Start( U32 periodMicroseconds )
+{
+    if ( periodMicroseconds == 0 )
+        return ERR_BAD_ARG;
+
+    if ( mTimer.joinable() )
+        return ERR_BAD_STATE;
+
+    mTimerStopping = false;
+    mTimer = std::thread( &SamplingProfiler::RunTimer, this, periodMicroseconds );
+
+    return ERR_NONE;
+}
+
+void SamplingProfiler::Stop()
+{
+    if ( !mTimer.joinable() )
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock( mMutex );
+        mTimerStopping = true;
+    }
+
+    mTimerCond.notify_all();
+    mTimer.join();
+
+    mSampleRequested = false;
+}
+
+void SamplingProfiler::RequestSample()
+{
+    mSampleRequested.store( true, std::memory_order_relaxed );
+}
+
+void SamplingProfiler::RunTimer( U32 periodMicroseconds )
+{
+    std::unique_lock<std::mutex> lock( mMutex );
+    auto period = std::chrono::microseconds( periodMicroseconds );
+
+    while ( !mTimerCond.wait_for( lock, period, [this] { return mTimerStopping; } ) )
+    {
+        RequestSample();
+    }
+}
+
+U64 SamplingProfiler::GetSampleCount()
+{
+    std::lock_guard<std::mutex> lock( mMutex );
+
+    return mRoot.TotalSamples;
+}
+
+void SamplingProfiler::Clear()
+{
+    std::lock_guard<std::mutex> lock( mMutex );
+
+    mRoot.Children.clear();
+    mRoot.Samples = 0;
+    mRoot.TotalSamples = 0;
+}
+
+const SamplingProfiler::CallNode& SamplingProfiler::GetCallTree() const
+{
+    return mRoot;
+}
+
+void SamplingProfiler::AddSample( const Machine& machine )
+{
+    std::lock_guard<std::mutex> lock( mMutex );
+
+    size_t depth = machine.GetCallStack( mStackBuf, MAX_SAMPLE_DEPTH );
+
+    // Return addresses point after the call, which might be the start of
+    // the next function
+
+    for ( size_t i = 1; i < depth; i++ )
+        mStackBuf[i]--;
+
+    CallNode* node = &mRoot;
+
+    node->TotalSamples++;
+
+    for ( size_t i = depth; i > 0; i-- )
+    {
+        U32 addrWord = mStackBuf[i - 1];
+        auto& child = node->Children[addrWord];
+
+        if ( !child )
+        {
+            child.reset( new CallNode() );
+            child->AddrWord = addrWord;
+        }
+
+        node = child.get();
+        node->TotalSamples++;
+    }
+
+    node->Samples++;
+}
+
+static void CollapseNode(
+    const SamplingProfiler::CallNode& node,
+    SamplingProfiler::ISymbols* symbols,
+    std::string& path,
+    std::map<std::string, U64>& lines )
+{
+    for ( const auto& [addrWord, child] : node.Children )
+    {
+        std::string name;
+
+        if ( symbols == nullptr || !symbols->FindFunctionName( addrWord, name ) )
+        {
+            char buf[16];
+
+            snprintf( buf, sizeof buf, "%02X:%06X", CodeAddr::GetModule( addrWord ), CodeAddr::GetAddress( addrWord ) );
+            name = buf;
+        }
+
+        size_t pathLen = path.size();
+
+        if ( pathLen > 0 )
+            path.append( ";" );
+
+        path.append( name );
+
+        if ( child->Samples > 0 )
+            lines[path] += child->Samples;
+
+        CollapseNode( *child, symbols, path, lines );
+
+        path.resize( pathLen );
+    }
+}
+
+std::string SamplingProfiler::FormatCollapsed( ISymbols* symbols )
+{
+    std::map<std::string, U64> lines;
+    std::string path;
+
+    {
+        std::lock_guard<std::mutex> lock( mMutex );
+
+        CollapseNode( mRoot, symbols, path, lines );
+    }
+
+    std::string text;
+
+    for ( const auto& [stack, count] : lines )
+    {
+        char countStr[24];
+
+        snprintf( countStr, sizeof countStr, " %" PRIu64 "\n", count );
+
+        text.append( stack );
+        text.append( countStr );
+    }
+
+    return text;
+}
+
+
+CompilerSymbols::CompilerSymbols( const CompilerAttrs& attrs ) :
+    mAttrs( attrs )
+{
+}
+
+bool CompilerSymbols::FindFunctionName( U32 addrWord, std::string& name )
+{
+    auto func = mAttrs.FindFunctionContaining( addrWord );
+
+    if ( !func )
+        return false;
+
+    name = func->Name;
+    return true;
+}
+
+}
@@ -0,0 +1,113 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+#pragma once
+
+#include "Machine.h"
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace Gemini
+{
+
+class CompilerAttrs;
+
+// Takes samples of the script call stacks of the machines that it's set on
+// with Machine::SetSampler.
+//
+// A sample is requested by setting a flag, either by the timer that Start
+// runs, or by calling RequestSample, which is safe to call from a signal
+// handler. The interpreter checks the flag at backward branches and calls,
+// and the first machine that sees it walks its stack frames and adds the
+// stack to the call tree. JIT and AOT code only check it when they hand an
+// instruction to the interpreter.
+//
+// Addresses in the tree are inside the functions they stand for: the PC for
+// the innermost frame, and the byte before the return address for the others.
+
+class SamplingProfiler
+{
+    friend class Machine;
+
+public:
+    static constexpr size_t MAX_SAMPLE_DEPTH = 256;
+
+    struct CallNode
+    {
+        U32     AddrWord;
+        U64     Samples;        // Samples where this was the innermost frame
+        U64     TotalSamples;   // Samples where this was on the stack
+        std::map<U32, std::unique_ptr<CallNode>> Children;
+    };
+
+    // Maps a code address to the name of the function that contains it
+    class ISymbols
+    {
+    public:
+        virtual bool FindFunctionName( U32 addrWord, std::string& name ) = 0;
+    };
+
+private:
+    std::atomic<bool>       mSampleRequested;
+    std::mutex              mMutex;
+    std::condition_variable mTimerCond;
+    std::thread             mTimer;
+    bool                    mTimerStopping;
+    CallNode                mRoot;
+    U32                     mStackBuf[MAX_SAMPLE_DEPTH];
+
+public:
+    SamplingProfiler();
+    ~SamplingProfiler();
+
+    SamplingProfiler( const SamplingProfiler& ) = delete;
+    SamplingProfiler& operator=( const SamplingProfiler& ) = delete;
+
+    // Starts a thread that requests a sample every period
+    int Start( U32 periodMicroseconds );
+    void Stop();
+
+    void RequestSample();
+
+    U64 GetSampleCount();
+    void Clear();
+
+    // The root has no address. Its children are the outermost frames. Don't
+    // use the tree while machines are still being sampled.
+    const CallNode& GetCallTree() const;
+
+    // One line for each distinct stack, outermost function first, separated
+    // by semicolons, then the sample count. This is the collapsed format
+    // that flame graph tools read. Without symbols, or for addresses they
+    // don't know, the frames are shown as module:address in hex.
+    std::string FormatCollapsed( ISymbols* symbols = nullptr );
+
+private:
+    void AddSample( const Machine& machine );
+    void RunTimer( U32 periodMicroseconds );
+};
+
+
+// Names functions from the metadata that the compiler records
+
+class CompilerSymbols : public SamplingProfiler::ISymbols
+{
+    const CompilerAttrs& mAttrs;
+
+public:
+    CompilerSymbols( const CompilerAttrs& attrs );
+
+    virtual bool FindFunctionName( U32 addrWord, std::string& name ) override;
+};
+
+}
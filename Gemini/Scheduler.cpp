@@ -0,0 +1,275 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+#include "pch.h"
+#include "Scheduler.h"
+#include <chrono>
+
+
+namespace Gemini
+{
+
+Scheduler::Scheduler( unsigned workerCount, U32 sliceBudget ) :
+    mSliceBudget( sliceBudget != 0 ? sliceBudget : DEFAULT_SLICE_BUDGET )
+{
+    if ( workerCount == 0 )
+        workerCount = std::max( 1u, std::thread::hardware_concurrency() );
+
+    for ( unsigned i = 0; i < workerCount; i++ )
+        mWorkers.push_back( std::make_unique<Worker>() );
+
+    // Start them after they all exist, because they look at each other's queues
+
+    for ( size_t i = 0; i < mWorkers.size(); i++ )
+        mWorkers[i]->Thread = std::thread( &Scheduler::WorkerMain, this, i );
+}
+
+Scheduler::~Scheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock( mIdleMutex );
+        mStopping = true;
+    }
+
+    mIdleCond.notify_all();
+
+    for ( auto& worker : mWorkers )
+        worker->Thread.join();
+}
+
+unsigned Scheduler::GetWorkerCount() const
+{
+    return static_cast<unsigned>( mWorkers.size() );
+}
+
+Scheduler::TaskId Scheduler::Add( Machine* machine )
+{
+    Task* task;
+    size_t workerIndex;
+
+    {
+        std::lock_guard<std::mutex> lock( mTaskMutex );
+
+        auto newTask = std::make_unique<Task>();
+
+        newTask->Vm = machine;
+        newTask->Id = static_cast<TaskId>( mTasks.size() );
+        newTask->State = TaskState::Queued;
+        newTask->WakePending = false;
+        newTask->Stats = {};
+
+        task = newTask.get();
+        mTasks.push_back( std::move( newTask ) );
+        mRunningCount++;
+
+        // Spread new machines around, and let stealing even out the rest
+
+        workerIndex = mNextWorker;
+        mNextWorker = (mNextWorker + 1) % mWorkers.size();
+    }
+
+    Enqueue( task, workerIndex );
+
+    return task->Id;
+}
+
+void Scheduler::Wake( TaskId id )
+{
+    Task* task = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock( mTaskMutex );
+
+        if ( id >= mTasks.size() )
+            return;
+
+        Task* candidate = mTasks[id].get();
+
+        if ( candidate->State == TaskState::Waiting )
+        {
+            candidate->State = TaskState::Queued;
+            task = candidate;
+        }
+        else if ( candidate->State != TaskState::Done )
+        {
+            candidate->WakePending = true;
+        }
+    }
+
+    if ( task != nullptr )
+        Enqueue( task, id % mWorkers.size() );
+}
+
+void Scheduler::WaitAll()
+{
+    std::unique_lock<std::mutex> lock( mTaskMutex );
+
+    mDoneCond.wait( lock, [this] { return mRunningCount == 0; } );
+}
+
+Scheduler::TaskStats Scheduler::GetStats( TaskId id ) const
+{
+    std::lock_guard<std::mutex> lock( mTaskMutex );
+
+    if ( id >= mTasks.size() )
+        return {};
+
+    return mTasks[id]->Stats;
+}
+
+void Scheduler::Enqueue( Task* task, size_t workerIndex )
+{
+    Worker& worker = *mWorkers[workerIndex];
+
+    {
+        std::lock_guard<std::mutex> lock( worker.Mutex );
+        worker.Queue.push_back( task );
+    }
+
+    // Take the idle lock, so that a worker can't miss the count going up
+    // between checking it and going to sleep
+
+    {
+        std::lock_guard<std::mutex> lock( mIdleMutex );
+        mQueuedCount++;
+    }
+
+    mIdleCond.notify_one();
+}
+
+Scheduler::Task* Scheduler::Dequeue( size_t workerIndex, bool& stolen )
+{
+    // Run the own queue in order, and steal from the other end of the others,
+    // where the work that's waited the least is
+
+    {
+        Worker& worker = *mWorkers[workerIndex];
+        std::lock_guard<std::mutex> lock( worker.Mutex );
+
+        if ( !worker.Queue.empty() )
+        {
+            Task* task = worker.Queue.front();
+            worker.Queue.pop_front();
+            mQueuedCount--;
+            stolen = false;
+            return task;
+        }
+    }
+
+    for ( size_t i = 1; i < mWorkers.size(); i++ )
+    {
+        Worker& victim = *mWorkers[(workerIndex + i) % mWorkers.size()];
+        std::lock_guard<std::mutex> lock( victim.Mutex );
+
+        if ( !victim.Queue.empty() )
+        {
+            Task* task = victim.Queue.back();
+            victim.Queue.pop_back();
+            mQueuedCount--;
+            stolen = true;
+            return task;
+        }
+    }
+
+    return nullptr;
+}
+
+void Scheduler::WorkerMain( size_t workerIndex )
+{
+    while ( !mStopping )
+    {
+        bool stolen = false;
+        Task* task = Dequeue( workerIndex, stolen );
+
+        if ( task != nullptr )
+        {
+            if ( stolen )
+            {
+                std::lock_guard<std::mutex> lock( mTaskMutex );
+                task->Stats.Steals++;
+            }
+
+            RunSlice( task, workerIndex );
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock( mIdleMutex );
+
+        mIdleCond.wait( lock, [this] { return mQueuedCount > 0 || mStopping; } );
+    }
+}
+
+void Scheduler::RunSlice( Task* task, size_t workerIndex )
+{
+    using Clock = std::chrono::steady_clock;
+
+    Machine* machine = task->Vm;
+
+    {
+        std::lock_guard<std::mutex> lock( mTaskMutex );
+        task->State = TaskState::Running;
+    }
+
+    auto startTime = Clock::now();
+
+    int err = machine->Run( mSliceBudget );
+
+    auto endTime = Clock::now();
+
+    bool requeue = false;
+    bool finished = false;
+
+    {
+        std::lock_guard<std::mutex> lock( mTaskMutex );
+
+        TaskStats& stats = task->Stats;
+
+        stats.Slices++;
+        stats.RunNanoseconds += static_cast<U64>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>( endTime - startTime ).count() );
+
+        if ( err == ERR_BUDGET_EXHAUSTED )
+        {
+            stats.Preemptions++;
+            requeue = true;
+        }
+        else if ( err == ERR_YIELDED )
+        {
+            stats.Yields++;
+
+            if ( !machine->HasNativeContinuation() || task->WakePending )
+            {
+                task->WakePending = false;
+                requeue = true;
+            }
+            else
+            {
+                stats.Waits++;
+                task->State = TaskState::Waiting;
+            }
+        }
+        else
+        {
+            stats.Result = err;
+            stats.Done = true;
+            task->State = TaskState::Done;
+
+            mRunningCount--;
+            finished = mRunningCount == 0;
+        }
+
+        if ( requeue )
+            task->State = TaskState::Queued;
+    }
+
+    if ( requeue )
+        Enqueue( task, workerIndex );
+
+    if ( finished )
+        mDoneCond.notify_all();
+}
+
+}
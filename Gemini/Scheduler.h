@@ -0,0 +1,126 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+#pragma once
+
+#include "Machine.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace Gemini
+{
+
+// Runs many machines on a pool of worker threads.
+//
+// Each worker has its own run queue, and takes work from the others when
+// its own is empty. A machine runs for a slice of its instruction budget at a
+// time, then goes to the back of the queue, so that no script can hold a
+// worker.
+//
+// A machine that stops with ERR_YIELDED goes back in the queue, unless a
+// native function yielded with Machine::Yield. Then it waits until the host
+// calls Wake, for example when the I/O that the continuation needs is done.
+// Any other result finishes the machine.
+//
+// A machine must not be used by anything else while it's in the scheduler.
+// Destroying the scheduler stops the workers after their current slices,
+// whether or not the machines are done.
+
+class Scheduler
+{
+public:
+    using TaskId = U32;
+
+    static constexpr U32 DEFAULT_SLICE_BUDGET = 10000;
+
+    struct TaskStats
+    {
+        U32     Slices;             // Times the machine was run
+        U32     Preemptions;        // Slices that used up the budget
+        U32     Yields;             // Slices that ended in ERR_YIELDED
+        U32     Waits;              // Yields that waited for Wake
+        U32     Steals;             // Times a worker took it from another one's queue
+        U64     RunNanoseconds;     // Time spent in Machine::Run
+        int     Result;             // How the machine finished, if Done
+        bool    Done;
+    };
+
+private:
+    enum class TaskState
+    {
+        Queued,
+        Running,
+        Waiting,
+        Done,
+    };
+
+    struct Task
+    {
+        Machine*    Vm;
+        TaskId      Id;
+        TaskState   State;
+        bool        WakePending;
+        TaskStats   Stats;
+    };
+
+    struct Worker
+    {
+        std::mutex          Mutex;
+        std::deque<Task*>   Queue;
+        std::thread         Thread;
+    };
+
+    U32                                 mSliceBudget;
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+
+    // Guards the tasks, their states and stats
+    mutable std::mutex                  mTaskMutex;
+    std::vector<std::unique_ptr<Task>>  mTasks;
+    std::condition_variable             mDoneCond;
+    size_t                              mRunningCount = 0;
+    size_t                              mNextWorker = 0;
+
+    std::mutex                          mIdleMutex;
+    std::condition_variable             mIdleCond;
+    std::atomic<size_t>                 mQueuedCount{ 0 };
+    std::atomic<bool>                   mStopping{ false };
+
+public:
+    // A worker count of 0 uses one for each hardware thread
+    explicit Scheduler( unsigned workerCount = 0, U32 sliceBudget = DEFAULT_SLICE_BUDGET );
+    ~Scheduler();
+
+    Scheduler( const Scheduler& ) = delete;
+    Scheduler& operator=( const Scheduler& ) = delete;
+
+    unsigned GetWorkerCount() const;
+
+    // The machine must have been started
+    TaskId Add( Machine* machine );
+
+    // Lets a machine waiting on a native continuation run again. If it hasn't
+    // started waiting yet, then it won't wait the next time.
+    void Wake( TaskId id );
+
+    // Blocks until every machine added so far is done
+    void WaitAll();
+
+    TaskStats GetStats( TaskId id ) const;
+
+private:
+    void Enqueue( Task* task, size_t workerIndex );
+    Task* Dequeue( size_t workerIndex, bool& stolen );
+    void WorkerMain( size_t workerIndex );
+    void RunSlice( Task* task, size_t workerIndex );
+};
+
+}
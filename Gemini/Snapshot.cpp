@@ -0,0 +1,228 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+#include "pch.h"
+#include "Common.h"
+#include "Machine.h"
+#include "VmCommon.h"
+#include <algorithm>
+
+
+// Serialized snapshot, little endian
+//
+//   U32    Magic
+//   U16    Version
+//   U16    Stack size
+//   U16    Frame pointer
+//   U8     Module index
+//   U8     Reserved, 0
+//   U32    PC
+//   U32    Live cell count
+//   I32    Live cells, from the stack pointer to the end
+
+namespace Gemini
+{
+
+constexpr U32 SNAPSHOT_MAGIC    = 0x534D4547;   // "GEMS"
+constexpr U16 SNAPSHOT_VERSION  = 1;
+constexpr size_t SNAPSHOT_HEADER_SIZE = 20;
+
+
+int Machine::Snapshot( MachineSnapshot& snapshot ) const
+{
+    if ( mStack == nullptr )
+        return ERR_NOT_RUNING;
+
+    if ( mNativeNestingLevel != 0 )
+        return ERR_BAD_STATE;
+
+    snapshot.Stack.assign( mSP, &mStack[mStackSize] );
+    snapshot.StackSize                  = mStackSize;
+    snapshot.FramePtr                   = mFramePtr;
+    snapshot.PC                         = mPC;
+    snapshot.ModIndex                   = mModIndex;
+    snapshot.NativeContinuation         = mNativeContinuation;
+    snapshot.NativeContinuationContext  = mNativeContinuationContext;
+    snapshot.NativeContinuationFlags    = mNativeContinuationFlags;
+
+    return ERR_NONE;
+}
+
+int Machine::Restore( const MachineSnapshot& snapshot )
+{
+    return SetState(
+        snapshot.Stack.data(),
+        snapshot.Stack.size(),
+        snapshot.StackSize,
+        snapshot.FramePtr,
+        snapshot.PC,
+        snapshot.ModIndex,
+        snapshot.NativeContinuation,
+        snapshot.NativeContinuationContext,
+        snapshot.NativeContinuationFlags );
+}
+
+int Machine::Fork( Machine& child ) const
+{
+    if ( &child == this )
+        return ERR_BAD_ARG;
+
+    if ( mStack == nullptr )
+        return ERR_NOT_RUNING;
+
+    if ( mNativeNestingLevel != 0 )
+        return ERR_BAD_STATE;
+
+    return child.SetState(
+        mSP,
+        &mStack[mStackSize] - mSP,
+        mStackSize,
+        mFramePtr,
+        mPC,
+        mModIndex,
+        mNativeContinuation,
+        mNativeContinuationContext,
+        mNativeContinuationFlags );
+}
+
+int Machine::SetState(
+    const CELL* liveStack,
+    size_t liveCount,
+    U16 stackSize,
+    U16 framePtr,
+    U32 pc,
+    U8 modIndex,
+    NativeFunc continuation,
+    UserContext continuationContext,
+    U8 continuationFlags )
+{
+    if ( mStack == nullptr )
+        return ERR_NOT_RUNING;
+
+    if ( mNativeNestingLevel != 0 )
+        return ERR_BAD_STATE;
+
+    if ( stackSize != mStackSize || liveCount > mStackSize || framePtr > mStackSize )
+        return ERR_BAD_ARG;
+
+    const Module* module = mMod;
+
+    // A machine that isn't running only has results on its stack, and its
+    // module doesn't matter until it's started again
+
+    if ( framePtr < stackSize )
+    {
+        if ( modIndex == mModIndex && mMod != nullptr )
+            module = mMod;
+        else
+            module = GetModule( modIndex );
+
+        if ( module == nullptr )
+            return ERR_BYTECODE_NOT_FOUND;
+
+        if ( module->CodeBase == nullptr
+            || module->CodeSize <= SENTINEL_SIZE )
+            return ERR_BAD_MODULE;
+
+        if ( pc >= module->CodeSize - SENTINEL_SIZE )
+            return ERR_BAD_ADDRESS;
+
+        // Verified code runs without stack checks, so it can only go on from
+        // an instruction where the verifier knows the stack height. A native
+        // continuation goes on from its frame's return address instead, which
+        // Run checks the same way.
+
+        I32 height = framePtr - static_cast<I32>( mStackSize - liveCount );
+
+        if ( continuation == nullptr
+            && module->Verified != nullptr
+            && module->Verified->Heights[pc] != height )
+            return ERR_BAD_ADDRESS;
+    }
+
+    mSP = &mStack[mStackSize - liveCount];
+
+    std::copy_n( liveStack, liveCount, mSP );
+
+    mFramePtr                   = framePtr;
+    mPC                         = pc;
+    mModIndex                   = modIndex;
+    mMod                        = module;
+    mNativeContinuation         = continuation;
+    mNativeContinuationContext  = continuationContext;
+    mNativeContinuationFlags    = continuationFlags;
+
+    return ERR_NONE;
+}
+
+
+int SerializeSnapshot( const MachineSnapshot& snapshot, std::vector<U8>& bytes )
+{
+    if ( snapshot.NativeContinuation != nullptr )
+        return ERR_BAD_STATE;
+
+    if ( snapshot.Stack.size() > snapshot.StackSize )
+        return ERR_BAD_ARG;
+
+    bytes.resize( SNAPSHOT_HEADER_SIZE + snapshot.Stack.size() * sizeof( CELL ) );
+
+    U8* p = bytes.data();
+
+    WriteU32( p, SNAPSHOT_MAGIC );
+    WriteU16( p, SNAPSHOT_VERSION );
+    WriteU16( p, snapshot.StackSize );
+    WriteU16( p, snapshot.FramePtr );
+    *p++ = snapshot.ModIndex;
+    *p++ = 0;
+    WriteU32( p, snapshot.PC );
+    WriteU32( p, static_cast<U32>( snapshot.Stack.size() ) );
+
+    for ( CELL cell : snapshot.Stack )
+        WriteI32( p, cell );
+
+    return ERR_NONE;
+}
+
+int DeserializeSnapshot( const U8* bytes, size_t size, MachineSnapshot& snapshot )
+{
+    if ( bytes == nullptr || size < SNAPSHOT_HEADER_SIZE )
+        return ERR_BAD_ARG;
+
+    const U8* p = bytes;
+
+    if ( ReadU32( p ) != SNAPSHOT_MAGIC || ReadU16( p ) != SNAPSHOT_VERSION )
+        return ERR_BAD_ARG;
+
+    U16 stackSize   = ReadU16( p );
+    U16 framePtr    = ReadU16( p );
+    U8  modIndex    = ReadU8( p );
+    U8  reserved    = ReadU8( p );
+    U32 pc          = ReadU32( p );
+    U32 liveCount   = ReadU32( p );
+
+    if ( reserved != 0
+        || liveCount > stackSize
+        || framePtr > stackSize
+        || size != SNAPSHOT_HEADER_SIZE + static_cast<size_t>( liveCount ) * sizeof( CELL ) )
+        return ERR_BAD_ARG;
+
+    snapshot.Stack.resize( liveCount );
+
+    for ( U32 i = 0; i < liveCount; i++ )
+        snapshot.Stack[i] = ReadI32( p );
+
+    snapshot.StackSize                  = stackSize;
+    snapshot.FramePtr                   = framePtr;
+    snapshot.PC                         = pc;
+    snapshot.ModIndex                   = modIndex;
+    snapshot.NativeContinuation         = nullptr;
+    snapshot.NativeContinuationContext  = 0;
+    snapshot.NativeContinuationFlags    = 0;
+
+    return ERR_NONE;
+}
+
+}
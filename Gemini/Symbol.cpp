@@ -0,0 +1,105 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+#include "pch.h"
+#include "Symbol.h"
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+
+namespace Gemini
+{
+
+namespace
+{
+
+// Split up by hash, so that threads parsing at the same time seldom wait for
+// each other. The strings are kept in deques, so they don't move. The
+// index is keyed by views of them, so that looking up a name that a parser
+// points to in its source doesn't copy it.
+
+class SymbolPool
+{
+    static constexpr size_t ShardCount = 16;
+
+    struct Shard
+    {
+        std::mutex                      Mutex;
+        std::deque<std::string>         Strings;
+        std::unordered_map<std::string_view, const std::string*> Index;
+    };
+
+    Shard   mShards[ShardCount];
+
+public:
+    const std::string* Intern( std::string_view str )
+    {
+        size_t hash = std::hash<std::string_view>()( str );
+        Shard& shard = mShards[hash % ShardCount];
+
+        std::lock_guard<std::mutex> lock( shard.Mutex );
+
+        if ( auto it = shard.Index.find( str ); it != shard.Index.end() )
+            return it->second;
+
+        const std::string* interned = &shard.Strings.emplace_back( str );
+
+        shard.Index.insert( { *interned, interned } );
+
+        return interned;
+    }
+};
+
+// Never destroyed, so that symbols can still be used while other statics are
+// destroyed
+SymbolPool& GetPool()
+{
+    static SymbolPool* pool = new SymbolPool();
+
+    return *pool;
+}
+
+// Never destroyed, like the pool
+const std::string* GetEmptyString()
+{
+    static const std::string* empty = new std::string();
+
+    return empty;
+}
+
+const std::string* Intern( std::string_view str )
+{
+    if ( str.empty() )
+        return GetEmptyString();
+
+    return GetPool().Intern( str );
+}
+
+}
+
+
+Symbol::Symbol() :
+    mString( GetEmptyString() )
+{
+}
+
+Symbol::Symbol( const std::string& str ) :
+    mString( Intern( str ) )
+{
+}
+
+Symbol::Symbol( const char* str ) :
+    mString( Intern( str ) )
+{
+}
+
+Symbol::Symbol( std::string_view str ) :
+    mString( Intern( str ) )
+{
+}
+
+}
@@ -0,0 +1,263 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+
+namespace Gemini
+{
+
+// A name interned in a pool shared by the parsers and compilers of all
+// threads. Equal names are the same Symbol, so comparing and hashing symbols
+// doesn't look at their characters. Interned names stay for the life of the
+// process.
+
+class Symbol
+{
+    const std::string*  mString;
+
+public:
+    Symbol();
+    Symbol( const std::string& str );
+    Symbol( const char* str );
+    Symbol( std::string_view str );
+
+    const std::string& GetString() const
+    {
+        return *mString;
+    }
+
+    operator const std::string&() const
+    {
+        return *mString;
+    }
+
+    const char* c_str() const
+    {
+        return mString->c_str();
+    }
+
+    size_t size() const
+    {
+        return mString->size();
+    }
+
+    bool empty() const
+    {
+        return mString->empty();
+    }
+
+    uint64_t GetHash() const
+    {
+        return reinterpret_cast<uintptr_t>( mString ) * 0x9E3779B97F4A7C15;
+    }
+
+    friend bool operator==( const Symbol& a, const Symbol& b )
+    {
+        return a.mString == b.mString;
+    }
+
+    friend bool operator!=( const Symbol& a, const Symbol& b )
+    {
+        return a.mString != b.mString;
+    }
+};
+
+
+// A hash table keyed by symbols. It keeps its entries in the order that they
+// were added, so that walking it gives the same order in every run. Erasing
+// an entry moves the last one into its place.
+//
+// Unlike std::map, adding an entry can move the others. So, iterators and
+// references to entries don't last past an insert.
+
+template <typename T>
+class SymbolMap
+{
+public:
+    using key_type          = Symbol;
+    using mapped_type       = T;
+    using value_type        = std::pair<Symbol, T>;
+    using iterator          = typename std::vector<value_type>::iterator;
+    using const_iterator    = typename std::vector<value_type>::const_iterator;
+
+private:
+    static constexpr uint32_t EmptySlot = UINT32_MAX;
+    static constexpr uint32_t MinSlotShift = 3;
+
+    // Indexes of the entries, placed by hash, with linear probing. There are
+    // at least twice as many slots as entries.
+    std::vector<value_type> mEntries;
+    std::vector<uint32_t>   mSlots;
+    uint32_t                mSlotShift = 0;
+
+public:
+    iterator begin()                { return mEntries.begin(); }
+    iterator end()                  { return mEntries.end(); }
+    const_iterator begin() const    { return mEntries.begin(); }
+    const_iterator end() const      { return mEntries.end(); }
+
+    size_t size() const
+    {
+        return mEntries.size();
+    }
+
+    bool empty() const
+    {
+        return mEntries.empty();
+    }
+
+    iterator find( const Symbol& key )
+    {
+        uint32_t slot = FindSlot( key );
+
+        return slot == EmptySlot ? mEntries.end() : mEntries.begin() + mSlots[slot];
+    }
+
+    const_iterator find( const Symbol& key ) const
+    {
+        uint32_t slot = FindSlot( key );
+
+        return slot == EmptySlot ? mEntries.end() : mEntries.begin() + mSlots[slot];
+    }
+
+    size_t count( const Symbol& key ) const
+    {
+        return FindSlot( key ) == EmptySlot ? 0 : 1;
+    }
+
+    std::pair<iterator, bool> insert( value_type value )
+    {
+        if ( auto it = find( value.first ); it != mEntries.end() )
+            return { it, false };
+
+        if ( (mEntries.size() + 1) * 2 > mSlots.size() )
+            Grow();
+
+        uint32_t slot = GetHomeSlot( value.first );
+
+        while ( mSlots[slot] != EmptySlot )
+            slot = (slot + 1) & GetSlotMask();
+
+        mSlots[slot] = static_cast<uint32_t>( mEntries.size() );
+        mEntries.push_back( std::move( value ) );
+
+        return { mEntries.end() - 1, true };
+    }
+
+    T& operator[]( const Symbol& key )
+    {
+        return insert( value_type( key, T() ) ).first->second;
+    }
+
+    // Returns the entry that took the erased one's place
+    iterator erase( const_iterator it )
+    {
+        size_t index = it - mEntries.cbegin();
+
+        RemoveSlot( FindSlot( it->first ) );
+
+        if ( index != mEntries.size() - 1 )
+        {
+            mSlots[FindSlot( mEntries.back().first )] = static_cast<uint32_t>( index );
+            mEntries[index] = std::move( mEntries.back() );
+        }
+
+        mEntries.pop_back();
+
+        return mEntries.begin() + index;
+    }
+
+    size_t erase( const Symbol& key )
+    {
+        auto it = find( key );
+
+        if ( it == mEntries.end() )
+            return 0;
+
+        erase( it );
+        return 1;
+    }
+
+    void clear()
+    {
+        mEntries.clear();
+        mSlots.clear();
+        mSlotShift = 0;
+    }
+
+private:
+    uint32_t GetSlotMask() const
+    {
+        return static_cast<uint32_t>( mSlots.size() - 1 );
+    }
+
+    uint32_t GetHomeSlot( const Symbol& key ) const
+    {
+        return static_cast<uint32_t>( key.GetHash() >> (64 - mSlotShift) );
+    }
+
+    uint32_t FindSlot( const Symbol& key ) const
+    {
+        if ( mSlots.empty() )
+            return EmptySlot;
+
+        for ( uint32_t slot = GetHomeSlot( key ); mSlots[slot] != EmptySlot; slot = (slot + 1) & GetSlotMask() )
+        {
+            if ( mEntries[mSlots[slot]].first == key )
+                return slot;
+        }
+
+        return EmptySlot;
+    }
+
+    // Shifts back the entries after the slot that would no longer be found
+    // past the hole
+    void RemoveSlot( uint32_t hole )
+    {
+        uint32_t mask = GetSlotMask();
+
+        for ( uint32_t slot = (hole + 1) & mask; mSlots[slot] != EmptySlot; slot = (slot + 1) & mask )
+        {
+            uint32_t home = GetHomeSlot( mEntries[mSlots[slot]].first );
+            bool stays = hole <= slot
+                ? (hole < home && home <= slot)
+                : (hole < home || home <= slot);
+
+            if ( !stays )
+            {
+                mSlots[hole] = mSlots[slot];
+                hole = slot;
+            }
+        }
+
+        mSlots[hole] = EmptySlot;
+    }
+
+    void Grow()
+    {
+        mSlotShift = mSlots.empty() ? MinSlotShift : mSlotShift + 1;
+        mSlots.assign( size_t( 1 ) << mSlotShift, EmptySlot );
+
+        for ( uint32_t i = 0; i < mEntries.size(); i++ )
+        {
+            uint32_t slot = GetHomeSlot( mEntries[i].first );
+
+            while ( mSlots[slot] != EmptySlot )
+                slot = (slot + 1) & GetSlotMask();
+
+            mSlots[slot] = i;
+        }
+    }
+};
+
+}
@@ -13,6 +13,14 @@
 namespace Gemini
 {
 
+void SyntaxDeleter::operator()( Syntax* syntax ) const
+{
+    if ( syntax->InArena )
+        syntax->~Syntax();
+    else
+        delete syntax;
+}
+
 Declaration* Syntax::GetDecl()
 {
     return nullptr;
@@ -28,13 +36,7 @@ NameExpr::NameExpr()
     Kind = SyntaxKind::Name;
 }
 
-NameExpr::NameExpr( const std::string& str ) :
-    String( str )
-{
-    Kind = SyntaxKind::Name;
-}
-
-NameExpr::NameExpr( std::string&& str ) :
+NameExpr::NameExpr( Symbol str ) :
     String( str )
 {
     Kind = SyntaxKind::Name;
@@ -107,6 +109,11 @@ AddrOfExpr::AddrOfExpr()
     Kind = SyntaxKind::AddrOfExpr;
 }
 
+BinaryExpr::BinaryExpr()
+{
+    Kind = SyntaxKind::Binary;
+}
+
 IndexExpr::IndexExpr()
 {
     Kind = SyntaxKind::Index;
@@ -122,6 +129,16 @@ DotExpr::DotExpr()
     Kind = SyntaxKind::DotExpr;
 }
 
+CallExpr::CallExpr()
+{
+    Kind = SyntaxKind::Call;
+}
+
+CallOrSymbolExpr::CallOrSymbolExpr()
+{
+    Kind = SyntaxKind::CallOrSymbol;
+}
+
 Declaration* DotExpr::GetDecl()
 {
     return Decl.get();
@@ -132,7 +149,8 @@ std::shared_ptr<Declaration> DotExpr::GetSharedDecl()
     return Decl;
 }
 
-Unit::Unit( const std::string& fileName )
+Unit::Unit( const std::string& fileName, std::shared_ptr<Arena> arena ) :
+    mArena( std::move( arena ) )
 {
     mFileName.resize( fileName.size() + 1 );
 
@@ -147,6 +165,11 @@ const char* Unit::GetUnitFileName()
     return mFileName.data();
 }
 
+const std::shared_ptr<Arena>& Unit::GetArena() const
+{
+    return mArena;
+}
+
 
 void AddrOfExpr::Accept( Visitor* visitor )
 {
@@ -6,7 +6,9 @@
 
 #pragma once
 
+#include "Arena.h"
 #include "Common.h"
+#include "Symbol.h"
 #include <list>
 #include <map>
 #include <memory>
@@ -32,9 +34,12 @@ enum class SyntaxKind
     Name,
     AddrOfExpr,
     AsExpr,
+    Binary,
     Index,
     Slice,
     DotExpr,
+    Call,
+    CallOrSymbol,
     ArrayInitializer,
     RecordInitializer,
     ConstDecl,
@@ -57,8 +62,14 @@ struct Declaration;
 class Type;
 
 
+// Destroys a node, and frees it unless it's in an arena
+struct SyntaxDeleter
+{
+    void operator()( Syntax* syntax ) const;
+};
+
 template <class T = Syntax>
-using Unique = std::unique_ptr<T, std::default_delete<Syntax>>;
+using Unique = std::unique_ptr<T, SyntaxDeleter>;
 
 
 class Syntax
@@ -69,6 +80,9 @@ public:
     int Column = 0;
     const char* FileName = nullptr;
 
+    // Set for nodes made by MakeInArena
+    bool InArena = false;
+
     // All nodes in the same syntax tree refer to the file name string in the root Unit
 
     std::shared_ptr<Gemini::Type>   Type;
@@ -91,11 +105,10 @@ class NameExpr : public Syntax
 {
 public:
     std::shared_ptr<Declaration> Decl;
-    std::string String;
+    Symbol String;
 
     NameExpr();
-    NameExpr( const std::string& str );
-    NameExpr( std::string&& str );
+    NameExpr( Symbol str );
 
     virtual void Accept( Visitor* visitor ) override;
     virtual Declaration* GetDecl() override;
@@ -233,7 +246,7 @@ class DeclSyntax : public Syntax
 public:
     std::shared_ptr<Declaration> Decl;
 
-    std::string Name;
+    Symbol Name;
 
     virtual Declaration* GetDecl() override;
     virtual std::shared_ptr<Declaration> GetSharedDecl() override;
@@ -368,6 +381,8 @@ public:
     Unique<Syntax> Left;
     Unique<Syntax> Right;
 
+    BinaryExpr();
+
     virtual void Accept( Visitor* visitor ) override;
 };
 
@@ -417,7 +432,7 @@ class DotExpr : public Syntax
 {
 public:
     Unique<Syntax> Head;
-    std::string Member;
+    Symbol Member;
 
     std::shared_ptr<Declaration> Decl;
 
@@ -435,6 +450,8 @@ public:
     Unique<Syntax> Head;
     std::vector<Unique<Syntax>> Arguments;
 
+    CallExpr();
+
     virtual void Accept( Visitor* visitor ) override;
 };
 
@@ -443,6 +460,8 @@ class CallOrSymbolExpr : public Syntax
 public:
     Unique<Syntax> Symbol;
 
+    CallOrSymbolExpr();
+
     virtual void Accept( Visitor* visitor ) override;
 };
 
@@ -568,13 +587,17 @@ public:
 class ImportDecl : public DeclSyntax
 {
 public:
-    std::string OriginalName;
+    Symbol OriginalName;
 
     virtual void Accept( Visitor* visitor ) override;
 };
 
 class Unit : public Syntax
 {
+    // Holds the nodes that the parser made. It's declared first, so that
+    // it's released after them.
+    std::shared_ptr<Arena> mArena;
+
     // All nodes in the syntax tree rooted in this Unit refer to this string
     std::vector<char> mFileName;
 
@@ -582,9 +605,10 @@ public:
     std::vector<Unique<DeclSyntax>> DataDeclarations;
     std::vector<Unique<ProcDecl>> FuncDeclarations;
 
-    Unit( const std::string& fileName );
+    Unit( const std::string& fileName, std::shared_ptr<Arena> arena = nullptr );
 
     const char* GetUnitFileName();
+    const std::shared_ptr<Arena>& GetArena() const;
 
     virtual void Accept( Visitor* visitor ) override;
 };
@@ -592,6 +616,15 @@ public:
 
 std::optional<int32_t> GetFinalOptionalSyntaxValue( Syntax* node );
 
+// Makes a node whose memory belongs to the arena, which has to outlive it
+template <typename T, typename... Args>
+Unique<T> MakeInArena( Arena& arena, Args&&... args )
+{
+    T* syntax = new ( arena.Allocate( sizeof( T ), alignof( T ) ) ) T( std::forward<Args>( args )... );
+    syntax->InArena = true;
+    return Unique<T>( syntax );
+}
+
 void CopyBaseSyntax( Syntax& dest, const Syntax& source );
 
 
@@ -695,7 +728,7 @@ struct CommonDeclaration : public Declaration
     }
 };
 
-using SymTable = std::map<std::string, std::shared_ptr<Declaration>>;
+using SymTable = SymbolMap<std::shared_ptr<Declaration>>;
 
 struct UndefinedDeclaration : public CommonDeclaration
 {
@@ -822,6 +855,9 @@ struct LocalStorage : public CommonDeclaration
 {
     LocalSize   Offset = 0;
 
+    // Assigned or passed by reference after its declaration
+    bool        IsModified = false;
+
     LocalStorage();
 };
 
@@ -851,14 +887,15 @@ struct FieldStorage : public CommonDeclaration
 
 struct CallSite
 {
-    std::string FunctionName;
+    Symbol      FunctionName;
     int16_t     ExprDepth;
     uint8_t     ModIndex;
+    bool        IsTail;
 };
 
 struct Function : public CommonDeclaration
 {
-    std::string Name;
+    Symbol      Name;
     CodeSize    Address = UndefinedAddr;
     ModSize     ModIndex = 0;
     bool        IsLambda = false;
@@ -874,6 +911,7 @@ struct Function : public CommonDeclaration
     bool        IsCalculating = false;
     bool        IsRecursive = false;
     bool        IsDepthKnown = false;
+    bool        IsDepthPartial = false;
     bool        CallsIndirectly = false;
 
     std::list<CallSite> CalledFunctions;
@@ -0,0 +1,552 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+#include "pch.h"
+#include "Translator.h"
+#include "Disassembler.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <vector>
+
+
+// Translation
+//
+// Each instruction becomes a labeled block of C++ in one function, in bytecode
+// order, so that falling through works the same way. The function keeps the
+// stack and frame pointers in locals, and starts at the context's PC through a
+// switch with a case for every instruction.
+//
+// The templates match the unchecked engine: the module is verified before it
+// runs, so only the checks that can't be done statically are kept. The
+// instructions without templates go to the interpreter through
+// AotContext::Step, and then back through the switch.
+
+
+namespace Gemini
+{
+
+namespace
+{
+
+class Writer
+{
+    std::string& mSource;
+
+public:
+    Writer( std::string& source ) :
+        mSource( source )
+    {
+    }
+
+    void Line( const char* format, ... )
+    {
+        char line[256];
+        va_list args;
+
+        va_start( args, format );
+        vsnprintf( line, sizeof line, format, args );
+        va_end( args );
+
+        mSource.append( line );
+        mSource.append( "\n" );
+    }
+};
+
+
+const char* GetPrimitiveFunc( U8 func )
+{
+    switch ( func )
+    {
+    case PRIM_ADD:      return "VmAdd";
+    case PRIM_SUB:      return "VmSub";
+    case PRIM_MUL:      return "VmMul";
+    case PRIM_DIV:      return "VmDiv";
+    case PRIM_MOD:      return "VmMod";
+    case PRIM_ADD_U:    return "VmAddU";
+    case PRIM_SUB_U:    return "VmSubU";
+    case PRIM_MUL_U:    return "VmMulU";
+    default:            return nullptr;
+    }
+}
+
+const char* GetCompareOperator( U8 code )
+{
+    switch ( code )
+    {
+    case PRIM_EQ:
+    case OP_BEQ:    return "==";
+    case PRIM_NE:
+    case OP_BNE:    return "!=";
+    case PRIM_LT:
+    case OP_BLT:    return "<";
+    case PRIM_LE:
+    case OP_BLE:    return "<=";
+    case PRIM_GT:
+    case OP_BGT:    return ">";
+    case PRIM_GE:
+    case OP_BGE:    return ">=";
+    default:        return nullptr;
+    }
+}
+
+std::string FormatCell( CELL value )
+{
+    // The literal -2147483648 is a negated unsigned int
+    if ( value == INT32_MIN )
+        return "INT32_MIN";
+
+    return std::to_string( value );
+}
+
+// Writes "dest = a <func> b;" with the VM's semantics
+bool WritePrimitive( Writer& writer, U8 func, const char* dest, const char* a, const char* b, U32 addr )
+{
+    if ( const char* op = GetCompareOperator( func ) )
+    {
+        writer.Line( "    %s = %s %s %s;", dest, a, op, b );
+        return true;
+    }
+
+    const char* vmFunc = GetPrimitiveFunc( func );
+    if ( vmFunc == nullptr )
+        return false;
+
+    if ( func == PRIM_DIV || func == PRIM_MOD )
+        writer.Line( "    if ( %s == 0 ) AOT_FAIL( %u, ERR_DIVIDE );", b, addr );
+
+    writer.Line( "    %s = %s( %s, %s );", dest, vmFunc, a, b );
+    return true;
+}
+
+// Writes "if ( condition ) goto <target>;". Backward branches charge the budget.
+void WriteBranch( Writer& writer, const char* prefix, const char* condition, const U8*& codePtr, const U8* codeBase, bool isLong = false )
+{
+    I32 offset = isLong ? LongBranchInst::ReadOffset( codePtr ) : BranchInst::ReadOffset( codePtr );
+    I32 target = static_cast<I32>(codePtr - codeBase) + offset;
+    char jump[32];
+
+    if ( offset < 0 )
+        snprintf( jump, sizeof jump, "AOT_LOOP( %d );", target );
+    else
+        snprintf( jump, sizeof jump, "goto L_%d;", target );
+
+    if ( condition != nullptr )
+        writer.Line( "    %sif ( %s ) %s", prefix, condition, jump );
+    else
+        writer.Line( "    %s%s", prefix, jump );
+}
+
+// Returns false if the instruction is bad
+bool WriteInst( Writer& writer, const Module* mod, U32 addr )
+{
+    const U8* codePtr = mod->CodeBase + addr;
+    U8 op = *codePtr++;
+
+    switch ( op )
+    {
+    case OP_POP:
+        writer.Line( "    sp++;" );
+        break;
+
+    case OP_DUP:
+        writer.Line( "    sp--; sp[0] = sp[1];" );
+        break;
+
+    case OP_OVER:
+        writer.Line( "    sp--; sp[0] = sp[2];" );
+        break;
+
+    case OP_PUSH:
+        {
+            U8 count = ReadU8( codePtr );
+
+            writer.Line( "    sp -= %u; std::fill_n( sp, %u, 0 );", count, count );
+        }
+        break;
+
+    case OP_NOT:
+        writer.Line( "    sp[0] = !sp[0];" );
+        break;
+
+    case OP_LDARGA:
+    case OP_LDARG:
+    case OP_STARG:
+        {
+            int offset = FRAME_WORDS + ReadU8( codePtr );
+
+            writer.Line( "    if ( ctx.StackEnd - fp <= %d ) AOT_FAIL( %u, ERR_BAD_ADDRESS );", offset, addr );
+
+            if ( op == OP_LDARGA )
+                writer.Line( "    *--sp = CodeAddr::Build( static_cast<U32>( fp - ctx.StackBase ) + %d, MODINDEX_STACK );", offset );
+            else if ( op == OP_LDARG )
+                writer.Line( "    *--sp = fp[%d];", offset );
+            else
+                writer.Line( "    fp[%d] = *sp++;", offset );
+        }
+        break;
+
+    case OP_LDLOCA:
+        writer.Line( "    *--sp = CodeAddr::Build( static_cast<U32>( fp - ctx.StackBase ) - %d, MODINDEX_STACK );",
+            1 + ReadU8( codePtr ) );
+        break;
+
+    case OP_LDLOC:
+        writer.Line( "    *--sp = fp[-%d];", 1 + ReadU8( codePtr ) );
+        break;
+
+    case OP_STLOC:
+        writer.Line( "    fp[-%d] = *sp++;", 1 + ReadU8( codePtr ) );
+        break;
+
+    case OP_LDMOD:
+    case OP_STMOD:
+        {
+            U8  iMod = ReadU8( codePtr );
+            U16 dataAddr = ReadU16( codePtr );
+
+            // Only the module's own data is known here. Everything else,
+            // including bad addresses, goes to the interpreter.
+
+            if ( dataAddr < mod->DataSize && iMod < CONST_SECTION_MOD_INDEX_MASK )
+            {
+                if ( op == OP_LDMOD )
+                    writer.Line( "    if ( ctx.ModIndex == %u ) *--sp = sData[%u];", iMod, dataAddr );
+                else
+                    writer.Line( "    if ( ctx.ModIndex == %u ) sData[%u] = *sp++;", iMod, dataAddr );
+
+                writer.Line( "    else AOT_STEP( %u );", addr );
+            }
+            else
+            {
+                writer.Line( "    AOT_STEP( %u );", addr );
+            }
+        }
+        break;
+
+    case OP_LDC:
+        writer.Line( "    *--sp = %s;", FormatCell( ReadI32( codePtr ) ).c_str() );
+        break;
+
+    case OP_LDC_S:
+        writer.Line( "    *--sp = %d;", ReadI8( codePtr ) );
+        break;
+
+    case OP_PRIM:
+        if ( !WritePrimitive( writer, ReadU8( codePtr ), "sp[1]", "sp[1]", "sp[0]", addr ) )
+            return false;
+
+        writer.Line( "    sp++;" );
+        break;
+
+    case OP_PRIMLOC:
+        {
+            U8 func = ReadU8( codePtr );
+            char local[32];
+
+            snprintf( local, sizeof local, "fp[-%d]", 1 + ReadU8( codePtr ) );
+
+            if ( !WritePrimitive( writer, func, "sp[0]", "sp[0]", local, addr ) )
+                return false;
+        }
+        break;
+
+    case OP_PRIMC_S:
+        {
+            U8 func = ReadU8( codePtr );
+            std::string value = "(" + FormatCell( ReadI8( codePtr ) ) + ")";
+
+            if ( !WritePrimitive( writer, func, "sp[0]", "sp[0]", value.c_str(), addr ) )
+                return false;
+        }
+        break;
+
+    case OP_INCLOC:
+        {
+            int index = 1 + ReadU8( codePtr );
+            int step = ReadI8( codePtr );
+
+            writer.Line( "    fp[-%d] = VmAdd( fp[-%d], %d ); *--sp = fp[-%d];", index, index, step, index );
+        }
+        break;
+
+    case OP_B:
+        WriteBranch( writer, "", nullptr, codePtr, mod->CodeBase );
+        break;
+
+    case OP_B_L:
+        WriteBranch( writer, "", nullptr, codePtr, mod->CodeBase, true );
+        break;
+
+    case OP_BFALSE:
+        WriteBranch( writer, "", "!*sp++", codePtr, mod->CodeBase );
+        break;
+
+    case OP_BTRUE:
+        WriteBranch( writer, "", "*sp++", codePtr, mod->CodeBase );
+        break;
+
+    case OP_BEQ:
+    case OP_BNE:
+    case OP_BLT:
+    case OP_BLE:
+    case OP_BGT:
+    case OP_BGE:
+        {
+            std::string condition = std::string( "sp[-1] " ) + GetCompareOperator( op ) + " sp[-2]";
+
+            WriteBranch( writer, "sp += 2; ", condition.c_str(), codePtr, mod->CodeBase );
+        }
+        break;
+
+    case OP_INDEX:
+        {
+            U32 stride = ReadU24( codePtr );
+            U32 bound  = ReadU24( codePtr );
+
+            writer.Line( "    {" );
+            writer.Line( "        U32 base = sp[1];" );
+            writer.Line( "        CELL index = sp[0];" );
+            writer.Line( "        if ( index < 0 || static_cast<U32>(index) >= %uu ) AOT_FAIL( %u, ERR_BOUND );", bound, addr );
+            writer.Line( "        U64 newAddr = base + (static_cast<U64>(index) * %uu);", stride );
+            writer.Line( "        if ( newAddr > CodeAddr::ToModuleMax( base ) ) AOT_FAIL( %u, ERR_BAD_ADDRESS );", addr );
+            writer.Line( "        sp[1] = static_cast<CELL>(newAddr);" );
+            writer.Line( "        sp++;" );
+            writer.Line( "    }" );
+        }
+        break;
+
+    case OP_INDEX_U:
+        {
+            U32 stride = ReadU24( codePtr );
+
+            writer.Line( "    {" );
+            writer.Line( "        U32 base = sp[1];" );
+            writer.Line( "        CELL index = sp[0];" );
+            writer.Line( "        U64 newAddr = base + (static_cast<U64>(static_cast<U32>(index)) * %uu);", stride );
+            writer.Line( "        if ( newAddr > CodeAddr::ToModuleMax( base ) ) AOT_FAIL( %u, ERR_BAD_ADDRESS );", addr );
+            writer.Line( "        sp[1] = static_cast<CELL>(newAddr);" );
+            writer.Line( "        sp++;" );
+            writer.Line( "    }" );
+        }
+        break;
+
+    case OP_LOADI:
+    case OP_STOREI:
+    case OP_RET:
+    case OP_CALL:
+    case OP_CALLI:
+    case OP_CALLM:
+    case OP_CALLNATIVE:
+    case OP_CALLNATIVE_S:
+    case OP_COPYBLOCK:
+    case OP_COPYARRAY:
+    case OP_INDEXOPEN:
+    case OP_RANGEOPEN:
+    case OP_RANGEOPENCLOSED:
+    case OP_RANGE:
+    case OP_OFFSET:
+    case OP_YIELD:
+    case OP_TAILCALL:
+    case OP_TAILCALLI:
+    case OP_TAILCALLM:
+    case OP_SWITCH:
+        writer.Line( "    AOT_STEP( %u );", addr );
+        break;
+
+    default:
+        return false;
+    }
+
+    return true;
+}
+
+void WriteCells( Writer& writer, const char* name, const CELL* cells, U16 count )
+{
+    if ( count == 0 )
+        return;
+
+    writer.Line( "CELL %s[] =", name );
+    writer.Line( "{" );
+
+    for ( U16 i = 0; i < count; i++ )
+        writer.Line( "    %s,", FormatCell( cells[i] ).c_str() );
+
+    writer.Line( "};" );
+    writer.Line( "" );
+}
+
+}
+
+
+int TranslateModule(
+    const Module* mod,
+    U8 modIndex,
+    const char* name,
+    const AotExport* exports,
+    size_t exportCount,
+    std::string& source )
+{
+    if ( name == nullptr || (exports == nullptr && exportCount > 0) )
+        return ERR_BAD_ARG;
+
+    // The translation skips the checks that verification makes unneeded
+
+    VerifiedCode verifiedCode;
+
+    int err = VerifyModuleCode( mod, &verifiedCode );
+    if ( err != ERR_NONE )
+        return err;
+
+    // Translated modules carry their own data
+
+    if ( mod->Cow != nullptr )
+        return ERR_BAD_MODULE;
+
+    std::vector<U32> instAddrs;
+    std::vector<std::string> instTexts;
+
+    Disassembler disassembler( mod->CodeBase, false );
+    U32 codeLimit = mod->CodeSize - SENTINEL_SIZE;
+    U32 addr = 0;
+
+    while ( addr < codeLimit && mod->CodeBase[addr] != OP_SENTINEL )
+    {
+        char text[256];
+
+        int size = disassembler.Disassemble( text, sizeof text );
+        if ( size <= 0 )
+            return ERR_BAD_MODULE;
+
+        instAddrs.push_back( addr );
+        instTexts.push_back( text );
+        addr += size;
+    }
+
+    U32 codeEnd = addr;
+
+    source.clear();
+
+    Writer writer( source );
+
+    writer.Line( "// Translated from Gemini bytecode. Don't edit." );
+    writer.Line( "" );
+    writer.Line( "#include <assert.h>" );
+    writer.Line( "#include <stddef.h>" );
+    writer.Line( "#include <stdint.h>" );
+    writer.Line( "#include <string>" );
+    writer.Line( "#include \"Aot.h\"" );
+    writer.Line( "" );
+    writer.Line( "using namespace Gemini;" );
+    writer.Line( "" );
+    writer.Line( "" );
+    writer.Line( "namespace" );
+    writer.Line( "{" );
+    writer.Line( "" );
+
+    writer.Line( "const U8 sCode[] =" );
+    writer.Line( "{" );
+
+    for ( U32 i = 0; i < mod->CodeSize; i += 16 )
+    {
+        std::string line = "   ";
+
+        for ( U32 j = i; j < mod->CodeSize && j < i + 16; j++ )
+        {
+            char byteText[8];
+
+            snprintf( byteText, sizeof byteText, " 0x%02X,", mod->CodeBase[j] );
+            line += byteText;
+        }
+
+        writer.Line( "%s", line.c_str() );
+    }
+
+    writer.Line( "};" );
+    writer.Line( "" );
+
+    WriteCells( writer, "sData", mod->DataBase, mod->DataSize );
+    WriteCells( writer, "sConst", mod->ConstBase, mod->ConstSize );
+
+    if ( exportCount > 0 )
+    {
+        writer.Line( "const AotExport sExports[] =" );
+        writer.Line( "{" );
+
+        for ( size_t i = 0; i < exportCount; i++ )
+            writer.Line( "    { \"%s\", %u },", exports[i].Name, exports[i].Address );
+
+        writer.Line( "};" );
+        writer.Line( "" );
+    }
+
+    writer.Line( "#define AOT_FAIL( addr, err ) \\" );
+    writer.Line( "    do { ctx.SP = sp; ctx.PC = (addr); return (err); } while ( 0 )" );
+    writer.Line( "" );
+    writer.Line( "#define AOT_LOOP( addr ) \\" );
+    writer.Line( "    do { if ( --ctx.Budget == 0 ) AOT_FAIL( addr, ERR_BUDGET_EXHAUSTED ); goto L_##addr; } while ( 0 )" );
+    writer.Line( "" );
+    writer.Line( "#define AOT_STEP( addr ) \\" );
+    writer.Line( "    do { \\" );
+    writer.Line( "        ctx.SP = sp; \\" );
+    writer.Line( "        if ( !ctx.Step( addr ) ) return ctx.Status; \\" );
+    writer.Line( "        sp = ctx.SP; fp = ctx.FramePtr; \\" );
+    writer.Line( "        goto Dispatch; \\" );
+    writer.Line( "    } while ( 0 )" );
+    writer.Line( "" );
+
+    writer.Line( "int Run( AotContext& ctx )" );
+    writer.Line( "{" );
+    writer.Line( "    CELL* sp = ctx.SP;" );
+    writer.Line( "    CELL* fp = ctx.FramePtr;" );
+    writer.Line( "" );
+    writer.Line( "    (void) fp;" );
+    writer.Line( "" );
+    writer.Line( "Dispatch:" );
+    writer.Line( "    switch ( ctx.PC )" );
+    writer.Line( "    {" );
+
+    for ( U32 instAddr : instAddrs )
+        writer.Line( "    case %u: goto L_%u;", instAddr, instAddr );
+
+    writer.Line( "    default: AOT_FAIL( ctx.PC, ERR_BAD_ADDRESS );" );
+    writer.Line( "    }" );
+
+    for ( size_t i = 0; i < instAddrs.size(); i++ )
+    {
+        writer.Line( "" );
+        writer.Line( "L_%u:    //%s", instAddrs[i], instTexts[i].c_str() );
+
+        if ( !WriteInst( writer, mod, instAddrs[i] ) )
+            return ERR_BAD_MODULE;
+    }
+
+    // Verified code never gets here, but dead code might run into the sentinel
+
+    writer.Line( "" );
+    writer.Line( "    AOT_FAIL( %u, ERR_BAD_OPCODE );", codeEnd );
+    writer.Line( "}" );
+    writer.Line( "" );
+    writer.Line( "}" );
+    writer.Line( "" );
+    writer.Line( "" );
+
+    writer.Line( "const AotModule& %s()", name );
+    writer.Line( "{" );
+    writer.Line( "    static const AotModule sModule(" );
+    writer.Line( "        sCode, sizeof( sCode )," );
+    writer.Line( "        %s, %u,", mod->DataSize > 0 ? "sData" : "nullptr", mod->DataSize );
+    writer.Line( "        %s, %u,", mod->ConstSize > 0 ? "sConst" : "nullptr", mod->ConstSize );
+    writer.Line( "        %u,", modIndex );
+    writer.Line( "        %s, %zu,", exportCount > 0 ? "sExports" : "nullptr", exportCount );
+    writer.Line( "        Run );" );
+    writer.Line( "" );
+    writer.Line( "    return sModule;" );
+    writer.Line( "}" );
+
+    return ERR_NONE;
+}
+
+}
@@ -0,0 +1,26 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+#pragma once
+
+#include "Aot.h"
+#include <string>
+
+
+namespace Gemini
+{
+
+// Writes a C++ translation unit for the module. The unit defines
+// "const Gemini::AotModule& <name>()" and includes "Aot.h".
+int TranslateModule(
+    const Module* mod,
+    U8 modIndex,
+    const char* name,
+    const AotExport* exports,
+    size_t exportCount,
+    std::string& source );
+
+}
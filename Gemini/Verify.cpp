@@ -8,6 +8,9 @@
 #include "Common.h"
 #include "Machine.h"
 #include "OpCodes.h"
+#include "VmCommon.h"
+#include <algorithm>
+#include <map>
 
 
 namespace Gemini
@@ -28,6 +31,9 @@ int VerifyModule( const Module* mod )
         || (mod->ConstBase == nullptr && mod->ConstSize > 0) )
         return ERR_BAD_MODULE;
 
+    if ( mod->Cow != nullptr && (mod->DataBase != nullptr || mod->DataSize > 0) )
+        return ERR_BAD_MODULE;
+
     const U8* codeBase = mod->CodeBase;
 
     for ( U32 i = mod->CodeSize - SENTINEL_SIZE; i < mod->CodeSize; i++ )
@@ -39,4 +45,694 @@ int VerifyModule( const Module* mod )
     return ERR_NONE;
 }
 
+
+
+namespace
+{
+
+struct InstInfo
+{
+    U32     Size;
+    U16     Pops;
+    U16     Pushes;
+    U16     Reserve;        // Cells pushed and released while running, like a call frame
+    U16     Locals;         // Count of locals the instruction reaches
+    I32     Target;         // Branch or call target, if not negative
+    bool    IsCall;
+    bool    IsSwitch;       // Target is the default, and the table has the rest
+    bool    IsReturnSite;   // A bytecode call that comes back with RET
+    bool    FallsThrough;
+};
+
+bool DecodeInst( const U8* codePtr, U32 addr, InstInfo& inst )
+{
+    const U8* startPtr = codePtr;
+    U8 op = *codePtr++;
+
+    inst = {};
+    inst.Target = -1;
+    inst.FallsThrough = true;
+
+    switch ( op )
+    {
+    case OP_POP:
+        inst.Pops = 1;
+        break;
+
+    case OP_DUP:
+        inst.Pops = 1;
+        inst.Pushes = 2;
+        break;
+
+    case OP_OVER:
+        inst.Pops = 2;
+        inst.Pushes = 3;
+        break;
+
+    case OP_PUSH:
+        inst.Pushes = ReadU8( codePtr );
+        break;
+
+    case OP_NOT:
+    case OP_LOADI:
+        inst.Pops = 1;
+        inst.Pushes = 1;
+        break;
+
+    case OP_LDARGA:
+    case OP_LDARG:
+        codePtr++;
+        inst.Pushes = 1;
+        break;
+
+    case OP_STARG:
+        codePtr++;
+        inst.Pops = 1;
+        break;
+
+    case OP_LDLOCA:
+    case OP_LDLOC:
+        inst.Locals = ReadU8( codePtr ) + 1;
+        inst.Pushes = 1;
+        break;
+
+    case OP_STLOC:
+        inst.Locals = ReadU8( codePtr ) + 1;
+        inst.Pops = 1;
+        break;
+
+    case OP_LDMOD:
+        codePtr += 3;
+        inst.Pushes = 1;
+        break;
+
+    case OP_STMOD:
+        codePtr += 3;
+        inst.Pops = 1;
+        break;
+
+    case OP_LDC:
+        codePtr += 4;
+        inst.Pushes = 1;
+        break;
+
+    case OP_LDC_S:
+        codePtr++;
+        inst.Pushes = 1;
+        break;
+
+    case OP_STOREI:
+        inst.Pops = 2;
+        break;
+
+    case OP_PRIM:
+        if ( ReadU8( codePtr ) >= PRIM_MAXPRIMITIVE )
+            return false;
+
+        inst.Pops = 2;
+        inst.Pushes = 1;
+        break;
+
+    case OP_PRIMLOC:
+        if ( ReadU8( codePtr ) >= PRIM_MAXPRIMITIVE )
+            return false;
+
+        inst.Locals = ReadU8( codePtr ) + 1;
+        inst.Pops = 1;
+        inst.Pushes = 1;
+        break;
+
+    case OP_PRIMC_S:
+        if ( ReadU8( codePtr ) >= PRIM_MAXPRIMITIVE )
+            return false;
+
+        codePtr++;
+        inst.Pops = 1;
+        inst.Pushes = 1;
+        break;
+
+    case OP_INCLOC:
+        inst.Locals = ReadU8( codePtr ) + 1;
+        codePtr++;
+        inst.Pushes = 1;
+        break;
+
+    case OP_B:
+    case OP_BFALSE:
+    case OP_BTRUE:
+    case OP_BEQ:
+    case OP_BNE:
+    case OP_BLT:
+    case OP_BLE:
+    case OP_BGT:
+    case OP_BGE:
+        {
+            BranchInst::TOffset offset = BranchInst::ReadOffset( codePtr );
+
+            inst.Target = static_cast<I32>(addr + (codePtr - startPtr)) + offset;
+            inst.FallsThrough = (op != OP_B);
+
+            if ( op == OP_BFALSE || op == OP_BTRUE )
+                inst.Pops = 1;
+            else if ( op != OP_B )
+                inst.Pops = 2;
+        }
+        break;
+
+    case OP_B_L:
+        {
+            LongBranchInst::TOffset offset = LongBranchInst::ReadOffset( codePtr );
+            int64_t target = static_cast<int64_t>(addr + (codePtr - startPtr)) + offset;
+
+            if ( target < 0 || target > INT32_MAX )
+                return false;
+
+            inst.Target = static_cast<I32>(target);
+            inst.FallsThrough = false;
+        }
+        break;
+
+    case OP_RET:
+        inst.Pops = 1;
+        inst.FallsThrough = false;
+        break;
+
+    case OP_CALL:
+    case OP_CALLI:
+    case OP_CALLM:
+    case OP_CALLNATIVE:
+    case OP_CALLNATIVE_S:
+        {
+            U8 callFlags = ReadU8( codePtr );
+
+            inst.Pops = CallFlags::GetCount( callFlags );
+            inst.Pushes = CallFlags::GetAutoPop( callFlags ) ? 0 : 1;
+            inst.Reserve = FRAME_WORDS;
+            inst.IsReturnSite = (op == OP_CALL || op == OP_CALLI || op == OP_CALLM);
+
+            if ( op == OP_CALL )
+            {
+                inst.Target = ReadU24( codePtr );
+                inst.IsCall = true;
+            }
+            else if ( op == OP_CALLI )
+            {
+                inst.Pops++;
+            }
+            else if ( op == OP_CALLNATIVE_S )
+            {
+                codePtr++;
+            }
+            else
+            {
+                codePtr += 4;
+            }
+        }
+        break;
+
+    // These replace the current frame, so they don't come back here. The
+    // callee's frame goes where the current one's arguments were, which is
+    // above the new arguments.
+
+    case OP_TAILCALL:
+    case OP_TAILCALLI:
+    case OP_TAILCALLM:
+        {
+            U8 callFlags = ReadU8( codePtr );
+
+            inst.Pops = CallFlags::GetCount( callFlags );
+            inst.FallsThrough = false;
+
+            if ( op == OP_TAILCALL )
+            {
+                inst.Target = ReadU24( codePtr );
+                inst.IsCall = true;
+            }
+            else if ( op == OP_TAILCALLI )
+            {
+                inst.Pops++;
+            }
+            else
+            {
+                codePtr += 4;
+            }
+        }
+        break;
+
+    case OP_COPYBLOCK:
+        codePtr += 3;
+        inst.Pops = 2;
+        break;
+
+    case OP_COPYARRAY:
+        codePtr += 3;
+        inst.Pops = 4;
+        break;
+
+    case OP_INDEX:
+        codePtr += 6;
+        inst.Pops = 2;
+        inst.Pushes = 1;
+        break;
+
+    case OP_INDEX_U:
+        codePtr += 3;
+        inst.Pops = 2;
+        inst.Pushes = 1;
+        break;
+
+    case OP_INDEXOPEN:
+        codePtr += 3;
+        inst.Pops = 3;
+        inst.Pushes = 1;
+        break;
+
+    case OP_RANGEOPEN:
+        codePtr += 3;
+        inst.Pops = 4;
+        inst.Pushes = 2;
+        break;
+
+    case OP_RANGEOPENCLOSED:
+        codePtr += 3;
+        inst.Pops = 4;
+        inst.Pushes = 1;
+        break;
+
+    case OP_RANGE:
+        codePtr += 6;
+        inst.Pops = 3;
+        inst.Pushes = 2;
+        break;
+
+    case OP_OFFSET:
+        codePtr += 3;
+        inst.Pops = 1;
+        inst.Pushes = 1;
+        break;
+
+    case OP_YIELD:
+        break;
+
+    // The table isn't read here, because it might run past the code
+
+    case OP_SWITCH:
+        {
+            U32 size = SwitchInst::GetSize( startPtr );
+            if ( size == 0 )
+                return false;
+
+            inst.Target = static_cast<I32>(addr + size) + SwitchInst::GetDefaultOffset( startPtr );
+            if ( inst.Target < 0 )
+                return false;
+
+            inst.Pops = 1;
+            inst.IsSwitch = true;
+            inst.FallsThrough = false;
+            codePtr = startPtr + size;
+        }
+        break;
+
+    default:
+        return false;
+    }
+
+    inst.Size = static_cast<U32>(codePtr - startPtr);
+    return true;
+}
+
+I32 GetSwitchTarget( const U8* codePtr, U32 addr, const InstInfo& inst, U32 index )
+{
+    return static_cast<I32>(addr + inst.Size) + SwitchInst::GetOffset( codePtr, index );
+}
+
+// Keys must be in order for the machine's binary search, and a dense table's
+// keys must not wrap around
+bool IsSwitchTableValid( const U8* codePtr )
+{
+    U32 count = SwitchInst::GetCount( codePtr );
+
+    if ( count == 0 )
+        return true;
+
+    if ( SwitchInst::GetFormat( codePtr ) == SwitchInst::Dense )
+    {
+        const U8* p = codePtr + SwitchInst::HeaderSize;
+        int64_t lastKey = static_cast<int64_t>(ReadI32( p )) + count - 1;
+
+        return lastKey <= INT32_MAX;
+    }
+
+    for ( U32 i = 1; i < count; i++ )
+    {
+        if ( SwitchInst::GetKey( codePtr, i - 1 ) >= SwitchInst::GetKey( codePtr, i ) )
+            return false;
+    }
+
+    return true;
+}
+
+
+// Finds the stack height at each instruction by following control flow from
+// each function entry. The start of the code and call targets are known
+// entries. Other code that isn't
+// reached from them is either a function that's only called indirectly or
+// dead code left after a jump or return. So, each such region is tried as an
+// entry, in address order. If it turns out to be inconsistent, then it's
+// marked dead, and no entry or live branch is allowed to reach it.
+
+class CodeVerifier
+{
+    enum : I32
+    {
+        NOT_INST    = -3,
+        DEAD        = -2,
+        UNKNOWN     = -1,
+    };
+
+    const U8*           mCode;
+    U32                 mCodeLimit;
+    std::vector<I32>    mHeights;
+    std::vector<U32>    mWorklist;
+    std::vector<U32>    mTouched;
+    std::vector<U32>    mEntries;
+
+public:
+    int Verify( const Module* mod, VerifiedCode& verifiedCode );
+
+private:
+    bool Decode( const Module* mod );
+    bool IsTargetValid( I32 target ) const;
+    bool Flow( U32 entry );
+    bool Merge( U32 addr, I32 height );
+    void MarkDead();
+};
+
+int CodeVerifier::Verify( const Module* mod, VerifiedCode& verifiedCode )
+{
+    if ( !Decode( mod ) )
+        return ERR_BAD_MODULE;
+
+    std::vector<U32> entries = mEntries;
+
+    for ( U32 entry : entries )
+    {
+        if ( !Flow( entry ) )
+            return ERR_BAD_MODULE;
+    }
+
+    for ( U32 addr = 0; addr < mCodeLimit; addr++ )
+    {
+        if ( mHeights[addr] != UNKNOWN )
+            continue;
+
+        if ( Flow( addr ) )
+            entries.push_back( addr );
+        else
+            MarkDead();
+    }
+
+    std::sort( entries.begin(), entries.end() );
+    entries.erase( std::unique( entries.begin(), entries.end() ), entries.end() );
+
+    std::vector<U16> returnHeights( mod->CodeSize, NOT_RETURN_SITE );
+    std::vector<U16> heights( mod->CodeSize, NOT_LIVE_INST );
+    I32 stackUsage = 0;
+
+    for ( U32 addr = 0; addr < mCodeLimit; addr++ )
+    {
+        I32 height = mHeights[addr];
+
+        if ( height < 0 )
+            continue;
+
+        InstInfo inst;
+
+        DecodeInst( &mCode[addr], addr, inst );
+
+        I32 nextHeight = height - inst.Pops + inst.Pushes;
+
+        heights[addr] = static_cast<U16>(height);
+
+        stackUsage = std::max( stackUsage, height + inst.Reserve );
+        stackUsage = std::max( stackUsage, nextHeight );
+        stackUsage = std::max( stackUsage, static_cast<I32>(inst.Locals) );
+
+        if ( inst.IsReturnSite )
+            returnHeights[addr + inst.Size] = static_cast<U16>(nextHeight);
+    }
+
+    if ( stackUsage >= NOT_RETURN_SITE )
+        return ERR_BAD_MODULE;
+
+    verifiedCode.Entries = std::move( entries );
+    verifiedCode.ReturnHeights = std::move( returnHeights );
+    verifiedCode.Heights = std::move( heights );
+    verifiedCode.StackUsage = static_cast<U16>(stackUsage);
+
+    return ERR_NONE;
+}
+
+bool CodeVerifier::Decode( const Module* mod )
+{
+    mCode = mod->CodeBase;
+    mHeights.assign( mod->CodeSize, NOT_INST );
+
+    U32 addr = 0;
+    U32 codeEnd = mod->CodeSize - SENTINEL_SIZE;
+
+    // Code ends at the first instruction that's a sentinel. Everything after it must be too
+
+    while ( mCode[addr] != OP_SENTINEL )
+    {
+        InstInfo inst;
+
+        if ( !DecodeInst( &mCode[addr], addr, inst )
+            || inst.Size > codeEnd - addr )
+            return false;
+
+        mHeights[addr] = UNKNOWN;
+        addr += inst.Size;
+    }
+
+    mCodeLimit = addr;
+
+    if ( mCodeLimit > 0 )
+        mEntries.push_back( 0 );
+
+    for ( ; addr < mod->CodeSize; addr++ )
+    {
+        if ( mCode[addr] != OP_SENTINEL )
+            return false;
+    }
+
+    for ( addr = 0; addr < mCodeLimit; addr++ )
+    {
+        if ( mHeights[addr] == NOT_INST )
+            continue;
+
+        InstInfo inst;
+
+        DecodeInst( &mCode[addr], addr, inst );
+
+        if ( inst.Target < 0 )
+            continue;
+
+        if ( !IsTargetValid( inst.Target ) )
+            return false;
+
+        if ( inst.IsCall )
+            mEntries.push_back( inst.Target );
+
+        if ( inst.IsSwitch )
+        {
+            if ( !IsSwitchTableValid( &mCode[addr] ) )
+                return false;
+
+            for ( U32 i = 0, count = SwitchInst::GetCount( &mCode[addr] ); i < count; i++ )
+            {
+                if ( !IsTargetValid( GetSwitchTarget( &mCode[addr], addr, inst, i ) ) )
+                    return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool CodeVerifier::IsTargetValid( I32 target ) const
+{
+    return target >= 0
+        && static_cast<U32>(target) < mCodeLimit
+        && mHeights[target] != NOT_INST;
+}
+
+bool CodeVerifier::Flow( U32 entry )
+{
+    mWorklist.clear();
+    mTouched.clear();
+
+    if ( !Merge( entry, 0 ) )
+        return false;
+
+    while ( !mWorklist.empty() )
+    {
+        U32 addr = mWorklist.back();
+        I32 height = mHeights[addr];
+        InstInfo inst;
+
+        mWorklist.pop_back();
+
+        DecodeInst( &mCode[addr], addr, inst );
+
+        if ( height < inst.Pops )
+            return false;
+
+        I32 nextHeight = height - inst.Pops + inst.Pushes;
+
+        if ( inst.Target >= 0 && !inst.IsCall )
+        {
+            if ( !Merge( inst.Target, nextHeight ) )
+                return false;
+        }
+
+        if ( inst.IsSwitch )
+        {
+            for ( U32 i = 0, count = SwitchInst::GetCount( &mCode[addr] ); i < count; i++ )
+            {
+                if ( !Merge( GetSwitchTarget( &mCode[addr], addr, inst, i ), nextHeight ) )
+                    return false;
+            }
+        }
+
+        // Falling into the sentinel is an error the machine reports anyway
+
+        if ( inst.FallsThrough && addr + inst.Size < mCodeLimit )
+        {
+            if ( !Merge( addr + inst.Size, nextHeight ) )
+                return false;
+        }
+    }
+
+    return true;
+}
+
+bool CodeVerifier::Merge( U32 addr, I32 height )
+{
+    if ( mHeights[addr] == UNKNOWN )
+    {
+        if ( height >= NOT_RETURN_SITE )
+            return false;
+
+        mHeights[addr] = height;
+        mWorklist.push_back( addr );
+        mTouched.push_back( addr );
+        return true;
+    }
+
+    return mHeights[addr] == height;
+}
+
+void CodeVerifier::MarkDead()
+{
+    for ( U32 addr : mTouched )
+        mHeights[addr] = DEAD;
+}
+
+}
+
+
+int VerifyModuleCode( const Module* mod, VerifiedCode* verifiedCode )
+{
+    if ( verifiedCode == nullptr )
+        return ERR_BAD_ARG;
+
+    int err = VerifyModule( mod );
+    if ( err != ERR_NONE )
+        return err;
+
+    CodeVerifier verifier;
+
+    return verifier.Verify( mod, *verifiedCode );
+}
+
+int BindNatives(
+    const Module* mod,
+    IEnvironment* env,
+    NativeBinding* binding,
+    std::vector<U32>* unresolvedIds )
+{
+    if ( env == nullptr || binding == nullptr )
+        return ERR_BAD_ARG;
+
+    int err = VerifyModule( mod );
+    if ( err != ERR_NONE )
+        return err;
+
+    const U8* code = mod->CodeBase;
+    U32 codeLimit = mod->CodeSize - SENTINEL_SIZE;
+    NativeBinding newBinding;
+    std::map<U32, U16> idIndexes;
+    std::vector<U32> unresolved;
+
+    newBinding.CallSites.assign( codeLimit, NativeBinding::NOT_BOUND );
+
+    // Like the verifier, code ends at the first sentinel
+
+    for ( U32 addr = 0; addr < codeLimit && code[addr] != OP_SENTINEL; )
+    {
+        InstInfo inst;
+
+        if ( !DecodeInst( &code[addr], addr, inst ) || inst.Size > codeLimit - addr )
+            return ERR_BAD_MODULE;
+
+        U8 op = code[addr];
+
+        if ( op == OP_CALLNATIVE || op == OP_CALLNATIVE_S )
+        {
+            // Skip the opcode and call flags
+
+            const U8* idPtr = &code[addr + 2];
+            U32 id = (op == OP_CALLNATIVE) ? ReadU32( idPtr ) : ReadU8( idPtr );
+            auto it = idIndexes.find( id );
+
+            if ( it == idIndexes.end() )
+            {
+                NativeCode nativeCode;
+                U16 index = NativeBinding::NOT_BOUND;
+
+                if ( !env->FindNativeCode( id, &nativeCode ) || nativeCode.Proc == nullptr )
+                {
+                    unresolved.push_back( id );
+                }
+                else
+                {
+                    if ( newBinding.Funcs.size() >= NativeBinding::NOT_BOUND )
+                        return ERR_BAD_MODULE;
+
+                    index = static_cast<U16>( newBinding.Funcs.size() );
+                    newBinding.Funcs.push_back( nativeCode.Proc );
+                    newBinding.Ids.push_back( id );
+                }
+
+                it = idIndexes.insert( { id, index } ).first;
+            }
+
+            newBinding.CallSites[addr] = it->second;
+        }
+
+        addr += inst.Size;
+    }
+
+    if ( unresolvedIds != nullptr )
+        *unresolvedIds = unresolved;
+
+    if ( !unresolved.empty() )
+        return ERR_NATIVECODE_NOT_FOUND;
+
+    *binding = std::move( newBinding );
+
+    return ERR_NONE;
+}
+
 }
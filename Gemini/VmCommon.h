@@ -62,6 +62,7 @@ void WritePacked( uint8_t*& p, S value )
 
 #define StoreI16    StorePacked<int16_t>
 #define StoreU16    StorePacked<uint16_t>
+#define StoreI32    StorePacked<int32_t>
 #define StoreU24    StorePacked<uint32_t, 3>
 #define StoreU32    StorePacked<uint32_t>
 
@@ -80,6 +81,11 @@ void WritePacked( uint8_t*& p, S value )
 #define WriteU32    WritePacked<uint32_t>
 
 
+// Returned by the engines when control reaches a module that needs another
+// one, or when a single step is done
+constexpr int ERR_SWITCH_ENGINE = -1;
+
+
 struct VmDivModResult
 {
     int32_t Quotient;
@@ -112,6 +118,24 @@ constexpr int32_t VmMul( int32_t a, int32_t b )
     return Saturate( static_cast<int64_t>(a) * b );
 }
 
+// The unchecked operations are for operands that the compiler has shown
+// can't overflow. They wrap instead of being undefined, if they do.
+
+constexpr int32_t VmAddU( int32_t a, int32_t b )
+{
+    return static_cast<int32_t>(static_cast<uint32_t>(a) + static_cast<uint32_t>(b));
+}
+
+constexpr int32_t VmSubU( int32_t a, int32_t b )
+{
+    return static_cast<int32_t>(static_cast<uint32_t>(a) - static_cast<uint32_t>(b));
+}
+
+constexpr int32_t VmMulU( int32_t a, int32_t b )
+{
+    return static_cast<int32_t>(static_cast<uint32_t>(a) * static_cast<uint32_t>(b));
+}
+
 constexpr VmDivModResult VmDivMod( int32_t a, int32_t b )
 {
     int32_t q = 0;
@@ -208,6 +232,166 @@ struct BranchInst
 };
 
 
+// OP_B_L is an unconditional branch that can reach anywhere in a module. The
+// compiler uses it for targets too far for the short branches. A far
+// conditional branch becomes the opposite short one over an OP_B_L.
+
+struct LongBranchInst
+{
+    using TOffset = int32_t;
+
+    static constexpr int Size = 1 + sizeof( TOffset );
+
+    static void StoreOffset( uint8_t* p, TOffset offset )
+    {
+        StoreI32( p, offset );
+    }
+
+    static TOffset ReadOffset( const uint8_t*& p )
+    {
+        return ReadI32( p );
+    }
+
+    static void WriteOffset( uint8_t*& p, TOffset offset )
+    {
+        WriteI32( p, offset );
+    }
+};
+
+
+// OP_SWITCH pops a key and branches to the offset that the table has for it,
+// or to the default offset. Offsets are relative to the end of the whole
+// instruction. After the opcode come the format, the count of entries, and
+// the default offset. Then:
+//
+//  Dense:  the lowest key, then an offset for each key from it up
+//  Sparse: each key and its offset, in ascending order of keys
+
+struct SwitchInst
+{
+    enum Format : uint8_t
+    {
+        Dense,
+        Sparse,
+    };
+
+    using TKey = int32_t;
+    using TOffset = BranchInst::TOffset;
+
+    static constexpr int HeaderSize = 1 + 1 + 2 + sizeof( TOffset );
+    static constexpr int DenseEntrySize = sizeof( TOffset );
+    static constexpr int SparseEntrySize = sizeof( TKey ) + sizeof( TOffset );
+    static constexpr int MaxCount = UINT16_MAX;
+
+    // Only reads as far as the count, so it's safe at the end of a module.
+    // Zero if the format is bad.
+    static uint32_t GetSize( const uint8_t* instPtr )
+    {
+        uint32_t count = GetCount( instPtr );
+
+        switch ( instPtr[1] )
+        {
+        case Dense:     return HeaderSize + sizeof( TKey ) + count * DenseEntrySize;
+        case Sparse:    return HeaderSize + count * SparseEntrySize;
+        default:        return 0;
+        }
+    }
+
+    static Format GetFormat( const uint8_t* instPtr )
+    {
+        return static_cast<Format>(instPtr[1]);
+    }
+
+    static uint16_t GetCount( const uint8_t* instPtr )
+    {
+        const uint8_t* p = instPtr + 2;
+        return ReadU16( p );
+    }
+
+    static TOffset GetDefaultOffset( const uint8_t* instPtr )
+    {
+        const uint8_t* p = GetDefaultOffsetPtr( instPtr );
+        return ReadI16( p );
+    }
+
+    static TKey GetKey( const uint8_t* instPtr, uint32_t index )
+    {
+        const uint8_t* p = instPtr + HeaderSize;
+
+        if ( GetFormat( instPtr ) == Dense )
+            return static_cast<TKey>(static_cast<int64_t>(ReadI32( p )) + index);
+
+        p += index * SparseEntrySize;
+        return ReadI32( p );
+    }
+
+    static TOffset GetOffset( const uint8_t* instPtr, uint32_t index )
+    {
+        const uint8_t* p = GetOffsetPtr( instPtr, index );
+        return ReadI16( p );
+    }
+
+    static void StoreOffset( uint8_t* instPtr, uint32_t index, TOffset offset )
+    {
+        StoreI16( const_cast<uint8_t*>(GetOffsetPtr( instPtr, index )), offset );
+    }
+
+    static void StoreDefaultOffset( uint8_t* instPtr, TOffset offset )
+    {
+        StoreI16( instPtr + 4, offset );
+    }
+
+    static const uint8_t* GetDefaultOffsetPtr( const uint8_t* instPtr )
+    {
+        return instPtr + 4;
+    }
+
+    static const uint8_t* GetOffsetPtr( const uint8_t* instPtr, uint32_t index )
+    {
+        if ( GetFormat( instPtr ) == Dense )
+            return instPtr + HeaderSize + sizeof( TKey ) + index * DenseEntrySize;
+        else
+            return instPtr + HeaderSize + index * SparseEntrySize + sizeof( TKey );
+    }
+
+    // Finds the offset for a key: directly in a dense table, and by binary
+    // search in a sparse one
+    static TOffset FindOffset( const uint8_t* instPtr, TKey key )
+    {
+        uint32_t count = GetCount( instPtr );
+
+        if ( GetFormat( instPtr ) == Dense )
+        {
+            const uint8_t* p = instPtr + HeaderSize;
+            int64_t index = static_cast<int64_t>(key) - ReadI32( p );
+
+            if ( index >= 0 && index < count )
+                return GetOffset( instPtr, static_cast<uint32_t>(index) );
+        }
+        else
+        {
+            uint32_t low = 0;
+            uint32_t high = count;
+
+            while ( low < high )
+            {
+                uint32_t mid = low + (high - low) / 2;
+                TKey midKey = GetKey( instPtr, mid );
+
+                if ( midKey == key )
+                    return GetOffset( instPtr, mid );
+                else if ( midKey < key )
+                    low = mid + 1;
+                else
+                    high = mid;
+            }
+        }
+
+        return GetDefaultOffset( instPtr );
+    }
+};
+
+
 struct CodeAddr
 {
     static uint32_t Build( uint32_t address, uint8_t module )
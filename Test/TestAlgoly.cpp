@@ -856,6 +856,91 @@ TEST_CASE( "Algoly: For-to-step, complex bounds and step, call lambda with loop
     TestCompileAndRunAlgoly( code, 350 );
 }
 
+TEST_CASE( "Algoly: For-to-step, step too big for a byte", "[algoly]" )
+{
+    const char code[] =
+        "def a\n"
+        "  var x:=0\n"
+        "  for i := 0 to 1000 by 200 do x := x + i end\n"
+        "  x\n"
+        "end\n"
+        ;
+
+    TestCompileAndRunAlgoly( code, 3000 );
+}
+
+TEST_CASE( "Algoly: For-downto-step, variable step", "[algoly]" )
+{
+    const char code[] =
+        "def a\n"
+        "  var x:=0, s:=-2\n"
+        "  for i := 9 downto 1 by s do x := x * 10 + i end\n"
+        "  x\n"
+        "end\n"
+        ;
+
+    TestCompileAndRunAlgoly( code, 97531 );
+}
+
+TEST_CASE( "Algoly: Comparisons of locals and constants as conditions", "[algoly]" )
+{
+    const char code[] =
+        "def a\n"
+        "  var x:=3, y:=5\n"
+        "  if x < y and y >= 5 and not (x = y) and x <> 4 and not (y > 5) then 1 else 2 end\n"
+        "end\n"
+        ;
+
+    TestCompileAndRunAlgoly( code, 1 );
+}
+
+TEST_CASE( "Algoly: Case expression as a condition", "[algoly]" )
+{
+    // The case's arms are comparisons, but its code doesn't end with one, so
+    // the branch on it can't be fused
+
+    struct Condition
+    {
+        const char* Text;
+        int         Result;
+    };
+
+    const Condition conditions[] =
+    {
+        { "case x when 1 then x = 1 else x = 9 end",                10 },
+        { "case x when 2 then x = 1 else x = 9 end",                20 },
+        { "case x when 1, y then x < y else x > y end",             10 },
+        { "x = 1 and (case x when 1 then x = 1 else x = 9 end)",    10 },
+        { "x = 2 or (case x when 1 then x = 9 else x = 1 end)",     20 },
+        { "not (case x when 1 then x = 1 else x = 9 end)",          20 },
+        { "not (case x when 3 then x = 1 else x = 9 end)",          10 },
+    };
+
+    for ( const auto& condition : conditions )
+    {
+        std::string code =
+            "def a\n"
+            "  var x:=1, y:=2\n"
+            "  if " + std::string( condition.Text ) + " then 10 else 20 end\n"
+            "end\n"
+            ;
+
+        TestCompileAndRunAlgoly( code.c_str(), condition.Result );
+    }
+}
+
+TEST_CASE( "Algoly: Divide by zero local", "[algoly]" )
+{
+    const char code[] =
+        "def a\n"
+        "  var x:=5, y:=0\n"
+        "  x / y\n"
+        "end\n"
+        ;
+
+    TestCompileAndRunAlgoly( code, ERR_DIVIDE );
+}
+
 TEST_CASE( "Algoly: Let, call, complex exprs", "[algoly]" )
 {
     const char code[] =
@@ -956,7 +1041,7 @@ TEST_CASE( "Algoly: Local array repeat init with call and binary", "[algoly]" )
         "def B(x) x*x end\n"
         ;
 
-    TestCompileAndRunAlgoly( code, 44, 0, 11 );
+    TestCompileAndRunAlgoly( code, 44, 0, 9 );
 }
 
 TEST_CASE( "Algoly: Global array, int complex elem and repeat init, complex indexing", "[algoly]" )
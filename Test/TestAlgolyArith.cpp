@@ -0,0 +1,140 @@
+#include "pch.h"
+#include "TestBase.h"
+#include "../Gemini/OpCodes.h"
+
+using namespace Gemini;
+
+
+namespace
+{
+
+struct ArithCounts
+{
+    int Saturating;
+    int Unchecked;
+};
+
+}
+
+// Counts the adds, subtracts and multiplies in PRIM, PRIMLOC and PRIMC.S
+static ArithCounts CountArithmetic( const char* code )
+{
+    CompiledAlgoly compiled = CompileAlgoly( code );
+    ArithCounts counts = {};
+
+    for ( const auto& inst : compiled.Insts )
+    {
+        if ( inst.Op == OP_PRIM || inst.Op == OP_PRIMLOC || inst.Op == OP_PRIMC_S )
+        {
+            uint8_t primitive = compiled.Code[inst.Address + 1];
+
+            if ( primitive == PRIM_ADD || primitive == PRIM_SUB || primitive == PRIM_MUL )
+                counts.Saturating++;
+            else if ( primitive == PRIM_ADD_U || primitive == PRIM_SUB_U || primitive == PRIM_MUL_U )
+                counts.Unchecked++;
+        }
+    }
+
+    return counts;
+}
+
+
+//----------------------------------------------------------------------------
+// Arithmetic that can't overflow
+//----------------------------------------------------------------------------
+
+TEST_CASE( "Algoly: arith, loop indexes", "[algoly][arith]" )
+{
+    const char code[] =
+        "var ar: [10] := [0...]\n"
+        "def a\n"
+        "  var s := 0\n"
+        "  for i := 0 below 10 do ar[i] := i * i + 1 end\n"
+        "  for i := 1 to 9 do s := s + ar[i] - ar[i - 1] end\n"
+        "  s\n"
+        "end\n"
+        ;
+
+    ArithCounts counts = CountArithmetic( code );
+
+    REQUIRE( counts.Saturating == 2 );
+    REQUIRE( counts.Unchecked == 3 );
+
+    TestCompileAndRunAlgoly( code, 81 );
+}
+
+TEST_CASE( "Algoly: arith, remainders", "[algoly][arith]" )
+{
+    const char code[] =
+        "def a(x)\n"
+        "  (x % 256) * 256 + x % 16 - 8\n"
+        "end\n"
+        ;
+
+    ArithCounts counts = CountArithmetic( code );
+
+    REQUIRE( counts.Saturating == 0 );
+    REQUIRE( counts.Unchecked == 3 );
+
+    TestCompileAndRunAlgoly( code, 13308, 0x1234 );
+    TestCompileAndRunAlgoly( code, 65287, -1 );
+    TestCompileAndRunAlgoly( code, -8, INT32_MIN );
+}
+
+TEST_CASE( "Algoly: arith, unknown operands saturate", "[algoly][arith]" )
+{
+    const char code[] =
+        "def a(x)\n"
+        "  var s := x * 2\n"
+        "  for i := 0 to 2 do s := s + i * 1500000000 end\n"
+        "  s\n"
+        "end\n"
+        ;
+
+    ArithCounts counts = CountArithmetic( code );
+
+    REQUIRE( counts.Saturating == 3 );
+    REQUIRE( counts.Unchecked == 0 );
+
+    TestCompileAndRunAlgoly( code, INT32_MAX, 0 );
+    TestCompileAndRunAlgoly( code, 1499999999, -2000000000 );
+}
+
+TEST_CASE( "Algoly: arith, ranges at the limit", "[algoly][arith]" )
+{
+    const char code[] =
+        "def a\n"
+        "  var x := 0, y := 0\n"
+        "  for i := 2147483640 to 2147483646 do x := i + 1 end\n"
+        "  for i := 2147483640 to 2147483646 do y := i + 2 end\n"
+        "  x % 1000 + y % 1000 * 1000\n"
+        "end\n"
+        ;
+
+    ArithCounts counts = CountArithmetic( code );
+
+    // Only the second add could go past the limit
+
+    REQUIRE( counts.Saturating == 1 );
+    REQUIRE( counts.Unchecked == 3 );
+
+    TestCompileAndRunAlgoly( code, 647647 );
+}
+
+TEST_CASE( "Algoly: arith, negative and divided ranges", "[algoly][arith]" )
+{
+    const char code[] =
+        "def a\n"
+        "  var s := 0\n"
+        "  for i := -5 to 5 do s := s * 3 + (i - 10) * (i / 2) end\n"
+        "  s\n"
+        "end\n"
+        ;
+
+    ArithCounts counts = CountArithmetic( code );
+
+    REQUIRE( counts.Saturating == 2 );
+    REQUIRE( counts.Unchecked == 2 );
+
+    TestCompileAndRunAlgoly( code, 3412853 );
+}
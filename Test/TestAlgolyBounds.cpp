@@ -0,0 +1,185 @@
+#include "pch.h"
+#include "TestBase.h"
+#include "../Gemini/OpCodes.h"
+
+using namespace Gemini;
+
+
+namespace
+{
+
+struct IndexCounts
+{
+    int Checked;
+    int Unchecked;
+};
+
+}
+
+static IndexCounts CountIndexes( const char* code )
+{
+    IndexCounts counts = {};
+
+    for ( const auto& inst : CompileAlgoly( code ).Insts )
+    {
+        if ( inst.Op == OP_INDEX )
+            counts.Checked++;
+        else if ( inst.Op == OP_INDEX_U )
+            counts.Unchecked++;
+    }
+
+    return counts;
+}
+
+
+//----------------------------------------------------------------------------
+// Indexing without bound checks in counted loops
+//----------------------------------------------------------------------------
+
+TEST_CASE( "Algoly: bounds, for below countof", "[algoly][bounds]" )
+{
+    const char code[] =
+        "var ar: [5] := [1, 2, 3, 4, 5]\n"
+        "def a\n"
+        "  var s := 0\n"
+        "  for i := 0 below countof(ar) do s := s * 10 + ar[i] end\n"
+        "  s\n"
+        "end\n"
+        ;
+
+    IndexCounts counts = CountIndexes( code );
+
+    REQUIRE( counts.Checked == 0 );
+    REQUIRE( counts.Unchecked == 1 );
+
+    TestCompileAndRunAlgoly( code, 12345 );
+}
+
+TEST_CASE( "Algoly: bounds, local array and stores", "[algoly][bounds]" )
+{
+    const char code[] =
+        "def a(n)\n"
+        "  var ar: [4] := [0...]\n"
+        "  for i := 0 to 3 do ar[i] := n + i end\n"
+        "  ar[0] + ar[1] * 10 + ar[2] * 100 + ar[3] * 1000\n"
+        "end\n"
+        ;
+
+    IndexCounts counts = CountIndexes( code );
+
+    REQUIRE( counts.Checked == 0 );
+    REQUIRE( counts.Unchecked == 1 );
+
+    TestCompileAndRunAlgoly( code, 4321, 1 );
+}
+
+TEST_CASE( "Algoly: bounds, downward loops and steps", "[algoly][bounds]" )
+{
+    const char code[] =
+        "var ar: [5] := [1, 2, 3, 4, 5]\n"
+        "def a\n"
+        "  var x := 0, y := 0, z := 0\n"
+        "  for i := countof(ar) - 1 downto 0 do x := x * 10 + ar[i] end\n"
+        "  for i := 4 above -1 by -2 do y := y * 10 + ar[i] end\n"
+        "  for i := 0 below 5 by 3 do z := z * 10 + ar[i] end\n"
+        "  x + y + z\n"
+        "end\n"
+        ;
+
+    IndexCounts counts = CountIndexes( code );
+
+    REQUIRE( counts.Checked == 0 );
+    REQUIRE( counts.Unchecked == 3 );
+
+    TestCompileAndRunAlgoly( code, 54321 + 531 + 14 );
+}
+
+TEST_CASE( "Algoly: bounds, offsets from the index", "[algoly][bounds]" )
+{
+    const char code[] =
+        "var ar: [5] := [1, 2, 3, 4, 5]\n"
+        "def a\n"
+        "  var s := 0\n"
+        "  for i := 0 below countof(ar) - 1 do s := s * 10 + ar[i + 1] - ar[i] end\n"
+        "  for i := 1 to 4 do s := s * 10 + ar[4 - i] end\n"
+        "  for i := 1 to 4 do s := s * 10 + ar[i + 1] end\n"
+        "  s\n"
+        "end\n"
+        ;
+
+    IndexCounts counts = CountIndexes( code );
+
+    // The last loop goes past the end
+
+    REQUIRE( counts.Checked == 1 );
+    REQUIRE( counts.Unchecked == 3 );
+
+    TestCompileAndRunAlgoly( code, ERR_BOUND );
+}
+
+TEST_CASE( "Algoly: bounds, nested loops over a matrix", "[algoly][bounds]" )
+{
+    const char code[] =
+        "def a\n"
+        "  var m: [3] of [4] := [[0...]...]\n"
+        "  var s := 0\n"
+        "  for i := 0 below 3 do\n"
+        "    for j := 0 below 4 do m[i][j] := i * 4 + j end\n"
+        "  end\n"
+        "  for j := 0 below 4 do s := s + m[2][j] end\n"
+        "  s\n"
+        "end\n"
+        ;
+
+    IndexCounts counts = CountIndexes( code );
+
+    REQUIRE( counts.Checked == 0 );
+    REQUIRE( counts.Unchecked == 3 );
+
+    TestCompileAndRunAlgoly( code, 8 + 9 + 10 + 11 );
+}
+
+TEST_CASE( "Algoly: bounds, unknown index values are checked", "[algoly][bounds]" )
+{
+    const char code[] =
+        "var ar: [5] := [1, 2, 3, 4, 5]\n"
+        "var n := 1\n"
+        "def a\n"
+        "  var s := 0\n"
+        "  for i := 0 below n do s := s + ar[i] end\n"
+        "  for i := 0 below 5 do s := s + ar[i]; i := i + 1 end\n"
+        "  for i := 0 below 5 do s := s + ar[i]; B(i) end\n"
+        "  for i := 0 below 5 by n do s := s + ar[i] end\n"
+        "  for i := 0 to 5 do s := s + ar[i] end\n"
+        "  s\n"
+        "end\n"
+        "def B(var x) x := x + 1 end\n"
+        ;
+
+    IndexCounts counts = CountIndexes( code );
+
+    REQUIRE( counts.Checked == 5 );
+    REQUIRE( counts.Unchecked == 0 );
+
+    TestCompileAndRunAlgoly( code, ERR_BOUND );
+}
+
+TEST_CASE( "Algoly: bounds, loops that never run", "[algoly][bounds]" )
+{
+    const char code[] =
+        "var ar: [5] := [1, 2, 3, 4, 5]\n"
+        "def a\n"
+        "  var s := 0\n"
+        "  for i := 5 below 5 do s := s + ar[i] end\n"
+        "  for i := 0 downto 10 do s := s + ar[i] end\n"
+        "  s + 7\n"
+        "end\n"
+        ;
+
+    IndexCounts counts = CountIndexes( code );
+
+    REQUIRE( counts.Checked == 2 );
+    REQUIRE( counts.Unchecked == 0 );
+
+    TestCompileAndRunAlgoly( code, 7 );
+}
@@ -0,0 +1,253 @@
+#include "pch.h"
+#include "TestBase.h"
+#include "../Gemini/OpCodes.h"
+#include <string.h>
+#include <string>
+
+using namespace Gemini;
+
+
+// The disassembly of the first SWITCH in the compiled code; empty if there isn't one
+static std::string FindSwitch( const char* code )
+{
+    for ( const auto& inst : CompileAlgoly( code ).Insts )
+    {
+        if ( inst.Op == OP_SWITCH )
+            return inst.Text;
+    }
+
+    return std::string();
+}
+
+static bool StartsWith( const std::string& text, const char* prefix )
+{
+    return text.compare( 0, strlen( prefix ), prefix ) == 0;
+}
+
+
+//----------------------------------------------------------------------------
+// Case expressions with switch tables
+//----------------------------------------------------------------------------
+
+TEST_CASE( "Algoly: case, dense table", "[algoly][case]" )
+{
+    const char code[] =
+        "def a(x)\n"
+        "  case x\n"
+        "    when 1 then 10\n"
+        "    when 2, 3 then 20\n"
+        "    when 5 then 50\n"
+        "    when 6 then 60\n"
+        "    else 99\n"
+        "  end\n"
+        "end\n"
+        ;
+
+    REQUIRE( StartsWith( FindSwitch( code ), "  SWITCH.D(6)" ) );
+
+    TestCompileAndRunAlgoly( code, 10, 1 );
+    TestCompileAndRunAlgoly( code, 20, 2 );
+    TestCompileAndRunAlgoly( code, 20, 3 );
+    TestCompileAndRunAlgoly( code, 99, 4 );
+    TestCompileAndRunAlgoly( code, 50, 5 );
+    TestCompileAndRunAlgoly( code, 60, 6 );
+    TestCompileAndRunAlgoly( code, 99, 0 );
+    TestCompileAndRunAlgoly( code, 99, 7 );
+    TestCompileAndRunAlgoly( code, 99, INT32_MIN );
+    TestCompileAndRunAlgoly( code, 99, INT32_MAX );
+}
+
+TEST_CASE( "Algoly: case, dense table with negative keys", "[algoly][case]" )
+{
+    const char code[] =
+        "def a(x)\n"
+        "  case x\n"
+        "    when -3 then 3\n"
+        "    when -2 then 2\n"
+        "    when -1 then 1\n"
+        "    when 0 then 100\n"
+        "    else 99\n"
+        "  end\n"
+        "end\n"
+        ;
+
+    REQUIRE( StartsWith( FindSwitch( code ), "  SWITCH.D(4)" ) );
+
+    TestCompileAndRunAlgoly( code, 3, -3 );
+    TestCompileAndRunAlgoly( code, 2, -2 );
+    TestCompileAndRunAlgoly( code, 1, -1 );
+    TestCompileAndRunAlgoly( code, 100, 0 );
+    TestCompileAndRunAlgoly( code, 99, -4 );
+    TestCompileAndRunAlgoly( code, 99, 1 );
+}
+
+TEST_CASE( "Algoly: case, sparse table", "[algoly][case]" )
+{
+    const char code[] =
+        "def a(x)\n"
+        "  case x\n"
+        "    when 1000000 then 6\n"
+        "    when -50000 then 1\n"
+        "    when 3 then 2\n"
+        "    when 100, 70000 then 4\n"
+        "    else 99\n"
+        "  end\n"
+        "end\n"
+        ;
+
+    REQUIRE( StartsWith( FindSwitch( code ), "  SWITCH.S(5)" ) );
+
+    TestCompileAndRunAlgoly( code, 1, -50000 );
+    TestCompileAndRunAlgoly( code, 2, 3 );
+    TestCompileAndRunAlgoly( code, 4, 100 );
+    TestCompileAndRunAlgoly( code, 4, 70000 );
+    TestCompileAndRunAlgoly( code, 6, 1000000 );
+    TestCompileAndRunAlgoly( code, 99, -50001 );
+    TestCompileAndRunAlgoly( code, 99, 4 );
+    TestCompileAndRunAlgoly( code, 99, 1000001 );
+}
+
+TEST_CASE( "Algoly: case, table without else", "[algoly][case]" )
+{
+    const char code[] =
+        "def a(x)\n"
+        "  case x\n"
+        "    when 1 then 10\n"
+        "    when 2 then 20\n"
+        "    when 3 then 30\n"
+        "    when 4 then 40\n"
+        "  end\n"
+        "end\n"
+        ;
+
+    REQUIRE( StartsWith( FindSwitch( code ), "  SWITCH.D(4)" ) );
+
+    TestCompileAndRunAlgoly( code, 30, 3 );
+    TestCompileAndRunAlgoly( code, 0, 5 );
+}
+
+TEST_CASE( "Algoly: case, repeated key goes to the first clause", "[algoly][case]" )
+{
+    const char code[] =
+        "def a(x)\n"
+        "  case x\n"
+        "    when 1 then 10\n"
+        "    when 2, 1 then 20\n"
+        "    when 3 then 30\n"
+        "    when 4, 3 then 40\n"
+        "    else 99\n"
+        "  end\n"
+        "end\n"
+        ;
+
+    REQUIRE( StartsWith( FindSwitch( code ), "  SWITCH.D(4)" ) );
+
+    TestCompileAndRunAlgoly( code, 10, 1 );
+    TestCompileAndRunAlgoly( code, 20, 2 );
+    TestCompileAndRunAlgoly( code, 30, 3 );
+    TestCompileAndRunAlgoly( code, 40, 4 );
+}
+
+TEST_CASE( "Algoly: case, few keys compare one by one", "[algoly][case]" )
+{
+    const char code[] =
+        "def a(x)\n"
+        "  case x when 1 then 10 when 2 then 20 when 3 then 30 else 99 end\n"
+        "end\n"
+        ;
+
+    REQUIRE( FindSwitch( code ).empty() );
+
+    TestCompileAndRunAlgoly( code, 20, 2 );
+    TestCompileAndRunAlgoly( code, 99, 4 );
+}
+
+TEST_CASE( "Algoly: case, variable key compares one by one", "[algoly][case]" )
+{
+    const char code[] =
+        "var m := 4\n"
+        "def a(x)\n"
+        "  case x when 1 then 10 when 2 then 20 when 3 then 30 when m then 40 else 99 end\n"
+        "end\n"
+        ;
+
+    REQUIRE( FindSwitch( code ).empty() );
+
+    TestCompileAndRunAlgoly( code, 40, 4 );
+    TestCompileAndRunAlgoly( code, 99, 5 );
+}
+
+TEST_CASE( "Algoly: case, table as a condition", "[algoly][case]" )
+{
+    const char code[] =
+        "def a(x)\n"
+        "  if case x when 1, 2 then 0 when 3, 4 then 1 end then 5 else 6 end\n"
+        "end\n"
+        ;
+
+    REQUIRE( StartsWith( FindSwitch( code ), "  SWITCH.D(4)" ) );
+
+    TestCompileAndRunAlgoly( code, 6, 1 );
+    TestCompileAndRunAlgoly( code, 5, 3 );
+    TestCompileAndRunAlgoly( code, 6, 9 );
+}
+
+TEST_CASE( "Algoly: case, table in a loop", "[algoly][case]" )
+{
+    const char code[] =
+        "def a(n)\n"
+        "  var sum := 0\n"
+        "  for i := 1 to n do\n"
+        "    case i % 8\n"
+        "      when 0 then next\n"
+        "      when 1, 2 then sum := sum + 1\n"
+        "      when 3 then sum := sum + 10\n"
+        "      when 7 then break\n"
+        "      else sum := sum + 100\n"
+        "    end\n"
+        "  end\n"
+        "  sum\n"
+        "end\n"
+        ;
+
+    REQUIRE( StartsWith( FindSwitch( code ), "  SWITCH.D(8)" ) );
+
+    TestCompileAndRunAlgoly( code, 12, 3 );
+    TestCompileAndRunAlgoly( code, 312, 6 );
+    TestCompileAndRunAlgoly( code, 312, 20 );
+}
+
+TEST_CASE( "Algoly: case, many keys", "[algoly][case]" )
+{
+    std::string dense = "def a(x)\n  case x\n";
+    std::string sparse = "def a(x)\n  case x\n";
+
+    for ( int i = 0; i < 200; i++ )
+    {
+        dense += "    when " + std::to_string( i ) + " then " + std::to_string( i * 2 ) + "\n";
+        sparse += "    when " + std::to_string( i * 1000 ) + " then " + std::to_string( i * 2 ) + "\n";
+    }
+
+    dense += "    else -1\n  end\nend\n";
+    sparse += "    else -1\n  end\nend\n";
+
+    std::string denseSwitch = FindSwitch( dense.c_str() );
+    std::string sparseSwitch = FindSwitch( sparse.c_str() );
+
+    // Long tables are cut off in the disassembly
+
+    REQUIRE( StartsWith( denseSwitch, "  SWITCH.D(200)" ) );
+    REQUIRE( StartsWith( sparseSwitch, "  SWITCH.S(200)" ) );
+    REQUIRE( denseSwitch.size() < 256 );
+    REQUIRE( denseSwitch.compare( denseSwitch.size() - 5, 5, ", ..." ) == 0 );
+
+    TestCompileAndRunAlgoly( dense.c_str(), 0, 0 );
+    TestCompileAndRunAlgoly( dense.c_str(), 198, 99 );
+    TestCompileAndRunAlgoly( dense.c_str(), 398, 199 );
+    TestCompileAndRunAlgoly( dense.c_str(), -1, 200 );
+
+    TestCompileAndRunAlgoly( sparse.c_str(), 0, 0 );
+    TestCompileAndRunAlgoly( sparse.c_str(), 198, 99000 );
+    TestCompileAndRunAlgoly( sparse.c_str(), 398, 199000 );
+    TestCompileAndRunAlgoly( sparse.c_str(), -1, 99001 );
+}
@@ -0,0 +1,235 @@
+#include "pch.h"
+#include "TestBase.h"
+#include "../Gemini/Compiler.h"
+
+using namespace Gemini;
+
+
+//----------------------------------------------------------------------------
+// Inlining
+//----------------------------------------------------------------------------
+
+TEST_CASE( "Algoly: inline, leaf with a parameter", "[algoly][inline]" )
+{
+    const char code[] =
+        "def a(x)\n"
+        "  Sq(x) + 1\n"
+        "end\n"
+        "def Sq(y) y * y end\n"
+        ;
+
+    CompilerStats stats = CompileAlgoly( code ).Stats;
+    CompilerStats statsCalled = CompileAlgoly( code, false ).Stats;
+
+    REQUIRE( stats.InlinedCalls == 1 );
+    REQUIRE( stats.InlineLocalsAdded == 1 );
+    REQUIRE( stats.Static.MaxCallDepth == 1 );
+    REQUIRE( stats.Static.MaxStackUsage < statsCalled.Static.MaxStackUsage );
+    REQUIRE( statsCalled.InlinedCalls == 0 );
+    REQUIRE( statsCalled.Static.MaxCallDepth == 2 );
+
+    TestCompileAndRunAlgoly( code, 10, 3, stats.Static.MaxStackUsage );
+    TestCompileAndRunAlgoly( code, 1, 0, stats.Static.MaxStackUsage );
+}
+
+TEST_CASE( "Algoly: inline, arguments in order", "[algoly][inline]" )
+{
+    const char code[] =
+        "def a(x)\n"
+        "  Sub(x, 3) * 100 + Sub(10, x)\n"
+        "end\n"
+        "def Sub(p, q) p - q end\n"
+        ;
+
+    CompilerStats stats = CompileAlgoly( code ).Stats;
+
+    REQUIRE( stats.InlinedCalls == 2 );
+    REQUIRE( stats.InlineLocalsAdded == 2 );
+
+    TestCompileAndRunAlgoly( code, 205, 5 );
+}
+
+TEST_CASE( "Algoly: inline, calls in arguments", "[algoly][inline]" )
+{
+    const char code[] =
+        "def a(x)\n"
+        "  Sub(Sq(x), Sq(Sub(x, 1)))\n"
+        "end\n"
+        "def Sub(p, q) p - q end\n"
+        "def Sq(y) y * y end\n"
+        ;
+
+    CompilerStats stats = CompileAlgoly( code ).Stats;
+
+    REQUIRE( stats.InlinedCalls == 4 );
+    REQUIRE( stats.InlineLocalsAdded == 2 );
+
+    TestCompileAndRunAlgoly( code, 9, 5 );
+}
+
+TEST_CASE( "Algoly: inline, parameter assigned in the callee", "[algoly][inline]" )
+{
+    const char code[] =
+        "def a(x)\n"
+        "  var z := 1\n"
+        "  Twice(x) + x * 10 + z * 1000\n"
+        "end\n"
+        "def Twice(y) y := y * 2; y end\n"
+        ;
+
+    CompilerStats stats = CompileAlgoly( code ).Stats;
+
+    REQUIRE( stats.InlinedCalls == 1 );
+    REQUIRE( stats.InlineLocalsAdded == 1 );
+
+    TestCompileAndRunAlgoly( code, 1036, 3 );
+}
+
+TEST_CASE( "Algoly: inline, callees as conditions", "[algoly][inline]" )
+{
+    const char code[] =
+        "def a(x)\n"
+        "  var r := 0\n"
+        "  if IsBig(x) then r := 1 end\n"
+        "  if not IsBig(x) then r := r + 2 end\n"
+        "  if IsBig(x) and IsOdd(x) then r := r + 4 end\n"
+        "  if IsBig(x) or IsOdd(x) then r := r + 8 end\n"
+        "  r\n"
+        "end\n"
+        "def IsBig(y) y > 10 end\n"
+        "def IsOdd(y) y % 2 = 1 end\n"
+        ;
+
+    CompilerStats stats = CompileAlgoly( code ).Stats;
+
+    REQUIRE( stats.InlinedCalls == 6 );
+
+    TestCompileAndRunAlgoly( code, 13, 11 );
+    TestCompileAndRunAlgoly( code, 9, 12 );
+    TestCompileAndRunAlgoly( code, 10, 3 );
+    TestCompileAndRunAlgoly( code, 2, 4 );
+}
+
+TEST_CASE( "Algoly: inline, discarded calls with globals", "[algoly][inline]" )
+{
+    const char code[] =
+        "var g := 0\n"
+        "var t: [4] := [1, 2, 3, 4]\n"
+        "def a(x)\n"
+        "  Add(x)\n"
+        "  Add(Get(2))\n"
+        "  g\n"
+        "end\n"
+        "def Add(y) g := g + y end\n"
+        "def Get(i) t[i] end\n"
+        ;
+
+    CompilerStats stats = CompileAlgoly( code ).Stats;
+
+    REQUIRE( stats.InlinedCalls == 3 );
+
+    TestCompileAndRunAlgoly( code, 8, 5 );
+}
+
+TEST_CASE( "Algoly: inline, returns and branches", "[algoly][inline]" )
+{
+    const char code[] =
+        "def a(x)\n"
+        "  Abs(x) * 10 + Sign(x)\n"
+        "end\n"
+        "def Abs(y) return if y < 0 then -y else y end end\n"
+        "def Sign(y)\n"
+        "  if y = 0 then 0 elsif y < 0 then 2 else 1 end\n"
+        "end\n"
+        ;
+
+    CompilerStats stats = CompileAlgoly( code ).Stats;
+
+    REQUIRE( stats.InlinedCalls == 2 );
+
+    TestCompileAndRunAlgoly( code, 72, -7 );
+    TestCompileAndRunAlgoly( code, 71, 7 );
+    TestCompileAndRunAlgoly( code, 0, 0 );
+}
+
+TEST_CASE( "Algoly: inline, tail position and loops", "[algoly][inline]" )
+{
+    const char code[] =
+        "def a(n)\n"
+        "  var s := 0\n"
+        "  for i := 1 to n do s := s + Sq(i) end\n"
+        "  Sq(s)\n"
+        "end\n"
+        "def Sq(y) y * y end\n"
+        ;
+
+    CompilerStats stats = CompileAlgoly( code ).Stats;
+
+    REQUIRE( stats.InlinedCalls == 2 );
+    REQUIRE( stats.Static.MaxCallDepth == 1 );
+
+    TestCompileAndRunAlgoly( code, 196, 3 );
+}
+
+TEST_CASE( "Algoly: inline, stack use", "[algoly][inline][stack]" )
+{
+    // Each runs with exactly the stack that's estimated for it
+
+    const char nested[] =
+        "def a(x)\n"
+        "  1 + Sub(Sq(x), Sq(Sub(x, 1)))\n"
+        "end\n"
+        "def Sub(p, q) p - q end\n"
+        "def Sq(y) y * y end\n"
+        ;
+
+    const char deep[] =
+        "def a(x)\n"
+        "  x + (x + (x + Sq(x)))\n"
+        "end\n"
+        "def Sq(y) y * y end\n"
+        ;
+
+    const char inLoop[] =
+        "def a(n)\n"
+        "  var s := 0\n"
+        "  for i := 1 to n do s := s + Sub(Sq(i), i) end\n"
+        "  s\n"
+        "end\n"
+        "def Sub(p, q) p - q end\n"
+        "def Sq(y) y * y end\n"
+        ;
+
+    REQUIRE( CompileAlgoly( nested ).Stats.Static.MaxStackUsage == 9 );
+    REQUIRE( CompileAlgoly( nested, false ).Stats.Static.MaxStackUsage == 10 );
+    REQUIRE( CompileAlgoly( deep ).Stats.Static.MaxStackUsage == 9 );
+    REQUIRE( CompileAlgoly( deep, false ).Stats.Static.MaxStackUsage == 11 );
+    REQUIRE( CompileAlgoly( inLoop ).Stats.Static.MaxStackUsage == 11 );
+    REQUIRE( CompileAlgoly( inLoop, false ).Stats.Static.MaxStackUsage == 12 );
+
+    TestCompileAndRunAlgoly( nested, 10, 5, 9 );
+    TestCompileAndRunAlgoly( deep, 28, 4, 9 );
+    TestCompileAndRunAlgoly( inLoop, 8, 3, 11 );
+}
+
+TEST_CASE( "Algoly: inline, procedures that are still called", "[algoly][inline]" )
+{
+    const char code[] =
+        "var p: [2] := [1, 2]\n"
+        "def a(x)\n"
+        "  Fact(x) + Outer(x) + Local(x) + Ref(p) + Big(x)\n"
+        "end\n"
+        "def Fact(n) if n <= 1 then 1 else n * Fact(n - 1) end end\n"
+        "def Outer(n) Fact(n) end\n"
+        "def Local(n) var m := n; m end\n"
+        "def Ref(var ar: [2]) ar[0] end\n"
+        "def Big(n) n+n+n+n+n+n+n+n+n+n end\n"
+        ;
+
+    CompilerStats stats = CompileAlgoly( code ).Stats;
+
+    REQUIRE( stats.InlinedCalls == 0 );
+    REQUIRE( stats.InlineLocalsAdded == 0 );
+
+    TestCompileAndRunAlgoly( code, 24 + 24 + 4 + 1 + 40, 4 );
+}
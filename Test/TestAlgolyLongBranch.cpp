@@ -0,0 +1,122 @@
+#include "pch.h"
+#include "TestBase.h"
+#include "../Gemini/Compiler.h"
+#include <string>
+
+using namespace Gemini;
+
+
+// Enough statements to put the code around them out of reach of a short branch
+static std::string MakeLongBody( const char* indent )
+{
+    std::string body;
+
+    for ( int i = 0; i < 8000; i++ )
+    {
+        body += indent;
+        body += "g := g + 1\n";
+    }
+
+    return body;
+}
+
+
+//----------------------------------------------------------------------------
+// Long branches
+//----------------------------------------------------------------------------
+
+TEST_CASE( "Algoly: long branch, loop", "[algoly][longbranch]" )
+{
+    std::string code =
+        "var g := 0\n"
+        "def a(n)\n"
+        "  for i := 1 to n do\n"
+        + MakeLongBody( "    " ) +
+        "  end\n"
+        "  g\n"
+        "end\n"
+        ;
+
+    CompilerStats stats = CompileAlgoly( code.c_str() ).Stats;
+
+    REQUIRE( stats.LongBranches > 0 );
+    REQUIRE( stats.CodeBytesWritten > 32768 );
+
+    TestCompileAndRunAlgoly( code.c_str(), 24000, 3 );
+    TestCompileAndRunAlgoly( code.c_str(), 0, 0 );
+}
+
+TEST_CASE( "Algoly: long branch, if and else", "[algoly][longbranch]" )
+{
+    std::string code =
+        "var g := 0\n"
+        "def a(x)\n"
+        "  if x > 0 then\n"
+        + MakeLongBody( "    " ) +
+        "  elsif x < 0 then\n"
+        "    g := -1\n"
+        "  else\n"
+        + MakeLongBody( "    " ) +
+        "    g := g * 2\n"
+        "  end\n"
+        "  g + 1\n"
+        "end\n"
+        ;
+
+    CompilerStats stats = CompileAlgoly( code.c_str() ).Stats;
+
+    REQUIRE( stats.LongBranches > 0 );
+
+    TestCompileAndRunAlgoly( code.c_str(), 8001, 1 );
+    TestCompileAndRunAlgoly( code.c_str(), 0, -1 );
+    TestCompileAndRunAlgoly( code.c_str(), 16001, 0 );
+}
+
+TEST_CASE( "Algoly: long branch, case table", "[algoly][longbranch]" )
+{
+    std::string code =
+        "var g := 0\n"
+        "def a(x)\n"
+        "  case x\n"
+        "    when 1 then\n"
+        + MakeLongBody( "      " ) +
+        "    when 2 then g := 20\n"
+        "    when 3 then\n"
+        + MakeLongBody( "      " ) +
+        "      g := g + 3\n"
+        "    when 4 then g := 40\n"
+        "    else\n"
+        "      g := 99\n"
+        "  end\n"
+        "  g\n"
+        "end\n"
+        ;
+
+    CompilerStats stats = CompileAlgoly( code.c_str() ).Stats;
+
+    REQUIRE( stats.LongBranches > 0 );
+
+    TestCompileAndRunAlgoly( code.c_str(), 8000, 1 );
+    TestCompileAndRunAlgoly( code.c_str(), 20, 2 );
+    TestCompileAndRunAlgoly( code.c_str(), 8003, 3 );
+    TestCompileAndRunAlgoly( code.c_str(), 40, 4 );
+    TestCompileAndRunAlgoly( code.c_str(), 99, 5 );
+    TestCompileAndRunAlgoly( code.c_str(), 99, 0 );
+}
+
+TEST_CASE( "Algoly: long branch, short code stays short", "[algoly][longbranch]" )
+{
+    const char code[] =
+        "var g := 0\n"
+        "def a(n)\n"
+        "  for i := 1 to n do if i % 2 = 0 then g := g + i end end\n"
+        "  g\n"
+        "end\n"
+        ;
+
+    CompilerStats stats = CompileAlgoly( code ).Stats;
+
+    REQUIRE( stats.LongBranches == 0 );
+
+    TestCompileAndRunAlgoly( code, 30, 10 );
+}
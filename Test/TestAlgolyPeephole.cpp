@@ -0,0 +1,131 @@
+#include "pch.h"
+#include "TestBase.h"
+#include "../Gemini/Compiler.h"
+
+using namespace Gemini;
+
+
+//----------------------------------------------------------------------------
+// Peephole optimizer
+//----------------------------------------------------------------------------
+
+TEST_CASE( "Algoly: peephole, nothing to do", "[algoly][peephole]" )
+{
+    const char code[] =
+        "def a\n"
+        "  return 3\n"
+        "end\n"
+        ;
+
+    CompilerStats stats = CompileAlgoly( code ).Stats;
+
+    REQUIRE( stats.PeepholeBytesSaved == 0 );
+    REQUIRE( stats.PeepholeInstsSaved == 0 );
+
+    TestCompileAndRunAlgoly( code, 3 );
+}
+
+TEST_CASE( "Algoly: peephole, adding and subtracting zero", "[algoly][peephole]" )
+{
+    const char code[] =
+        "def a(x)\n"
+        "  return x + 0 - 0\n"
+        "end\n"
+        ;
+
+    CompilerStats stats = CompileAlgoly( code ).Stats;
+
+    REQUIRE( stats.PeepholeBytesSaved == 6 );
+    REQUIRE( stats.PeepholeInstsSaved == 2 );
+
+    TestCompileAndRunAlgoly( code, 7, 7 );
+    TestCompileAndRunAlgoly( code, INT32_MIN, INT32_MIN );
+}
+
+TEST_CASE( "Algoly: peephole, first local is loaded in place", "[algoly][peephole]" )
+{
+    const char code[] =
+        "def a(x)\n"
+        "  var y := 5\n"
+        "  return y + x\n"
+        "end\n"
+        ;
+
+    CompilerStats stats = CompileAlgoly( code ).Stats;
+
+    REQUIRE( stats.PeepholeBytesSaved == 4 );
+    REQUIRE( stats.PeepholeInstsSaved == 2 );
+
+    TestCompileAndRunAlgoly( code, 8, 3 );
+}
+
+TEST_CASE( "Algoly: peephole, last of several locals is loaded in place", "[algoly][peephole]" )
+{
+    const char code[] =
+        "def a(x)\n"
+        "  var y := x\n"
+        "  var z := 4\n"
+        "  y := y * z\n"
+        "  return y + z\n"
+        "end\n"
+        ;
+
+    TestCompileAndRunAlgoly( code, 16, 3 );
+}
+
+TEST_CASE( "Algoly: peephole, branch to a return", "[algoly][peephole]" )
+{
+    const char code[] =
+        "def a(x)\n"
+        "  if x > 2 then return 1 else return 2 end\n"
+        "end\n"
+        ;
+
+    CompilerStats stats = CompileAlgoly( code ).Stats;
+
+    REQUIRE( stats.PeepholeBytesSaved == 2 );
+    REQUIRE( stats.PeepholeInstsSaved == 0 );
+
+    TestCompileAndRunAlgoly( code, 1, 3 );
+    TestCompileAndRunAlgoly( code, 2, 2 );
+}
+
+TEST_CASE( "Algoly: peephole, branch over a branch", "[algoly][peephole]" )
+{
+    const char code[] =
+        "def a(n)\n"
+        "  var x := 1; loop x := x + 1; if x >= n then break end end\n"
+        "  x\n"
+        "end\n"
+        ;
+
+    CompilerStats stats = CompileAlgoly( code ).Stats;
+
+    // The first local also saves 4 bytes and 2 instructions
+
+    REQUIRE( stats.PeepholeBytesSaved == 7 );
+    REQUIRE( stats.PeepholeInstsSaved == 3 );
+
+    TestCompileAndRunAlgoly( code, 2, 0 );
+    TestCompileAndRunAlgoly( code, 9, 9 );
+}
+
+TEST_CASE( "Algoly: peephole, branches in nested loops", "[algoly][peephole]" )
+{
+    const char code[] =
+        "def a(x)\n"
+        "  var s := 0\n"
+        "  for i := 0 to x do\n"
+        "    for j := 0 to i do\n"
+        "      if j > 3 then break end\n"
+        "      if j = 1 then next end\n"
+        "      s := s + j\n"
+        "    end\n"
+        "  end\n"
+        "  return s\n"
+        "end\n"
+        ;
+
+    TestCompileAndRunAlgoly( code, 0, 1 );
+    TestCompileAndRunAlgoly( code, 22, 6 );
+}
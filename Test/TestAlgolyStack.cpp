@@ -218,7 +218,7 @@ TEST_CASE( "Algoly: StackUse: call at right at end of deep tree going right", "[
         "def B 1 end\n"
         ;
 
-    TestCompileAndRunAlgoly( code, 9, 0, 9 );
+    TestCompileAndRunAlgoly( code, 9, 0, 7 );
 }
 
 TEST_CASE( "Algoly: StackUse: call at left in deep tree going right", "[algoly][stack]" )
@@ -232,7 +232,7 @@ TEST_CASE( "Algoly: StackUse: call at left in deep tree going right", "[algoly][
         "def E 1 end\n"
         ;
 
-    TestCompileAndRunAlgoly( code, 9, 0, 12 );
+    TestCompileAndRunAlgoly( code, 9, 0, 10 );
 }
 
 TEST_CASE( "Algoly: StackUse: return binary, then tree going right", "[algoly][stack]" )
@@ -304,7 +304,7 @@ TEST_CASE( "Algoly: StackUse: if with comparison and no else, shallow call tree"
         "def C 1 end\n"
         ;
 
-    TestCompileAndRunAlgoly( code, 1, 0, 7 );
+    TestCompileAndRunAlgoly( code, 1, 0, 5 );
 }
 
 TEST_CASE( "Algoly: StackUse: if with comparison and else, shallow call tree", "[algoly][stack]" )
@@ -316,7 +316,7 @@ TEST_CASE( "Algoly: StackUse: if with comparison and else, shallow call tree", "
         "def C 1 end\n"
         ;
 
-    TestCompileAndRunAlgoly( code, 1, 0, 7 );
+    TestCompileAndRunAlgoly( code, 1, 0, 5 );
 }
 
 TEST_CASE( "Algoly: StackUse: if with comparison and else, shallow call tree in else", "[algoly][stack]" )
@@ -328,7 +328,7 @@ TEST_CASE( "Algoly: StackUse: if with comparison and else, shallow call tree in
         "def C 1 end\n"
         ;
 
-    TestCompileAndRunAlgoly( code, 10, 0, 7 );
+    TestCompileAndRunAlgoly( code, 10, 0, 5 );
 }
 
 TEST_CASE( "Algoly: StackUse: assign global", "[algoly][stack]" )
@@ -420,7 +420,7 @@ TEST_CASE( "Algoly: StackUse: 2-nested call, assign", "[algoly][stack]" )
         "def C 9 end\n"
         ;
 
-    TestCompileAndRunAlgoly( code, 1, 0, 7 );
+    TestCompileAndRunAlgoly( code, 1, 0, 5 );
 }
 
 TEST_CASE( "Algoly: StackUse: 2-nested call, assign return", "[algoly][stack]" )
@@ -432,7 +432,7 @@ TEST_CASE( "Algoly: StackUse: 2-nested call, assign return", "[algoly][stack]" )
         "def C 9 end\n"
         ;
 
-    TestCompileAndRunAlgoly( code, 9, 0, 7 );
+    TestCompileAndRunAlgoly( code, 9, 0, 5 );
 }
 
 TEST_CASE( "Algoly: StackUse: return lambda", "[algoly][stack]" )
@@ -590,7 +590,7 @@ TEST_CASE( "Algoly: StackUse: even call tree", "[algoly][stack]" )
         "def B(x, y) x+y end\n"
         ;
 
-    TestCompileAndRunAlgoly( code, 36, 0, 10 );
+    TestCompileAndRunAlgoly( code, 36, 0, 8 );
 }
 
 TEST_CASE( "Algoly: StackUse: deep calls", "[algoly][stack]" )
@@ -736,31 +736,31 @@ TEST_CASE( "Algoly: StackUse: if many elsif", "[algoly][stack]" )
         ;
 
     WHEN( "2" )
-        TestCompileAndRunAlgoly( code, 20, 2, 8 );
+        TestCompileAndRunAlgoly( code, 20, 2, 6 );
 
     WHEN( "3" )
-        TestCompileAndRunAlgoly( code, 20, 3, 8 );
+        TestCompileAndRunAlgoly( code, 20, 3, 6 );
 
     WHEN( "4" )
-        TestCompileAndRunAlgoly( code, 20, 4, 8 );
+        TestCompileAndRunAlgoly( code, 20, 4, 6 );
 
     WHEN( "5" )
-        TestCompileAndRunAlgoly( code, 20, 5, 8 );
+        TestCompileAndRunAlgoly( code, 20, 5, 6 );
 
     WHEN( "6" )
-        TestCompileAndRunAlgoly( code, 20, 6, 8 );
+        TestCompileAndRunAlgoly( code, 20, 6, 6 );
 
     WHEN( "7" )
-        TestCompileAndRunAlgoly( code, 20, 7, 8 );
+        TestCompileAndRunAlgoly( code, 20, 7, 6 );
 
     WHEN( "8" )
-        TestCompileAndRunAlgoly( code, 20, 8, 8 );
+        TestCompileAndRunAlgoly( code, 20, 8, 6 );
 
     WHEN( "9" )
-        TestCompileAndRunAlgoly( code, 20, 9, 8 );
+        TestCompileAndRunAlgoly( code, 20, 9, 6 );
 
     WHEN( "10" )
-        TestCompileAndRunAlgoly( code, 20, 10, 8 );
+        TestCompileAndRunAlgoly( code, 20, 10, 6 );
 }
 
 TEST_CASE( "Algoly: StackUse: add two if no else", "[algoly][stack]" )
@@ -851,31 +851,31 @@ TEST_CASE( "Algoly: StackUse: case many clauses", "[algoly][stack]" )
         ;
 
     WHEN( "2" )
-        TestCompileAndRunAlgoly( code, 20, 2, 8 );
+        TestCompileAndRunAlgoly( code, 20, 2, 6 );
 
     WHEN( "3" )
-        TestCompileAndRunAlgoly( code, 20, 3, 8 );
+        TestCompileAndRunAlgoly( code, 20, 3, 6 );
 
     WHEN( "4" )
-        TestCompileAndRunAlgoly( code, 20, 4, 8 );
+        TestCompileAndRunAlgoly( code, 20, 4, 6 );
 
     WHEN( "5" )
-        TestCompileAndRunAlgoly( code, 20, 5, 8 );
+        TestCompileAndRunAlgoly( code, 20, 5, 6 );
 
     WHEN( "6" )
-        TestCompileAndRunAlgoly( code, 20, 6, 8 );
+        TestCompileAndRunAlgoly( code, 20, 6, 6 );
 
     WHEN( "7" )
-        TestCompileAndRunAlgoly( code, 20, 7, 8 );
+        TestCompileAndRunAlgoly( code, 20, 7, 6 );
 
     WHEN( "8" )
-        TestCompileAndRunAlgoly( code, 20, 8, 8 );
+        TestCompileAndRunAlgoly( code, 20, 8, 6 );
 
     WHEN( "9" )
-        TestCompileAndRunAlgoly( code, 20, 9, 8 );
+        TestCompileAndRunAlgoly( code, 20, 9, 6 );
 
     WHEN( "10" )
-        TestCompileAndRunAlgoly( code, 20, 10, 8 );
+        TestCompileAndRunAlgoly( code, 20, 10, 6 );
 }
 
 TEST_CASE( "Algoly: StackUse: add two case no else", "[algoly][stack]" )
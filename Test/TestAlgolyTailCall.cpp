@@ -0,0 +1,160 @@
+#include "pch.h"
+#include "TestBase.h"
+
+using namespace Gemini;
+
+
+//----------------------------------------------------------------------------
+// Tail calls
+//
+// The test stack is 1024 cells. Without tail calls, a thousand nested calls
+// would overflow it.
+//----------------------------------------------------------------------------
+
+TEST_CASE( "Algoly: tail call, self", "[algoly][tail-call]" )
+{
+    const char code[] =
+        "def a\n"
+        "  return Sum(1000, 0)\n"
+        "end\n"
+        "def Sum(n, acc)\n"
+        "  if n = 0 then return acc end\n"
+        "  return Sum(n - 1, acc + n)\n"
+        "end\n"
+        ;
+
+    TestCompileAndRunAlgoly( code, 500500 );
+}
+
+TEST_CASE( "Algoly: tail call, mutual", "[algoly][tail-call]" )
+{
+    const char code[] =
+        "def a\n"
+        "  return IsEven(1001)\n"
+        "end\n"
+        "def IsEven(n)\n"
+        "  if n = 0 then return 1 end\n"
+        "  return IsOdd(n - 1)\n"
+        "end\n"
+        "def IsOdd(n)\n"
+        "  if n = 0 then return 0 end\n"
+        "  return IsEven(n - 1)\n"
+        "end\n"
+        ;
+
+    TestCompileAndRunAlgoly( code, 0 );
+}
+
+TEST_CASE( "Algoly: tail call, more and fewer args", "[algoly][tail-call]" )
+{
+    const char code[] =
+        "def a\n"
+        "  return B(1000)\n"
+        "end\n"
+        "def B(n)\n"
+        "  if n = 0 then return 7 end\n"
+        "  return C(n, 1, 2)\n"
+        "end\n"
+        "def C(n, x, y)\n"
+        "  return B(n - x * y + 1)\n"
+        "end\n"
+        ;
+
+    TestCompileAndRunAlgoly( code, 7 );
+}
+
+TEST_CASE( "Algoly: tail call, indirect", "[algoly][tail-call]" )
+{
+    const char code[] =
+        "var f: &proc(int) -> int := &Count\n"
+        "def a\n"
+        "  return (f)(1000)\n"
+        "end\n"
+        "def Count(n) -> int\n"
+        "  if n = 0 then return 9 end\n"
+        "  return (f)(n - 1)\n"
+        "end\n"
+        ;
+
+    TestCompileAndRunAlgoly( code, 9 );
+}
+
+TEST_CASE( "Algoly: tail call, in a discarded call", "[algoly][tail-call]" )
+{
+    const char code[] =
+        "def a\n"
+        "  B(1000);\n"
+        "  return 4\n"
+        "end\n"
+        "def B(n)\n"
+        "  if n = 0 then return 0 end\n"
+        "  return B(n - 1)\n"
+        "end\n"
+        ;
+
+    TestCompileAndRunAlgoly( code, 4 );
+}
+
+TEST_CASE( "Algoly: no tail call when passing a local by reference", "[algoly][tail-call]" )
+{
+    const char code[] =
+        "def a\n"
+        "  return B(5)\n"
+        "end\n"
+        "def B(n)\n"
+        "  var x := n\n"
+        "  return C(x)\n"
+        "end\n"
+        "def C(var m)\n"
+        "  m := m + 3\n"
+        "  return m\n"
+        "end\n"
+        ;
+
+    TestCompileAndRunAlgoly( code, 8 );
+}
+
+TEST_CASE( "Algoly: no tail call when passing an arg by reference", "[algoly][tail-call]" )
+{
+    const char code[] =
+        "def a\n"
+        "  return B(5)\n"
+        "end\n"
+        "def B(n)\n"
+        "  return C(n)\n"
+        "end\n"
+        "def C(var m)\n"
+        "  m := m + 3\n"
+        "  return m\n"
+        "end\n"
+        ;
+
+    TestCompileAndRunAlgoly( code, 8 );
+}
+
+TEST_CASE( "Algoly: tail call, modules", "[algoly][tail-call][module]" )
+{
+    const char* modeCodeA[] =
+    {
+        "def Down(n)\n"
+        "  if n = 0 then return 6 end\n"
+        "  return Down(n - 1)\n"
+        "end\n"
+    };
+
+    const char* mainCode[] =
+    {
+        "import ModA\n"
+        "def a\n"
+        "  return ModA.Down(1000)\n"
+        "end\n"
+    };
+
+    const ModuleSource modSources[] =
+    {
+        { "ModA",   Span( modeCodeA ) },
+        { "Main",   Span( mainCode ) },
+    };
+
+    TestCompileAndRun( Language::Gema, modSources, 6, 0 );
+}
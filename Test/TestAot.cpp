@@ -0,0 +1,197 @@
+#include "pch.h"
+#include "TestBase.h"
+#include "../Gemini/Aot.h"
+#include "../Gemini/Common.h"
+#include "../Gemini/OpCodes.h"
+#include "../Gemini/Translator.h"
+#include <limits.h>
+#include <vector>
+
+using namespace Gemini;
+
+
+TEST_CASE( "Aot: translate a module", "[aot]" )
+{
+    auto code = MakeCode( { OP_LDC_S, 3, OP_PRIMC_S, PRIM_ADD, 4, OP_RET } );
+    Module mod = {};
+    AotExport exports[] = { { "Seven", 0 } };
+    std::string source;
+
+    mod.CodeBase = code.data();
+    mod.CodeSize = static_cast<U32>(code.size());
+
+    REQUIRE( TranslateModule( &mod, 0, "SevenModule", exports, std::size( exports ), source ) == ERR_NONE );
+    REQUIRE( source.find( "const AotModule& SevenModule()" ) != std::string::npos );
+    REQUIRE( source.find( "VmAdd( sp[0], (4) )" ) != std::string::npos );
+    REQUIRE( source.find( "\"Seven\"" ) != std::string::npos );
+}
+
+TEST_CASE( "Aot: translating needs verified code", "[aot]" )
+{
+    auto code = MakeCode( { OP_LDC_S, 1, OP_PRIM, PRIM_ADD, OP_RET } );
+    Module mod = {};
+    std::string source;
+
+    mod.CodeBase = code.data();
+    mod.CodeSize = static_cast<U32>(code.size());
+
+    REQUIRE( TranslateModule( &mod, 0, "Bad", nullptr, 0, source ) == ERR_BAD_MODULE );
+}
+
+
+#if defined( GEMINIVM_AOT_SAMPLE )
+
+// Generated by GeminiTranslator from AotSample.gema
+const AotModule& AotSample();
+
+struct AotResult
+{
+    int                 Err;
+    CELL                Value;
+    std::vector<CELL>   Data;
+};
+
+static AotResult RunSample( IEnvironment* env, const Module* mod, const char* funcName, std::initializer_list<CELL> args )
+{
+    CELL stack[256];
+    Machine machine;
+    U32 address = 0;
+
+    REQUIRE( AotSample().FindExport( funcName, &address ) );
+
+    if ( env != nullptr )
+        machine.Init( stack, static_cast<U16>(std::size( stack )), env );
+    else
+        machine.Init( stack, static_cast<U16>(std::size( stack )), AotSample().GetIndex(), mod );
+
+    CELL* argPtr = machine.Start( AotSample().GetIndex(), address, static_cast<U8>(args.size()) );
+
+    REQUIRE( argPtr != nullptr );
+
+    std::copy( args.begin(), args.end(), argPtr );
+
+    AotResult result;
+
+    result.Err = machine.Run();
+    result.Value = stack[std::size( stack ) - 1];
+    result.Data.assign( mod->DataBase, mod->DataBase + mod->DataSize );
+
+    return result;
+}
+
+// Runs the translated code and the interpreter from the same data, and
+// checks that they agree
+static AotResult RunAndCompare( const char* funcName, std::initializer_list<CELL> args )
+{
+    const Module* aotMod = AotSample().GetModule();
+
+    REQUIRE( aotMod != nullptr );
+
+    std::vector<CELL> dataImage( aotMod->DataBase, aotMod->DataBase + aotMod->DataSize );
+
+    AotEnvironment env;
+
+    REQUIRE( env.AddModule( AotSample() ) == ERR_NONE );
+
+    AotResult aotResult = RunSample( &env, aotMod, funcName, args );
+
+    std::copy( dataImage.begin(), dataImage.end(), aotMod->DataBase );
+
+    Module interpMod = *aotMod;
+
+    interpMod.Verified = nullptr;
+    interpMod.Aot = nullptr;
+
+    AotResult interpResult = RunSample( nullptr, &interpMod, funcName, args );
+
+    REQUIRE( aotResult.Err == interpResult.Err );
+    REQUIRE( aotResult.Data == interpResult.Data );
+
+    if ( aotResult.Err == ERR_NONE )
+        REQUIRE( aotResult.Value == interpResult.Value );
+
+    std::copy( dataImage.begin(), dataImage.end(), aotMod->DataBase );
+
+    return aotResult;
+}
+
+
+TEST_CASE( "Aot: sample module verified", "[aot]" )
+{
+    REQUIRE( AotSample().GetStatus() == ERR_NONE );
+    REQUIRE( AotSample().GetModule() != nullptr );
+}
+
+TEST_CASE( "Aot: loop", "[aot]" )
+{
+    REQUIRE( RunAndCompare( "Sum", { 100 } ).Value == 5050 );
+    REQUIRE( RunAndCompare( "Sum", { 0 } ).Value == 0 );
+}
+
+TEST_CASE( "Aot: array bounds", "[aot]" )
+{
+    REQUIRE( RunAndCompare( "Lookup", { 2 } ).Value == 4 );
+    REQUIRE( RunAndCompare( "Lookup", { 4 } ).Err == ERR_BOUND );
+    REQUIRE( RunAndCompare( "Lookup", { -1 } ).Err == ERR_BOUND );
+}
+
+TEST_CASE( "Aot: recursion and saturation", "[aot]" )
+{
+    REQUIRE( RunAndCompare( "Fact", { 5 } ).Value == 120 );
+    REQUIRE( RunAndCompare( "Fact", { 13 } ).Value == INT32_MAX );
+}
+
+TEST_CASE( "Aot: division", "[aot]" )
+{
+    REQUIRE( RunAndCompare( "Divide", { -7, 2 } ).Value == -4 );
+    REQUIRE( RunAndCompare( "Modulo", { -7, 2 } ).Value == 1 );
+    REQUIRE( RunAndCompare( "Divide", { 1, 0 } ).Err == ERR_DIVIDE );
+    REQUIRE( RunAndCompare( "Divide", { INT32_MIN, -1 } ).Value == INT32_MAX );
+}
+
+TEST_CASE( "Aot: globals", "[aot]" )
+{
+    AotResult result = RunAndCompare( "Accumulate", { 10 } );
+
+    REQUIRE( result.Value == 23 );
+    REQUIRE( result.Data[0] == 23 );
+}
+
+TEST_CASE( "Aot: indirect calls", "[aot]" )
+{
+    REQUIRE( RunAndCompare( "Twice", { 21 } ).Value == 42 );
+}
+
+TEST_CASE( "Aot: budget", "[aot]" )
+{
+    CELL stack[256];
+    Machine machine;
+    AotEnvironment env;
+    U32 address = 0;
+
+    REQUIRE( env.AddModule( AotSample() ) == ERR_NONE );
+    REQUIRE( AotSample().FindExport( "Sum", &address ) );
+
+    machine.Init( stack, static_cast<U16>(std::size( stack )), &env );
+
+    CELL* args = machine.Start( AotSample().GetIndex(), address, 1 );
+
+    REQUIRE( args != nullptr );
+
+    args[0] = 100;
+
+    int slices = 0;
+    int err;
+
+    do
+    {
+        err = machine.Run( 10 );
+        slices++;
+    } while ( err == ERR_BUDGET_EXHAUSTED );
+
+    REQUIRE( err == ERR_NONE );
+    REQUIRE( slices > 5 );
+    REQUIRE( stack[std::size( stack ) - 1] == 5050 );
+}
+
+#endif
@@ -0,0 +1,152 @@
+#include "pch.h"
+#include "TestBase.h"
+#include "../Gemini/AlgolyParser.h"
+#include "../Gemini/Arena.h"
+#include "../Gemini/Syntax.h"
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace Gemini;
+
+
+namespace
+{
+
+class CountedObject
+{
+    int&    mLiveCount;
+
+public:
+    int     Value;
+
+    CountedObject( int& liveCount, int value ) :
+        mLiveCount( liveCount ),
+        Value( value )
+    {
+        mLiveCount++;
+    }
+
+    ~CountedObject()
+    {
+        mLiveCount--;
+    }
+};
+
+class NullLog : public ICompilerLog
+{
+public:
+    virtual void Add( LogCategory category, const char* fileName, int line, int column, const char* message ) override
+    {
+    }
+};
+
+}
+
+
+//----------------------------------------------------------------------------
+// Arena
+//----------------------------------------------------------------------------
+
+TEST_CASE( "Arena: allocations are aligned and don't overlap", "[arena]" )
+{
+    Arena arena;
+    std::vector<std::pair<uint8_t*, size_t>> allocs;
+    bool aligned = true;
+
+    for ( size_t i = 1; i < 2000; i++ )
+    {
+        size_t alignment = size_t( 1 ) << (i % 5);
+        size_t size = i % 37 + 1;
+        uint8_t* p = static_cast<uint8_t*>( arena.Allocate( size, alignment ) );
+
+        aligned = aligned && reinterpret_cast<uintptr_t>( p ) % alignment == 0;
+
+        memset( p, static_cast<uint8_t>( i ), size );
+        allocs.push_back( { p, size } );
+    }
+
+    REQUIRE( aligned );
+
+    // Each one still holds what was written to it
+
+    bool intact = true;
+
+    for ( size_t i = 0; i < allocs.size(); i++ )
+    {
+        for ( size_t j = 0; j < allocs[i].second; j++ )
+            intact = intact && allocs[i].first[j] == static_cast<uint8_t>( i + 1 );
+    }
+
+    REQUIRE( intact );
+
+    REQUIRE( arena.GetBlockBytes() > 0 );
+}
+
+TEST_CASE( "Arena: big allocations get their own blocks", "[arena]" )
+{
+    Arena arena;
+
+    char* small1 = static_cast<char*>( arena.Allocate( 16, 8 ) );
+    char* big = static_cast<char*>( arena.Allocate( 1024 * 1024, 16 ) );
+    char* small2 = static_cast<char*>( arena.Allocate( 16, 8 ) );
+
+    memset( big, 0, 1024 * 1024 );
+
+    REQUIRE( reinterpret_cast<uintptr_t>( big ) % 16 == 0 );
+    REQUIRE( arena.GetBlockBytes() > 1024 * 1024 );
+
+    // The small ones still share a block
+    REQUIRE( small2 == small1 + 16 );
+}
+
+TEST_CASE( "Arena: shared objects keep the arena alive", "[arena]" )
+{
+    int liveCount = 0;
+    std::shared_ptr<CountedObject> kept;
+
+    {
+        auto arena = std::make_shared<Arena>();
+        auto dropped = std::allocate_shared<CountedObject>( ArenaAllocator<CountedObject>( arena ), liveCount, 1 );
+
+        kept = std::allocate_shared<CountedObject>( ArenaAllocator<CountedObject>( arena ), liveCount, 2 );
+
+        REQUIRE( liveCount == 2 );
+    }
+
+    // Only the object is left holding the arena
+
+    REQUIRE( liveCount == 1 );
+    REQUIRE( kept->Value == 2 );
+
+    kept.reset();
+
+    REQUIRE( liveCount == 0 );
+}
+
+TEST_CASE( "Arena: parsed nodes are in the unit's arena", "[arena]" )
+{
+    const char* code =
+        "const N = 3\n"
+        "def a(x) var y := x * N; y + &a end\n"
+        ;
+
+    NullLog log;
+    AlgolyParser parser( code, strlen( code ), "Arena", &log );
+    Unique<Unit> unit = parser.Parse();
+
+    REQUIRE( !unit->InArena );
+    REQUIRE( unit->GetArena() != nullptr );
+    REQUIRE( unit->GetArena()->GetBlockBytes() > 0 );
+    REQUIRE( unit->FuncDeclarations.size() == 1 );
+    REQUIRE( unit->FuncDeclarations[0]->InArena );
+    REQUIRE( unit->DataDeclarations[0]->InArena );
+
+    // A node made elsewhere can still be put in the tree
+
+    Unique<NumberExpr> number( new NumberExpr( 4 ) );
+
+    REQUIRE( !number->InArena );
+
+    unit->FuncDeclarations[0]->Body.Statements.push_back( std::move( number ) );
+}
@@ -5,7 +5,9 @@
 #include "../Gemini/AlgolyParser.h"
 #include "../Gemini/Compiler.h"
 #include "../Gemini/Disassembler.h"
+#include "../Gemini/Jit.h"
 #include "../Gemini/Machine.h"
+#include "../Gemini/OpCodes.h"
 #include <limits.h>
 #include <string.h>
 
@@ -107,6 +109,9 @@ public:
 
     virtual Module* FindModule( U8 index ) override
     {
+        if ( index >= mMods.size() )
+            return nullptr;
+
         return &mMods[index];
     }
 };
@@ -240,6 +245,104 @@ void Disassemble( const uint8_t* program, int size )
 }
 
 
+CompiledAlgoly CompileAlgoly( const char* code, bool inlining )
+{
+    CompilerAttrs attrs;
+    CompilerEnv env;
+    CompilerLog log{ true };
+    Compiler compiler( &env, &log, attrs );
+    AlgolyParser parser( code, static_cast<int>(strlen( code )), "Main", &log );
+
+    compiler.AddUnit( parser.Parse() );
+    compiler.SetInlining( inlining );
+
+    REQUIRE( compiler.Compile() == CompilerErr::OK );
+
+    CompiledAlgoly compiled{};
+    const uint8_t* codeBin = compiler.GetCode();
+
+    compiled.Code.assign( codeBin, codeBin + compiler.GetCodeSize() );
+    compiler.GetStats( compiled.Stats );
+
+    Disassembler disassembler( compiled.Code.data(), false );
+
+    for ( size_t addr = 0; addr < compiled.Code.size() && compiled.Code[addr] != OP_SENTINEL; )
+    {
+        char text[256];
+
+        int size = disassembler.Disassemble( text, sizeof text );
+        REQUIRE( size > 0 );
+
+        compiled.Insts.push_back( { static_cast<uint32_t>(addr), compiled.Code[addr], text } );
+        addr += size;
+    }
+
+    return compiled;
+}
+
+
+std::vector<U8> MakeCode( std::initializer_list<U8> insts )
+{
+    std::vector<U8> code( insts );
+
+    code.insert( code.end(), SENTINEL_SIZE, OP_SENTINEL );
+
+    while ( (code.size() % MODULE_CODE_ALIGNMENT) != 0 )
+        code.push_back( OP_SENTINEL );
+
+    return code;
+}
+
+Module MakeModule( const std::vector<U8>& code )
+{
+    Module mod = {};
+
+    mod.CodeBase = code.data();
+    mod.CodeSize = static_cast<U32>(code.size());
+    return mod;
+}
+
+const std::initializer_list<U8> gSumLoop =
+{
+    OP_PUSH, 1,
+    OP_LDC_S, 0,
+    OP_INCLOC, 0, 1,
+    OP_PRIM, PRIM_ADD,
+    OP_LDLOC, 0,
+    OP_LDARG, 0,
+    OP_BLT, 0xF4, 0xFF,
+    OP_RET
+};
+
+
+bool RecordingEnv::AddExternal( const std::string& name, ExternalKind kind, int address )
+{
+    Calls.push_back( name + "@" + std::to_string( address ) );
+    return true;
+}
+
+bool RecordingEnv::FindExternal( const std::string& name, ExternalFunc* func )
+{
+    return false;
+}
+
+bool RecordingEnv::AddGlobal( const std::string& name, int offset )
+{
+    Calls.push_back( name + "=" + std::to_string( offset ) );
+    return true;
+}
+
+bool RecordingEnv::FindGlobal( const std::string& name, int& offset )
+{
+    return false;
+}
+
+void RecordingLog::Add( LogCategory category, const char* fileName, int line, int column, const char* message )
+{
+    Messages.push_back( std::string( fileName != nullptr ? fileName : "" ) + ": " + message );
+}
+
+
 template <typename T>
 class CodeGenBuffer
 {
@@ -384,12 +487,82 @@ void TestCompileAndRun(
     TestCompileAndRun( config );
 }
 
+static std::vector<std::vector<CELL>> GetDataImages( CompilerEnv& env )
+{
+    std::vector<std::vector<CELL>> dataImages;
+
+    for ( ModSize i = 0; i < env.GetModuleCount(); i++ )
+    {
+        Module* mod = env.FindModule( i );
+
+        dataImages.emplace_back( mod->DataBase, mod->DataBase + mod->DataSize );
+    }
+
+    return dataImages;
+}
+
+static void SetDataImages( CompilerEnv& env, const std::vector<std::vector<CELL>>& dataImages )
+{
+    for ( ModSize i = 0; i < env.GetModuleCount(); i++ )
+    {
+        Module* mod = env.FindModule( i );
+
+        std::copy( dataImages[i].begin(), dataImages[i].end(), mod->DataBase );
+    }
+}
+
+// A budget of zero runs without one
+static void RunAndCheck(
+    CompilerEnv& env,
+    const ByteCode& byteCode,
+    const TestConfig& config,
+    U32 budget = 0,
+    bool preloadModules = false,
+    size_t stackSize = std::size( gStack ) )
+{
+    std::fill_n( gStack, std::size( gStack ), 0xFEFEFEFE );
+
+    Machine machine;
+
+    machine.Init( gStack, static_cast<U16>(stackSize), &env );
+
+    if ( preloadModules )
+        machine.PreloadModules();
+
+    CELL* args = machine.Start( (U8) (env.GetModuleCount() - 1), byteCode.Address, (U8) config.params.size() );
+
+    REQUIRE( args != nullptr );
+
+    std::copy( config.params.begin(), config.params.end(), args );
+
+    int err = 0;
+
+    do
+    {
+        err = (budget == 0) ? machine.Run() : machine.Run( budget );
+    } while ( err == ERR_YIELDED || (budget != 0 && err == ERR_BUDGET_EXHAUSTED) );
+
+    if ( GetKind( config.expectedResult ) == ResultKind::Vm )
+    {
+        REQUIRE( err == Get<ResultKind::Vm>( config.expectedResult ) );
+        return;
+    }
+    else
+    {
+        REQUIRE( err == 0 );
+    }
+
+    if ( GetKind( config.expectedResult ) == ResultKind::Stack )
+        REQUIRE( gStack[stackSize - 1] == Get<ResultKind::Stack>( config.expectedResult ) );
+}
+
 void TestCompileAndRun( const TestConfig& config )
 {
     if ( config.moduleSources.size() == 0 )
         throw std::invalid_argument( "config.moduleSources" );
 
     uint32_t    maxStack = 0;
+    bool        callsIndirectly = false;
 
     CodeGenBuffer<U8>   codeBuf;
     CodeGenBuffer<CELL> dataBuf;
@@ -445,6 +618,7 @@ void TestCompileAndRun( const TestConfig& config )
         compiler1.GetStats( stats );
 
         maxStack = std::max( maxStack, stats.Static.MaxStackUsage );
+        callsIndirectly = callsIndirectly || stats.CallsIndirectly;
 
         if ( GetKind( config.expectedResult ) == ResultKind::Compiler
             && (modIndex == config.moduleSources.size() - 1) )
@@ -474,8 +648,6 @@ void TestCompileAndRun( const TestConfig& config )
     if ( config.expectedStack > 0 )
         REQUIRE( (size_t) config.expectedStack == maxStack );
 
-    std::fill_n( gStack, std::size( gStack ), 0xFEFEFEFE );
-
     for ( ModSize i = 0; i < env.GetModuleCount(); i++ )
     {
         Module* mod = env.FindModule( i );
@@ -500,33 +672,84 @@ void TestCompileAndRun( const TestConfig& config )
     b = env.FindByteCode( external.Id, &byteCode );
     REQUIRE( b );
 
-    Machine machine;
+    auto dataImages = GetDataImages( env );
 
-    machine.Init( gStack, static_cast<U16>(std::size( gStack )), &env );
+    // If the test gives its stack use, then the checked engine gets exactly
+    // that much stack, besides the arguments to the entry procedure, which
+    // its caller would have counted. The unchecked engine needs more, since
+    // it makes sure that each call has room for the module's biggest frame.
+    // What indirect and native calls use isn't known when compiling.
 
-    CELL* args = machine.Start( (U8) (env.GetModuleCount() - 1), byteCode.Address, (U8) config.params.size() );
+    if ( config.expectedStack > 0 && !callsIndirectly && config.natives == nullptr )
+    {
+        RunAndCheck( env, byteCode, config, 0, false, config.expectedStack + config.params.size() );
+        SetDataImages( env, dataImages );
+    }
 
-    REQUIRE( args != nullptr );
+    RunAndCheck( env, byteCode, config );
 
-    std::copy( config.params.begin(), config.params.end(), args );
+    auto checkedDataImages = GetDataImages( env );
 
-    int err = 0;
+    // Run again with the unchecked engine, starting from the same data
 
-    do
-    {
-        err = machine.Run();
-    } while ( err == ERR_YIELDED );
+    std::vector<VerifiedCode> verifiedCodes( env.GetModuleCount() );
+    std::vector<NativeBinding> nativeBindings( env.GetModuleCount() );
 
-    if ( GetKind( config.expectedResult ) == ResultKind::Vm )
+    for ( ModSize i = 0; i < env.GetModuleCount(); i++ )
     {
-        REQUIRE( err == Get<ResultKind::Vm>( config.expectedResult ) );
-        return;
+        Module* mod = env.FindModule( i );
+
+        REQUIRE( VerifyModuleCode( mod, &verifiedCodes[i] ) == ERR_NONE );
+
+        mod->Verified = &verifiedCodes[i];
+
+        // Also call natives through a binding, unless the test expects some
+        // to be missing
+
+        int err = BindNatives( mod, &env, &nativeBindings[i] );
+
+        if ( err == ERR_NONE )
+            mod->Natives = &nativeBindings[i];
+        else
+            REQUIRE( err == ERR_NATIVECODE_NOT_FOUND );
     }
-    else
+
+    SetDataImages( env, dataImages );
+    RunAndCheck( env, byteCode, config );
+
+    REQUIRE( GetDataImages( env ) == checkedDataImages );
+
+    // Then in small time slices, which have to pick up where they stopped,
+    // and with the modules looked up ahead of time
+
+    SetDataImages( env, dataImages );
+    RunAndCheck( env, byteCode, config, 3, true );
+
+    REQUIRE( GetDataImages( env ) == checkedDataImages );
+
+    // And once more with native code, where it's supported
+
+    if ( !JitCode::IsSupported() )
+        return;
+
+    std::vector<JitCode> jitCodes( env.GetModuleCount() );
+
+    for ( ModSize i = 0; i < env.GetModuleCount(); i++ )
     {
-        REQUIRE( err == 0 );
+        Module* mod = env.FindModule( i );
+
+        REQUIRE( jitCodes[i].Compile( mod ) == ERR_NONE );
+
+        mod->Jit = &jitCodes[i];
     }
 
-    if ( GetKind( config.expectedResult ) == ResultKind::Stack )
-        REQUIRE( gStack[std::size( gStack ) - 1] == Get<ResultKind::Stack>( config.expectedResult ) );
+    SetDataImages( env, dataImages );
+    RunAndCheck( env, byteCode, config, 5, true );
+
+    REQUIRE( GetDataImages( env ) == checkedDataImages );
+
+    for ( ModSize i = 0; i < env.GetModuleCount(); i++ )
+    {
+        env.FindModule( i )->Jit = nullptr;
+    }
 }
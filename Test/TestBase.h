@@ -1,9 +1,13 @@
 #pragma once
 
 #include <stdint.h>
+#include <string>
 #include <variant>
+#include <vector>
 #include "../Gemini/Machine.h"
 #include "../Gemini/LangCommon.h"
+#include "../Gemini/Compiler.h"
+#include "../Gemini/ModuleBuilder.h"
 
 
 enum class Language
@@ -152,6 +156,66 @@ void TestCompileAndRun(
 void TestCompileAndRun( const TestConfig& config );
 
 
+// For tests that look at the code that the compiler generates
+
+struct CompiledInst
+{
+    uint32_t        Address;
+    uint8_t         Op;
+    std::string     Text;       // Disassembly without the address
+};
+
+struct CompiledAlgoly
+{
+    std::vector<uint8_t>        Code;
+    std::vector<CompiledInst>   Insts;      // Each instruction up to the sentinel
+    Gemini::CompilerStats       Stats;
+};
+
+// Compiles a module named Main, which has to compile without errors
+CompiledAlgoly CompileAlgoly( const char* code, bool inlining = true );
+
+
+// For tests that run bytecode written by hand
+
+// Adds the sentinels that end a module's code
+std::vector<Gemini::U8> MakeCode( std::initializer_list<Gemini::U8> insts );
+Gemini::Module MakeModule( const std::vector<Gemini::U8>& code );
+
+// Sums the numbers 1 to the argument in a loop
+extern const std::initializer_list<Gemini::U8> gSumLoop;
+
+
+// For tests that compare what different ways of building modules produce
+
+class RecordingEnv : public Gemini::ICompilerEnv
+{
+public:
+    std::vector<std::string>    Calls;
+
+    bool AddExternal( const std::string& name, Gemini::ExternalKind kind, int address ) override;
+    bool FindExternal( const std::string& name, Gemini::ExternalFunc* func ) override;
+    bool AddGlobal( const std::string& name, int offset ) override;
+    bool FindGlobal( const std::string& name, int& offset ) override;
+};
+
+class RecordingLog : public Gemini::ICompilerLog
+{
+public:
+    std::vector<std::string>    Messages;
+
+    void Add( Gemini::LogCategory category, const char* fileName, int line, int column, const char* message ) override;
+};
+
+struct BuildResult
+{
+    Gemini::CompilerErr                 Error;
+    std::vector<Gemini::BuiltModule>    Modules;
+    std::vector<std::string>            EnvCalls;
+    std::vector<std::string>            LogMessages;
+};
+
+
 // Sample natives
 
 int NatAdd( Gemini::Machine* machine, Gemini::U8 argc, Gemini::CELL* args, Gemini::UserContext context );
@@ -0,0 +1,167 @@
+#include "pch.h"
+#include "TestBase.h"
+#include "../Gemini/Common.h"
+#include "../Gemini/Jit.h"
+#include "../Gemini/OpCodes.h"
+#include <vector>
+
+using namespace Gemini;
+
+
+enum class Engine
+{
+    Checked,
+    Unchecked,
+    Native,
+};
+
+struct BudgetModule
+{
+    std::vector<U8> Code;
+    Module          Mod = {};
+    VerifiedCode    Verified;
+    JitCode         Jit;
+
+    BudgetModule( std::initializer_list<U8> insts, Engine engine ) :
+        Code( MakeCode( insts ) )
+    {
+        Mod.CodeBase = Code.data();
+        Mod.CodeSize = static_cast<U32>(Code.size());
+
+        if ( engine == Engine::Checked )
+            return;
+
+        REQUIRE( VerifyModuleCode( &Mod, &Verified ) == ERR_NONE );
+
+        Mod.Verified = &Verified;
+
+        if ( engine == Engine::Native )
+        {
+            REQUIRE( Jit.Compile( &Mod ) == ERR_NONE );
+
+            Mod.Jit = &Jit;
+        }
+    }
+};
+
+static std::vector<Engine> GetEngines()
+{
+    std::vector<Engine> engines = { Engine::Checked, Engine::Unchecked };
+
+    if ( JitCode::IsSupported() )
+        engines.push_back( Engine::Native );
+
+    return engines;
+}
+
+TEST_CASE( "Budget: infinite loop stops", "[budget]" )
+{
+    for ( Engine engine : GetEngines() )
+    {
+        CELL stack[64];
+        Machine machine;
+        BudgetModule budgetMod( { OP_LDC_S, 1, OP_POP, OP_B, 0xFA, 0xFF, OP_RET }, engine );
+
+        machine.Init( stack, static_cast<U16>(std::size( stack )), 0, &budgetMod.Mod );
+
+        REQUIRE( machine.Start( 0, 0, 0 ) != nullptr );
+
+        for ( int i = 0; i < 3; i++ )
+        {
+            REQUIRE( machine.Run( 1000 ) == ERR_BUDGET_EXHAUSTED );
+            REQUIRE( machine.GetPC() == 0 );
+            REQUIRE( machine.IsRunning() );
+        }
+    }
+}
+
+TEST_CASE( "Budget: loop resumes across slices", "[budget]" )
+{
+    for ( Engine engine : GetEngines() )
+    {
+        CELL stack[64];
+        Machine machine;
+        BudgetModule budgetMod( gSumLoop, engine );
+
+        machine.Init( stack, static_cast<U16>(std::size( stack )), 0, &budgetMod.Mod );
+
+        CELL* args = machine.Start( 0, 0, 1 );
+
+        REQUIRE( args != nullptr );
+
+        args[0] = 100;
+
+        int slices = 0;
+        int err;
+
+        do
+        {
+            err = machine.Run( 10 );
+            slices++;
+        } while ( err == ERR_BUDGET_EXHAUSTED );
+
+        // 99 backward branches and the call from Start, which isn't charged
+
+        REQUIRE( err == ERR_NONE );
+        REQUIRE( slices == 10 );
+        REQUIRE( stack[std::size( stack ) - 1] == 5050 );
+    }
+}
+
+TEST_CASE( "Budget: calls are charged", "[budget]" )
+{
+    for ( Engine engine : GetEngines() )
+    {
+        CELL stack[256];
+        Machine machine;
+
+        // Counts down from 10 recursively, without any backward branch
+
+        BudgetModule budgetMod( {
+            OP_LDARG, 0,
+            OP_BFALSE, 11, 0,
+            OP_LDARG, 0,
+            OP_PRIMC_S, PRIM_SUB, 1,
+            OP_CALL, 1, 0, 0, 0,
+            OP_RET,
+            OP_LDC_S, 7,
+            OP_RET
+            }, engine );
+
+        machine.Init( stack, static_cast<U16>(std::size( stack )), 0, &budgetMod.Mod );
+
+        CELL* args = machine.Start( 0, 0, 1 );
+
+        REQUIRE( args != nullptr );
+
+        args[0] = 10;
+
+        REQUIRE( machine.Run( 4 ) == ERR_BUDGET_EXHAUSTED );
+        REQUIRE( machine.GetPC() == 0 );
+        REQUIRE( machine.Run( 4 ) == ERR_BUDGET_EXHAUSTED );
+        REQUIRE( machine.Run( 4 ) == ERR_NONE );
+        REQUIRE( stack[std::size( stack ) - 1] == 7 );
+    }
+}
+
+TEST_CASE( "Budget: zero budget", "[budget]" )
+{
+    CELL stack[64];
+    Machine machine;
+    BudgetModule budgetMod( gSumLoop, Engine::Checked );
+
+    machine.Init( stack, static_cast<U16>(std::size( stack )), 0, &budgetMod.Mod );
+
+    REQUIRE( machine.Run( 10 ) == ERR_NOT_RUNING );
+
+    CELL* args = machine.Start( 0, 0, 1 );
+
+    REQUIRE( args != nullptr );
+
+    args[0] = 100;
+
+    REQUIRE( machine.Run( 0 ) == ERR_BUDGET_EXHAUSTED );
+    REQUIRE( machine.GetPC() == 0 );
+    REQUIRE( machine.Run() == ERR_NONE );
+    REQUIRE( stack[std::size( stack ) - 1] == 5050 );
+}
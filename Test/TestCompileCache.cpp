@@ -0,0 +1,324 @@
+#include "pch.h"
+#include "TestBase.h"
+#include "../Gemini/CompileCache.h"
+#include "../Gemini/ModuleBuilder.h"
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace Gemini;
+
+
+namespace
+{
+
+using SourceList = std::vector<std::pair<std::string, std::string>>;
+
+class TempDir
+{
+    std::filesystem::path   mPath;
+
+public:
+    TempDir( const char* name )
+    {
+        mPath = std::filesystem::temp_directory_path() / name;
+        std::filesystem::remove_all( mPath );
+    }
+
+    ~TempDir()
+    {
+        std::error_code error;
+        std::filesystem::remove_all( mPath, error );
+    }
+
+    std::string GetPath() const
+    {
+        return mPath.string();
+    }
+};
+
+}
+
+static BuildResult Build( const SourceList& sources, CompileCache* cache )
+{
+    CompilerAttrs attrs;
+    RecordingEnv env;
+    RecordingLog log;
+    BuildResult result = {};
+    ModuleBuilder builder( &env, &log, attrs, 4 );
+
+    builder.SetCache( cache );
+
+    for ( const auto& [name, text] : sources )
+        builder.AddModule( name, { { name, text, SourceLanguage::Algoly } } );
+
+    result.Error = builder.Build();
+
+    for ( ModSize i = 0; i < builder.GetModuleCount(); i++ )
+        result.Modules.push_back( builder.GetModule( i ) );
+
+    result.EnvCalls = env.Calls;
+    result.LogMessages = log.Messages;
+    return result;
+}
+
+static void CheckSameBuild( const BuildResult& cached, const BuildResult& compiled )
+{
+    REQUIRE( cached.Error == compiled.Error );
+    REQUIRE( cached.Modules.size() == compiled.Modules.size() );
+    REQUIRE( cached.EnvCalls == compiled.EnvCalls );
+    REQUIRE( cached.LogMessages == compiled.LogMessages );
+
+    for ( size_t i = 0; i < compiled.Modules.size(); i++ )
+    {
+        const BuiltModule& a = cached.Modules[i];
+        const BuiltModule& b = compiled.Modules[i];
+
+        REQUIRE( a.Error == b.Error );
+        REQUIRE( a.Code == b.Code );
+        REQUIRE( a.Data == b.Data );
+        REQUIRE( a.Const == b.Const );
+        REQUIRE( a.Stats.CodeBytesWritten == b.Stats.CodeBytesWritten );
+        REQUIRE( a.Stats.Static.MaxCallDepth == b.Stats.Static.MaxCallDepth );
+        REQUIRE( a.Stats.Static.MaxStackUsage == b.Stats.Static.MaxStackUsage );
+        REQUIRE( a.Stats.Lambda.MaxStackUsage == b.Stats.Lambda.MaxStackUsage );
+        REQUIRE( (a.Metadata != nullptr) == (b.Metadata != nullptr) );
+
+        if ( a.Metadata != nullptr )
+        {
+            REQUIRE( a.Metadata->Index == b.Metadata->Index );
+            REQUIRE( a.Metadata->Name == b.Metadata->Name );
+            REQUIRE( a.Metadata->Table.size() == b.Metadata->Table.size() );
+        }
+    }
+}
+
+static std::vector<bool> GetFromCache( const BuildResult& result )
+{
+    std::vector<bool> fromCache;
+
+    for ( const auto& module : result.Modules )
+        fromCache.push_back( module.FromCache );
+
+    return fromCache;
+}
+
+// Uses records, enums, aliases, and constants holding arrays and procedure
+// pointers, all across modules
+static const SourceList gSources =
+{
+    { "ModA",
+        "type R = record a, f: @proc end\n"
+        "type E = enum E1 = 1, E2 = 2 end\n"
+        "type T = int\n"
+        "const N = 3\n"
+        "const Arr = [10, 20, 30]\n"
+        "const R1: R = { a: 3, f: @F }\n"
+        "var G := 5\n"
+        "def F 4 end\n"
+        "def Sq(x) x * x end\n"
+        "def Last(x) x + 1 end\n" },
+    { "ModB",
+        "import ModA\n"
+        "type S = record c: ModA.R, r: ModA.R end\n"
+        "const S1: S = { c: { a: 1, f: @H }, r: ModA.R1 }\n"
+        "const P = &ModA.Sq\n"
+        "def H 2 end\n"
+        "def B(x) ModA.Sq(x) + ModA.N + ModA.Arr[1] end\n"
+        "def K -> ModA.E ModA.E.E2 end\n" },
+    { "ModC",
+        "def C(x) x * 3 end\n" },
+    { "Main",
+        "import ModA\n"
+        "import ModB\n"
+        "import ModC\n"
+        "def a\n"
+        "  var i: ModA.T := ModB.K() as int;\n"
+        "  ModB.B(2) + ModC.C(4) + ModB.S1.c.a + (ModB.S1.r.f)() + (ModB.P)(i) + ModA.G + i\n"
+        "end\n" },
+};
+
+
+//----------------------------------------------------------------------------
+// Compile cache
+//----------------------------------------------------------------------------
+
+TEST_CASE( "CompileCache: second build loads every module", "[compilecache]" )
+{
+    TempDir dir( "GeminiTestCache1" );
+    CompileCache cache( dir.GetPath() );
+
+    BuildResult compiled = Build( gSources, nullptr );
+    BuildResult first = Build( gSources, &cache );
+    BuildResult second = Build( gSources, &cache );
+
+    REQUIRE( compiled.Error == CompilerErr::OK );
+    REQUIRE( GetFromCache( first ) == std::vector<bool>{ false, false, false, false } );
+    REQUIRE( GetFromCache( second ) == std::vector<bool>{ true, true, true, true } );
+
+    CheckSameBuild( first, compiled );
+    CheckSameBuild( second, compiled );
+}
+
+TEST_CASE( "CompileCache: edited modules and the ones that see them are compiled", "[compilecache]" )
+{
+    TempDir dir( "GeminiTestCache2" );
+    CompileCache cache( dir.GetPath() );
+
+    Build( gSources, &cache );
+
+    SECTION( "Last module" )
+    {
+        SourceList sources = gSources;
+
+        sources[3].second += "def Extra 7 end\n";
+
+        BuildResult edited = Build( sources, &cache );
+
+        REQUIRE( GetFromCache( edited ) == std::vector<bool>{ true, true, true, false } );
+        CheckSameBuild( edited, Build( sources, nullptr ) );
+    }
+
+    SECTION( "Module whose metadata changes" )
+    {
+        SourceList sources = gSources;
+
+        sources[1].second += "def Extra 7 end\n";
+
+        BuildResult edited = Build( sources, &cache );
+
+        REQUIRE( GetFromCache( edited ) == std::vector<bool>{ true, false, true, false } );
+        CheckSameBuild( edited, Build( sources, nullptr ) );
+    }
+
+    SECTION( "Module whose metadata stays the same" )
+    {
+        SourceList sources = gSources;
+        size_t pos = sources[0].second.find( "x + 1" );
+
+        sources[0].second.replace( pos, 5, "x + 2" );
+
+        BuildResult edited = Build( sources, &cache );
+
+        REQUIRE( GetFromCache( edited ) == std::vector<bool>{ false, true, true, true } );
+        CheckSameBuild( edited, Build( sources, nullptr ) );
+    }
+}
+
+TEST_CASE( "CompileCache: failed modules aren't stored", "[compilecache]" )
+{
+    TempDir dir( "GeminiTestCache3" );
+    CompileCache cache( dir.GetPath() );
+    SourceList sources = gSources;
+
+    sources[2].second = "def C(x) y end\n";
+
+    BuildResult first = Build( sources, &cache );
+    BuildResult second = Build( sources, &cache );
+
+    // ModC is on the first level with ModA, so the build stops before ModB
+
+    REQUIRE( first.Error == CompilerErr::SEMANTICS );
+    REQUIRE( first.Modules[1].Error == CompilerErr::NONE );
+    REQUIRE( GetFromCache( second ) == std::vector<bool>{ true, false, false, false } );
+
+    CheckSameBuild( second, first );
+}
+
+TEST_CASE( "CompileCache: bad entries are ignored", "[compilecache]" )
+{
+    TempDir dir( "GeminiTestCache4" );
+    CompileCache cache( dir.GetPath() );
+
+    Build( gSources, &cache );
+
+    // Cut every entry short
+
+    for ( const auto& file : std::filesystem::directory_iterator( dir.GetPath() ) )
+        std::filesystem::resize_file( file.path(), std::filesystem::file_size( file.path() ) / 2 );
+
+    BuildResult truncated = Build( gSources, &cache );
+
+    REQUIRE( GetFromCache( truncated ) == std::vector<bool>{ false, false, false, false } );
+    CheckSameBuild( truncated, Build( gSources, nullptr ) );
+
+    // The entries were written again
+
+    REQUIRE( GetFromCache( Build( gSources, &cache ) ) == std::vector<bool>{ true, true, true, true } );
+}
+
+TEST_CASE( "CompileCache: entries from another format are ignored", "[compilecache]" )
+{
+    TempDir dir( "GeminiTestCache5" );
+    CompileCache cache( dir.GetPath() );
+
+    Build( gSources, &cache );
+
+    // Make every entry look like it was written for another instruction set.
+    // The format follows the magic and the version.
+
+    for ( const auto& file : std::filesystem::directory_iterator( dir.GetPath() ) )
+    {
+        std::fstream stream( file.path(), std::ios::in | std::ios::out | std::ios::binary );
+        char byte = 0;
+
+        stream.seekg( 8 );
+        stream.get( byte );
+        stream.seekp( 8 );
+        stream.put( static_cast<char>( byte ^ 1 ) );
+    }
+
+    BuildResult otherFormat = Build( gSources, &cache );
+
+    REQUIRE( GetFromCache( otherFormat ) == std::vector<bool>{ false, false, false, false } );
+    CheckSameBuild( otherFormat, Build( gSources, nullptr ) );
+
+    REQUIRE( GetFromCache( Build( gSources, &cache ) ) == std::vector<bool>{ true, true, true, true } );
+}
+
+TEST_CASE( "CompileCache: entries round trip", "[compilecache]" )
+{
+    CacheEntry entry;
+    CacheEntry loaded;
+    std::vector<uint8_t> bytes;
+
+    entry.ImportNames = { "ModA", "ModB" };
+    entry.Imports = { { 0, 0x1122334455667788 }, { 1, 42 } };
+    entry.Code = { 1, 2, 3 };
+    entry.Data = { -1, 7 };
+    entry.Const = { 9 };
+    entry.Stats = {};
+    entry.Stats.CodeBytesWritten = 3;
+    entry.Externals = { { "F", ExternalKind::Bytecode, 12 } };
+    entry.Globals = { { "G", 4 } };
+    entry.LogEntries = { { LogCategory::WARNING, true, "ModA", 2, 5, "Careful" } };
+    entry.Metadata = { 5, 6 };
+
+    SerializeCacheEntry( entry, 77, bytes );
+
+    REQUIRE( !DeserializeCacheEntry( bytes.data(), bytes.size(), 78, loaded ) );
+    REQUIRE( !DeserializeCacheEntry( bytes.data(), bytes.size() - 1, 77, loaded ) );
+
+    std::vector<uint8_t> otherFormat = bytes;
+
+    otherFormat[8] ^= 1;
+
+    REQUIRE( !DeserializeCacheEntry( otherFormat.data(), otherFormat.size(), 77, loaded ) );
+    REQUIRE( DeserializeCacheEntry( bytes.data(), bytes.size(), 77, loaded ) );
+
+    REQUIRE( loaded.ImportNames == entry.ImportNames );
+    REQUIRE( loaded.Imports.size() == 2 );
+    REQUIRE( loaded.Imports[0].Fingerprint == 0x1122334455667788 );
+    REQUIRE( loaded.Imports[1].Index == 1 );
+    REQUIRE( loaded.Code == entry.Code );
+    REQUIRE( loaded.Data == entry.Data );
+    REQUIRE( loaded.Const == entry.Const );
+    REQUIRE( loaded.Stats.CodeBytesWritten == 3 );
+    REQUIRE( loaded.Externals[0].Name == "F" );
+    REQUIRE( loaded.Externals[0].Address == 12 );
+    REQUIRE( loaded.Globals[0].Offset == 4 );
+    REQUIRE( loaded.LogEntries[0].Message == "Careful" );
+    REQUIRE( loaded.LogEntries[0].Column == 5 );
+    REQUIRE( loaded.Metadata == entry.Metadata );
+}
@@ -0,0 +1,188 @@
+#include "pch.h"
+#include "TestBase.h"
+#include "../Gemini/Common.h"
+#include "../Gemini/CowData.h"
+#include "../Gemini/Jit.h"
+#include "../Gemini/OpCodes.h"
+#include <numeric>
+#include <vector>
+
+using namespace Gemini;
+
+
+static Module MakeCowModule( const std::vector<U8>& code, CowData* cow )
+{
+    Module mod = MakeModule( code );
+
+    mod.Cow = cow;
+    return mod;
+}
+
+static std::vector<CELL> MakeImage( size_t size )
+{
+    std::vector<CELL> image( size );
+
+    std::iota( image.begin(), image.end(), 0 );
+    return image;
+}
+
+static int RunModule( const Module* mod, CELL& result )
+{
+    CELL stack[64];
+    Machine machine;
+
+    machine.Init( stack, static_cast<U16>(std::size( stack )), 0, mod );
+
+    if ( machine.Start( 0, 0, 0 ) == nullptr )
+        return ERR_BAD_STATE;
+
+    int err = machine.Run();
+
+    result = stack[std::size( stack ) - 1];
+    return err;
+}
+
+
+TEST_CASE( "CowData: machines share the image until they write", "[cow]" )
+{
+    auto image = MakeImage( 200 );
+    CowData writerData( image.data(), 200 );
+    CowData readerData( image.data(), 200 );
+
+    auto writerCode = MakeCode( { OP_LDC_S, 7, OP_STMOD, 0, 70, 0, OP_LDMOD, 0, 70, 0, OP_RET } );
+    auto readerCode = MakeCode( { OP_LDMOD, 0, 70, 0, OP_RET } );
+    auto writerMod = MakeCowModule( writerCode, &writerData );
+    auto readerMod = MakeCowModule( readerCode, &readerData );
+    CELL result = 0;
+
+    REQUIRE( RunModule( &readerMod, result ) == ERR_NONE );
+    REQUIRE( result == 70 );
+    REQUIRE( readerData.GetCopiedPageCount() == 0 );
+
+    REQUIRE( RunModule( &writerMod, result ) == ERR_NONE );
+    REQUIRE( result == 7 );
+    REQUIRE( writerData.GetCopiedPageCount() == 1 );
+    REQUIRE( writerData.Read( 70 ) == 7 );
+    REQUIRE( writerData.Read( 71 ) == 71 );
+
+    REQUIRE( RunModule( &readerMod, result ) == ERR_NONE );
+    REQUIRE( result == 70 );
+    REQUIRE( image[70] == 70 );
+
+    writerData.Reset();
+
+    REQUIRE( writerData.GetCopiedPageCount() == 0 );
+    REQUIRE( writerData.Read( 70 ) == 70 );
+}
+
+TEST_CASE( "CowData: indirect stores copy one page", "[cow]" )
+{
+    auto image = MakeImage( 200 );
+    CowData data( image.data(), 200 );
+
+    auto code = MakeCode( {
+        OP_LDC_S, 9,
+        OP_LDC, 150, 0, 0, 0,
+        OP_STOREI,
+        OP_LDC, 150, 0, 0, 0,
+        OP_LOADI,
+        OP_RET
+        } );
+    auto mod = MakeCowModule( code, &data );
+    CELL result = 0;
+
+    REQUIRE( RunModule( &mod, result ) == ERR_NONE );
+    REQUIRE( result == 9 );
+    REQUIRE( data.GetCopiedPageCount() == 1 );
+    REQUIRE( image[150] == 150 );
+}
+
+TEST_CASE( "CowData: block copy across pages", "[cow]" )
+{
+    auto image = MakeImage( 200 );
+    CowData data( image.data(), 200 );
+
+    // Copies cells 0 to 99 onto 100 to 199, which spans three pages
+
+    auto code = MakeCode( {
+        OP_LDC_S, 0,
+        OP_LDC_S, 100,
+        OP_COPYBLOCK, 100, 0, 0,
+        OP_LDC_S, 0,
+        OP_RET
+        } );
+    auto mod = MakeCowModule( code, &data );
+    CELL result = 0;
+
+    REQUIRE( RunModule( &mod, result ) == ERR_NONE );
+    REQUIRE( data.GetCopiedPageCount() == 3 );
+
+    for ( U32 i = 0; i < 100; i++ )
+    {
+        REQUIRE( data.Read( i ) == static_cast<CELL>( i ) );
+        REQUIRE( data.Read( 100 + i ) == static_cast<CELL>( i ) );
+        REQUIRE( image[100 + i] == static_cast<CELL>( 100 + i ) );
+    }
+}
+
+TEST_CASE( "CowData: addresses past the data", "[cow]" )
+{
+    auto image = MakeImage( 10 );
+    CowData data( image.data(), 10 );
+
+    auto loadCode = MakeCode( { OP_LDMOD, 0, 10, 0, OP_RET } );
+    auto copyCode = MakeCode( { OP_LDC_S, 0, OP_LDC_S, 5, OP_COPYBLOCK, 6, 0, 0, OP_LDC_S, 0, OP_RET } );
+    auto loadMod = MakeCowModule( loadCode, &data );
+    auto copyMod = MakeCowModule( copyCode, &data );
+    CELL result = 0;
+
+    REQUIRE( RunModule( &loadMod, result ) == ERR_BAD_ADDRESS );
+    REQUIRE( RunModule( &copyMod, result ) == ERR_BAD_ADDRESS );
+    REQUIRE( data.GetCopiedPageCount() == 0 );
+}
+
+TEST_CASE( "CowData: JIT code goes through the copy-on-write data", "[cow]" )
+{
+    if ( !JitCode::IsSupported() )
+        return;
+
+    auto image = MakeImage( 100 );
+    CowData data( image.data(), 100 );
+    VerifiedCode verifiedCode;
+    JitCode jitCode;
+
+    auto code = MakeCode( { OP_LDC_S, 5, OP_STMOD, 0, 80, 0, OP_LDMOD, 0, 80, 0, OP_LDMOD, 0, 3, 0, OP_PRIM, PRIM_ADD, OP_RET } );
+    auto mod = MakeCowModule( code, &data );
+
+    REQUIRE( VerifyModuleCode( &mod, &verifiedCode ) == ERR_NONE );
+
+    mod.Verified = &verifiedCode;
+
+    REQUIRE( jitCode.Compile( &mod ) == ERR_NONE );
+
+    mod.Jit = &jitCode;
+
+    CELL result = 0;
+
+    REQUIRE( RunModule( &mod, result ) == ERR_NONE );
+    REQUIRE( result == 8 );
+    REQUIRE( data.Read( 80 ) == 5 );
+    REQUIRE( image[80] == 80 );
+}
+
+TEST_CASE( "CowData: module can't also have its own data", "[cow]" )
+{
+    auto image = MakeImage( 10 );
+    CowData data( image.data(), 10 );
+    CELL ownData[10] = {};
+
+    auto code = MakeCode( { OP_LDC_S, 0, OP_RET } );
+    auto mod = MakeCowModule( code, &data );
+
+    REQUIRE( VerifyModule( &mod ) == ERR_NONE );
+
+    mod.DataBase = ownData;
+    mod.DataSize = 10;
+
+    REQUIRE( VerifyModule( &mod ) == ERR_BAD_MODULE );
+}
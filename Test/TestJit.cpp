@@ -0,0 +1,221 @@
+#include "pch.h"
+#include "TestBase.h"
+#include "../Gemini/Common.h"
+#include "../Gemini/Jit.h"
+#include "../Gemini/OpCodes.h"
+#include <limits.h>
+#include <vector>
+
+using namespace Gemini;
+
+
+struct JitModule
+{
+    std::vector<U8> Code;
+    Module          Mod = {};
+    VerifiedCode    Verified;
+    JitCode         Jit;
+
+    explicit JitModule( std::initializer_list<U8> insts ) :
+        Code( MakeCode( insts ) )
+    {
+        Mod.CodeBase = Code.data();
+        Mod.CodeSize = static_cast<U32>(Code.size());
+
+        REQUIRE( VerifyModuleCode( &Mod, &Verified ) == ERR_NONE );
+
+        Mod.Verified = &Verified;
+
+        REQUIRE( Jit.Compile( &Mod ) == ERR_NONE );
+
+        Mod.Jit = &Jit;
+    }
+};
+
+static int RunJit( std::initializer_list<U8> insts, CELL& result )
+{
+    CELL stack[64];
+    Machine machine;
+    JitModule jitMod( insts );
+
+    machine.Init( stack, static_cast<U16>(std::size( stack )), 0, &jitMod.Mod );
+
+    REQUIRE( machine.Start( 0, 0, 0 ) != nullptr );
+
+    int err = machine.Run();
+
+    result = stack[std::size( stack ) - 1];
+    return err;
+}
+
+
+TEST_CASE( "Jit: module must be verified", "[jit]" )
+{
+    if ( !JitCode::IsSupported() )
+        return;
+
+    auto code = MakeCode( { OP_LDC_S, 1, OP_RET } );
+    Module mod = {};
+    JitCode jitCode;
+
+    mod.CodeBase = code.data();
+    mod.CodeSize = static_cast<U32>(code.size());
+
+    REQUIRE( jitCode.Compile( &mod ) == ERR_BAD_ARG );
+}
+
+TEST_CASE( "Jit: saturating add and subtract", "[jit]" )
+{
+    if ( !JitCode::IsSupported() )
+        return;
+
+    CELL result = 0;
+
+    REQUIRE( RunJit( { OP_LDC, 0xFF, 0xFF, 0xFF, 0x7F, OP_LDC_S, 1, OP_PRIM, PRIM_ADD, OP_RET }, result ) == ERR_NONE );
+    REQUIRE( result == INT32_MAX );
+
+    REQUIRE( RunJit( { OP_LDC, 0x00, 0x00, 0x00, 0x80, OP_PRIMC_S, PRIM_SUB, 1, OP_RET }, result ) == ERR_NONE );
+    REQUIRE( result == INT32_MIN );
+}
+
+TEST_CASE( "Jit: saturating multiply", "[jit]" )
+{
+    if ( !JitCode::IsSupported() )
+        return;
+
+    CELL result = 0;
+
+    REQUIRE( RunJit( { OP_LDC, 0x00, 0x00, 0x01, 0x00, OP_DUP, OP_PRIM, PRIM_MUL, OP_RET }, result ) == ERR_NONE );
+    REQUIRE( result == INT32_MAX );
+
+    REQUIRE( RunJit( { OP_LDC, 0x00, 0x00, 0x01, 0x00, OP_PRIMC_S, PRIM_MUL, 0xFF,
+        OP_LDC, 0x00, 0x00, 0x01, 0x00, OP_PRIM, PRIM_MUL, OP_RET }, result ) == ERR_NONE );
+    REQUIRE( result == INT32_MIN );
+}
+
+TEST_CASE( "Jit: unchecked arithmetic", "[jit]" )
+{
+    if ( !JitCode::IsSupported() )
+        return;
+
+    CELL result = 0;
+
+    REQUIRE( RunJit( { OP_LDC_S, 7, OP_LDC_S, 3, OP_PRIM, PRIM_SUB_U, OP_PRIMC_S, PRIM_MUL_U, 0xFB, OP_RET }, result ) == ERR_NONE );
+    REQUIRE( result == -20 );
+
+    // Unchecked operations wrap
+    REQUIRE( RunJit( { OP_LDC, 0xFF, 0xFF, 0xFF, 0x7F, OP_PRIMC_S, PRIM_ADD_U, 1, OP_RET }, result ) == ERR_NONE );
+    REQUIRE( result == INT32_MIN );
+}
+
+TEST_CASE( "Jit: divide rounds toward negative infinity", "[jit]" )
+{
+    if ( !JitCode::IsSupported() )
+        return;
+
+    CELL result = 0;
+
+    REQUIRE( RunJit( { OP_LDC_S, 0xF9, OP_PRIMC_S, PRIM_DIV, 2, OP_RET }, result ) == ERR_NONE );
+    REQUIRE( result == -4 );
+
+    REQUIRE( RunJit( { OP_LDC_S, 0xF9, OP_PRIMC_S, PRIM_MOD, 2, OP_RET }, result ) == ERR_NONE );
+    REQUIRE( result == 1 );
+}
+
+TEST_CASE( "Jit: divide by zero", "[jit]" )
+{
+    if ( !JitCode::IsSupported() )
+        return;
+
+    CELL result = 0;
+
+    REQUIRE( RunJit( { OP_LDC_S, 7, OP_LDC_S, 0, OP_PRIM, PRIM_MOD, OP_RET }, result ) == ERR_DIVIDE );
+}
+
+TEST_CASE( "Jit: index out of bounds", "[jit]" )
+{
+    if ( !JitCode::IsSupported() )
+        return;
+
+    CELL result = 0;
+
+    REQUIRE( RunJit( { OP_LDC_S, 0, OP_LDC_S, 3, OP_INDEX, 1, 0, 0, 3, 0, 0, OP_RET }, result ) == ERR_BOUND );
+    REQUIRE( RunJit( { OP_LDC_S, 0, OP_LDC_S, 0xFF, OP_INDEX, 1, 0, 0, 3, 0, 0, OP_RET }, result ) == ERR_BOUND );
+    REQUIRE( RunJit( { OP_LDC_S, 5, OP_LDC_S, 2, OP_INDEX, 3, 0, 0, 3, 0, 0, OP_RET }, result ) == ERR_NONE );
+    REQUIRE( result == 11 );
+}
+
+TEST_CASE( "Jit: unchecked index keeps address in module", "[jit]" )
+{
+    if ( !JitCode::IsSupported() )
+        return;
+
+    CELL result = 0;
+
+    REQUIRE( RunJit( { OP_LDC_S, 0, OP_LDC_S, 0xFF, OP_INDEX_U, 1, 0, 0, OP_RET }, result ) == ERR_BAD_ADDRESS );
+    REQUIRE( RunJit( { OP_LDC_S, 5, OP_LDC_S, 2, OP_INDEX_U, 3, 0, 0, OP_RET }, result ) == ERR_NONE );
+    REQUIRE( result == 11 );
+}
+
+TEST_CASE( "Jit: yield goes back to native code", "[jit]" )
+{
+    CELL stack[64];
+    Machine machine;
+
+    if ( !JitCode::IsSupported() )
+        return;
+
+    JitModule jitMod( { OP_LDC_S, 1, OP_YIELD, OP_PRIMC_S, PRIM_ADD, 2, OP_RET } );
+
+    machine.Init( stack, static_cast<U16>(std::size( stack )), 0, &jitMod.Mod );
+
+    REQUIRE( machine.Start( 0, 0, 0 ) != nullptr );
+    REQUIRE( machine.Run() == ERR_YIELDED );
+    REQUIRE( machine.GetPC() == 3 );
+    REQUIRE( machine.Run() == ERR_NONE );
+    REQUIRE( stack[std::size( stack ) - 1] == 3 );
+}
+
+TEST_CASE( "Jit: calls and loops", "[jit]" )
+{
+    if ( !JitCode::IsSupported() )
+        return;
+
+    CELL result = 0;
+
+    // Sums the numbers 1 to 100 in a function with a local
+
+    REQUIRE( RunJit( {
+        OP_CALL, 0, 6, 0, 0,
+        OP_RET,
+        OP_PUSH, 1,
+        OP_LDC_S, 0,
+        OP_INCLOC, 0, 1,
+        OP_PRIM, PRIM_ADD,
+        OP_LDLOC, 0,
+        OP_LDC_S, 100,
+        OP_BLT, 0xF4, 0xFF,
+        OP_RET
+        }, result ) == ERR_NONE );
+    REQUIRE( result == 5050 );
+}
+
+TEST_CASE( "Jit: overwritten return address", "[jit]" )
+{
+    if ( !JitCode::IsSupported() )
+        return;
+
+    CELL result = 0;
+
+    REQUIRE( RunJit( {
+        OP_CALL, 0, 6, 0, 0,
+        OP_RET,
+        OP_LDC_S, 1,
+        OP_LDARGA, 0,
+        OP_LDC_S, 1,
+        OP_PRIM, PRIM_SUB,
+        OP_STOREI,
+        OP_LDC_S, 0,
+        OP_RET
+        }, result ) == ERR_BAD_ADDRESS );
+}
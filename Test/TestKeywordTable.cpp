@@ -0,0 +1,85 @@
+#include "pch.h"
+#include "TestBase.h"
+#include "../Gemini/KeywordTable.h"
+#include <string>
+
+using namespace Gemini;
+
+
+namespace
+{
+
+enum class Word
+{
+    None,
+    Do,
+    Downto,
+    Else,
+    Elsif,
+    End,
+    LE,
+    NE,
+    Plus,
+};
+
+constexpr KeywordEntry<Word> gWordList[] =
+{
+    { "do",     Word::Do },
+    { "downto", Word::Downto },
+    { "else",   Word::Else },
+    { "elsif",  Word::Elsif },
+    { "end",    Word::End },
+    { "<=",     Word::LE },
+    { "<>",     Word::NE },
+    { "+",      Word::Plus },
+};
+
+constexpr auto gWords = MakeKeywordTable( gWordList );
+
+Word FindWord( std::string_view name )
+{
+    const Word* word = gWords.Find( name );
+
+    return word != nullptr ? *word : Word::None;
+}
+
+}
+
+
+//----------------------------------------------------------------------------
+// KeywordTable
+//----------------------------------------------------------------------------
+
+TEST_CASE( "KeywordTable: finds each word", "[keyword]" )
+{
+    for ( const auto& entry : gWordList )
+        REQUIRE( FindWord( entry.Name ) == entry.Value );
+
+    // It's resolved at compile time too
+    static_assert( *gWords.Find( "elsif" ) == Word::Elsif );
+    static_assert( gWords.Find( "elif" ) == nullptr );
+}
+
+TEST_CASE( "KeywordTable: rejects other words", "[keyword]" )
+{
+    const char* others[] =
+    {
+        "", "d", "don", "down", "downtoo", "els", "elseif", "ends", "End",
+        "<", "=", "+=", "<<", "x", "endend",
+    };
+
+    for ( const char* other : others )
+        REQUIRE( FindWord( other ) == Word::None );
+}
+
+TEST_CASE( "KeywordTable: compares only the view", "[keyword]" )
+{
+    // Words inside a longer text, like the tokens a parser scans
+    std::string text = "enddo<=else";
+
+    REQUIRE( FindWord( std::string_view( text ).substr( 0, 3 ) ) == Word::End );
+    REQUIRE( FindWord( std::string_view( text ).substr( 3, 2 ) ) == Word::Do );
+    REQUIRE( FindWord( std::string_view( text ).substr( 5, 2 ) ) == Word::LE );
+    REQUIRE( FindWord( std::string_view( text ).substr( 7 ) ) == Word::Else );
+    REQUIRE( FindWord( std::string_view( text ).substr( 0, 5 ) ) == Word::None );
+}
@@ -0,0 +1,273 @@
+#include "pch.h"
+#include "TestBase.h"
+#include "../Gemini/AlgolyParser.h"
+#include "../Gemini/Compiler.h"
+#include "../Gemini/LispyParser.h"
+#include "../Gemini/ModuleBuilder.h"
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace Gemini;
+
+
+namespace
+{
+
+struct BuildSource
+{
+    const char*     Name;
+    const char*     Text;
+    SourceLanguage  Language;
+};
+
+}
+
+// Compiles the modules one at a time, the way that a host would without the builder
+static BuildResult BuildSerially( const std::vector<BuildSource>& sources )
+{
+    CompilerAttrs attrs;
+    RecordingEnv env;
+    RecordingLog log;
+    BuildResult result = {};
+    std::vector<std::shared_ptr<ModuleDeclaration>> modDecls;
+
+    result.Error = CompilerErr::OK;
+
+    for ( size_t i = 0; i < sources.size() && result.Error == CompilerErr::OK; i++ )
+    {
+        const BuildSource& source = sources[i];
+        Compiler compiler( &env, &log, attrs, static_cast<ModSize>( i ) );
+        BuiltModule module = {};
+
+        module.Name = source.Name;
+        module.Error = CompilerErr::SYNTAX;
+
+        try
+        {
+            if ( source.Language == SourceLanguage::Algoly )
+            {
+                AlgolyParser parser( source.Text, strlen( source.Text ), source.Name, &log );
+                compiler.AddUnit( parser.Parse() );
+            }
+            else
+            {
+                LispyParser parser( source.Text, strlen( source.Text ), source.Name, &log );
+                compiler.AddUnit( parser.Parse() );
+            }
+
+            for ( const auto& modDecl : modDecls )
+                compiler.AddModule( modDecl );
+
+            module.Error = compiler.Compile();
+        }
+        catch ( CompilerException& )
+        {
+        }
+
+        if ( module.Error == CompilerErr::OK )
+        {
+            compiler.GetStats( module.Stats );
+
+            module.Code.assign( compiler.GetCode(), compiler.GetCode() + compiler.GetCodeSize() );
+            module.Data.assign( compiler.GetData(), compiler.GetData() + compiler.GetDataSize() );
+            module.Const.assign( compiler.GetConst(), compiler.GetConst() + compiler.GetConstSize() );
+            module.Metadata = compiler.GetMetadata( source.Name );
+
+            modDecls.push_back( module.Metadata );
+        }
+
+        result.Error = module.Error;
+        result.Modules.push_back( std::move( module ) );
+    }
+
+    result.EnvCalls = env.Calls;
+    result.LogMessages = log.Messages;
+    return result;
+}
+
+static BuildResult BuildInParallel( const std::vector<BuildSource>& sources, unsigned threadCount )
+{
+    CompilerAttrs attrs;
+    RecordingEnv env;
+    RecordingLog log;
+    BuildResult result = {};
+    ModuleBuilder builder( &env, &log, attrs, threadCount );
+
+    for ( const auto& source : sources )
+        builder.AddModule( source.Name, { { source.Name, source.Text, source.Language } } );
+
+    result.Error = builder.Build();
+
+    for ( ModSize i = 0; i < builder.GetModuleCount(); i++ )
+        result.Modules.push_back( builder.GetModule( i ) );
+
+    result.EnvCalls = env.Calls;
+    result.LogMessages = log.Messages;
+    return result;
+}
+
+static void CheckSameModule( const BuiltModule& parallel, const BuiltModule& serial )
+{
+    REQUIRE( parallel.Name == serial.Name );
+    REQUIRE( parallel.Error == serial.Error );
+    REQUIRE( parallel.Code == serial.Code );
+    REQUIRE( parallel.Data == serial.Data );
+    REQUIRE( parallel.Const == serial.Const );
+    REQUIRE( parallel.Stats.CodeBytesWritten == serial.Stats.CodeBytesWritten );
+    REQUIRE( parallel.Stats.Static.MaxCallDepth == serial.Stats.Static.MaxCallDepth );
+    REQUIRE( parallel.Stats.Static.MaxStackUsage == serial.Stats.Static.MaxStackUsage );
+    REQUIRE( (parallel.Metadata != nullptr) == (serial.Metadata != nullptr) );
+
+    if ( parallel.Metadata != nullptr )
+    {
+        REQUIRE( parallel.Metadata->Index == serial.Metadata->Index );
+        REQUIRE( parallel.Metadata->Table.size() == serial.Metadata->Table.size() );
+    }
+}
+
+static void CheckSameAsSerial( const std::vector<BuildSource>& sources, unsigned threadCount )
+{
+    BuildResult serial = BuildSerially( sources );
+    BuildResult parallel = BuildInParallel( sources, threadCount );
+
+    REQUIRE( parallel.Error == serial.Error );
+    REQUIRE( parallel.Modules.size() == sources.size() );
+    REQUIRE( parallel.EnvCalls == serial.EnvCalls );
+    REQUIRE( parallel.LogMessages == serial.LogMessages );
+
+    for ( size_t i = 0; i < serial.Modules.size(); i++ )
+        CheckSameModule( parallel.Modules[i], serial.Modules[i] );
+}
+
+
+//----------------------------------------------------------------------------
+// Building modules in parallel
+//----------------------------------------------------------------------------
+
+TEST_CASE( "ModuleBuilder: diamond of imports", "[modulebuilder]" )
+{
+    const std::vector<BuildSource> sources =
+    {
+        { "ModA", "const N = 3\nvar G := 5\ndef Sq(x) x * x end\ndef Tw(x) x + x end\n", SourceLanguage::Algoly },
+        { "ModB", "import ModA\ndef B(x) ModA.Sq(x) + ModA.N end\n", SourceLanguage::Algoly },
+        { "ModL", "(defun L (x) (+ x 1))", SourceLanguage::Lispy },
+        { "ModC", "import ModA\nvar P := &ModA.Tw\ndef C(x) (P)(x) + ModA.G end\n", SourceLanguage::Algoly },
+        { "Main", "import ModB\nimport ModC\ndef a\n  ModB.B(2) + ModC.C(4)\nend\n", SourceLanguage::Algoly },
+    };
+
+    CheckSameAsSerial( sources, 4 );
+    CheckSameAsSerial( sources, 1 );
+
+    BuildResult parallel = BuildInParallel( sources, 4 );
+
+    REQUIRE( parallel.Error == CompilerErr::OK );
+
+    for ( const auto& module : parallel.Modules )
+    {
+        REQUIRE( module.Error == CompilerErr::OK );
+        REQUIRE( !module.Code.empty() );
+    }
+}
+
+TEST_CASE( "ModuleBuilder: many modules", "[modulebuilder]" )
+{
+    std::vector<std::string> texts;
+    std::vector<std::string> names;
+    std::vector<BuildSource> sources;
+
+    // Every third module imports the two before it, so most levels hold many modules
+
+    for ( int i = 0; i < 60; i++ )
+    {
+        std::string text;
+        std::string body = "x + " + std::to_string( i );
+
+        if ( i >= 2 && i % 3 == 0 )
+        {
+            text += "import M" + std::to_string( i - 1 ) + "\n";
+            text += "import M" + std::to_string( i - 2 ) + "\n";
+            body += " + M" + std::to_string( i - 1 ) + ".F(x) + M" + std::to_string( i - 2 ) + ".F(x)";
+        }
+
+        text += "const K = " + std::to_string( i * 7 ) + "\n";
+        text += "var T: [4] := [1, 2, 3, K]\n";
+        text += "def F(x) " + body + " end\n";
+        text += "def G(n) var s := 0; for i := 0 below 4 do s := s + T[i] * n end; s end\n";
+
+        names.push_back( "M" + std::to_string( i ) );
+        texts.push_back( text );
+    }
+
+    for ( size_t i = 0; i < texts.size(); i++ )
+        sources.push_back( { names[i].c_str(), texts[i].c_str(), SourceLanguage::Algoly } );
+
+    CheckSameAsSerial( sources, 8 );
+}
+
+TEST_CASE( "ModuleBuilder: failed module stops the later levels", "[modulebuilder]" )
+{
+    const std::vector<BuildSource> sources =
+    {
+        { "ModA", "def A(x) x end\n", SourceLanguage::Algoly },
+        { "ModB", "def B(x) y end\n", SourceLanguage::Algoly },
+        { "ModC", "def C(x) x + 1 end\n", SourceLanguage::Algoly },
+        { "Main", "import ModA\ndef a ModA.A(1) end\n", SourceLanguage::Algoly },
+    };
+
+    BuildResult result = BuildInParallel( sources, 4 );
+
+    REQUIRE( result.Error == CompilerErr::SEMANTICS );
+    REQUIRE( result.Modules[0].Error == CompilerErr::OK );
+    REQUIRE( result.Modules[1].Error == CompilerErr::SEMANTICS );
+    REQUIRE( result.Modules[1].Code.empty() );
+    REQUIRE( result.Modules[1].Metadata == nullptr );
+    REQUIRE( result.Modules[2].Error == CompilerErr::OK );
+    REQUIRE( result.Modules[3].Error == CompilerErr::NONE );
+    REQUIRE( result.LogMessages.size() == 1 );
+    REQUIRE( result.LogMessages[0].compare( 0, 6, "ModB: " ) == 0 );
+
+    // What the modules added, in module order, up to the one that failed
+
+    REQUIRE( result.EnvCalls.size() == 2 );
+    REQUIRE( result.EnvCalls[0].compare( 0, 2, "A@" ) == 0 );
+    REQUIRE( result.EnvCalls[1].compare( 0, 2, "C@" ) == 0 );
+}
+
+TEST_CASE( "ModuleBuilder: syntax errors stop before compiling", "[modulebuilder]" )
+{
+    const std::vector<BuildSource> sources =
+    {
+        { "ModA", "def A(x) x end\n", SourceLanguage::Algoly },
+        { "ModB", "def B(x) ( end\n", SourceLanguage::Algoly },
+        { "ModL", "(defun L (x) (+ x 1)", SourceLanguage::Lispy },
+    };
+
+    BuildResult result = BuildInParallel( sources, 4 );
+
+    REQUIRE( result.Error == CompilerErr::SYNTAX );
+    REQUIRE( result.Modules[0].Error == CompilerErr::NONE );
+    REQUIRE( result.Modules[1].Error == CompilerErr::SYNTAX );
+    REQUIRE( result.Modules[2].Error == CompilerErr::SYNTAX );
+    REQUIRE( result.EnvCalls.empty() );
+    REQUIRE( result.LogMessages.size() == 2 );
+    REQUIRE( result.LogMessages[0].compare( 0, 6, "ModB: " ) == 0 );
+    REQUIRE( result.LogMessages[1].compare( 0, 6, "ModL: " ) == 0 );
+}
+
+TEST_CASE( "ModuleBuilder: imports only reach earlier modules", "[modulebuilder]" )
+{
+    const std::vector<BuildSource> sources =
+    {
+        { "Main", "import ModA\ndef a ModA.A(1) end\n", SourceLanguage::Algoly },
+        { "ModA", "def A(x) x end\n", SourceLanguage::Algoly },
+    };
+
+    BuildResult result = BuildInParallel( sources, 2 );
+
+    REQUIRE( result.Error == CompilerErr::SEMANTICS );
+    REQUIRE( result.Modules[0].Error == CompilerErr::SEMANTICS );
+    REQUIRE( result.Modules[1].Error == CompilerErr::OK );
+
+    CheckSameModule( result.Modules[0], BuildSerially( sources ).Modules[0] );
+}
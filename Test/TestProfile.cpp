@@ -0,0 +1,129 @@
+#include "pch.h"
+#include "TestBase.h"
+#include "../Gemini/Common.h"
+#include "../Gemini/OpCodes.h"
+#include <vector>
+
+using namespace Gemini;
+
+
+TEST_CASE( "Profile: format text and JSON", "[profile]" )
+{
+    MachineProfile profile = {};
+
+    profile.Ops[OP_LDC_S].Count = 3;
+    profile.Ops[OP_RET].Count = 1;
+    profile.Ops[0xF0].Count = 2;
+    profile.Prims[PRIM_MUL].Count = 4;
+
+    std::string text = FormatProfileText( profile );
+
+    REQUIRE( text.find( "LDC.S" ) != std::string::npos );
+    REQUIRE( text.find( "$F0" ) != std::string::npos );
+    REQUIRE( text.find( "MUL" ) != std::string::npos );
+    REQUIRE( text.find( "Cycles" ) == std::string::npos );
+    REQUIRE( text.find( "LDC.S" ) < text.find( "$F0" ) );
+    REQUIRE( text.find( "$F0" ) < text.find( "RET" ) );
+
+    profile.Timing = true;
+    profile.Ops[OP_RET].Cycles = 12345;
+
+    text = FormatProfileText( profile );
+
+    REQUIRE( text.find( "Cycles" ) != std::string::npos );
+    REQUIRE( text.find( "12345" ) != std::string::npos );
+
+    std::string json = FormatProfileJson( profile );
+
+    REQUIRE( json.find( "\"timing\": true" ) != std::string::npos );
+    REQUIRE( json.find( "{ \"name\": \"LDC.S\", \"count\": 3, \"cycles\": 0 }" ) != std::string::npos );
+    REQUIRE( json.find( "{ \"name\": \"MUL\", \"count\": 4, \"cycles\": 0 }" ) != std::string::npos );
+
+    profile = {};
+
+    json = FormatProfileJson( profile );
+
+    REQUIRE( json == "{\n  \"timing\": false,\n  \"ops\": [],\n  \"prims\": []\n}\n" );
+}
+
+#ifdef GEMINIVM_PROFILE
+
+TEST_CASE( "Profile: count opcodes and primitives", "[profile]" )
+{
+    auto code = MakeCode( gSumLoop );
+    auto mod = MakeModule( code );
+    CELL stack[64];
+    Machine machine;
+
+    machine.Init( stack, 64, 0, &mod );
+
+    CELL* args = machine.Start( 0, 0, 1 );
+
+    REQUIRE( args != nullptr );
+
+    args[0] = 10;
+
+    REQUIRE( machine.Run() == ERR_NONE );
+    REQUIRE( stack[63] == 55 );
+
+    const MachineProfile* profile = machine.GetProfile();
+
+    REQUIRE( profile != nullptr );
+    REQUIRE( profile->Ops[OP_PUSH].Count == 1 );
+    REQUIRE( profile->Ops[OP_INCLOC].Count == 10 );
+    REQUIRE( profile->Ops[OP_PRIM].Count == 10 );
+    REQUIRE( profile->Ops[OP_BLT].Count == 10 );
+    REQUIRE( profile->Ops[OP_RET].Count == 1 );
+    REQUIRE( profile->Prims[PRIM_ADD].Count == 10 );
+    REQUIRE( profile->Prims[PRIM_SUB].Count == 0 );
+    REQUIRE( profile->Ops[OP_RET].Cycles == 0 );
+
+    machine.ResetProfile();
+
+    REQUIRE( profile->Ops[OP_INCLOC].Count == 0 );
+}
+
+TEST_CASE( "Profile: time opcodes and primitives", "[profile]" )
+{
+    auto code = MakeCode( gSumLoop );
+    auto mod = MakeModule( code );
+    CELL stack[64];
+    Machine machine;
+
+    machine.Init( stack, 64, 0, &mod );
+    machine.SetProfileTiming( true );
+
+    CELL* args = machine.Start( 0, 0, 1 );
+
+    REQUIRE( args != nullptr );
+
+    args[0] = 1000;
+
+    REQUIRE( machine.Run() == ERR_NONE );
+
+    const MachineProfile* profile = machine.GetProfile();
+    U64 loopCycles = profile->Ops[OP_INCLOC].Cycles
+        + profile->Ops[OP_PRIM].Cycles
+        + profile->Ops[OP_BLT].Cycles;
+
+    REQUIRE( profile->Timing );
+    REQUIRE( loopCycles > 0 );
+    REQUIRE( profile->Prims[PRIM_ADD].Cycles <= profile->Ops[OP_PRIM].Cycles );
+    REQUIRE( FormatProfileText( *profile ).find( "INCLOC" ) != std::string::npos );
+}
+
+#else
+
+TEST_CASE( "Profile: not kept without GEMINIVM_PROFILE", "[profile]" )
+{
+    Machine machine;
+
+    REQUIRE( machine.GetProfile() == nullptr );
+
+    machine.ResetProfile();
+    machine.SetProfileTiming( true );
+
+    REQUIRE( machine.GetProfile() == nullptr );
+}
+
+#endif
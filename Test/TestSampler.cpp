@@ -0,0 +1,186 @@
+#include "pch.h"
+#include "TestBase.h"
+#include "../Gemini/Common.h"
+#include "../Gemini/OpCodes.h"
+#include "../Gemini/Sampler.h"
+#include "../Gemini/Syntax.h"
+#include "../Gemini/VmCommon.h"
+#include <chrono>
+#include <vector>
+
+using namespace Gemini;
+
+
+// Main calls Count, which counts down from 100
+static const std::initializer_list<U8> sCallCount =
+{
+    OP_CALL, 0, 6, 0, 0,
+    OP_RET,
+    OP_LDC_S, 100,
+    OP_PRIMC_S, PRIM_SUB, 1,
+    OP_DUP,
+    OP_BTRUE, 0xF9, 0xFF,
+    OP_RET
+};
+
+class TestSymbols : public SamplingProfiler::ISymbols
+{
+public:
+    virtual bool FindFunctionName( U32 addrWord, std::string& name ) override
+    {
+        U32 addr = CodeAddr::GetAddress( addrWord );
+
+        if ( addr >= 16 )
+            return false;
+
+        name = (addr < 6) ? "Main" : "Count";
+        return true;
+    }
+};
+
+
+TEST_CASE( "Sampler: call stack", "[sampler]" )
+{
+    auto code = MakeCode( sCallCount );
+    auto mod = MakeModule( code );
+    CELL stack[64];
+    Machine machine;
+    U32 addrWords[8];
+
+    machine.Init( stack, 64, 0, &mod );
+
+    REQUIRE( machine.GetCallStack( addrWords, std::size( addrWords ) ) == 0 );
+    REQUIRE( machine.Start( 0, 0, 0 ) != nullptr );
+    REQUIRE( machine.GetCallStack( addrWords, std::size( addrWords ) ) == 1 );
+    REQUIRE( addrWords[0] == 0 );
+
+    // Stop after the call, then at the first loop branch
+
+    REQUIRE( machine.Run( 2 ) == ERR_BUDGET_EXHAUSTED );
+    REQUIRE( machine.GetCallStack( addrWords, std::size( addrWords ) ) == 2 );
+    REQUIRE( addrWords[0] == 8 );
+    REQUIRE( addrWords[1] == 5 );
+    REQUIRE( machine.GetCallStack( addrWords, 1 ) == 1 );
+}
+
+TEST_CASE( "Sampler: requested samples", "[sampler]" )
+{
+    auto code = MakeCode( sCallCount );
+    auto mod = MakeModule( code );
+    CELL stack[64];
+    Machine machine;
+    SamplingProfiler sampler;
+
+    machine.Init( stack, 64, 0, &mod );
+    machine.SetSampler( &sampler );
+
+    REQUIRE( machine.Start( 0, 0, 0 ) != nullptr );
+
+    // The first check is at the call
+
+    sampler.RequestSample();
+
+    REQUIRE( machine.Run( 10 ) == ERR_BUDGET_EXHAUSTED );
+    REQUIRE( sampler.GetSampleCount() == 1 );
+
+    sampler.RequestSample();
+
+    REQUIRE( machine.Run() == ERR_NONE );
+    REQUIRE( stack[63] == 0 );
+    REQUIRE( sampler.GetSampleCount() == 2 );
+
+    const auto& root = sampler.GetCallTree();
+
+    REQUIRE( root.Children.size() == 1 );
+
+    const auto& mainNode = *root.Children.begin()->second;
+
+    REQUIRE( mainNode.AddrWord == 4 );
+    REQUIRE( mainNode.TotalSamples == 2 );
+    REQUIRE( mainNode.Samples == 0 );
+    REQUIRE( mainNode.Children.size() == 2 );
+    REQUIRE( mainNode.Children.count( 6 ) == 1 );
+    REQUIRE( mainNode.Children.count( 8 ) == 1 );
+
+    TestSymbols symbols;
+
+    REQUIRE( sampler.FormatCollapsed( &symbols ) == "Main;Count 2\n" );
+    REQUIRE( sampler.FormatCollapsed() == "00:000004;00:000006 1\n00:000004;00:000008 1\n" );
+
+    sampler.Clear();
+
+    REQUIRE( sampler.GetSampleCount() == 0 );
+    REQUIRE( sampler.FormatCollapsed() == "" );
+}
+
+TEST_CASE( "Sampler: timer", "[sampler]" )
+{
+    auto code = MakeCode( { OP_B, 0xFD, 0xFF, OP_RET } );
+    auto mod = MakeModule( code );
+    CELL stack[64];
+    Machine machine;
+    SamplingProfiler sampler;
+
+    machine.Init( stack, 64, 0, &mod );
+    machine.SetSampler( &sampler );
+
+    REQUIRE( machine.Start( 0, 0, 0 ) != nullptr );
+    REQUIRE( sampler.Start( 0 ) == ERR_BAD_ARG );
+    REQUIRE( sampler.Start( 100 ) == ERR_NONE );
+    REQUIRE( sampler.Start( 100 ) == ERR_BAD_STATE );
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds( 10 );
+
+    while ( sampler.GetSampleCount() < 3 && std::chrono::steady_clock::now() < deadline )
+    {
+        REQUIRE( machine.Run( 10000 ) == ERR_BUDGET_EXHAUSTED );
+    }
+
+    sampler.Stop();
+
+    REQUIRE( sampler.GetSampleCount() >= 3 );
+    REQUIRE( sampler.FormatCollapsed().find( "00:000000 " ) == 0 );
+
+    // Without the sampler, requests aren't seen
+
+    machine.SetSampler( nullptr );
+    sampler.Clear();
+    sampler.RequestSample();
+
+    REQUIRE( machine.Run( 100 ) == ERR_BUDGET_EXHAUSTED );
+    REQUIRE( sampler.GetSampleCount() == 0 );
+}
+
+TEST_CASE( "Sampler: names from compiler metadata", "[sampler]" )
+{
+    CompilerAttrs attrs;
+
+    auto main = std::make_shared<Function>();
+    auto count = std::make_shared<Function>();
+    auto other = std::make_shared<Function>();
+
+    main->Name = "Main";
+    main->Address = 0;
+    count->Name = "Count";
+    count->Address = 6;
+    other->Name = "Other";
+    other->Address = 0;
+    other->ModIndex = 1;
+
+    attrs.AddFunctionByAddress( main );
+    attrs.AddFunctionByAddress( count );
+    attrs.AddFunctionByAddress( other );
+
+    CompilerSymbols symbols( attrs );
+    std::string name;
+
+    REQUIRE( symbols.FindFunctionName( 4, name ) );
+    REQUIRE( name == "Main" );
+    REQUIRE( symbols.FindFunctionName( 6, name ) );
+    REQUIRE( name == "Count" );
+    REQUIRE( symbols.FindFunctionName( 100, name ) );
+    REQUIRE( name == "Count" );
+    REQUIRE( symbols.FindFunctionName( CodeAddr::Build( 3, 1 ), name ) );
+    REQUIRE( name == "Other" );
+    REQUIRE( !symbols.FindFunctionName( CodeAddr::Build( 3, 2 ), name ) );
+}
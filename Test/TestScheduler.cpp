@@ -0,0 +1,206 @@
+#include "pch.h"
+#include "TestBase.h"
+#include "../Gemini/Common.h"
+#include "../Gemini/OpCodes.h"
+#include "../Gemini/Scheduler.h"
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace Gemini;
+
+
+struct SchedMachine
+{
+    CELL    Stack[64];
+    Machine Vm;
+};
+
+template <typename Pred>
+static bool WaitFor( Pred pred )
+{
+    for ( int i = 0; i < 5000; i++ )
+    {
+        if ( pred() )
+            return true;
+
+        std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+    }
+
+    return false;
+}
+
+
+TEST_CASE( "Scheduler: run many machines", "[scheduler]" )
+{
+    auto code = MakeCode( gSumLoop );
+    auto mod = MakeModule( code );
+    std::vector<SchedMachine> machines( 200 );
+    std::vector<Scheduler::TaskId> ids;
+
+    Scheduler scheduler( 4, 50 );
+
+    REQUIRE( scheduler.GetWorkerCount() == 4 );
+
+    for ( size_t i = 0; i < machines.size(); i++ )
+    {
+        machines[i].Vm.Init( machines[i].Stack, static_cast<U16>(std::size( machines[i].Stack )), 0, &mod );
+
+        CELL* args = machines[i].Vm.Start( 0, 0, 1 );
+
+        REQUIRE( args != nullptr );
+
+        args[0] = static_cast<CELL>( 100 + i );
+
+        ids.push_back( scheduler.Add( &machines[i].Vm ) );
+    }
+
+    scheduler.WaitAll();
+
+    for ( size_t i = 0; i < machines.size(); i++ )
+    {
+        CELL n = static_cast<CELL>( 100 + i );
+        auto stats = scheduler.GetStats( ids[i] );
+
+        REQUIRE( stats.Done );
+        REQUIRE( stats.Result == ERR_NONE );
+        REQUIRE( stats.Slices == stats.Preemptions + 1 );
+        REQUIRE( stats.Preemptions >= 1 );
+        REQUIRE( machines[i].Stack[std::size( machines[i].Stack ) - 1] == n * (n + 1) / 2 );
+    }
+}
+
+TEST_CASE( "Scheduler: runaway script doesn't hold the worker", "[scheduler]" )
+{
+    auto loopCode = MakeCode( { OP_B, 0xFD, 0xFF, OP_RET } );
+    auto loopMod = MakeModule( loopCode );
+    auto sumCode = MakeCode( gSumLoop );
+    auto sumMod = MakeModule( sumCode );
+    SchedMachine runaway;
+    SchedMachine other;
+
+    Scheduler scheduler( 1, 100 );
+
+    runaway.Vm.Init( runaway.Stack, static_cast<U16>(std::size( runaway.Stack )), 0, &loopMod );
+    REQUIRE( runaway.Vm.Start( 0, 0, 0 ) != nullptr );
+
+    other.Vm.Init( other.Stack, static_cast<U16>(std::size( other.Stack )), 0, &sumMod );
+    CELL* args = other.Vm.Start( 0, 0, 1 );
+    REQUIRE( args != nullptr );
+    args[0] = 1000;
+
+    auto runawayId = scheduler.Add( &runaway.Vm );
+    auto otherId = scheduler.Add( &other.Vm );
+
+    REQUIRE( WaitFor( [&] { return scheduler.GetStats( otherId ).Done; } ) );
+    REQUIRE( other.Stack[std::size( other.Stack ) - 1] == 500500 );
+    REQUIRE( !scheduler.GetStats( runawayId ).Done );
+}
+
+TEST_CASE( "Scheduler: errors finish the machine", "[scheduler]" )
+{
+    auto code = MakeCode( { OP_LDC_S, 1, OP_LDC_S, 0, OP_PRIM, PRIM_DIV, OP_RET } );
+    auto mod = MakeModule( code );
+    SchedMachine sm;
+
+    Scheduler scheduler( 2 );
+
+    sm.Vm.Init( sm.Stack, static_cast<U16>(std::size( sm.Stack )), 0, &mod );
+    REQUIRE( sm.Vm.Start( 0, 0, 0 ) != nullptr );
+
+    auto id = scheduler.Add( &sm.Vm );
+
+    scheduler.WaitAll();
+
+    REQUIRE( scheduler.GetStats( id ).Done );
+    REQUIRE( scheduler.GetStats( id ).Result == ERR_DIVIDE );
+}
+
+
+static int NatContinue( Machine* machine, U8 argc, CELL* args, UserContext context )
+{
+    machine->PushCell( static_cast<CELL>( context ) );
+    return ERR_NONE;
+}
+
+static int NatWait( Machine* machine, U8 argc, CELL* args, UserContext context )
+{
+    return machine->Yield( NatContinue, 42 );
+}
+
+class NativeEnv : public IEnvironment
+{
+    const Module*   mMod;
+
+public:
+    NativeEnv( const Module* mod ) :
+        mMod( mod )
+    {
+    }
+
+    virtual bool FindNativeCode( U32 id, NativeCode* nativeCode ) override
+    {
+        if ( id != 0 )
+            return false;
+
+        nativeCode->Proc = NatWait;
+        return true;
+    }
+
+    virtual const Module* FindModule( U8 index ) override
+    {
+        return index == 0 ? mMod : nullptr;
+    }
+};
+
+TEST_CASE( "Scheduler: native continuation waits for Wake", "[scheduler]" )
+{
+    auto code = MakeCode( { OP_YIELD, OP_CALLNATIVE_S, 0, 0, OP_RET } );
+    auto mod = MakeModule( code );
+    NativeEnv env( &mod );
+    SchedMachine sm;
+
+    Scheduler scheduler( 2 );
+
+    sm.Vm.Init( sm.Stack, static_cast<U16>(std::size( sm.Stack )), &env );
+    REQUIRE( sm.Vm.Start( 0, 0, 0 ) != nullptr );
+
+    auto id = scheduler.Add( &sm.Vm );
+
+    REQUIRE( WaitFor( [&] { return scheduler.GetStats( id ).Waits == 1; } ) );
+
+    std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+
+    REQUIRE( !scheduler.GetStats( id ).Done );
+
+    scheduler.Wake( id );
+    scheduler.WaitAll();
+
+    auto stats = scheduler.GetStats( id );
+
+    REQUIRE( stats.Result == ERR_NONE );
+    REQUIRE( stats.Yields == 2 );
+    REQUIRE( stats.Waits == 1 );
+    REQUIRE( sm.Stack[std::size( sm.Stack ) - 1] == 42 );
+}
+
+TEST_CASE( "Scheduler: early Wake isn't lost", "[scheduler]" )
+{
+    auto code = MakeCode( { OP_CALLNATIVE_S, 0, 0, OP_RET } );
+    auto mod = MakeModule( code );
+    NativeEnv env( &mod );
+    SchedMachine sm;
+
+    Scheduler scheduler( 1 );
+
+    sm.Vm.Init( sm.Stack, static_cast<U16>(std::size( sm.Stack )), &env );
+    REQUIRE( sm.Vm.Start( 0, 0, 0 ) != nullptr );
+
+    auto id = scheduler.Add( &sm.Vm );
+
+    scheduler.Wake( id );
+    scheduler.WaitAll();
+
+    REQUIRE( scheduler.GetStats( id ).Result == ERR_NONE );
+    REQUIRE( sm.Stack[std::size( sm.Stack ) - 1] == 42 );
+}
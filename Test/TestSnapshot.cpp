@@ -0,0 +1,273 @@
+#include "pch.h"
+#include "TestBase.h"
+#include "../Gemini/Common.h"
+#include "../Gemini/OpCodes.h"
+#include <vector>
+
+using namespace Gemini;
+
+
+static int Continue( Machine*, U8, CELL*, UserContext )
+{
+    return ERR_NONE;
+}
+
+static void StartSum( Machine& machine, CELL* stack, U16 stackSize, const Module* mod, CELL n )
+{
+    machine.Init( stack, stackSize, 0, mod );
+
+    CELL* args = machine.Start( 0, 0, 1 );
+
+    REQUIRE( args != nullptr );
+
+    args[0] = n;
+}
+
+
+TEST_CASE( "Snapshot: restore a stopped run in another machine", "[snapshot]" )
+{
+    auto code = MakeCode( gSumLoop );
+    auto mod = MakeModule( code );
+    CELL stack[64];
+    CELL otherStack[64];
+    Machine machine;
+    Machine other;
+    MachineSnapshot snapshot;
+
+    StartSum( machine, stack, 64, &mod, 100 );
+
+    REQUIRE( machine.Run( 10 ) == ERR_BUDGET_EXHAUSTED );
+    REQUIRE( machine.Snapshot( snapshot ) == ERR_NONE );
+    REQUIRE( snapshot.StackSize == 64 );
+    REQUIRE( snapshot.Stack.size() < 64 );
+
+    other.Init( otherStack, 64, 0, &mod );
+
+    REQUIRE( other.Restore( snapshot ) == ERR_NONE );
+    REQUIRE( other.IsRunning() );
+    REQUIRE( other.Run() == ERR_NONE );
+    REQUIRE( otherStack[63] == 5050 );
+
+    // The original is untouched and can go back to the snapshot after finishing
+
+    REQUIRE( machine.Run() == ERR_NONE );
+    REQUIRE( stack[63] == 5050 );
+
+    REQUIRE( machine.Restore( snapshot ) == ERR_NONE );
+    REQUIRE( machine.Run() == ERR_NONE );
+    REQUIRE( stack[63] == 5050 );
+}
+
+TEST_CASE( "Snapshot: restore into verified code checks the stack height", "[snapshot]" )
+{
+    auto code = MakeCode( gSumLoop );
+    auto mod = MakeModule( code );
+    VerifiedCode verifiedCode;
+    CELL stack[64];
+    Machine machine;
+    MachineSnapshot snapshot;
+
+    REQUIRE( VerifyModuleCode( &mod, &verifiedCode ) == ERR_NONE );
+
+    mod.Verified = &verifiedCode;
+
+    StartSum( machine, stack, 64, &mod, 100 );
+
+    REQUIRE( machine.Run( 10 ) == ERR_BUDGET_EXHAUSTED );
+    REQUIRE( machine.Snapshot( snapshot ) == ERR_NONE );
+
+    // The middle of an instruction
+
+    MachineSnapshot tampered = snapshot;
+
+    tampered.PC++;
+
+    REQUIRE( machine.Restore( tampered ) == ERR_BAD_ADDRESS );
+
+    // A cell short of the height at the PC
+
+    tampered = snapshot;
+    tampered.Stack.erase( tampered.Stack.begin() );
+
+    REQUIRE( machine.Restore( tampered ) == ERR_BAD_ADDRESS );
+
+    // A frame at the end of the stack with nothing below it
+
+    tampered = snapshot;
+    tampered.FramePtr = 63;
+    tampered.Stack.clear();
+
+    for ( U32 pc = 0; pc < mod.CodeSize - SENTINEL_SIZE; pc++ )
+    {
+        tampered.PC = pc;
+
+        REQUIRE( machine.Restore( tampered ) == ERR_BAD_ADDRESS );
+    }
+
+    // The machine still has the state it stopped with
+
+    REQUIRE( machine.Run() == ERR_NONE );
+    REQUIRE( stack[63] == 5050 );
+
+    REQUIRE( machine.Restore( snapshot ) == ERR_NONE );
+    REQUIRE( machine.Run() == ERR_NONE );
+    REQUIRE( stack[63] == 5050 );
+}
+
+TEST_CASE( "Snapshot: restore of serialized state into verified code checks the stack height", "[snapshot]" )
+{
+    auto code = MakeCode( gSumLoop );
+    auto mod = MakeModule( code );
+    VerifiedCode verifiedCode;
+    CELL stack[64];
+    CELL otherStack[64];
+    Machine machine;
+    Machine other;
+    MachineSnapshot snapshot;
+    MachineSnapshot loaded;
+    std::vector<U8> bytes;
+
+    REQUIRE( VerifyModuleCode( &mod, &verifiedCode ) == ERR_NONE );
+
+    mod.Verified = &verifiedCode;
+
+    StartSum( machine, stack, 64, &mod, 100 );
+
+    REQUIRE( machine.Run( 10 ) == ERR_BUDGET_EXHAUSTED );
+    REQUIRE( machine.Snapshot( snapshot ) == ERR_NONE );
+    REQUIRE( SerializeSnapshot( snapshot, bytes ) == ERR_NONE );
+
+    // Move the PC into the middle of an instruction. Deserializing doesn't
+    // know the module, so only Restore can catch it
+
+    const size_t PCOffset = 12;
+
+    REQUIRE( bytes[PCOffset] == snapshot.PC );
+
+    bytes[PCOffset]++;
+
+    REQUIRE( DeserializeSnapshot( bytes.data(), bytes.size(), loaded ) == ERR_NONE );
+    REQUIRE( loaded.PC == snapshot.PC + 1 );
+
+    other.Init( otherStack, 64, 0, &mod );
+
+    REQUIRE( other.Restore( loaded ) == ERR_BAD_ADDRESS );
+    REQUIRE( !other.IsRunning() );
+}
+
+TEST_CASE( "Snapshot: fork runs independently of the parent", "[snapshot]" )
+{
+    auto code = MakeCode( gSumLoop );
+    auto mod = MakeModule( code );
+    CELL parentStack[64];
+    CELL childStack[64];
+    Machine parent;
+    Machine child;
+
+    StartSum( parent, parentStack, 64, &mod, 50 );
+
+    REQUIRE( parent.Run( 5 ) == ERR_BUDGET_EXHAUSTED );
+
+    child.Init( childStack, 64, 0, &mod );
+
+    REQUIRE( parent.Fork( child ) == ERR_NONE );
+    REQUIRE( child.IsRunning() );
+
+    // Finish the parent first, so that the child can't be reading its stack
+
+    REQUIRE( parent.Run() == ERR_NONE );
+    REQUIRE( parentStack[63] == 1275 );
+
+    REQUIRE( child.Run() == ERR_NONE );
+    REQUIRE( childStack[63] == 1275 );
+
+    REQUIRE( parent.Fork( parent ) == ERR_BAD_ARG );
+}
+
+TEST_CASE( "Snapshot: serialize round trip", "[snapshot]" )
+{
+    auto code = MakeCode( gSumLoop );
+    auto mod = MakeModule( code );
+    CELL stack[64];
+    CELL otherStack[64];
+    Machine machine;
+    Machine other;
+    MachineSnapshot snapshot;
+    MachineSnapshot loaded;
+    std::vector<U8> bytes;
+
+    StartSum( machine, stack, 64, &mod, 20 );
+
+    REQUIRE( machine.Run( 4 ) == ERR_BUDGET_EXHAUSTED );
+    REQUIRE( machine.Snapshot( snapshot ) == ERR_NONE );
+    REQUIRE( SerializeSnapshot( snapshot, bytes ) == ERR_NONE );
+    REQUIRE( DeserializeSnapshot( bytes.data(), bytes.size(), loaded ) == ERR_NONE );
+
+    REQUIRE( loaded.Stack == snapshot.Stack );
+    REQUIRE( loaded.StackSize == snapshot.StackSize );
+    REQUIRE( loaded.FramePtr == snapshot.FramePtr );
+    REQUIRE( loaded.PC == snapshot.PC );
+    REQUIRE( loaded.ModIndex == snapshot.ModIndex );
+
+    other.Init( otherStack, 64, 0, &mod );
+
+    REQUIRE( other.Restore( loaded ) == ERR_NONE );
+    REQUIRE( other.Run() == ERR_NONE );
+    REQUIRE( otherStack[63] == 210 );
+
+    // Truncated and corrupted input
+
+    REQUIRE( DeserializeSnapshot( bytes.data(), bytes.size() - 1, loaded ) == ERR_BAD_ARG );
+
+    bytes[0] ^= 0xFF;
+
+    REQUIRE( DeserializeSnapshot( bytes.data(), bytes.size(), loaded ) == ERR_BAD_ARG );
+}
+
+TEST_CASE( "Snapshot: native continuation can't be serialized", "[snapshot]" )
+{
+    MachineSnapshot snapshot = {};
+    std::vector<U8> bytes;
+
+    snapshot.StackSize = 64;
+    snapshot.FramePtr = 64;
+    snapshot.NativeContinuation = Continue;
+
+    REQUIRE( SerializeSnapshot( snapshot, bytes ) == ERR_BAD_STATE );
+
+    snapshot.NativeContinuation = nullptr;
+
+    REQUIRE( SerializeSnapshot( snapshot, bytes ) == ERR_NONE );
+}
+
+TEST_CASE( "Snapshot: restore checks the machine", "[snapshot]" )
+{
+    auto code = MakeCode( gSumLoop );
+    auto mod = MakeModule( code );
+    CELL stack[64];
+    CELL smallStack[32];
+    Machine machine;
+    Machine small;
+    MachineSnapshot snapshot;
+
+    StartSum( machine, stack, 64, &mod, 10 );
+
+    REQUIRE( machine.Run( 2 ) == ERR_BUDGET_EXHAUSTED );
+    REQUIRE( machine.Snapshot( snapshot ) == ERR_NONE );
+
+    small.Init( smallStack, 32, 0, &mod );
+
+    REQUIRE( small.Restore( snapshot ) == ERR_BAD_ARG );
+    REQUIRE( machine.Fork( small ) == ERR_BAD_ARG );
+
+    // The module index has to be found in the machine's environment
+
+    snapshot.ModIndex = 3;
+
+    REQUIRE( machine.Restore( snapshot ) == ERR_BYTECODE_NOT_FOUND );
+
+    snapshot.ModIndex = 0;
+    snapshot.PC = mod.CodeSize;
+
+    REQUIRE( machine.Restore( snapshot ) == ERR_BAD_ADDRESS );
+}
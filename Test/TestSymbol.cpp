@@ -0,0 +1,175 @@
+#include "pch.h"
+#include "TestBase.h"
+#include "../Gemini/Symbol.h"
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Gemini;
+
+
+//----------------------------------------------------------------------------
+// Symbol
+//----------------------------------------------------------------------------
+
+TEST_CASE( "Symbol: equal names are the same symbol", "[symbol]" )
+{
+    std::string name = "alpha";
+    Symbol a( name );
+    Symbol b( "alpha" );
+    Symbol c( std::string_view( "alphabet", 5 ) );
+    Symbol d( "beta" );
+
+    REQUIRE( a == b );
+    REQUIRE( a == c );
+    REQUIRE( a != d );
+    REQUIRE( &a.GetString() == &b.GetString() );
+    REQUIRE( a.GetString() == "alpha" );
+    REQUIRE( a.GetHash() == c.GetHash() );
+
+    REQUIRE( Symbol() == Symbol( "" ) );
+    REQUIRE( Symbol().empty() );
+}
+
+TEST_CASE( "Symbol: threads intern the same names", "[symbol]" )
+{
+    const int ThreadCount = 4;
+    const int NameCount = 1000;
+
+    std::vector<std::vector<Symbol>> symbols( ThreadCount );
+    std::vector<std::thread> threads;
+
+    for ( int t = 0; t < ThreadCount; t++ )
+    {
+        threads.emplace_back( [&symbols, t]
+        {
+            for ( int i = 0; i < NameCount; i++ )
+                symbols[t].push_back( Symbol( "thread_name_" + std::to_string( i ) ) );
+        } );
+    }
+
+    for ( auto& thread : threads )
+        thread.join();
+
+    bool same = true;
+
+    for ( int t = 1; t < ThreadCount; t++ )
+    {
+        for ( int i = 0; i < NameCount; i++ )
+            same = same && symbols[t][i] == symbols[0][i];
+    }
+
+    REQUIRE( same );
+    REQUIRE( symbols[0][7].GetString() == "thread_name_7" );
+}
+
+
+//----------------------------------------------------------------------------
+// SymbolMap
+//----------------------------------------------------------------------------
+
+TEST_CASE( "SymbolMap: insert and find", "[symbol]" )
+{
+    SymbolMap<int> map;
+
+    REQUIRE( map.empty() );
+    REQUIRE( map.find( "a" ) == map.end() );
+
+    auto [it, inserted] = map.insert( { "a", 1 } );
+
+    REQUIRE( inserted );
+    REQUIRE( it->second == 1 );
+
+    // Adding the same name again keeps the first value
+    auto result = map.insert( { "a", 2 } );
+
+    REQUIRE( !result.second );
+    REQUIRE( result.first->second == 1 );
+
+    map["b"] = 3;
+
+    REQUIRE( map.size() == 2 );
+    REQUIRE( map.count( "b" ) == 1 );
+    REQUIRE( map.count( "c" ) == 0 );
+    REQUIRE( map.find( "b" )->second == 3 );
+}
+
+TEST_CASE( "SymbolMap: entries stay in insertion order", "[symbol]" )
+{
+    SymbolMap<int> map;
+    const char* names[] = { "zeta", "alpha", "mu", "beta", "omega" };
+
+    for ( int i = 0; i < 5; i++ )
+        map.insert( { names[i], i } );
+
+    int i = 0;
+
+    for ( auto& [name, value] : map )
+    {
+        REQUIRE( name == Symbol( names[i] ) );
+        REQUIRE( value == i );
+        i++;
+    }
+
+    // The last entry takes the place of an erased one
+
+    REQUIRE( map.erase( "alpha" ) == 1 );
+    REQUIRE( map.erase( "alpha" ) == 0 );
+
+    std::vector<int> values;
+
+    for ( auto& [name, value] : map )
+        values.push_back( value );
+
+    REQUIRE( values == std::vector<int>{ 0, 4, 2, 3 } );
+}
+
+TEST_CASE( "SymbolMap: many entries survive growth and erasure", "[symbol]" )
+{
+    const int Count = 5000;
+
+    SymbolMap<int> map;
+    std::vector<Symbol> names;
+
+    for ( int i = 0; i < Count; i++ )
+    {
+        names.push_back( Symbol( "map_name_" + std::to_string( i ) ) );
+        map.insert( { names[i], i } );
+    }
+
+    REQUIRE( map.size() == Count );
+
+    // Erase every third name, half through iterators
+
+    for ( int i = 0; i < Count; i += 3 )
+    {
+        if ( i % 2 == 0 )
+            map.erase( map.find( names[i] ) );
+        else
+            map.erase( names[i] );
+    }
+
+    bool found = true;
+
+    for ( int i = 0; i < Count; i++ )
+    {
+        auto it = map.find( names[i] );
+
+        if ( i % 3 == 0 )
+            found = found && it == map.end();
+        else
+            found = found && it != map.end() && it->second == i;
+    }
+
+    REQUIRE( found );
+    REQUIRE( map.size() == Count - (Count + 2) / 3 );
+
+    map.clear();
+
+    REQUIRE( map.empty() );
+    REQUIRE( map.find( names[1] ) == map.end() );
+
+    map.insert( { names[1], 1 } );
+
+    REQUIRE( map.find( names[1] )->second == 1 );
+}
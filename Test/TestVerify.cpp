@@ -0,0 +1,456 @@
+#include "pch.h"
+#include "TestBase.h"
+#include "../Gemini/Common.h"
+#include "../Gemini/OpCodes.h"
+#include "../Gemini/VmCommon.h"
+#include <vector>
+
+using namespace Gemini;
+
+
+static int VerifyCode( std::initializer_list<U8> insts, VerifiedCode* verifiedCode = nullptr )
+{
+    VerifiedCode localVerifiedCode;
+
+    auto code = MakeCode( insts );
+    auto mod = MakeModule( code );
+
+    return VerifyModuleCode( &mod, verifiedCode != nullptr ? verifiedCode : &localVerifiedCode );
+}
+
+
+//----------------------------------------------------------------------------
+// Verifier
+//----------------------------------------------------------------------------
+
+TEST_CASE( "Verify: straight line code", "[verify]" )
+{
+    VerifiedCode verifiedCode;
+
+    int err = VerifyCode( { OP_PUSH, 2, OP_LDC_S, 3, OP_DUP, OP_STLOC, 1, OP_RET }, &verifiedCode );
+
+    REQUIRE( err == ERR_NONE );
+    REQUIRE( verifiedCode.Entries == std::vector<U32>{ 0 } );
+    REQUIRE( verifiedCode.StackUsage == 4 );
+}
+
+TEST_CASE( "Verify: function only reached indirectly is an entry", "[verify]" )
+{
+    VerifiedCode verifiedCode;
+
+    int err = VerifyCode( { OP_LDC_S, 1, OP_RET, OP_LDC_S, 2, OP_RET }, &verifiedCode );
+
+    REQUIRE( err == ERR_NONE );
+    REQUIRE( verifiedCode.Entries == std::vector<U32>{ 0, 3 } );
+}
+
+TEST_CASE( "Verify: dead code at a different height is not an entry", "[verify]" )
+{
+    VerifiedCode verifiedCode;
+
+    // The dead branch would reach the RET with nothing on the stack
+
+    int err = VerifyCode( { OP_LDC_S, 1, OP_RET, OP_B, 0xFC, 0xFF }, &verifiedCode );
+
+    REQUIRE( err == ERR_NONE );
+    REQUIRE( verifiedCode.Entries == std::vector<U32>{ 0 } );
+}
+
+TEST_CASE( "Verify: return sites record the stack height", "[verify]" )
+{
+    VerifiedCode verifiedCode;
+
+    int err = VerifyCode( { OP_PUSH, 1, OP_CALL, 0, 8, 0, 0, OP_RET, OP_LDC_S, 9, OP_RET }, &verifiedCode );
+
+    REQUIRE( err == ERR_NONE );
+    REQUIRE( verifiedCode.Entries == std::vector<U32>{ 0, 8 } );
+    REQUIRE( verifiedCode.ReturnHeights[7] == 2 );
+    REQUIRE( verifiedCode.ReturnHeights[8] == NOT_RETURN_SITE );
+}
+
+TEST_CASE( "Verify: live instructions record the stack height", "[verify]" )
+{
+    VerifiedCode verifiedCode;
+
+    int err = VerifyCode( { OP_PUSH, 1, OP_CALL, 0, 8, 0, 0, OP_RET, OP_LDC_S, 9, OP_RET, OP_B, 0xFC, 0xFF }, &verifiedCode );
+
+    REQUIRE( err == ERR_NONE );
+    REQUIRE( verifiedCode.Heights[0] == 0 );
+    REQUIRE( verifiedCode.Heights[2] == 1 );
+    REQUIRE( verifiedCode.Heights[3] == NOT_LIVE_INST );
+    REQUIRE( verifiedCode.Heights[7] == 2 );
+    REQUIRE( verifiedCode.Heights[8] == 0 );
+    REQUIRE( verifiedCode.Heights[10] == 1 );
+
+    // The dead branch would reach the RET with nothing on the stack
+
+    REQUIRE( verifiedCode.Heights[11] == NOT_LIVE_INST );
+}
+
+TEST_CASE( "Verify: branch into the middle of an instruction", "[verify]" )
+{
+    int err = VerifyCode( { OP_LDC, 0, 0, 0, 0, OP_B, 0xFA, 0xFF, OP_RET } );
+
+    REQUIRE( err == ERR_BAD_MODULE );
+}
+
+TEST_CASE( "Verify: call into the middle of an instruction", "[verify]" )
+{
+    int err = VerifyCode( { OP_CALL, 0, 1, 0, 0, OP_RET } );
+
+    REQUIRE( err == ERR_BAD_MODULE );
+}
+
+TEST_CASE( "Verify: branch past the end of the code", "[verify]" )
+{
+    int err = VerifyCode( { OP_LDC_S, 0, OP_B, 0x10, 0x00, OP_RET } );
+
+    REQUIRE( err == ERR_BAD_MODULE );
+}
+
+TEST_CASE( "Verify: long branch", "[verify]" )
+{
+    int err = VerifyCode( { OP_B_L, 2, 0, 0, 0, OP_LDC_S, 9, OP_LDC_S, 5, OP_RET } );
+
+    REQUIRE( err == ERR_NONE );
+}
+
+TEST_CASE( "Verify: long branch before the start of the code", "[verify]" )
+{
+    int err = VerifyCode( { OP_LDC_S, 0, OP_B_L, 0xF0, 0xFF, 0xFF, 0xFF, OP_RET } );
+
+    REQUIRE( err == ERR_BAD_MODULE );
+}
+
+TEST_CASE( "Verify: long branch past the end of the code", "[verify]" )
+{
+    int err = VerifyCode( { OP_LDC_S, 0, OP_B_L, 0x00, 0x00, 0x01, 0x00, OP_RET } );
+
+    REQUIRE( err == ERR_BAD_MODULE );
+}
+
+TEST_CASE( "Verify: different heights at a join", "[verify]" )
+{
+    int err = VerifyCode( { OP_LDC_S, 0, OP_BFALSE, 2, 0, OP_LDC_S, 5, OP_RET } );
+
+    REQUIRE( err == ERR_BAD_MODULE );
+}
+
+TEST_CASE( "Verify: stack underflow", "[verify]" )
+{
+    int err = VerifyCode( { OP_LDC_S, 1, OP_PRIM, PRIM_ADD, OP_RET } );
+
+    REQUIRE( err == ERR_BAD_MODULE );
+}
+
+TEST_CASE( "Verify: bad primitive", "[verify]" )
+{
+    int err = VerifyCode( { OP_LDC_S, 1, OP_LDC_S, 2, OP_PRIM, PRIM_MAXPRIMITIVE, OP_RET } );
+
+    REQUIRE( err == ERR_BAD_MODULE );
+}
+
+TEST_CASE( "Verify: bad opcode", "[verify]" )
+{
+    int err = VerifyCode( { OP_LDC_S, 1, OP_MAXOPCODE, OP_RET } );
+
+    REQUIRE( err == ERR_BAD_MODULE );
+}
+
+TEST_CASE( "Verify: instruction runs into the sentinel", "[verify]" )
+{
+    int err = VerifyCode( { OP_LDC_S, 1, OP_RET, OP_LDC } );
+
+    REQUIRE( err == ERR_BAD_MODULE );
+}
+
+TEST_CASE( "Verify: switch to the middle of an instruction", "[verify]" )
+{
+    int err = VerifyCode( {
+        OP_LDC_S, 2,
+        OP_SWITCH, SwitchInst::Dense, 2, 0, 0, 0, 1, 0, 0, 0, 0, 0, 1, 0,
+        OP_LDC_S, 10, OP_RET
+        } );
+
+    REQUIRE( err == ERR_BAD_MODULE );
+}
+
+TEST_CASE( "Verify: sparse switch keys must be in order", "[verify]" )
+{
+    SECTION( "In order" )
+    {
+        int err = VerifyCode( {
+            OP_LDC_S, 1,
+            OP_SWITCH, SwitchInst::Sparse, 2, 0, 0, 0, 3, 0, 0, 0, 0, 0, 5, 0, 0, 0, 0, 0,
+            OP_LDC_S, 10, OP_RET
+            } );
+
+        REQUIRE( err == ERR_NONE );
+    }
+
+    SECTION( "Out of order" )
+    {
+        int err = VerifyCode( {
+            OP_LDC_S, 1,
+            OP_SWITCH, SwitchInst::Sparse, 2, 0, 0, 0, 5, 0, 0, 0, 0, 0, 3, 0, 0, 0, 0, 0,
+            OP_LDC_S, 10, OP_RET
+            } );
+
+        REQUIRE( err == ERR_BAD_MODULE );
+    }
+}
+
+TEST_CASE( "Verify: switch table runs into the sentinel", "[verify]" )
+{
+    int err = VerifyCode( { OP_LDC_S, 1, OP_SWITCH, SwitchInst::Dense, 8, 0, 0, 0, 1, 0, 0, 0, OP_RET } );
+
+    REQUIRE( err == ERR_BAD_MODULE );
+}
+
+TEST_CASE( "Verify: bad switch format", "[verify]" )
+{
+    int err = VerifyCode( { OP_LDC_S, 1, OP_SWITCH, 2, 0, 0, 0, 0, OP_LDC_S, 10, OP_RET } );
+
+    REQUIRE( err == ERR_BAD_MODULE );
+}
+
+
+//----------------------------------------------------------------------------
+// Running verified code
+//----------------------------------------------------------------------------
+
+TEST_CASE( "Verify: start at an address that isn't an entry", "[verify]" )
+{
+    CELL stack[64];
+    VerifiedCode verifiedCode;
+    Machine machine;
+
+    auto code = MakeCode( { OP_LDC_S, 1, OP_RET, OP_LDC_S, 2, OP_RET } );
+    auto mod = MakeModule( code );
+
+    REQUIRE( VerifyModuleCode( &mod, &verifiedCode ) == ERR_NONE );
+
+    mod.Verified = &verifiedCode;
+
+    machine.Init( stack, static_cast<U16>(std::size( stack )), 0, &mod );
+
+    REQUIRE( machine.Start( 0, 1, 0 ) == nullptr );
+    REQUIRE( machine.Start( 0, 3, 0 ) != nullptr );
+    REQUIRE( machine.Run() == ERR_NONE );
+    REQUIRE( stack[std::size( stack ) - 1] == 2 );
+}
+
+TEST_CASE( "Verify: overwritten return address", "[verify]" )
+{
+    CELL stack[64];
+    VerifiedCode verifiedCode;
+    Machine machine;
+
+    // The callee stores 1 in its frame's return address, which points into
+    // the CALL instruction. The unchecked engine must not go there.
+
+    auto code = MakeCode( {
+        OP_CALL, 0, 6, 0, 0,
+        OP_RET,
+        OP_LDC_S, 1,
+        OP_LDARGA, 0,
+        OP_LDC_S, 1,
+        OP_PRIM, PRIM_SUB,
+        OP_STOREI,
+        OP_LDC_S, 0,
+        OP_RET
+        } );
+    auto mod = MakeModule( code );
+
+    REQUIRE( VerifyModuleCode( &mod, &verifiedCode ) == ERR_NONE );
+
+    mod.Verified = &verifiedCode;
+
+    machine.Init( stack, static_cast<U16>(std::size( stack )), 0, &mod );
+
+    REQUIRE( machine.Start( 0, 0, 0 ) != nullptr );
+    REQUIRE( machine.Run() == ERR_BAD_ADDRESS );
+}
+
+TEST_CASE( "Verify: switch", "[verify]" )
+{
+    CELL stack[64];
+    VerifiedCode verifiedCode;
+    Machine machine;
+
+    // The dense table is for keys 1 to 3. Each target loads ten times its
+    // key, and the default loads 99.
+
+    auto code = MakeCode( {
+        OP_LDARG, 0,
+        OP_SWITCH, SwitchInst::Dense, 3, 0, 9, 0, 1, 0, 0, 0, 0, 0, 3, 0, 6, 0,
+        OP_LDC_S, 10, OP_RET,
+        OP_LDC_S, 20, OP_RET,
+        OP_LDC_S, 30, OP_RET,
+        OP_LDC_S, 99, OP_RET
+        } );
+    auto mod = MakeModule( code );
+
+    REQUIRE( VerifyModuleCode( &mod, &verifiedCode ) == ERR_NONE );
+    REQUIRE( verifiedCode.Entries == std::vector<U32>{ 0 } );
+
+    for ( bool verified : { false, true } )
+    {
+        mod.Verified = verified ? &verifiedCode : nullptr;
+
+        for ( CELL key : { 0, 1, 2, 3, 4, INT32_MIN } )
+        {
+            CELL expected = (key >= 1 && key <= 3) ? key * 10 : 99;
+
+            machine.Init( stack, static_cast<U16>(std::size( stack )), 0, &mod );
+
+            CELL* args = machine.Start( 0, 0, 1 );
+
+            REQUIRE( args != nullptr );
+
+            args[0] = key;
+
+            REQUIRE( machine.Run() == ERR_NONE );
+            REQUIRE( stack[std::size( stack ) - 1] == expected );
+        }
+    }
+}
+
+TEST_CASE( "Verify: unverified switch table runs past the code", "[verify]" )
+{
+    CELL stack[64];
+    Machine machine;
+
+    auto code = MakeCode( { OP_LDC_S, 1, OP_SWITCH, SwitchInst::Sparse, 0xFF, 0xFF, 0, 0, OP_RET } );
+    auto mod = MakeModule( code );
+
+    machine.Init( stack, static_cast<U16>(std::size( stack )), 0, &mod );
+
+    REQUIRE( machine.Start( 0, 0, 0 ) != nullptr );
+    REQUIRE( machine.Run() == ERR_BAD_ADDRESS );
+}
+
+TEST_CASE( "Verify: stack overflow on entry", "[verify]" )
+{
+    CELL stack[8];
+    VerifiedCode verifiedCode;
+    Machine machine;
+
+    auto code = MakeCode( { OP_PUSH, 10, OP_LDC_S, 1, OP_RET } );
+    auto mod = MakeModule( code );
+
+    REQUIRE( VerifyModuleCode( &mod, &verifiedCode ) == ERR_NONE );
+
+    mod.Verified = &verifiedCode;
+
+    machine.Init( stack, static_cast<U16>(std::size( stack )), 0, &mod );
+
+    REQUIRE( machine.Start( 0, 0, 0 ) != nullptr );
+    REQUIRE( machine.Run() == ERR_STACK_OVERFLOW );
+}
+
+
+//----------------------------------------------------------------------------
+// Binding natives
+//----------------------------------------------------------------------------
+
+static int NatDouble( Machine* machine, U8 argc, CELL* args, UserContext context )
+{
+    return machine->PushCell( args[0] * 2 );
+}
+
+static int NatIncrement( Machine* machine, U8 argc, CELL* args, UserContext context )
+{
+    return machine->PushCell( args[0] + 1 );
+}
+
+class BindEnv : public IEnvironment
+{
+    const Module*   mMod;
+
+public:
+    int             Lookups = 0;
+    bool            HasIncrement = true;
+
+    BindEnv( const Module* mod ) :
+        mMod( mod )
+    {
+    }
+
+    virtual bool FindNativeCode( U32 id, NativeCode* nativeCode ) override
+    {
+        Lookups++;
+
+        if ( id == 3 )
+            nativeCode->Proc = NatDouble;
+        else if ( id == 0x10000 && HasIncrement )
+            nativeCode->Proc = NatIncrement;
+        else
+            return false;
+
+        return true;
+    }
+
+    virtual const Module* FindModule( U8 index ) override
+    {
+        return index == 0 ? mMod : nullptr;
+    }
+};
+
+// Doubles 5 and adds one, through natives 3 and 0x10000
+static const std::initializer_list<U8> sNativeCalls =
+{
+    OP_LDC_S, 5,
+    OP_CALLNATIVE_S, 1, 3,
+    OP_CALLNATIVE, 1, 0, 0, 1, 0,
+    OP_CALLNATIVE_S, 1, 3,
+    OP_RET
+};
+
+TEST_CASE( "Verify: bind natives", "[verify]" )
+{
+    CELL stack[64];
+    NativeBinding binding;
+    Machine machine;
+
+    auto code = MakeCode( sNativeCalls );
+    auto mod = MakeModule( code );
+    BindEnv env( &mod );
+
+    REQUIRE( BindNatives( &mod, &env, &binding ) == ERR_NONE );
+    REQUIRE( env.Lookups == 2 );
+    REQUIRE( binding.Funcs == std::vector<NativeFunc>{ NatDouble, NatIncrement } );
+    REQUIRE( binding.Ids == std::vector<U32>{ 3, 0x10000 } );
+    REQUIRE( binding.CallSites[2] == 0 );
+    REQUIRE( binding.CallSites[5] == 1 );
+    REQUIRE( binding.CallSites[11] == 0 );
+    REQUIRE( binding.CallSites[0] == NativeBinding::NOT_BOUND );
+
+    mod.Natives = &binding;
+
+    machine.Init( stack, static_cast<U16>(std::size( stack )), &env );
+
+    REQUIRE( machine.Start( 0, 0, 0 ) != nullptr );
+    REQUIRE( machine.Run() == ERR_NONE );
+    REQUIRE( stack[std::size( stack ) - 1] == 22 );
+    REQUIRE( env.Lookups == 2 );
+}
+
+TEST_CASE( "Verify: unresolved natives are reported when binding", "[verify]" )
+{
+    NativeBinding binding;
+    std::vector<U32> unresolved;
+
+    auto code = MakeCode( sNativeCalls );
+    auto mod = MakeModule( code );
+    BindEnv env( &mod );
+
+    env.HasIncrement = false;
+
+    REQUIRE( BindNatives( &mod, &env, &binding, &unresolved ) == ERR_NATIVECODE_NOT_FOUND );
+    REQUIRE( unresolved == std::vector<U32>{ 0x10000 } );
+    REQUIRE( binding.Funcs.empty() );
+    REQUIRE( binding.CallSites.empty() );
+
+    REQUIRE( BindNatives( &mod, nullptr, &binding ) == ERR_BAD_ARG );
+}
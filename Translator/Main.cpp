@@ -0,0 +1,248 @@
+// Gemini Languages and Virtual Machine
+// Copyright 2021 Aldo Jose Nunez
+//
+// Licensed under the Apache License, Version 2.0.
+// See the LICENSE.txt file for details.
+
+// Compiles a standalone module, and translates it to a C++ unit that can be
+// built into a host program. See Gemini/Translator.h.
+//
+// Usage: GeminiTranslator [-modindex N] -name Name -o Out.cpp Source...
+//
+// The language of each source file comes from its extension: .gema or .geml.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../Gemini/AlgolyParser.h"
+#include "../Gemini/Compiler.h"
+#include "../Gemini/LangCommon.h"
+#include "../Gemini/LispyParser.h"
+#include "../Gemini/Translator.h"
+
+using namespace Gemini;
+
+
+namespace
+{
+
+class TranslatorEnv : public ICompilerEnv
+{
+    std::map<std::string, ExternalFunc> mFuncMap;
+    std::map<std::string, int>          mGlobalMap;
+
+public:
+    std::vector<std::string>    FuncNames;
+
+    bool AddExternal( const std::string& name, ExternalKind kind, int address ) override
+    {
+        if ( mFuncMap.find( name ) != mFuncMap.end() )
+            return false;
+
+        ExternalFunc func;
+        func.Id = static_cast<int>( mFuncMap.size() );
+        func.Kind = kind;
+        func.Address = address;
+        mFuncMap.insert( { name, func } );
+
+        if ( kind == ExternalKind::Bytecode )
+            FuncNames.push_back( name );
+
+        return true;
+    }
+
+    bool FindExternal( const std::string& name, ExternalFunc* func ) override
+    {
+        auto it = mFuncMap.find( name );
+        if ( it == mFuncMap.end() )
+            return false;
+
+        *func = it->second;
+        return true;
+    }
+
+    bool AddGlobal( const std::string& name, int offset ) override
+    {
+        return mGlobalMap.insert( { name, offset } ).second;
+    }
+
+    bool FindGlobal( const std::string& name, int& offset ) override
+    {
+        auto it = mGlobalMap.find( name );
+        if ( it == mGlobalMap.end() )
+            return false;
+
+        offset = it->second;
+        return true;
+    }
+};
+
+class TranslatorLog : public ICompilerLog
+{
+public:
+    virtual void Add( LogCategory category, const char* fileName, int line, int column, const char* message ) override
+    {
+        fprintf( stderr, "%s(%d,%d): %s: %s\n",
+            (fileName != nullptr ? fileName : ""),
+            line,
+            column,
+            (category == LogCategory::ERROR ? "error" : "warning"),
+            message );
+    }
+};
+
+bool EndsWith( const std::string& str, const char* suffix )
+{
+    size_t suffixLen = strlen( suffix );
+
+    return str.size() >= suffixLen
+        && str.compare( str.size() - suffixLen, suffixLen, suffix ) == 0;
+}
+
+bool ReadFile( const char* path, std::string& text )
+{
+    std::ifstream file( path, std::ios::binary );
+    if ( !file )
+        return false;
+
+    std::ostringstream stream;
+    stream << file.rdbuf();
+    text = stream.str();
+    return true;
+}
+
+int Usage()
+{
+    fprintf( stderr, "Usage: GeminiTranslator [-modindex N] -name Name -o Out.cpp Source...\n" );
+    return 2;
+}
+
+}
+
+
+int main( int argc, char* argv[] )
+{
+    const char* name = nullptr;
+    const char* outPath = nullptr;
+    int modIndex = 0;
+    std::vector<const char*> sourcePaths;
+
+    for ( int i = 1; i < argc; i++ )
+    {
+        if ( strcmp( argv[i], "-name" ) == 0 && i + 1 < argc )
+            name = argv[++i];
+        else if ( strcmp( argv[i], "-o" ) == 0 && i + 1 < argc )
+            outPath = argv[++i];
+        else if ( strcmp( argv[i], "-modindex" ) == 0 && i + 1 < argc )
+            modIndex = atoi( argv[++i] );
+        else if ( argv[i][0] == '-' )
+            return Usage();
+        else
+            sourcePaths.push_back( argv[i] );
+    }
+
+    if ( name == nullptr || outPath == nullptr || sourcePaths.empty()
+        || modIndex < 0 || modIndex >= ModSizeMax )
+        return Usage();
+
+    CompilerAttrs compilerAttrs;
+    TranslatorEnv env;
+    TranslatorLog log;
+    Compiler compiler( &env, &log, compilerAttrs, static_cast<ModSize>( modIndex ) );
+
+    // The parsers keep pointers into the text, so it lives until compiling is done
+
+    std::vector<std::string> sourceTexts( sourcePaths.size() );
+
+    for ( size_t i = 0; i < sourcePaths.size(); i++ )
+    {
+        std::string& text = sourceTexts[i];
+        std::string  path = sourcePaths[i];
+        Unique<Unit> unit;
+
+        if ( !ReadFile( sourcePaths[i], text ) )
+        {
+            fprintf( stderr, "Can't read %s\n", sourcePaths[i] );
+            return 1;
+        }
+
+        if ( !EndsWith( path, ".gema" ) && !EndsWith( path, ".geml" ) )
+        {
+            fprintf( stderr, "Unknown language: %s\n", sourcePaths[i] );
+            return 1;
+        }
+
+        // Syntax errors are logged and thrown
+
+        try
+        {
+            if ( EndsWith( path, ".gema" ) )
+            {
+                AlgolyParser parser( text.c_str(), text.size(), sourcePaths[i], &log );
+                unit = parser.Parse();
+            }
+            else
+            {
+                LispyParser parser( text.c_str(), text.size(), sourcePaths[i], &log );
+                unit = parser.Parse();
+            }
+        }
+        catch ( CompilerException& )
+        {
+            return 1;
+        }
+
+        compiler.AddUnit( std::move( unit ) );
+    }
+
+    if ( compiler.Compile() != CompilerErr::OK )
+        return 1;
+
+    Module mod = {};
+
+    mod.CodeBase  = compiler.GetCode();
+    mod.CodeSize  = static_cast<CodeSize>( compiler.GetCodeSize() );
+    mod.DataBase  = compiler.GetData();
+    mod.DataSize  = static_cast<GlobalSize>( compiler.GetDataSize() );
+    mod.ConstBase = compiler.GetConst();
+    mod.ConstSize = static_cast<GlobalSize>( compiler.GetConstSize() );
+
+    std::vector<AotExport> exports;
+
+    for ( const auto& funcName : env.FuncNames )
+    {
+        ExternalFunc func = {};
+
+        env.FindExternal( funcName, &func );
+        exports.push_back( { funcName.c_str(), static_cast<U32>( func.Address ) } );
+    }
+
+    std::string source;
+
+    int err = TranslateModule( &mod, static_cast<U8>( modIndex ), name, exports.data(), exports.size(), source );
+    if ( err != ERR_NONE )
+    {
+        fprintf( stderr, "Can't translate the module: error %d\n", err );
+        return 1;
+    }
+
+    std::ofstream outFile( outPath, std::ios::binary );
+
+    outFile << source;
+
+    if ( !outFile )
+    {
+        fprintf( stderr, "Can't write %s\n", outPath );
+        return 1;
+    }
+
+    return 0;
+}